@@ -0,0 +1,167 @@
+// File  : Affinity.h
+// Author: Cole Schwandt
+//
+// CPU and NUMA node layout of the host, and pinning a thread to a CPU.
+//
+// The layout comes from /sys/devices/system/node/node*/cpulist, so no
+// NUMA library is needed. On a host without that directory (or not
+// Linux), every CPU is on node 0. Pinning uses pthread_setaffinity_np
+// and does nothing where that is not available.
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// "0-3,8,10-11" -> 0 1 2 3 8 10 11 (the kernel's cpulist format)
+inline std::vector< int > parse_cpulist(const std::string & text)
+{
+    std::vector< int > cpus;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        // trailing newline from sysfs
+        while (!item.empty() && (item.back() == '\n' || item.back() == ' '))
+            item.pop_back();
+        if (item.empty())
+            continue;
+
+        std::size_t dash = item.find('-');
+        try
+        {
+            std::size_t used = 0;
+            int lo = std::stoi(item.substr(0, dash), &used);
+            if (used != item.substr(0, dash).size())
+                throw std::invalid_argument(item);
+            int hi = lo;
+            if (dash != std::string::npos)
+            {
+                std::string rest = item.substr(dash + 1);
+                hi = std::stoi(rest, &used);
+                if (used != rest.size())
+                    throw std::invalid_argument(item);
+            }
+            if (lo < 0 || hi < lo)
+                throw std::invalid_argument(item);
+            for (int c = lo; c <= hi; ++c)
+                cpus.push_back(c);
+        }
+        catch (const std::logic_error &)
+        {
+            throw std::runtime_error("bad CPU list entry '" + item + "'");
+        }
+    }
+    return cpus;
+}
+
+//==============================================================
+// CpuTopology
+//==============================================================
+struct CpuTopology
+{
+    std::vector< std::vector< int > > node_cpus; // CPUs of each node
+
+    static CpuTopology detect()
+    {
+        CpuTopology t;
+        for (int node = 0; ; ++node)
+        {
+            std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!f)
+                break;
+            std::string text;
+            std::getline(f, text);
+            t.node_cpus.push_back(parse_cpulist(text));
+        }
+
+        if (t.node_cpus.empty())
+        {
+            unsigned n = std::thread::hardware_concurrency();
+            t.node_cpus.push_back(std::vector< int >());
+            for (unsigned c = 0; c < (n ? n : 1); ++c)
+                t.node_cpus[0].push_back(static_cast<int>(c));
+        }
+        return t;
+    }
+
+    std::size_t nodes() const { return node_cpus.size(); }
+
+    // node holding 'cpu'; 0 if the CPU is not listed
+    std::size_t node_of(int cpu) const
+    {
+        for (std::size_t n = 0; n < node_cpus.size(); ++n)
+            for (int c : node_cpus[n])
+                if (c == cpu)
+                    return n;
+        return 0;
+    }
+
+    // every CPU, node by node
+    std::vector< int > all_cpus() const
+    {
+        std::vector< int > cpus;
+        for (const std::vector< int > & n : node_cpus)
+            cpus.insert(cpus.end(), n.begin(), n.end());
+        return cpus;
+    }
+};
+
+//==============================================================
+// Thread affinity
+//==============================================================
+// the calling thread's CPU set, to be put back with restore_affinity
+class SavedAffinity
+{
+public:
+    SavedAffinity()
+    {
+#if defined(__linux__)
+        saved_ = pthread_getaffinity_np(pthread_self(), sizeof set_, &set_) == 0;
+#endif
+    }
+
+    void restore_affinity()
+    {
+#if defined(__linux__)
+        if (saved_)
+            pthread_setaffinity_np(pthread_self(), sizeof set_, &set_);
+#endif
+    }
+
+private:
+#if defined(__linux__)
+    cpu_set_t set_;
+    bool saved_ = false;
+#endif
+};
+
+// run the calling thread only on 'cpu'; false if that failed (no such
+// CPU, not allowed by the current cpuset, or unsupported)
+inline bool pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+#endif // AFFINITY_H
@@ -0,0 +1,392 @@
+// File  : BatchRunner.h
+// Author: Cole Schwandt
+//
+// Runs one ProgramImage once per input on a set of worker threads.
+//
+// Each worker takes the next job index from a shared counter, borrows a
+// Machine from the MachinePool, instantiates the image on it (shared
+// text, private data and stack) and runs it with the job's input as the
+// console. The guest reads its input in place and its output goes to a
+// string in the machine's arena, so a job allocates from the global heap
+// only for its final output string.
+//
+// With pinning on, there is one worker per CPU of the chosen set, and
+// each worker is pinned to its CPU. Jobs are split into one queue per
+// NUMA node, in proportion to that node's workers. Each worker borrows
+// machines from its own node's free list, so the arena and page memory
+// it runs on were first touched on that node. A worker moves on to
+// another node's queue only when its own runs dry. The shared text
+// pages of the image stay wherever the image was built.
+//
+// Given a predicted cost per job (see CostModel.h), jobs start longest
+// first, so a long job at the end of the list no longer runs alone
+// while the other workers sit idle. Each job, longest first, goes to
+// the node with the least predicted work per worker, and every node's
+// queue runs in falling cost order.
+//
+// With verify on, every job also runs on a fresh machine of its own,
+// and the final state of the pooled run is diffed against it
+// (StateDiff.h). A difference means state leaked into the job through
+// a reused machine.
+
+#ifndef BATCH_RUNNER_H
+#define BATCH_RUNNER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <istream>
+#include <memory>
+#include <memory_resource>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Affinity.h"
+#include "Machine.h"
+#include "MachinePool.h"
+#include "ProgramImage.h"
+#include "StateDiff.h"
+
+struct BatchResult
+{
+    std::string output;
+    std::string status;     // "halted", "end of text", "step limit" or a fault
+    std::string where;      // symbolized pc of a fault
+    bool        faulted = false;
+    uint64_t    steps   = 0;
+    std::string mismatch;   // with verify on: how a fresh machine's run differed
+};
+
+// where the workers of a batch run
+struct BatchPlacement
+{
+    bool pin = false;          // one worker per CPU, pinned to it
+    std::vector< int > cpus;   // CPUs to use; empty: all, nodes interleaved
+};
+
+class BatchRunner
+{
+public:
+    BatchRunner(std::shared_ptr< const ProgramImage > image,
+                MachinePool & pool,
+                uint64_t max_steps = 1000000)
+        : image_(std::move(image)), pool_(pool), max_steps_(max_steps)
+    {}
+
+    // one result per input, in input order. 'workers' of 0 means one
+    // per hardware thread (one per CPU of the set when pinning).
+    // 'costs', if not empty, is the predicted cost of every job: jobs
+    // then start longest first.
+    std::vector< BatchResult > run(const std::vector< std::string > & inputs,
+                                   unsigned workers,
+                                   const BatchPlacement & place = BatchPlacement(),
+                                   const std::vector< double > & costs = std::vector< double >())
+    {
+        if (inputs.empty())
+            return std::vector< BatchResult >();
+        if (!costs.empty() && costs.size() != inputs.size())
+            throw std::runtime_error("batch: one cost per job expected");
+
+        // CPU and node of every worker; node 0 and no CPU unpinned
+        CpuTopology topo;
+        std::vector< int > cpus;
+        std::vector< std::size_t > nodes;
+        std::size_t num_nodes = 1;
+        if (place.pin)
+        {
+            topo = CpuTopology::detect();
+            cpus = place.cpus.empty() ? interleaved(topo) : place.cpus;
+            if (cpus.empty())
+                throw std::runtime_error("batch: no CPUs to run on");
+            if (workers == 0)
+                workers = static_cast<unsigned>(cpus.size());
+            num_nodes = topo.nodes();
+        }
+
+        if (workers == 0)
+            workers = std::thread::hardware_concurrency();
+        if (workers == 0)
+            workers = 1;
+        if (workers > inputs.size())
+            workers = static_cast<unsigned>(inputs.size());
+
+        std::vector< unsigned > per_node(num_nodes, 0);
+        for (unsigned w = 0; w < workers; ++w)
+        {
+            std::size_t node = place.pin ? topo.node_of(cpus[w % cpus.size()]) : 0;
+            nodes.push_back(node);
+            ++per_node[node];
+        }
+
+        // each node's jobs are a contiguous range of 'order'
+        std::vector< std::size_t > order(inputs.size());
+        std::vector< JobQueue > queues(num_nodes);
+        if (costs.empty())
+        {
+            // input order, ranges sized by each node's workers
+            std::iota(order.begin(), order.end(), std::size_t(0));
+            std::size_t begin = 0;
+            unsigned seen = 0;
+            for (std::size_t n = 0; n < num_nodes; ++n)
+            {
+                seen += per_node[n];
+                std::size_t end = inputs.size() * seen / workers;
+                queues[n].next.store(begin);
+                queues[n].end = end;
+                begin = end;
+            }
+        }
+        else
+        {
+            deal_longest_first(costs, per_node, order, queues);
+        }
+
+        std::vector< BatchResult > results(inputs.size());
+        std::atomic< uint64_t > stolen(0);
+        std::atomic< unsigned > unpinned(0);
+
+        auto work = [&](unsigned w)
+        {
+            if (place.pin && !pin_current_thread(cpus[w % cpus.size()]))
+                ++unpinned;
+
+            const std::size_t home = nodes[w];
+            for (std::size_t k = 0; k < num_nodes; ++k)
+            {
+                JobQueue & q = queues[(home + k) % num_nodes];
+                for (std::size_t i = q.next++; i < q.end; i = q.next++)
+                {
+                    if (k != 0)
+                        ++stolen;
+                    const std::size_t j = order[i];
+                    MachinePool::Lease lease = pool_.acquire(home);
+                    results[j] = run_one(lease, inputs[j]);
+                }
+            }
+        };
+
+        SavedAffinity caller;
+        std::vector< std::thread > threads;
+        for (unsigned w = 1; w < workers; ++w)
+            threads.emplace_back(work, w);
+        work(0); // the calling thread is a worker too
+        for (std::thread & t : threads)
+            t.join();
+        if (place.pin)
+            caller.restore_affinity();
+
+        last_stolen_   = stolen.load();
+        last_unpinned_ = unpinned.load();
+        return results;
+    }
+
+    // also run every job on a fresh machine outside the pool and diff
+    // the two final states (BatchResult::mismatch)
+    void set_verify(bool on) { verify_ = on; }
+
+    // jobs the last run took from another node's queue
+    uint64_t last_stolen() const { return last_stolen_; }
+
+    // workers of the last run that could not be pinned
+    unsigned last_unpinned() const { return last_unpinned_; }
+
+private:
+    // console input read in place from the job's string; nothing is copied
+    class InputBuf : public std::streambuf
+    {
+    public:
+        explicit InputBuf(const std::string & s)
+        {
+            // only ever read: putting back a different char fails
+            char * p = const_cast<char *>(s.data());
+            setg(p, p, p + s.size());
+        }
+    };
+
+    // console output appended to a string in the machine's arena. (a
+    // pmr ostringstream would not do: its string is copied on the way
+    // in, and the copy takes the default resource.)
+    class ArenaOutBuf : public std::streambuf
+    {
+    public:
+        explicit ArenaOutBuf(std::pmr::memory_resource * arena) : text_(arena) {}
+
+        const std::pmr::string & text() const { return text_; }
+
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if (!traits_type::eq_int_type(c, traits_type::eof()))
+                text_.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * s, std::streamsize n) override
+        {
+            text_.append(s, static_cast<std::size_t>(n));
+            return n;
+        }
+
+    private:
+        std::pmr::string text_;
+    };
+
+    // one node's jobs, on its own cache line
+    struct alignas(64) JobQueue
+    {
+        std::atomic< std::size_t > next{0};
+        std::size_t end = 0;
+    };
+
+    std::shared_ptr< const ProgramImage > image_;
+    MachinePool & pool_;
+    uint64_t max_steps_;
+    bool     verify_ = false;
+    uint64_t last_stolen_ = 0;
+    unsigned last_unpinned_ = 0;
+
+    // every CPU, taking one from each node in turn, so a few workers
+    // still spread over all nodes
+    static std::vector< int > interleaved(const CpuTopology & topo)
+    {
+        std::vector< int > cpus;
+        for (std::size_t i = 0; ; ++i)
+        {
+            bool any = false;
+            for (const std::vector< int > & n : topo.node_cpus)
+            {
+                if (i < n.size())
+                {
+                    cpus.push_back(n[i]);
+                    any = true;
+                }
+            }
+            if (!any)
+                return cpus;
+        }
+    }
+
+    // jobs by falling cost, each to the node with the least predicted
+    // work per worker; fills 'order' and the queue ranges
+    static void deal_longest_first(const std::vector< double > & costs,
+                                   const std::vector< unsigned > & per_node,
+                                   std::vector< std::size_t > & order,
+                                   std::vector< JobQueue > & queues)
+    {
+        std::vector< std::size_t > by_cost(costs.size());
+        std::iota(by_cost.begin(), by_cost.end(), std::size_t(0));
+        std::stable_sort(by_cost.begin(), by_cost.end(),
+                         [&](std::size_t a, std::size_t b) { return costs[a] > costs[b]; });
+
+        const std::size_t num_nodes = queues.size();
+        std::vector< std::vector< std::size_t > > jobs(num_nodes);
+        std::vector< double > load(num_nodes, 0.0);
+        for (std::size_t j : by_cost)
+        {
+            std::size_t best = num_nodes;
+            for (std::size_t n = 0; n < num_nodes; ++n)
+            {
+                if (per_node[n] == 0)
+                    continue;
+                if (best == num_nodes || load[n] / per_node[n] < load[best] / per_node[best])
+                    best = n;
+            }
+            jobs[best].push_back(j);
+            load[best] += costs[j];
+        }
+
+        std::size_t begin = 0;
+        for (std::size_t n = 0; n < num_nodes; ++n)
+        {
+            std::copy(jobs[n].begin(), jobs[n].end(), order.begin() + begin);
+            queues[n].next.store(begin);
+            queues[n].end = begin + jobs[n].size();
+            begin = queues[n].end;
+        }
+    }
+
+    BatchResult run_one(MachinePool::Lease & lease, const std::string & input)
+    {
+        Machine & m = lease.machine();
+        ArenaOutBuf out_buf(lease.arena());
+        BatchResult r = run_on(m, input, out_buf);
+        if (verify_)
+            r.mismatch = verify(m, input, r);
+        return r;
+    }
+
+    // instantiate the image on 'm' and run it with 'input' as the
+    // console, its output going to 'out_buf'
+    BatchResult run_on(Machine & m, const std::string & input, ArenaOutBuf & out_buf)
+    {
+        BatchResult r;
+        image_->instantiate(m);
+
+        InputBuf in_buf(input);
+        std::istream in(&in_buf);
+        std::ostream out(&out_buf);
+        m.cpu.console_in  = &in;
+        m.cpu.console_out = &out;
+
+        try
+        {
+            while (!m.cpu.halted && m.cpu.pc < m.text_cursor && r.steps < max_steps_)
+            {
+                m.cpu.step();
+                ++r.steps;
+            }
+
+            if (m.cpu.halted)
+                r.status = "halted";
+            else if (r.steps >= max_steps_)
+                r.status = "step limit";
+            else
+                r.status = "end of text";
+        }
+        catch (const std::exception & e)
+        {
+            r.status  = e.what();
+            r.faulted = true;
+            r.where   = m.symbolize(m.cpu.recent_pcs().back());
+        }
+
+        r.output.assign(out_buf.text().data(), out_buf.text().size());
+
+        // the streams die with this frame; the pooled CPU must not keep
+        // pointing at them
+        m.cpu.console_in  = &std::cin;
+        m.cpu.console_out = &std::cout;
+        return r;
+    }
+
+    // run the job again on a fresh machine outside the pool and compare.
+    // both instances start at the image's checkpoint, so the diff looks
+    // only at what the two runs wrote. "" if they agree.
+    std::string verify(const Machine & pooled, const std::string & input,
+                       const BatchResult & r)
+    {
+        Machine fresh;
+        ArenaOutBuf out_buf(std::pmr::get_default_resource());
+        BatchResult f = run_on(fresh, input, out_buf);
+
+        std::ostringstream ss;
+        if (f.status != r.status || f.steps != r.steps)
+            ss << "status " << r.status << " after " << r.steps << " steps, fresh "
+               << f.status << " after " << f.steps << '\n';
+        if (f.output != r.output)
+            ss << "console output differs\n";
+        StateDiff d = StateDiff::between(pooled, fresh);
+        if (!d.empty())
+            d.print(ss);
+        return ss.str();
+    }
+};
+
+#endif // BATCH_RUNNER_H
@@ -9,11 +9,22 @@
 #include <cstdint>
 #include <stdexcept>
 #include <limits>
+#include <vector>
+#include <string>
+#include <iostream>
 
 #include "mybitlib.h"
 #include "RegisterFile.h"
 #include "Memory.h"
 #include "Constants.h"
+#include "RunStats.h"
+#include "Livelock.h"
+#include "Dataflow.h"
+#include "OoOModel.h"
+#include "Mmu.h"
+#include "StackDistance.h"
+#include "NativeRuntime.h"
+#include "Msa.h"
 
 //==============================================================
 // CPU
@@ -23,21 +34,238 @@ class CPU
 public:
     // CPU holds a reference to the machine's memory
     CPU(Memory & m)
-        : regs(), mem(m), pc(TEXT_BASE), halted(false)
-    {}
+        : regs(), mem(m), pc(TEXT_BASE), halted(false),
+          console_in(&std::cin), console_out(&std::cout), stats(nullptr),
+          livelock(nullptr), syscall_count(0), cp0_writes(0), lazy_text(nullptr),
+          native_runtime(false),
+          dataflow(nullptr), ooo(nullptr), reuse(nullptr), mmu(nullptr)
+    {
+        clear_pc_ring();
+    }
 
     void reset()
     {
         regs.reset();
+        vregs.reset();
+        cp0.reset();
         pc = TEXT_BASE;
+        clear_pc_ring();
     }
 
     // one step of execution: fetch, bump PC, then execute
     void step()
     {
+        // remember where we were; a fixed-size ring, so this is one
+        // store and one increment per instruction
+        pc_ring[pc_ring_pos++ & (PC_RING_SIZE - 1u)] = pc;
+
         uint32_t word = mem.load32(pc);
+        uint32_t at = pc;
         pc += 4; // default PC increment
-        execute(word);
+
+        // a lazy placeholder is observed as the real word once OP_LAZY
+        // has assembled it
+        const bool placeholder = (word == LAZY_TEXT_WORD);
+        if (dataflow != nullptr && !placeholder)
+            dataflow->observe(word, regs);
+        if (ooo != nullptr && !placeholder)
+            ooo->observe(word, regs);
+        if (reuse != nullptr)
+        {
+            reuse->fetch(at);
+            if (!placeholder)
+                reuse->observe(word, regs);
+        }
+
+        if (mmu != nullptr && (cp0.status & Cp0::STATUS_EXL))
+            mmu->count_handler_instr();
+
+        try
+        {
+            // with stats on, counters move only at the end of a block
+            if (stats != nullptr && at == stats->block_last())
+            {
+                stats->close_block(regs);
+                execute(word);
+                stats->next_block(pc);
+            }
+            else
+            {
+                execute(word);
+            }
+        }
+        catch (const TlbRefill & r)
+        {
+            // the access missed the TLB: drop the instruction and enter
+            // the guest's refill handler (eret retries it)
+            pc = r.vector;
+            if (stats != nullptr)
+                stats->trap(at, pc);
+        }
+
+        // control went backwards: a loop iteration may have ended
+        if (pc <= at && livelock != nullptr)
+            livelock->sample(pc, regs, mem.write_generation() + vregs.write_generation() +
+                                       syscall_count + cp0_writes);
+    }
+
+    // physical address of a data access at 'vaddr' by the executing
+    // instruction (pc has already moved past it)
+    uint32_t data_addr(uint32_t vaddr, bool write)
+    {
+        if (mmu == nullptr)
+            return vaddr;
+        return mmu->translate(vaddr, write, cp0, pc - 4, mem);
+    }
+
+    void clear_pc_ring()
+    {
+        for (auto & p : pc_ring)
+            p = 0;
+        pc_ring_pos = 0;
+    }
+
+    // recently executed PCs, oldest first. the last entry is the
+    // instruction that was executing when a fault was raised.
+    std::vector< uint32_t > recent_pcs() const
+    {
+        uint32_t n = (pc_ring_pos < PC_RING_SIZE ? pc_ring_pos : PC_RING_SIZE);
+        std::vector< uint32_t > pcs;
+        pcs.reserve(n);
+        for (uint32_t i = pc_ring_pos - n; i != pc_ring_pos; ++i)
+            pcs.push_back(pc_ring[i & (PC_RING_SIZE - 1u)]);
+        return pcs;
+    }
+
+    // run the service selected by $v0. a template over the memory
+    // type so engines with their own memory views share the services.
+    template < typename Mem >
+    static void do_syscall(RegisterFile & regs, Mem & mem,
+                           std::istream & in, std::ostream & out,
+                           bool & halted)
+    {
+        uint32_t service_code = regs.readU(2);
+
+        switch(service_code)
+        {
+            //--------------------------------------
+            // 1: print integer ($a0)
+            //--------------------------------------
+            case 1:
+            {
+                int32_t value = regs.readS(4); // $a0
+                out << value;
+                break;
+            }
+
+            //--------------------------------------
+            // 4: print string ($a0 = addr)
+            //--------------------------------------
+            case 4:
+            {
+                uint32_t addr = regs.readU(4); // $a0
+
+                // up to the null terminator, a page span at a time
+                std::size_t len = mem.find_byte(addr, 0, SIZE_MAX);
+                std::string text(len, '\0');
+                mem.read_block(addr, reinterpret_cast<uint8_t *>(&text[0]), len);
+                out << text;
+                break;
+            }
+
+            //--------------------------------------
+            // 5: read integer -> $v0
+            //--------------------------------------
+            case 5:
+            {
+                int32_t value = 0;
+                out << "CONSOLE INTEGER INPUT> ";
+                in >> value;
+
+                if (in.peek() == '\n')
+                    in.get();
+
+                regs.writeU(2, static_cast<uint32_t>(value)); // store into $v0
+                break;
+            }
+
+            //--------------------------------------
+            // 8: read string
+            //     $a0 = buffer address
+            //     $a1 = max chars
+            //--------------------------------------
+            case 8:
+            {
+                uint32_t buf_addr = regs.readU(4); // $a0
+                uint32_t max_len  = regs.readU(5); // $a1
+
+                // a TLB refill on the buffer re-executes this syscall:
+                // take it before the prompt and the line
+                mem.probe(buf_addr, max_len, true);
+
+                out << "CONSOLE STRING INPUT> ";
+
+                // Read a line from stdin.
+                // First flush leftover newline if needed.
+                if (in.peek() == '\n')
+                    in.get();
+
+                std::string line;
+                std::getline(in, line);
+
+                // SPIM behavior: store at most max_len-1 chars
+                if (max_len == 0)
+                    break; // store nothing
+
+                if (line.size() >= max_len)
+                    line.resize(max_len - 1);
+
+                // Copy into memory, with the null terminator
+                mem.write_block(buf_addr,
+                                reinterpret_cast<const uint8_t *>(line.c_str()),
+                                line.size() + 1);
+                break;
+            }
+
+            //--------------------------------------
+            // 10: exit
+            //--------------------------------------
+            case 10:
+            {
+                halted = true;
+                break;
+            }
+
+            //--------------------------------------
+            // 11: print character ($a0)
+            //--------------------------------------
+            case 11:
+            {
+                uint32_t v = regs.readU(4); // $a0
+                char c = static_cast<char>(v & 0xFF);
+                out << c;
+                break;
+            }
+
+            //--------------------------------------
+            // 12: read character -> $v0
+            //--------------------------------------
+            case 12:
+            {
+                char c = 0; // what end of input reads as
+                out << "CONSOLE INTEGER INPUT> ";
+                in.get(c);
+                regs.writeU(2, static_cast<uint32_t>(
+                                static_cast<unsigned char>(c)));
+                break;
+            }
+
+            //--------------------------------------
+            // Not implemented / unknown syscall
+            //--------------------------------------
+            default:
+                throw std::runtime_error("Unknown or unimplemented syscall code in $v0");
+        }
     }
 
     void execute(uint32_t word)
@@ -179,6 +407,22 @@ public:
                         break;
                     }
 
+                    // movz: rd = rs if rt == 0
+                    case FUNCT_MOVZ:
+                    {
+                        if (regs.readU(rt) == 0)
+                            regs.writeU(rd, regs.readU(rs));
+                        break;
+                    }
+
+                    // movn: rd = rs if rt != 0
+                    case FUNCT_MOVN:
+                    {
+                        if (regs.readU(rt) != 0)
+                            regs.writeU(rd, regs.readU(rs));
+                        break;
+                    }
+
                     //===========================
                     // RSHIFT (rd, rt, shamt)
                     //===========================
@@ -193,8 +437,18 @@ public:
 
                     case FUNCT_SRL:
                     {
-                        // rd = rt >> shamt (logical)
-                        uint32_t r = regs.readU(rt) >> shamt;
+                        uint32_t v = regs.readU(rt);
+                        uint32_t r;
+                        if (rs == 1)
+                        {
+                            // rotr: rd = rt rotated right by shamt
+                            r = (v >> shamt) | (v << ((32u - shamt) & 31u));
+                        }
+                        else
+                        {
+                            // rd = rt >> shamt (logical)
+                            r = v >> shamt;
+                        }
                         regs.writeU(rd, r);
                         break;
                     }
@@ -332,6 +586,8 @@ public:
                         // set pc to rs
                         uint8_t rs  = (word >> 21) & mask_bits(5);
                         pc = regs.readU(rs);
+                        if (lazy_text != nullptr)
+                            lazy_text->materialize(pc);
                         break;
                     }
 
@@ -343,135 +599,34 @@ public:
 
                         uint8_t rs  = (word >> 21) & mask_bits(5);
                         pc = regs.readU(rs);
+                        if (lazy_text != nullptr)
+                            lazy_text->materialize(pc);
                         break;
                     }
 
                     case FUNCT_SYSCALL:
                     {
-                        uint32_t service_code = regs.readU(2);
-                        
-                        switch(service_code)
+                        ++syscall_count;
+                        if (native_runtime && is_native_runtime_code(regs.readU(2)))
                         {
-                            //--------------------------------------
-                            // 1: print integer ($a0)
-                            //--------------------------------------
-                            case 1:
-                            {
-                                int32_t value = regs.readS(4); // $a0
-                                std::cout << value;
-                                break;
-                            }
-
-                            //--------------------------------------
-                            // 4: print string ($a0 = addr)
-                            //--------------------------------------
-                            case 4:
-                            {
-                                uint32_t addr = regs.readU(4); // $a0
-
-                                while (true)
-                                {
-                                    uint8_t byte = mem.load8(addr);
-                                    if (byte == 0)    // null terminator
-                                        break;
-                                    std::cout << static_cast<char>(byte);
-                                    ++addr;
-                                }
-                                break;
-                            }
-
-                            //--------------------------------------
-                            // 5: read integer -> $v0
-                            //--------------------------------------
-                            case 5:
-                            {
-                                int32_t value;
-                                std::cout << "CONSOLE INTEGER INPUT> ";
-                                std::cin >> value;
-
-                                if (std::cin.peek() == '\n')
-                                    std::cin.get();
-                                
-                                regs.writeU(2, static_cast<uint32_t>(value)); // store into $v0
-                                break;
-                            }
-
-                            //--------------------------------------
-                            // 8: read string
-                            //     $a0 = buffer address
-                            //     $a1 = max chars
-                            //--------------------------------------
-                            case 8:
-                            {
-                                uint32_t buf_addr = regs.readU(4); // $a0
-                                uint32_t max_len  = regs.readU(5); // $a1
-
-                                std::cout << "CONSOLE STRING INPUT> ";
-
-                                // Read a line from stdin.
-                                // First flush leftover newline if needed.
-                                if (std::cin.peek() == '\n')
-                                    std::cin.get();
-
-                                std::string line;
-                                std::getline(std::cin, line);
-
-                                // SPIM behavior: store at most max_len-1 chars
-                                if (max_len == 0)
-                                    break; // store nothing
-
-                                if (line.size() >= max_len)
-                                    line.resize(max_len - 1);
-
-                                // Copy into memory
-                                uint32_t addr = buf_addr;
-                                for (std::size_t i = 0; i < line.size(); ++i)
-                                {
-                                    mem.store8(addr++, static_cast<uint8_t>(line[i]));
-                                }
-                                // null terminator
-                                mem.store8(addr, 0);
-                                break;
-                            }
-
-                            //--------------------------------------
-                            // 10: exit
-                            //--------------------------------------
-                            case 10:
+                            if (mmu == nullptr)
                             {
-                                halted = true;
-                                break;
+                                native_runtime_call(regs, mem);
                             }
-
-                            //--------------------------------------
-                            // 11: print character ($a0)
-                            //--------------------------------------
-                            case 11:
+                            else
                             {
-                                uint32_t v = regs.readU(4); // $a0
-                                char c = static_cast<char>(v & 0xFF);
-                                std::cout << c;
-                                break;
-                            }
-
-                            //--------------------------------------
-                            // 12: read character -> $v0
-                            //--------------------------------------
-                            case 12:
-                            {
-                                char c;
-                                std::cout << "CONSOLE INTEGER INPUT> ";
-                                std::cin.get(c);
-                                regs.writeU(2, static_cast<uint32_t>(
-                                                static_cast<unsigned char>(c)));
-                                break;
+                                MappedMemory view(mem, *mmu, cp0, pc - 4);
+                                native_runtime_call(regs, view);
                             }
-
-                            //--------------------------------------
-                            // Not implemented / unknown syscall
-                            //--------------------------------------
-                            default:
-                                throw std::runtime_error("Unknown or unimplemented syscall code in $v0");
+                        }
+                        else if (mmu == nullptr)
+                        {
+                            do_syscall(regs, mem, *console_in, *console_out, halted);
+                        }
+                        else
+                        {
+                            MappedMemory view(mem, *mmu, cp0, pc - 4);
+                            do_syscall(regs, view, *console_in, *console_out, halted);
                         }
                         break;
                     }
@@ -591,7 +746,7 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), false);
 
                 uint8_t raw = mem.load8(addr);
                 int8_t  sval = static_cast<int8_t>(raw); // sign-extend from 8 bits
@@ -607,7 +762,7 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), false);
 
                 uint8_t raw = mem.load8(addr);
                 regs.writeU(rt, static_cast<uint32_t>(raw)); // zero-extend
@@ -622,11 +777,11 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), false);
 
                 if (addr & 0x1)
                 {
-                    throw std::runtime_error("MIPS lh: unaligned address");
+                    mem.raise_fault(addr, "MIPS lh: unaligned address");
                 }
 
                 uint8_t b0 = mem.load8(addr + 0); // big-endian
@@ -646,11 +801,11 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), false);
 
                 if (addr & 0x1)
                 {
-                    throw std::runtime_error("MIPS lhu: unaligned address");
+                    mem.raise_fault(addr, "MIPS lhu: unaligned address");
                 }
 
                 uint8_t b0 = mem.load8(addr + 0); // big-endian
@@ -669,7 +824,7 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), false);
 
                 uint32_t val = mem.load32(addr); // does its own alignment + bounds checks
                 regs.writeU(rt, val);
@@ -684,7 +839,7 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), true);
 
                 uint32_t val = regs.readU(rt);
                 uint8_t  b   = static_cast<uint8_t>(val & 0xFF);
@@ -700,11 +855,11 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), true);
 
                 if (addr & 0x1)
                 {
-                    throw std::runtime_error("MIPS sh: unaligned address");
+                    mem.raise_fault(addr, "MIPS sh: unaligned address");
                 }
 
                 uint32_t val = regs.readU(rt);
@@ -724,7 +879,7 @@ public:
 
                 uint32_t base = regs.readU(rs);
                 int32_t  off  = static_cast<int32_t>(imm);
-                uint32_t addr = base + static_cast<uint32_t>(off);
+                uint32_t addr = data_addr(base + static_cast<uint32_t>(off), true);
 
                 uint32_t val = regs.readU(rt);
                 mem.store32(addr, val); // does alignment + bounds checks
@@ -867,6 +1022,214 @@ public:
                 break;
             }
 
+            //==================================================
+            // SPECIAL2: mul, madd/msub, clz/clo
+            //==================================================
+            case OP_SPECIAL2:
+            {
+                uint8_t rs    = (word >> 21) & mask_bits(5);
+                uint8_t rt    = (word >> 16) & mask_bits(5);
+                uint8_t rd    = (word >> 11) & mask_bits(5);
+                uint8_t funct =  word        & mask_bits(6);
+
+                switch (funct)
+                {
+                    case S2_MUL: // rd = low 32 bits of rs * rt (hi/lo untouched)
+                    {
+                        int64_t p = static_cast<int64_t>(regs.readS(rs)) *
+                                    static_cast<int64_t>(regs.readS(rt));
+                        regs.writeU(rd, static_cast<uint32_t>(p));
+                        break;
+                    }
+
+                    case S2_MADD:  // hi:lo += rs * rt (signed)
+                    case S2_MSUB:  // hi:lo -= rs * rt (signed)
+                    {
+                        int64_t p = static_cast<int64_t>(regs.readS(rs)) *
+                                    static_cast<int64_t>(regs.readS(rt));
+                        uint64_t acc = (static_cast<uint64_t>(regs.hiU()) << 32) |
+                                       regs.loU();
+                        acc = (funct == S2_MADD) ? acc + static_cast<uint64_t>(p)
+                                                 : acc - static_cast<uint64_t>(p);
+                        regs.write_hiU(static_cast<uint32_t>(acc >> 32));
+                        regs.write_loU(static_cast<uint32_t>(acc & 0xFFFFFFFFu));
+                        break;
+                    }
+
+                    case S2_MADDU: // hi:lo += rs * rt (unsigned)
+                    case S2_MSUBU: // hi:lo -= rs * rt (unsigned)
+                    {
+                        uint64_t p = static_cast<uint64_t>(regs.readU(rs)) *
+                                     static_cast<uint64_t>(regs.readU(rt));
+                        uint64_t acc = (static_cast<uint64_t>(regs.hiU()) << 32) |
+                                       regs.loU();
+                        acc = (funct == S2_MADDU) ? acc + p : acc - p;
+                        regs.write_hiU(static_cast<uint32_t>(acc >> 32));
+                        regs.write_loU(static_cast<uint32_t>(acc & 0xFFFFFFFFu));
+                        break;
+                    }
+
+                    case S2_CLZ: // rd = leading zeros of rs
+                    {
+                        uint32_t v = regs.readU(rs);
+                        regs.writeU(rd, v ? __builtin_clz(v) : 32u);
+                        break;
+                    }
+
+                    case S2_CLO: // rd = leading ones of rs
+                    {
+                        uint32_t v = ~regs.readU(rs);
+                        regs.writeU(rd, v ? __builtin_clz(v) : 32u);
+                        break;
+                    }
+
+                    default:
+                        throw std::runtime_error("Unknown SPECIAL2 funct");
+                }
+                break;
+            }
+
+            //==================================================
+            // SPECIAL3: ext, ins, bshfl (wsbh, seb, seh)
+            //==================================================
+            case OP_SPECIAL3:
+            {
+                uint8_t rs    = (word >> 21) & mask_bits(5);
+                uint8_t rt    = (word >> 16) & mask_bits(5);
+                uint8_t rd    = (word >> 11) & mask_bits(5); // msb/msbd for ext/ins
+                uint8_t sa    = (word >>  6) & mask_bits(5); // lsb, or bshfl sub-op
+                uint8_t funct =  word        & mask_bits(6);
+
+                switch (funct)
+                {
+                    case S3_EXT: // rt = rs[lsb + msbd : lsb]
+                    {
+                        uint32_t size = rd + 1u;
+                        uint32_t mask = (size >= 32) ? 0xFFFFFFFFu : mask_bits(size);
+                        regs.writeU(rt, (regs.readU(rs) >> sa) & mask);
+                        break;
+                    }
+
+                    case S3_INS: // rt[msb : lsb] = rs[msb - lsb : 0]
+                    {
+                        if (rd < sa)
+                            throw std::runtime_error("MIPS ins: msb < lsb");
+                        uint32_t size = rd - sa + 1u;
+                        uint32_t mask = ((size >= 32) ? 0xFFFFFFFFu : mask_bits(size)) << sa;
+                        uint32_t r = (regs.readU(rt) & ~mask) |
+                                     ((regs.readU(rs) << sa) & mask);
+                        regs.writeU(rt, r);
+                        break;
+                    }
+
+                    case S3_BSHFL:
+                    {
+                        uint32_t v = regs.readU(rt);
+                        switch (sa)
+                        {
+                            case BSHFL_WSBH: // swap bytes within each halfword
+                                regs.writeU(rd, ((v & 0x00FF00FFu) << 8) |
+                                                ((v >> 8) & 0x00FF00FFu));
+                                break;
+                            case BSHFL_SEB:
+                                regs.writeS(rd, static_cast<int8_t>(v & 0xFFu));
+                                break;
+                            case BSHFL_SEH:
+                                regs.writeS(rd, static_cast<int16_t>(v & 0xFFFFu));
+                                break;
+                            default:
+                                throw std::runtime_error("Unknown BSHFL sub-op");
+                        }
+                        break;
+                    }
+
+                    default:
+                        throw std::runtime_error("Unknown SPECIAL3 funct");
+                }
+                break;
+            }
+
+            //==================================================
+            // System control (CP0)
+            //==================================================
+            case OP_COP0:
+            {
+                uint8_t code  = (word >> 21) & mask_bits(5);
+                uint8_t rt    = (word >> 16) & mask_bits(5);
+                uint8_t rd    = (word >> 11) & mask_bits(5);
+                uint8_t funct =  word        & mask_bits(6);
+
+                if (code == C0_MF)
+                {
+                    regs.writeU(rt, cp0.read(rd));
+                    break;
+                }
+                if (code == C0_MT)
+                {
+                    cp0.write(rd, regs.readU(rt));
+                    ++cp0_writes;
+                    break;
+                }
+                if (code != C0_CO)
+                    throw std::runtime_error("Unknown COP0 instruction");
+                ++cp0_writes; // eret, tlbwr, tlbwi and tlbp all change CP0 or the TLB
+
+                if (funct == C0_ERET)
+                {
+                    pc = cp0.epc;
+                    cp0.status &= ~Cp0::STATUS_EXL;
+                    if (mmu != nullptr)
+                        mmu->eret();
+                    break;
+                }
+
+                if (mmu == nullptr)
+                    throw std::runtime_error("TLB instruction with the MMU off");
+                switch (funct)
+                {
+                    case C0_TLBWR: mmu->write_random(cp0);  break;
+                    case C0_TLBWI: mmu->write_indexed(cp0); break;
+                    case C0_TLBP:  mmu->probe(cp0);         break;
+                    default:
+                        throw std::runtime_error("Unknown COP0 instruction");
+                }
+                break;
+            }
+
+            //==================================================
+            // Guest SIMD (MSA subset, see Msa.h)
+            //==================================================
+            case OP_MSA:
+            {
+                if (mmu == nullptr)
+                {
+                    msa_execute(word, regs, vregs, mem);
+                }
+                else
+                {
+                    MappedMemory view(mem, *mmu, cp0, pc - 4);
+                    msa_execute(word, regs, vregs, view);
+                }
+                break;
+            }
+
+            // first fetch from a lazily loaded region: assemble it and
+            // run the real instruction in its place
+            case OP_LAZY:
+            {
+                if (lazy_text == nullptr || !lazy_text->materialize(pc - 4))
+                    throw std::runtime_error("Unknown opcode");
+                uint32_t real = mem.load32(pc - 4);
+                if (dataflow != nullptr)
+                    dataflow->observe(real, regs);
+                if (ooo != nullptr)
+                    ooo->observe(real, regs);
+                if (reuse != nullptr)
+                    reuse->observe(real, regs);
+                execute(real);
+                break;
+            }
+
             default:
                 throw std::runtime_error("Unknown opcode");
         }
@@ -874,9 +1237,49 @@ public:
 
     // member variables
     RegisterFile regs;
+    VectorRegisterFile vregs; // $w0..$w31
     Memory & mem;
     uint32_t pc;
     bool halted;
+
+    // streams used by the console syscalls
+    std::istream * console_in;
+    std::ostream * console_out;
+
+    // block-batched run statistics; null when not collecting
+    RunStatsCollector * stats;
+
+    // livelock detection at backward branches; null when off.
+    // syscall_count and cp0_writes (mtc0, eret and the TLB
+    // instructions) are part of the detector's epoch.
+    LivelockDetector * livelock;
+    uint64_t syscall_count;
+    uint64_t cp0_writes;
+
+    // on-demand text of a lazy load; null otherwise
+    LazyText * lazy_text;
+
+    // serve syscalls 100..105 on the host (see NativeRuntime.h)
+    bool native_runtime;
+
+    // dataflow critical-path analysis; null when off
+    DataflowAnalyzer * dataflow;
+
+    // out-of-order timing model; null when off
+    OoOModel * ooo;
+
+    // stack-distance profile of fetch and data addresses; null when off
+    ReuseProfiler * reuse;
+
+    // system-control registers, and address translation (null: data
+    // addresses are physical)
+    Cp0   cp0;
+    Mmu * mmu;
+
+    // ring of the last PC_RING_SIZE fetched PCs (power of two)
+    static const uint32_t PC_RING_SIZE = 64;
+    uint32_t pc_ring[PC_RING_SIZE];
+    uint32_t pc_ring_pos;
 };
 
 #endif // CPU_H
@@ -0,0 +1,343 @@
+// File  : Checker.h
+// Author: Cole Schwandt
+//
+// Syntax checking without assembling and without exceptions.
+//
+// The Checker walks a source file line by line with its own Lexer and
+// the Parser's tables, and returns every problem it finds as a
+// Diagnostic (line, column, code, message) instead of stopping at the
+// first throw. Nothing is encoded and no Machine is touched, so one
+// Checker per thread can check many submissions at once; a bad file
+// costs a vector push per error rather than an unwind.
+//
+// It checks what the assembler would reject: invalid characters,
+// unknown mnemonics and directives, operand shapes, register names,
+// immediate and shift ranges, string escapes, duplicate labels and
+// labels that are never defined. Operand rules are the Parser's own
+// (Parser::check_operands and friends), so the two cannot drift apart.
+// Branch distances are not checked; the assembler relaxes those.
+
+#ifndef CHECKER_H
+#define CHECKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Constants.h"
+#include "Token.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+enum DiagCode
+{
+    DIAG_IO,          // file could not be read
+    DIAG_LEX,         // invalid character
+    DIAG_SYNTAX,      // line does not start with a label or mnemonic
+    DIAG_MNEMONIC,    // unknown instruction
+    DIAG_OPERANDS,    // operands do not fit the instruction
+    DIAG_REGISTER,    // unknown register name
+    DIAG_RANGE,       // immediate, shift or bit-field out of range
+    DIAG_LITERAL,     // malformed integer or string literal
+    DIAG_DIRECTIVE,   // unknown or malformed data directive
+    DIAG_DUP_LABEL,   // label defined twice
+    DIAG_UNDEF_LABEL, // label used but never defined
+};
+
+inline
+const char * diag_code_name(DiagCode c)
+{
+    switch (c)
+    {
+        case DIAG_IO:          return "io";
+        case DIAG_LEX:         return "lex";
+        case DIAG_SYNTAX:      return "syntax";
+        case DIAG_MNEMONIC:    return "mnemonic";
+        case DIAG_OPERANDS:    return "operands";
+        case DIAG_REGISTER:    return "register";
+        case DIAG_RANGE:       return "range";
+        case DIAG_LITERAL:     return "literal";
+        case DIAG_DIRECTIVE:   return "directive";
+        case DIAG_DUP_LABEL:   return "duplicate-label";
+        case DIAG_UNDEF_LABEL: return "undefined-label";
+    }
+    return "?";
+}
+
+struct Diagnostic
+{
+    uint32_t    line;   // 1-based source line
+    uint32_t    col;    // 1-based column of the offending token
+    DiagCode    code;
+    std::string message;
+};
+
+//==============================================================
+// Checker
+//==============================================================
+class Checker
+{
+public:
+    // every diagnostic for the file at 'path', in line order
+    std::vector< Diagnostic > check_file(const std::string & path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::vector< Diagnostic > diags;
+            diags.push_back(Diagnostic{0, 0, DIAG_IO, "could not open file"});
+            return diags;
+        }
+        return check(in);
+    }
+
+    std::vector< Diagnostic > check(std::istream & in)
+    {
+        diags_.clear();
+        defined_.clear();
+        uses_.clear();
+        in_text_ = true;
+
+        std::string line;
+        uint32_t line_n = 0;
+        while (std::getline(in, line))
+        {
+            ++line_n;
+            check_line(line, line_n);
+        }
+
+        for (const LabelUse & u : uses_)
+        {
+            if (defined_.find(u.name) == defined_.end())
+                add(u.line, u.col, DIAG_UNDEF_LABEL, "undefined label: " + u.name);
+        }
+
+        // undefined-label reports come last; keep the result in line order
+        std::stable_sort(diags_.begin(), diags_.end(),
+                         [](const Diagnostic & a, const Diagnostic & b)
+                         { return a.line < b.line; });
+        return std::move(diags_);
+    }
+
+private:
+    struct LabelUse
+    {
+        std::string name;
+        uint32_t    line;
+        uint32_t    col;
+    };
+
+    Lexer lexer_;
+    std::vector< Token > toks_;
+    std::vector< Diagnostic > diags_;
+    std::unordered_map< std::string, uint32_t > defined_; // label -> line
+    std::vector< LabelUse > uses_;
+    bool in_text_ = true;
+
+    void add(uint32_t line, uint32_t col, DiagCode code, const std::string & msg)
+    {
+        diags_.push_back(Diagnostic{line, col, code, msg});
+    }
+
+    void add_at(const Token & t, DiagCode code, const std::string & msg)
+    {
+        add(t.line, t.pos + 1, code, msg);
+    }
+
+    void check_line(const std::string & line, uint32_t line_n)
+    {
+        toks_.clear();
+        lexer_.lex_core(toks_, line, line_n);
+        if (toks_.empty() || toks_[0].type == EOL)
+            return;
+
+        // one report per run of adjacent invalid characters
+        bool bad_char = false;
+        for (std::size_t k = 0; k < toks_.size(); ++k)
+        {
+            if (toks_[k].type != ERROR)
+                continue;
+            std::size_t last = k;
+            while (last + 1 < toks_.size() && toks_[last + 1].type == ERROR &&
+                   toks_[last + 1].pos == toks_[last].pos + toks_[last].len)
+                ++last;
+            add_at(toks_[k], DIAG_LEX, "invalid character(s): " +
+                   line.substr(toks_[k].pos, toks_[last].pos + toks_[last].len - toks_[k].pos));
+            bad_char = true;
+            k = last;
+        }
+        if (bad_char)
+            return; // the shape checks would only repeat the same error
+
+        // segment directives
+        if (toks_[0].type == IDENTIFIER && toks_.size() == 2)
+        {
+            std::string word = toks_[0].get_string(line);
+            if (word == ".text" || word == ".data")
+            {
+                in_text_ = (word == ".text");
+                return;
+            }
+        }
+
+        std::size_t i = 0;
+        if (toks_[0].type == IDENTIFIER && toks_.size() > 1 && toks_[1].type == COLON)
+        {
+            define(toks_[0], line);
+            i = 2;
+        }
+        if (toks_[i].type == EOL)
+            return; // label-only line
+
+        if (in_text_)
+            check_text(line, i);
+        else
+            check_data(line, i);
+    }
+
+    void define(const Token & t, const std::string & line)
+    {
+        std::string name = t.get_string(line);
+        auto it = defined_.find(name);
+        if (it != defined_.end())
+        {
+            add_at(t, DIAG_DUP_LABEL, "label " + name + " already defined on line " +
+                   std::to_string(it->second));
+            return;
+        }
+        defined_[name] = t.line;
+    }
+
+    void use(const Token & t, const std::string & line)
+    {
+        uses_.push_back(LabelUse{t.get_string(line), t.line, t.pos + 1});
+    }
+
+    // the Parser's issues with this line's operands, as diagnostics
+    void report(const std::vector< Parser::OperandIssue > & issues)
+    {
+        for (const Parser::OperandIssue & is : issues)
+            add_at(toks_[is.tok], diag_code(is.problem), is.message);
+    }
+
+    static DiagCode diag_code(Parser::OperandProblem p)
+    {
+        switch (p)
+        {
+            case Parser::OPERAND_SHAPE:     return DIAG_OPERANDS;
+            case Parser::OPERAND_REGISTER:  return DIAG_REGISTER;
+            case Parser::OPERAND_LITERAL:   return DIAG_LITERAL;
+            case Parser::OPERAND_RANGE:     return DIAG_RANGE;
+            case Parser::OPERAND_DIRECTIVE: return DIAG_DIRECTIVE;
+        }
+        return DIAG_SYNTAX;
+    }
+
+    // every label operand from toks_[j] on
+    void use_labels(std::size_t j, const std::string & line)
+    {
+        for (; j < toks_.size(); ++j)
+        {
+            if (toks_[j].type == IDENTIFIER)
+                use(toks_[j], line);
+        }
+    }
+
+    //==========================================================
+    // text lines
+    //==========================================================
+    void check_text(const std::string & line, std::size_t i)
+    {
+        const Token & mnem_tok = toks_[i];
+        if (mnem_tok.type != IDENTIFIER)
+        {
+            add_at(mnem_tok, DIAG_SYNTAX, "expected instruction mnemonic");
+            return;
+        }
+
+        std::string mnem = mnem_tok.get_string(line);
+        std::vector< Parser::OperandIssue > issues;
+
+        auto pseudo = PSEUDO_TABLE.find(mnem);
+        auto instr = INSTR_TABLE.find(mnem);
+        if (pseudo != PSEUDO_TABLE.end())
+        {
+            Parser::check_pseudo_operands(pseudo->second, toks_, i + 1, line, issues);
+        }
+        else if (instr != INSTR_TABLE.end())
+        {
+            Parser::check_operands(instr->second, toks_, i + 1, line, issues);
+        }
+        else
+        {
+            add_at(mnem_tok, DIAG_MNEMONIC, "unknown instruction: " + mnem);
+            return;
+        }
+
+        report(issues);
+        // a line of the wrong shape has no reliable operands to look at
+        if (issues.empty() || issues.front().problem != Parser::OPERAND_SHAPE)
+            use_labels(i + 1, line);
+    }
+
+    //==========================================================
+    // data lines
+    //==========================================================
+    void check_data(const std::string & line, std::size_t i)
+    {
+        const Token & dir_tok = toks_[i];
+        if (dir_tok.type != IDENTIFIER)
+        {
+            add_at(dir_tok, DIAG_SYNTAX, "data line must start with a directive");
+            return;
+        }
+
+        std::vector< Parser::OperandIssue > issues;
+        Parser::check_data_operands(dir_tok.get_string(line), toks_, i + 1, line, issues);
+        report(issues);
+    }
+};
+
+//==============================================================
+// check_files: one result per path, in path order, on 'workers'
+// threads (0: one per hardware thread). Each worker has its own
+// Checker and takes the next path from a shared counter.
+//==============================================================
+inline
+std::vector< std::vector< Diagnostic > >
+check_files(const std::vector< std::string > & paths, unsigned workers)
+{
+    if (workers == 0)
+        workers = std::thread::hardware_concurrency();
+    if (workers == 0)
+        workers = 1;
+    if (workers > paths.size())
+        workers = static_cast<unsigned>(paths.size());
+
+    std::vector< std::vector< Diagnostic > > results(paths.size());
+    std::atomic< std::size_t > next(0);
+
+    auto work = [&]()
+    {
+        Checker checker;
+        for (std::size_t j = next++; j < paths.size(); j = next++)
+            results[j] = checker.check_file(paths[j]);
+    };
+
+    std::vector< std::thread > threads;
+    for (unsigned w = 1; w < workers; ++w)
+        threads.emplace_back(work);
+    work(); // the calling thread is a worker too
+    for (std::thread & t : threads)
+        t.join();
+
+    return results;
+}
+
+#endif // CHECKER_H
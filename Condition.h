@@ -0,0 +1,500 @@
+// File  : Condition.h
+// Author: Cole Schwandt
+//
+// Expressions for conditional breakpoints ('break LABEL if EXPR') and
+// 'run until EXPR'.
+//
+// An expression is compiled once into a small stack bytecode. A check
+// walks that array of instructions over a fixed stack, so a breakpoint
+// in a hot loop costs a few dozen operations per hit, not a parse.
+//
+//   $t0 $8 hi lo       registers, signed
+//   mem[EXPR]          the word at that address, signed (aligned)
+//   pc steps           current pc, steps taken by the run
+//   LABEL              the label's address, resolved when compiled
+//   123 -4 0x1F 'a'    constants; hex constants are 32-bit patterns,
+//                      so 0xFFFFFFFF == -1
+//
+// Operators, loosest first, as in C: || && | ^ & (== !=) (< <= > >=)
+// (+ -) (* / %) and unary - !. && and || short-circuit, so
+// '$t0 != 0 && mem[$t0] > 0' never reads through a null pointer.
+// Values are 64-bit while an expression is evaluated.
+
+#ifndef CONDITION_H
+#define CONDITION_H
+
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "RegisterFile.h"
+
+enum CondOp : uint8_t
+{
+    COND_PUSH,   // arg
+    COND_REG,    // register arg
+    COND_HI,
+    COND_LO,
+    COND_PC,
+    COND_STEPS,
+    COND_LOAD,   // top = mem[top]
+    COND_NEG,
+    COND_NOT,
+    COND_ADD,
+    COND_SUB,
+    COND_MUL,
+    COND_DIV,
+    COND_MOD,
+    COND_BAND,
+    COND_BOR,
+    COND_BXOR,
+    COND_EQ,
+    COND_NE,
+    COND_LT,
+    COND_LE,
+    COND_GT,
+    COND_GE,
+    COND_AND_JUMP, // top == 0: jump to arg keeping the 0, else pop
+    COND_OR_JUMP,  // top != 0: jump to arg with 1 on top, else pop
+    COND_BOOL      // top = (top != 0)
+};
+
+struct CondInsn
+{
+    CondOp  op;
+    int64_t arg;
+};
+
+class Condition
+{
+public:
+    // deepest stack an expression may need
+    static const int MAX_DEPTH = 32;
+
+    // address of a label; false if there is no such label
+    typedef std::function< bool(const std::string &, uint32_t &) > LabelLookup;
+
+    Condition() {}
+
+    // compile 'text'; throws std::runtime_error saying where it went wrong
+    static Condition compile(const std::string & text, const LabelLookup & labels)
+    {
+        Condition c;
+        c.text_ = text;
+        Compiler comp(text, labels, c.code_);
+        comp.compile();
+        return c;
+    }
+
+    bool empty() const { return code_.empty(); }
+    const std::string & text() const { return text_; }
+    std::size_t size() const { return code_.size(); }
+
+    // evaluate against a machine state. 'Mem' needs load32 (Memory or
+    // MappedMemory); its faults propagate.
+    template < typename Mem >
+    bool eval(const RegisterFile & regs, const Mem & mem, uint32_t pc, uint64_t steps) const
+    {
+        int64_t stack[MAX_DEPTH];
+        int sp = -1;
+        const std::size_t n = code_.size();
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            const CondInsn & in = code_[i];
+            switch (in.op)
+            {
+                case COND_PUSH:  stack[++sp] = in.arg; break;
+                case COND_REG:   stack[++sp] = regs.readS(static_cast<uint8_t>(in.arg)); break;
+                case COND_HI:    stack[++sp] = regs.hiS(); break;
+                case COND_LO:    stack[++sp] = regs.loS(); break;
+                case COND_PC:    stack[++sp] = pc; break;
+                case COND_STEPS: stack[++sp] = static_cast<int64_t>(steps); break;
+                case COND_LOAD:
+                    stack[sp] = static_cast<int32_t>(mem.load32(static_cast<uint32_t>(stack[sp])));
+                    break;
+                case COND_NEG:   stack[sp] = wrap(0 - static_cast<uint64_t>(stack[sp])); break;
+                case COND_NOT:   stack[sp] = !stack[sp]; break;
+                case COND_BOOL:  stack[sp] = stack[sp] != 0; break;
+
+                case COND_AND_JUMP:
+                    if (stack[sp] == 0)
+                        i = static_cast<std::size_t>(in.arg) - 1;
+                    else
+                        --sp;
+                    break;
+                case COND_OR_JUMP:
+                    if (stack[sp] != 0)
+                    {
+                        stack[sp] = 1;
+                        i = static_cast<std::size_t>(in.arg) - 1;
+                    }
+                    else
+                    {
+                        --sp;
+                    }
+                    break;
+
+                default:
+                {
+                    // binary operators
+                    const int64_t b = stack[sp--];
+                    int64_t & a = stack[sp];
+                    switch (in.op)
+                    {
+                        case COND_ADD:  a = wrap(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)); break;
+                        case COND_SUB:  a = wrap(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)); break;
+                        case COND_MUL:  a = wrap(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)); break;
+                        case COND_DIV:
+                        case COND_MOD:
+                            if (b == 0)
+                                throw std::runtime_error("division by zero");
+                            if (b == -1) // INT64_MIN / -1 traps on the host
+                                a = (in.op == COND_DIV) ? wrap(0 - static_cast<uint64_t>(a)) : 0;
+                            else
+                                a = (in.op == COND_DIV) ? a / b : a % b;
+                            break;
+                        case COND_BAND: a = a & b; break;
+                        case COND_BOR:  a = a | b; break;
+                        case COND_BXOR: a = a ^ b; break;
+                        case COND_EQ:   a = a == b; break;
+                        case COND_NE:   a = a != b; break;
+                        case COND_LT:   a = a <  b; break;
+                        case COND_LE:   a = a <= b; break;
+                        case COND_GT:   a = a >  b; break;
+                        case COND_GE:   a = a >= b; break;
+                        default:        break;
+                    }
+                }
+            }
+        }
+        return stack[0] != 0;
+    }
+
+private:
+    std::string text_;
+    std::vector< CondInsn > code_;
+
+    // arithmetic is done unsigned and wraps, as the guest's addu does
+    static int64_t wrap(uint64_t v) { return static_cast<int64_t>(v); }
+
+    //----------------------------------------------------------
+    // recursive-descent compiler, one precedence level per method
+    //----------------------------------------------------------
+    class Compiler
+    {
+    public:
+        Compiler(const std::string & text, const LabelLookup & labels,
+                 std::vector< CondInsn > & code)
+            : s_(text), labels_(labels), code_(code)
+        {}
+
+        void compile()
+        {
+            skip_blanks();
+            if (pos_ == s_.size())
+                fail("empty expression");
+            logical_or();
+            skip_blanks();
+            if (pos_ != s_.size())
+                fail("unexpected '" + s_.substr(pos_, 1) + "'");
+        }
+
+    private:
+        const std::string & s_;
+        const LabelLookup & labels_;
+        std::vector< CondInsn > & code_;
+        std::size_t pos_ = 0;
+        int depth_ = 0;
+
+        [[noreturn]] void fail(const std::string & what) const
+        {
+            throw std::runtime_error("condition: " + what + " at column " +
+                                     std::to_string(pos_ + 1));
+        }
+
+        void skip_blanks()
+        {
+            while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_])))
+                ++pos_;
+        }
+
+        // consume 'op' if it comes next, but not as the start of a
+        // longer operator ('&' in '&&', '<' in '<=')
+        bool accept(const char * op)
+        {
+            skip_blanks();
+            std::size_t n = std::char_traits< char >::length(op);
+            if (s_.compare(pos_, n, op) != 0)
+                return false;
+            if (n == 1 && pos_ + 1 < s_.size())
+            {
+                char next = s_[pos_ + 1];
+                if ((op[0] == '&' && next == '&') || (op[0] == '|' && next == '|') ||
+                    ((op[0] == '<' || op[0] == '>' || op[0] == '!') && next == '='))
+                    return false;
+            }
+            pos_ += n;
+            return true;
+        }
+
+        void expect(const char * op)
+        {
+            if (!accept(op))
+                fail(std::string("expected '") + op + "'");
+        }
+
+        // emit, tracking the stack depth the code will reach
+        void emit(CondOp op, int64_t arg = 0)
+        {
+            code_.push_back({ op, arg });
+            if (op <= COND_STEPS)
+            {
+                if (++depth_ > MAX_DEPTH)
+                    fail("expression too deep");
+            }
+            else if (op >= COND_ADD && op <= COND_GE)
+            {
+                --depth_;
+            }
+        }
+
+        void logical_or()
+        {
+            logical_and();
+            while (accept("||"))
+            {
+                std::size_t jump = code_.size();
+                emit(COND_OR_JUMP);
+                --depth_;
+                logical_and();
+                emit(COND_BOOL);
+                code_[jump].arg = static_cast<int64_t>(code_.size());
+            }
+        }
+
+        void logical_and()
+        {
+            bit_or();
+            while (accept("&&"))
+            {
+                std::size_t jump = code_.size();
+                emit(COND_AND_JUMP);
+                --depth_;
+                bit_or();
+                emit(COND_BOOL);
+                code_[jump].arg = static_cast<int64_t>(code_.size());
+            }
+        }
+
+        void bit_or()
+        {
+            bit_xor();
+            while (accept("|"))
+            {
+                bit_xor();
+                emit(COND_BOR);
+            }
+        }
+
+        void bit_xor()
+        {
+            bit_and();
+            while (accept("^"))
+            {
+                bit_and();
+                emit(COND_BXOR);
+            }
+        }
+
+        void bit_and()
+        {
+            equality();
+            while (accept("&"))
+            {
+                equality();
+                emit(COND_BAND);
+            }
+        }
+
+        void equality()
+        {
+            relational();
+            for (;;)
+            {
+                if (accept("=="))      { relational(); emit(COND_EQ); }
+                else if (accept("!=")) { relational(); emit(COND_NE); }
+                else return;
+            }
+        }
+
+        void relational()
+        {
+            additive();
+            for (;;)
+            {
+                if (accept("<="))     { additive(); emit(COND_LE); }
+                else if (accept(">=")) { additive(); emit(COND_GE); }
+                else if (accept("<"))  { additive(); emit(COND_LT); }
+                else if (accept(">"))  { additive(); emit(COND_GT); }
+                else return;
+            }
+        }
+
+        void additive()
+        {
+            multiplicative();
+            for (;;)
+            {
+                if (accept("+"))      { multiplicative(); emit(COND_ADD); }
+                else if (accept("-")) { multiplicative(); emit(COND_SUB); }
+                else return;
+            }
+        }
+
+        void multiplicative()
+        {
+            unary();
+            for (;;)
+            {
+                if (accept("*"))      { unary(); emit(COND_MUL); }
+                else if (accept("/")) { unary(); emit(COND_DIV); }
+                else if (accept("%")) { unary(); emit(COND_MOD); }
+                else return;
+            }
+        }
+
+        void unary()
+        {
+            if (accept("-"))
+            {
+                unary();
+                // fold a negative constant
+                if (code_.back().op == COND_PUSH)
+                    code_.back().arg = -code_.back().arg;
+                else
+                    emit(COND_NEG);
+            }
+            else if (accept("!"))
+            {
+                unary();
+                emit(COND_NOT);
+            }
+            else
+            {
+                primary();
+            }
+        }
+
+        void primary()
+        {
+            skip_blanks();
+            if (pos_ == s_.size())
+                fail("expression ends early");
+
+            char c = s_[pos_];
+            if (accept("("))
+            {
+                logical_or();
+                expect(")");
+            }
+            else if (c == '$')
+            {
+                std::size_t start = pos_++;
+                while (pos_ < s_.size() && std::isalnum(static_cast<unsigned char>(s_[pos_])))
+                    ++pos_;
+                std::string name = s_.substr(start, pos_ - start);
+                if (name == "$hi" || name == "$lo")
+                {
+                    emit(name == "$hi" ? COND_HI : COND_LO);
+                    return;
+                }
+                auto it = REG_TABLE.find(name);
+                if (it == REG_TABLE.end())
+                {
+                    pos_ = start;
+                    fail("unknown register " + name);
+                }
+                emit(COND_REG, it->second);
+            }
+            else if (std::isdigit(static_cast<unsigned char>(c)))
+            {
+                emit(COND_PUSH, number());
+            }
+            else if (c == '\'' && pos_ + 2 < s_.size() && s_[pos_ + 2] == '\'')
+            {
+                emit(COND_PUSH, static_cast<unsigned char>(s_[pos_ + 1]));
+                pos_ += 3;
+            }
+            else if (std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.')
+            {
+                std::size_t start = pos_;
+                while (pos_ < s_.size() &&
+                       (std::isalnum(static_cast<unsigned char>(s_[pos_])) ||
+                        s_[pos_] == '_' || s_[pos_] == '.'))
+                    ++pos_;
+                std::string word = s_.substr(start, pos_ - start);
+
+                uint32_t addr = 0;
+                if (word == "mem")
+                {
+                    expect("[");
+                    logical_or();
+                    expect("]");
+                    emit(COND_LOAD);
+                }
+                else if (word == "hi")    emit(COND_HI);
+                else if (word == "lo")    emit(COND_LO);
+                else if (word == "pc")    emit(COND_PC);
+                else if (word == "steps") emit(COND_STEPS);
+                else if (labels_ && labels_(word, addr))
+                    emit(COND_PUSH, addr);
+                else
+                {
+                    pos_ = start;
+                    fail("unknown name " + word);
+                }
+            }
+            else
+            {
+                fail("unexpected '" + std::string(1, c) + "'");
+            }
+        }
+
+        int64_t number()
+        {
+            std::size_t start = pos_;
+            int base = 10;
+            if (s_.compare(pos_, 2, "0x") == 0 || s_.compare(pos_, 2, "0X") == 0)
+            {
+                base = 16;
+                pos_ += 2;
+            }
+            std::size_t digits = pos_;
+            while (pos_ < s_.size() && std::isxdigit(static_cast<unsigned char>(s_[pos_])) &&
+                   (base == 16 || std::isdigit(static_cast<unsigned char>(s_[pos_]))))
+                ++pos_;
+            if (pos_ == digits || (pos_ < s_.size() && std::isalnum(static_cast<unsigned char>(s_[pos_]))))
+            {
+                pos_ = start;
+                fail("bad number");
+            }
+            std::string text = s_.substr(digits, pos_ - digits);
+            if (text.size() > (base == 16 ? 8u : 10u))
+            {
+                pos_ = start;
+                fail("number out of range");
+            }
+            int64_t v = std::stoll(text, nullptr, base);
+            if (base == 16)
+                return static_cast<int32_t>(static_cast<uint32_t>(v)); // a 32-bit pattern
+            return v;
+        }
+    };
+};
+
+#endif // CONDITION_H
@@ -33,6 +33,12 @@ enum Opcode : uint8_t
     OP_XORI  = 0x0E,  // xori
     OP_LUI   = 0x0F,  // lui
 
+    OP_COP0  = 0x10,  // mfc0, mtc0, tlbwr, tlbwi, tlbp, eret
+
+    OP_SPECIAL2 = 0x1C, // mul, madd, msub, clz, clo (MIPS32)
+    OP_MSA      = 0x1E, // SIMD: addv.w, ld.w, ... (see Msa.h)
+    OP_SPECIAL3 = 0x1F, // ext, ins, seb, seh, wsbh (MIPS32r2)
+
     OP_LB    = 0x20,  // lb
     OP_LH    = 0x21,  // lh
     OP_LW    = 0x23,  // lw
@@ -42,8 +48,14 @@ enum Opcode : uint8_t
     OP_SB    = 0x28,  // sb
     OP_SH    = 0x29,  // sh
     OP_SW    = 0x2B,  // sw
+
+    OP_LAZY  = 0x3B,  // not an instruction: text not yet assembled
 };
 
+// word left at the start of every region a lazy load has not
+// assembled yet (see LazyLoader.h)
+static const uint32_t LAZY_TEXT_WORD = static_cast<uint32_t>(OP_LAZY) << 26;
+
 // 6-bit funct codes (bits 5..0) for R-type (opcode = 0)
 enum Funct : uint8_t
 {
@@ -63,6 +75,10 @@ enum Funct : uint8_t
     FUNCT_JR    = 0b001000,
     FUNCT_JALR  = 0b001001,
 
+    // conditional moves (MIPS32)
+    FUNCT_MOVZ  = 0x0A,
+    FUNCT_MOVN  = 0x0B,
+
     // syscall / break
     FUNCT_SYSCALL = 0x0C,
 
@@ -98,6 +114,72 @@ enum RegimmCode : uint8_t
     RT_BGEZ = 0x01,
 };
 
+// funct codes under OP_SPECIAL2
+enum Special2Funct : uint8_t
+{
+    S2_MADD  = 0x00,
+    S2_MADDU = 0x01,
+    S2_MUL   = 0x02,
+    S2_MSUB  = 0x04,
+    S2_MSUBU = 0x05,
+    S2_CLZ   = 0x20,
+    S2_CLO   = 0x21,
+};
+
+// funct codes under OP_SPECIAL3
+enum Special3Funct : uint8_t
+{
+    S3_EXT   = 0x00,
+    S3_INS   = 0x04,
+    S3_BSHFL = 0x20, // sub-op in the shamt field, see BshflCode
+};
+
+// rs-field codes under OP_COP0
+enum Cop0Code : uint8_t
+{
+    C0_MF = 0x00, // mfc0 rt, rd
+    C0_MT = 0x04, // mtc0 rt, rd
+    C0_CO = 0x10, // the rest: selected by funct (Cop0Funct)
+};
+
+// funct codes of OP_COP0 / C0_CO
+enum Cop0Funct : uint8_t
+{
+    C0_TLBWI = 0x02,
+    C0_TLBWR = 0x06,
+    C0_TLBP  = 0x08,
+    C0_ERET  = 0x18,
+};
+
+// minor opcodes (bits 5..0) under OP_MSA. the operation and data
+// format fields above them are kept in InstrInfo::bits.
+enum MsaMinor : uint8_t
+{
+    MSA_SHIFT = 0x0D, // 3R: sll, sra, srl
+    MSA_ADD   = 0x0E, // 3R: addv, subv
+    MSA_CMP   = 0x0F, // 3R: ceq, clt_s, clt_u, cle_s, cle_u
+    MSA_MUL   = 0x12, // 3R: mulv
+    MSA_ELM   = 0x19, // ELM: splati, copy_s
+    MSA_VEC   = 0x1E, // VEC: and.v, or.v, nor.v, xor.v; also 2R fill
+    MSA_LD_W  = 0x22, // MI10: ld.w  (minor 1000, df = w)
+    MSA_ST_W  = 0x26, // MI10: st.w  (minor 1001, df = w)
+};
+
+// 3R operation field (bits 25..23) and data format (bits 22..21)
+static const uint32_t MSA_DF_W = 2;
+inline constexpr uint32_t msa_3r(uint32_t operation)
+{
+    return (operation << 23) | (MSA_DF_W << 21);
+}
+
+// shamt-field sub-ops of SPECIAL3 BSHFL
+enum BshflCode : uint8_t
+{
+    BSHFL_WSBH = 0x02,
+    BSHFL_SEB  = 0x10,
+    BSHFL_SEH  = 0x18,
+};
+
 //==============================================================
 // Instruction metadata
 //==============================================================
@@ -113,7 +195,17 @@ enum InstrType
     SYSCALL,   // R-format: syscall
     JR_JALR,   // R3: jr rs, jalr rs
     R_HILO1,   // rd     (mfhi, mflo)
-    R_HILO2,   // rs, rt (mult, multu, div, divu)
+    R_HILO2,   // rs, rt (mult, multu, div, divu, madd, msub)
+    R2,        // rd, rs         (clz, clo)
+    R2_BSHFL,  // rd, rt         (seb, seh, wsbh)
+    RROTATE,   // rd, rt, sa     (rotr)
+    EXT_INS,   // rt, rs, pos, size (ext, ins)
+    COP0_MOVE, // rt, rd     (mfc0, mtc0)
+    COP0_OP,   // no operands (tlbwr, tlbwi, tlbp, eret)
+    MSA_3R,    // wd, ws, wt        (addv.w, and.v, ceq.w, ...)
+    MSA_LS,    // wd, offset(rs)    (ld.w, st.w)
+    MSA_FILL,  // wd, rs            (fill.w)
+    MSA_ELEM,  // wd, ws[n] / rd, ws[n] (splati.w, copy_s.w)
     NUM_INSTRTYPE, 
 };
 
@@ -122,6 +214,7 @@ struct InstrInfo
     InstrType type;
     Opcode    opcode;  // 6-bit opcode field
     Funct     funct;   // 6-bit funct field (R-type); 0 / FUNCT_NONE for non-R
+    uint32_t  bits = 0; // fixed operation fields between opcode and funct (MSA)
 };
 
 enum PseudoType
@@ -131,7 +224,6 @@ enum PseudoType
     NEG,    // neg   rd, rs
     NEGU,   // negu  rd, rs
     NOT,    // not   rd, rs
-    MUL,    // mul   rd, rs, rt
     DIV3,    // div   rd, rs, rt
 
     // Set-on-compare pseudos
@@ -185,6 +277,36 @@ static const std::vector< TokenType > PATTERNS[NUM_INSTRTYPE] = {
 
     // R_HILO2: rs, rt
     std::vector< TokenType > { REGISTER, COMMA, REGISTER, EOL },
+
+    // R2: rd, rs              e.g. clz $t0, $t1
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, EOL },
+
+    // R2_BSHFL: rd, rt        e.g. seb $t0, $t1
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, EOL },
+
+    // RROTATE: rd, rt, sa     e.g. rotr $t0, $t1, 8
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, COMMA, INT, EOL },
+
+    // EXT_INS: rt, rs, pos, size   e.g. ext $t0, $t1, 4, 8
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, COMMA, INT, COMMA, INT, EOL },
+
+    // COP0_MOVE: rt, rd       e.g. mfc0 $k0, $4  (rd names a CP0 register)
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, EOL },
+
+    // COP0_OP: tlbwr
+    std::vector< TokenType > { EOL },
+
+    // MSA_3R: wd, ws, wt      e.g. addv.w $w0, $w1, $w2
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, COMMA, REGISTER, EOL },
+
+    // MSA_LS: wd, offset(rs)  e.g. ld.w $w0, 16($t0)
+    std::vector< TokenType > { REGISTER, COMMA, INT, LPAREN, REGISTER, RPAREN, EOL },
+
+    // MSA_FILL: wd, rs        e.g. fill.w $w0, $t0
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, EOL },
+
+    // MSA_ELEM: wd, ws[n]     e.g. copy_s.w $t0, $w1[3]
+    std::vector< TokenType > { REGISTER, COMMA, REGISTER, LBRACKET, INT, RBRACKET, EOL },
 };
 
 const std::unordered_map<std::string, uint8_t> REG_TABLE = {
@@ -267,6 +389,23 @@ const char * REGISTER_NAMES[32] = {
     "$ra"    // 31
 };
 
+// $w0..$w31 -> 0..31; -1 for anything else
+inline int vector_register_index(const std::string & name)
+{
+    if (name.size() < 3 || name.size() > 4 || name[0] != '$' || name[1] != 'w')
+        return -1;
+    int n = 0;
+    for (std::size_t i = 2; i < name.size(); ++i)
+    {
+        if (name[i] < '0' || name[i] > '9')
+            return -1;
+        n = n * 10 + (name[i] - '0');
+    }
+    if (name.size() == 4 && name[2] == '0')
+        return -1; // no "$w05"
+    return n < 32 ? n : -1;
+}
+
 inline const std::unordered_map<std::string, InstrInfo> INSTR_TABLE = {
     //==========================================================
     // R-type arithmetic / logical: rd, rs, rt   (R3)
@@ -283,12 +422,38 @@ inline const std::unordered_map<std::string, InstrInfo> INSTR_TABLE = {
     { "sltu",  { R3,      OP_RTYPE, FUNCT_SLTU  } },
     { "seq",   { R3,      OP_RTYPE, FUNCT_SEQ   } }, // pseudo-ish set-equal
 
+    // conditional moves: rd, rs, rt
+    { "movz",  { R3,      OP_RTYPE, FUNCT_MOVZ  } },
+    { "movn",  { R3,      OP_RTYPE, FUNCT_MOVN  } },
+
+    // three-operand multiply (SPECIAL2): rd, rs, rt
+    { "mul",   { R3,      OP_SPECIAL2, static_cast<Funct>(S2_MUL) } },
+
     // Multiply / divide to hi/lo
     { "mult",  { R_HILO2, OP_RTYPE, FUNCT_MULT  } },
     { "multu", { R_HILO2, OP_RTYPE, FUNCT_MULTU } },
     { "div",   { R_HILO2, OP_RTYPE, FUNCT_DIV   } },
     { "divu",  { R_HILO2, OP_RTYPE, FUNCT_DIVU  } },
 
+    // Multiply-accumulate into hi/lo (SPECIAL2)
+    { "madd",  { R_HILO2, OP_SPECIAL2, static_cast<Funct>(S2_MADD)  } },
+    { "maddu", { R_HILO2, OP_SPECIAL2, static_cast<Funct>(S2_MADDU) } },
+    { "msub",  { R_HILO2, OP_SPECIAL2, static_cast<Funct>(S2_MSUB)  } },
+    { "msubu", { R_HILO2, OP_SPECIAL2, static_cast<Funct>(S2_MSUBU) } },
+
+    // Count leading zeros/ones (SPECIAL2): rd, rs
+    { "clz",   { R2,      OP_SPECIAL2, static_cast<Funct>(S2_CLZ) } },
+    { "clo",   { R2,      OP_SPECIAL2, static_cast<Funct>(S2_CLO) } },
+
+    // Byte shuffles (SPECIAL3 BSHFL): rd, rt. funct holds the sub-op.
+    { "wsbh",  { R2_BSHFL, OP_SPECIAL3, static_cast<Funct>(BSHFL_WSBH) } },
+    { "seb",   { R2_BSHFL, OP_SPECIAL3, static_cast<Funct>(BSHFL_SEB)  } },
+    { "seh",   { R2_BSHFL, OP_SPECIAL3, static_cast<Funct>(BSHFL_SEH)  } },
+
+    // Bit-field extract/insert (SPECIAL3): rt, rs, pos, size
+    { "ext",   { EXT_INS, OP_SPECIAL3, static_cast<Funct>(S3_EXT) } },
+    { "ins",   { EXT_INS, OP_SPECIAL3, static_cast<Funct>(S3_INS) } },
+
     // Moves to/from hi/lo (one register operand)
     { "mfhi",  { R_HILO1,      OP_RTYPE, FUNCT_MFHI  } },
     { "mflo",  { R_HILO1,      OP_RTYPE, FUNCT_MFLO  } },
@@ -302,6 +467,9 @@ inline const std::unordered_map<std::string, InstrInfo> INSTR_TABLE = {
     { "srl",   { RSHIFT,  OP_RTYPE, FUNCT_SRL   } },
     { "sra",   { RSHIFT,  OP_RTYPE, FUNCT_SRA   } },
 
+    // rotate right: srl encoding with rs = 1
+    { "rotr",  { RROTATE, OP_RTYPE, FUNCT_SRL   } },
+
     // Variable shifts: rd, rs, rt   (you may later give them their own type)
     { "sllv",  { R3,      OP_RTYPE, FUNCT_SLLV  } },
     { "srlv",  { R3,      OP_RTYPE, FUNCT_SRLV  } },
@@ -360,14 +528,61 @@ inline const std::unordered_map<std::string, InstrInfo> INSTR_TABLE = {
     //==========================================================
     { "j",     { JUMP,    OP_J,     FUNCT_NONE  } },
     { "jal",   { JUMP,    OP_JAL,   FUNCT_NONE  } },
+
+    //==========================================================
+    // System control (CP0)                 (COP0_MOVE, COP0_OP)
+    //==========================================================
+    { "mfc0",  { COP0_MOVE, OP_COP0, static_cast<Funct>(C0_MF)    } },
+    { "mtc0",  { COP0_MOVE, OP_COP0, static_cast<Funct>(C0_MT)    } },
+    { "tlbwr", { COP0_OP,   OP_COP0, static_cast<Funct>(C0_TLBWR) } },
+    { "tlbwi", { COP0_OP,   OP_COP0, static_cast<Funct>(C0_TLBWI) } },
+    { "tlbp",  { COP0_OP,   OP_COP0, static_cast<Funct>(C0_TLBP)  } },
+    { "eret",  { COP0_OP,   OP_COP0, static_cast<Funct>(C0_ERET)  } },
+
+    //==========================================================
+    // SIMD (MSA subset, 4 x 32-bit lanes)   (see Msa.h)
+    //==========================================================
+    { "addv.w",   { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_ADD),   msa_3r(0) } },
+    { "subv.w",   { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_ADD),   msa_3r(1) } },
+    { "mulv.w",   { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_MUL),   msa_3r(0) } },
+    { "sll.w",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_SHIFT), msa_3r(0) } },
+    { "sra.w",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_SHIFT), msa_3r(1) } },
+    { "srl.w",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_SHIFT), msa_3r(2) } },
+    { "ceq.w",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_CMP),   msa_3r(0) } },
+    { "clt_s.w",  { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_CMP),   msa_3r(2) } },
+    { "clt_u.w",  { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_CMP),   msa_3r(3) } },
+    { "cle_s.w",  { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_CMP),   msa_3r(4) } },
+    { "cle_u.w",  { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_CMP),   msa_3r(5) } },
+    { "and.v",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_VEC),   0u << 21 } },
+    { "or.v",     { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_VEC),   1u << 21 } },
+    { "nor.v",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_VEC),   2u << 21 } },
+    { "xor.v",    { MSA_3R,   OP_MSA, static_cast<Funct>(MSA_VEC),   3u << 21 } },
+    { "ld.w",     { MSA_LS,   OP_MSA, static_cast<Funct>(MSA_LD_W) } },
+    { "st.w",     { MSA_LS,   OP_MSA, static_cast<Funct>(MSA_ST_W) } },
+    { "fill.w",   { MSA_FILL, OP_MSA, static_cast<Funct>(MSA_VEC),   (0xC0u << 18) | (MSA_DF_W << 16) } },
+    { "splati.w", { MSA_ELEM, OP_MSA, static_cast<Funct>(MSA_ELM),   (0x1u << 22) | (0x30u << 16) } },
+    { "copy_s.w", { MSA_ELEM, OP_MSA, static_cast<Funct>(MSA_ELM),   (0x2u << 22) | (0x30u << 16) } },
 };
 
+// register operands of an MSA instruction in source order: 'w' for a
+// vector register, 'g' for a general register
+inline const char * msa_register_kinds(const InstrInfo & info)
+{
+    switch (info.type)
+    {
+        case MSA_3R:   return "www";
+        case MSA_LS:   return "wg";
+        case MSA_FILL: return "wg";
+        case MSA_ELEM: return ((info.bits >> 22) & 0xF) == 2 ? "gw" : "ww"; // copy_s / splati
+        default:       return "";
+    }
+}
+
 inline const std::unordered_map<std::string, PseudoType> PSEUDO_TABLE = {
     { "abs",  ABS  },
     { "neg",  NEG  },
     { "negu", NEGU },
     { "not",  NOT  },
-    { "mul",  MUL  },
 
     { "sge",  SGE  },
     { "sgt",  SGT  },
@@ -398,5 +613,8 @@ static const uint32_t STACK_BASE = DATA_LIMIT;  // bottom of stack region (just
 static const uint32_t STACK_LIMIT = 0x80000000;  // top (exclusive)
 static const uint32_t STACK_INIT = 0x7fffeffc;  // initial $sp
 
+// page granularity used when reporting/dumping memory
+static const uint32_t MEM_PAGE_SIZE = 0x1000;
+
 #endif
 
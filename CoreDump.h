@@ -0,0 +1,319 @@
+// File  : CoreDump.h
+// Author: Cole Schwandt
+//
+// Post-mortem core files for guest faults.
+// A core holds the register file, the vector registers, pc, the
+// faulting address, the ring of recently executed PCs and every mapped
+// data/stack page span.
+// Text is not stored: the inspector re-assembles the program to get
+// the code and the labels used for symbolizing.
+//
+// Layout (all integers little-endian u32):
+//   "MIPSCORE" version pc fault_pc fault_addr flags steps
+//   regs[32] hi lo
+//   vregs[32][4]                    (lane 0 first; version 2 on)
+//   reason_len reason_bytes
+//   ring_count ring_pcs...
+//   page_count { addr len bytes... }...
+
+#ifndef CORE_DUMP_H
+#define CORE_DUMP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <functional>
+#include <stdexcept>
+
+#include "Constants.h"
+#include "Memory.h"
+#include "CPU.h"
+
+class CoreDump
+{
+public:
+    static const uint32_t VERSION = 2; // 1 is read too (no vregs)
+    static const uint32_t FLAG_HAS_FAULT_ADDR = 0x1;
+
+    // a contiguous run of mapped bytes inside one page
+    struct Span
+    {
+        uint32_t addr;
+        std::vector< uint8_t > bytes;
+    };
+
+    std::string reason;
+    uint32_t pc         = 0;   // pc after the faulting fetch
+    uint32_t fault_pc   = 0;   // pc of the faulting instruction
+    uint32_t fault_addr = 0;   // memory address, if a memory fault
+    uint32_t flags      = 0;
+    uint32_t steps      = 0;   // instructions executed before the fault
+    uint32_t regs[32]   = {};
+    uint32_t hi         = 0;
+    uint32_t lo         = 0;
+    uint32_t vregs[32][4] = {};
+    std::vector< uint32_t > recent_pcs; // oldest first
+    std::vector< Span > spans;
+
+    bool has_fault_addr() const { return (flags & FLAG_HAS_FAULT_ADDR) != 0; }
+
+    //==============================================================
+    // Capture
+    //==============================================================
+    static CoreDump capture(const CPU & cpu, const std::string & why,
+                            uint32_t steps)
+    {
+        CoreDump core;
+        core.reason = why;
+        core.pc     = cpu.pc;
+        core.steps  = steps;
+
+        for (uint8_t i = 0; i < 32; ++i)
+            core.regs[i] = cpu.regs.readU(i);
+        core.hi = cpu.regs.hiU();
+        core.lo = cpu.regs.loU();
+        for (uint8_t i = 0; i < 32; ++i)
+            for (unsigned n = 0; n < 4; ++n)
+                core.vregs[i][n] = cpu.vregs.lane(i, n);
+
+        core.recent_pcs = cpu.recent_pcs();
+        core.fault_pc = core.recent_pcs.empty() ? cpu.pc
+                                                : core.recent_pcs.back();
+
+        if (cpu.mem.has_fault())
+        {
+            core.fault_addr = cpu.mem.fault_addr();
+            core.flags |= FLAG_HAS_FAULT_ADDR;
+        }
+
+        // data and stack pages only; text comes from the program
+        for (uint32_t page : cpu.mem.mapped_pages(DATA_BASE, STACK_LIMIT))
+        {
+            uint32_t first = 0, last = 0;
+            if (!cpu.mem.mapped_span(page, first, last))
+                continue;
+
+            Span span;
+            span.addr = first;
+            span.bytes.resize(last - first);
+            cpu.mem.read_block(first, span.bytes.data(), span.bytes.size());
+            core.spans.push_back(std::move(span));
+        }
+
+        return core;
+    }
+
+    //==============================================================
+    // Serialization
+    //==============================================================
+    void write(const std::string & path) const
+    {
+        std::ofstream f(path, std::ios::binary);
+        if (!f)
+            throw std::runtime_error("Could not open core file for writing: " + path);
+
+        f.write("MIPSCORE", 8);
+        put32(f, VERSION);
+        put32(f, pc);
+        put32(f, fault_pc);
+        put32(f, fault_addr);
+        put32(f, flags);
+        put32(f, steps);
+        for (uint32_t r : regs)
+            put32(f, r);
+        put32(f, hi);
+        put32(f, lo);
+        for (const auto & w : vregs)
+            for (uint32_t v : w)
+                put32(f, v);
+
+        put32(f, static_cast<uint32_t>(reason.size()));
+        f.write(reason.data(), reason.size());
+
+        put32(f, static_cast<uint32_t>(recent_pcs.size()));
+        for (uint32_t p : recent_pcs)
+            put32(f, p);
+
+        put32(f, static_cast<uint32_t>(spans.size()));
+        for (const Span & s : spans)
+        {
+            put32(f, s.addr);
+            put32(f, static_cast<uint32_t>(s.bytes.size()));
+            f.write(reinterpret_cast<const char *>(s.bytes.data()),
+                    s.bytes.size());
+        }
+
+        if (!f)
+            throw std::runtime_error("Error writing core file: " + path);
+    }
+
+    static CoreDump read(const std::string & path)
+    {
+        std::ifstream f(path, std::ios::binary);
+        if (!f)
+            throw std::runtime_error("Could not open core file: " + path);
+
+        char magic[8];
+        f.read(magic, 8);
+        if (!f || std::string(magic, 8) != "MIPSCORE")
+            throw std::runtime_error("Not a MIPS core file: " + path);
+
+        CoreDump core;
+        uint32_t version = get32(f);
+        if (version != VERSION && version != 1)
+            throw std::runtime_error("Unsupported core file version");
+
+        core.pc         = get32(f);
+        core.fault_pc   = get32(f);
+        core.fault_addr = get32(f);
+        core.flags      = get32(f);
+        core.steps      = get32(f);
+        for (uint32_t & r : core.regs)
+            r = get32(f);
+        core.hi = get32(f);
+        core.lo = get32(f);
+        if (version >= 2)
+            for (auto & w : core.vregs)
+                for (uint32_t & v : w)
+                    v = get32(f);
+
+        core.reason.resize(checked_count(f, get32(f)));
+        f.read(&core.reason[0], core.reason.size());
+
+        uint32_t n = checked_count(f, get32(f));
+        for (uint32_t i = 0; i < n; ++i)
+            core.recent_pcs.push_back(get32(f));
+
+        n = checked_count(f, get32(f));
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            Span s;
+            s.addr = get32(f);
+            s.bytes.resize(checked_count(f, get32(f)));
+            f.read(reinterpret_cast<char *>(s.bytes.data()), s.bytes.size());
+            core.spans.push_back(std::move(s));
+        }
+
+        if (!f)
+            throw std::runtime_error("Truncated core file: " + path);
+        return core;
+    }
+
+    //==============================================================
+    // Printing
+    //==============================================================
+    // symbolize maps an address to "label+0x..", source maps a text
+    // address to the assembly line that produced it ("" if unknown).
+    void print(std::ostream & out,
+               const std::function< std::string(uint32_t) > & symbolize,
+               const std::function< std::string(uint32_t) > & source) const
+    {
+        auto hex = [](uint32_t v)
+        {
+            std::ostringstream ss;
+            ss << "0x" << std::setw(8) << std::setfill('0') << std::hex << v;
+            return ss.str();
+        };
+
+        auto where = [&](uint32_t a)
+        {
+            std::string s = hex(a) + " <" + symbolize(a) + ">";
+            std::string src = source(a);
+            if (!src.empty())
+                s += "  " + src;
+            return s;
+        };
+
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "CORE\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        out << "reason     : " << reason << '\n';
+        out << "steps      : " << steps << '\n';
+        out << "fault pc   : " << where(fault_pc) << '\n';
+        if (has_fault_addr())
+            out << "fault addr : " << hex(fault_addr)
+                << " <" << symbolize(fault_addr) << ">\n";
+        out << "pc         : " << hex(pc) << '\n';
+
+        out << "\nregisters:\n";
+        for (unsigned i = 0; i < 32; ++i)
+        {
+            out << "  " << std::left << std::setw(6) << REGISTER_NAMES[i]
+                << std::right << hex(regs[i])
+                << ((i % 4 == 3) ? "\n" : "");
+        }
+        out << "  " << std::left << std::setw(6) << "$hi" << std::right << hex(hi)
+            << "  " << std::left << std::setw(6) << "$lo" << std::right << hex(lo)
+            << '\n';
+
+        // vector registers only when an MSA program left any set
+        bool vector_header = false;
+        for (unsigned i = 0; i < 32; ++i)
+        {
+            const uint32_t * w = vregs[i];
+            if ((w[0] | w[1] | w[2] | w[3]) == 0)
+                continue;
+            if (!vector_header)
+                out << "\nvector registers (lanes 0..3):\n";
+            vector_header = true;
+            out << "  $w" << std::left << std::setw(4) << i << std::right;
+            for (unsigned n = 0; n < 4; ++n)
+                out << ' ' << hex(w[n]);
+            out << '\n';
+        }
+
+        out << "\nlast " << recent_pcs.size() << " executed pcs (oldest first):\n";
+        for (uint32_t p : recent_pcs)
+            out << "  " << where(p) << '\n';
+
+        uint32_t total = 0;
+        for (const Span & s : spans)
+            total += static_cast<uint32_t>(s.bytes.size());
+        out << "\nmemory: " << spans.size() << " page span(s), "
+            << total << " byte(s)\n";
+        for (const Span & s : spans)
+        {
+            out << "  " << hex(s.addr) << " .. "
+                << hex(s.addr + static_cast<uint32_t>(s.bytes.size()))
+                << " <" << symbolize(s.addr) << ">\n";
+        }
+    }
+
+private:
+    static void put32(std::ostream & f, uint32_t v)
+    {
+        char b[4] = {
+            static_cast<char>( v        & 0xFF),
+            static_cast<char>((v >> 8)  & 0xFF),
+            static_cast<char>((v >> 16) & 0xFF),
+            static_cast<char>((v >> 24) & 0xFF)
+        };
+        f.write(b, 4);
+    }
+
+    static uint32_t get32(std::istream & f)
+    {
+        unsigned char b[4] = {0, 0, 0, 0};
+        f.read(reinterpret_cast<char *>(b), 4);
+        return  static_cast<uint32_t>(b[0])        |
+               (static_cast<uint32_t>(b[1]) << 8)  |
+               (static_cast<uint32_t>(b[2]) << 16) |
+               (static_cast<uint32_t>(b[3]) << 24);
+    }
+
+    // guard against garbage lengths in a damaged file
+    static uint32_t checked_count(std::istream & f, uint32_t n)
+    {
+        if (!f || n > (DATA_LIMIT - DATA_BASE) + (STACK_LIMIT - STACK_BASE))
+            throw std::runtime_error("Corrupt core file");
+        return n;
+    }
+};
+
+#endif // CORE_DUMP_H
@@ -0,0 +1,398 @@
+// File  : CostModel.h
+// Author: Cole Schwandt
+//
+// Predicting how many steps a batch job will take, so the batch runner
+// can start the longest jobs first (see BatchRunner.h).
+//
+// The static estimate comes from the text alone. Every backward branch,
+// and every backward j, closes a loop over [target, branch]; back edges
+// to one target (a 'continue' and the loop's own branch, say) are one
+// loop, ending at the last of them. An instruction inside d loops is
+// counted LOOP_TRIPS^d times. A loop
+// holding an input syscall (read_int, read_string, read_char) is taken
+// to run once per piece of input, so the program's estimate scales with
+// the size of each job's input.
+//
+// RunHistory is a text file of the instruction counts of earlier runs,
+// one line per program and input:
+//
+//   PROGRAM INPUT BYTES STEPS     (hashes in hex, then decimal)
+//
+// A job's prediction uses the best source available:
+//   history  an earlier run of this program on this same input
+//   program  this program's steps per input byte over earlier runs
+//   static   the static estimate
+
+#ifndef COST_MODEL_H
+#define COST_MODEL_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Constants.h"
+#include "ProgramImage.h"
+
+// 64-bit FNV-1a, continuing from 'h'
+inline uint64_t fnv1a(const void * data, std::size_t n, uint64_t h = 0xCBF29CE484222325ull)
+{
+    const uint8_t * p = static_cast<const uint8_t *>(data);
+    for (std::size_t i = 0; i < n; ++i)
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    return h;
+}
+
+inline uint64_t input_hash(const std::string & input)
+{
+    return fnv1a(input.data(), input.size());
+}
+
+//==============================================================
+// RunHistory: instruction counts of earlier runs
+//==============================================================
+class RunHistory
+{
+public:
+    struct Totals
+    {
+        uint64_t runs  = 0;
+        uint64_t bytes = 0;
+        uint64_t steps = 0;
+    };
+
+    // read 'path'; a missing file is an empty history
+    void load(const std::string & path)
+    {
+        std::ifstream f(path);
+        if (!f)
+            return;
+
+        std::string line;
+        for (int n = 1; std::getline(f, line); ++n)
+        {
+            if (line.empty() || line[0] == '#')
+                continue;
+            std::istringstream ss(line);
+            uint64_t prog = 0, input = 0;
+            Entry e;
+            if (!(ss >> std::hex >> prog >> input >> std::dec >> e.bytes >> e.steps))
+                throw std::runtime_error("history: bad line " + std::to_string(n) + " in " + path);
+            runs_[std::make_pair(prog, input)] = e;
+        }
+    }
+
+    // write to a temporary and rename it over 'path', so a concurrent
+    // batch never reads half a file
+    void save(const std::string & path) const
+    {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp);
+            if (!f)
+                throw std::runtime_error("history: cannot write " + tmp);
+            f << "# program input bytes steps\n";
+            char buf[96];
+            for (const auto & kv : runs_)
+            {
+                std::snprintf(buf, sizeof buf, "%016" PRIx64 " %016" PRIx64 " %" PRIu64 " %" PRIu64 "\n",
+                              kv.first.first, kv.first.second, kv.second.bytes, kv.second.steps);
+                f << buf;
+            }
+        }
+        if (std::rename(tmp.c_str(), path.c_str()) != 0)
+            throw std::runtime_error("history: cannot replace " + path);
+    }
+
+    void record(uint64_t prog, const std::string & input, uint64_t steps)
+    {
+        Entry & e = runs_[std::make_pair(prog, input_hash(input))];
+        e.bytes = input.size();
+        e.steps = steps;
+    }
+
+    // steps of an earlier run of 'prog' on 'input'
+    bool lookup(uint64_t prog, const std::string & input, uint64_t & steps) const
+    {
+        auto it = runs_.find(std::make_pair(prog, input_hash(input)));
+        if (it == runs_.end())
+            return false;
+        steps = it->second.steps;
+        return true;
+    }
+
+    Totals totals(uint64_t prog) const
+    {
+        Totals t;
+        for (auto it = runs_.lower_bound(std::make_pair(prog, uint64_t(0)));
+             it != runs_.end() && it->first.first == prog; ++it)
+        {
+            ++t.runs;
+            t.bytes += it->second.bytes;
+            t.steps += it->second.steps;
+        }
+        return t;
+    }
+
+    std::size_t size() const { return runs_.size(); }
+
+private:
+    struct Entry
+    {
+        uint64_t bytes = 0;
+        uint64_t steps = 0;
+    };
+
+    std::map< std::pair< uint64_t, uint64_t >, Entry > runs_;
+};
+
+//==============================================================
+// CostModel: one program's loops and job predictions
+//==============================================================
+class CostModel
+{
+public:
+    // assumed trip count of a loop whose bound is unknown
+    static constexpr unsigned LOOP_TRIPS = 10;
+    // nesting deeper than this counts as this deep
+    static constexpr unsigned MAX_DEPTH = 6;
+
+    struct Loop
+    {
+        uint32_t head;        // branch target
+        uint32_t tail;        // the backward branch
+        unsigned depth;       // 1 for an outermost loop
+        bool     reads_input;
+    };
+
+    enum Source { FROM_HISTORY, FROM_PROGRAM, FROM_STATIC };
+
+    struct Estimate
+    {
+        double steps  = 0;
+        Source source = FROM_STATIC;
+    };
+
+    explicit CostModel(const ProgramImage & image)
+    {
+        for (const auto & kv : image.labels())
+        {
+            auto it = names_.find(kv.second);
+            if (it == names_.end() || kv.first < it->second)
+                names_[kv.second] = kv.first;
+        }
+        hash_program(image);
+        find_loops(image.memory(), image.text_end());
+    }
+
+    uint64_t program_hash() const { return hash_; }
+    const std::vector< Loop > & loops() const { return loops_; }
+    double static_steps() const { return static_steps_; }
+    bool reads_input_in_loop() const { return input_loops_ != 0; }
+
+    // predicted steps of a run on 'input'. 'mean_bytes' is the mean input
+    // size of the batch: the static estimate is for an input that size.
+    Estimate predict(const std::string & input, const RunHistory & history,
+                     double mean_bytes) const
+    {
+        Estimate e;
+        uint64_t steps = 0;
+        if (history.lookup(hash_, input, steps))
+        {
+            e.steps = static_cast<double>(steps);
+            e.source = FROM_HISTORY;
+            return e;
+        }
+
+        const double bytes = static_cast<double>(input.size());
+        RunHistory::Totals t = history.totals(hash_);
+        if (t.runs != 0)
+        {
+            // +1 per run keeps an empty input from predicting nothing
+            e.steps = static_cast<double>(t.steps) * (bytes + 1) /
+                      (static_cast<double>(t.bytes) + t.runs);
+            e.source = FROM_PROGRAM;
+            return e;
+        }
+
+        e.steps = static_steps_;
+        if (input_loops_ != 0)
+            e.steps *= (bytes + 1) / (mean_bytes + 1);
+        return e;
+    }
+
+    static const char * source_name(Source s)
+    {
+        return s == FROM_HISTORY ? "history" : s == FROM_PROGRAM ? "program" : "static";
+    }
+
+    void print(std::ostream & out, const RunHistory & history) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n'
+            << "COST ESTIMATE\n"
+            << std::setw(65) << '\n' << std::setfill(' ');
+
+        char hex[24];
+        std::snprintf(hex, sizeof hex, "%016" PRIx64, hash_);
+        out << "program       : " << hex << '\n'
+            << "text          : " << instructions_ << " instruction(s), "
+            << loops_.size() << " loop(s)";
+        unsigned deepest = 0;
+        for (const Loop & l : loops_)
+            deepest = std::max(deepest, l.depth);
+        if (deepest > 1)
+            out << ", nested " << deepest << " deep";
+        out << '\n';
+
+        for (const Loop & l : loops_)
+        {
+            out << "  loop " << std::setw(16) << std::left << name_of(l.head) << std::right
+                << " 0x" << std::hex << l.head << "-0x" << l.tail << std::dec
+                << "  depth " << l.depth << (l.reads_input ? ", reads input" : "") << '\n';
+        }
+
+        out << "static        : " << std::fixed << std::setprecision(0) << static_steps_
+            << " steps" << (input_loops_ ? " at the mean input size" : "") << '\n';
+
+        RunHistory::Totals t = history.totals(hash_);
+        out << "history       : " << t.runs << " run(s)";
+        if (t.runs != 0)
+            out << ", " << std::setprecision(1)
+                << static_cast<double>(t.steps) / (static_cast<double>(t.bytes) + t.runs)
+                << " steps per input byte";
+        out << std::defaultfloat << '\n';
+    }
+
+private:
+    uint64_t hash_ = 0;
+    std::vector< Loop > loops_;
+    double   static_steps_ = 0;
+    unsigned input_loops_ = 0;
+    std::size_t instructions_ = 0;
+    std::map< uint32_t, std::string > names_; // first label by name at each address
+
+    // text words, then the initial data
+    void hash_program(const ProgramImage & image)
+    {
+        const Memory & mem = image.memory();
+        uint64_t h = fnv1a(nullptr, 0);
+        for (uint32_t pc = TEXT_BASE; pc < image.text_end(); pc += 4)
+        {
+            uint32_t w = mem.load32(pc);
+            h = fnv1a(&w, sizeof w, h);
+        }
+        std::vector< uint8_t > data(image.data_end() - DATA_BASE);
+        if (!data.empty())
+            mem.read_block(DATA_BASE, data.data(), data.size());
+        hash_ = fnv1a(data.data(), data.size(), h);
+    }
+
+    // target of a backward branch or j at 'pc'; false for anything else
+    static bool backward_target(uint32_t word, uint32_t pc, uint32_t & target)
+    {
+        const uint32_t op = word >> 26;
+        if (op == OP_BEQ || op == OP_BNE || op == OP_BLEZ || op == OP_BGTZ || op == OP_REGIMM)
+        {
+            int32_t off = static_cast<int16_t>(word & 0xFFFF);
+            target = pc + 4 + static_cast<uint32_t>(off * 4);
+        }
+        else if (op == OP_J)
+        {
+            target = ((pc + 4) & 0xF0000000u) | ((word & 0x03FFFFFFu) << 2);
+        }
+        else
+        {
+            return false;
+        }
+        return target <= pc && target >= TEXT_BASE;
+    }
+
+    // a syscall whose $v0 was just set to 5, 8 or 12 (the read calls)
+    static bool is_input_syscall(const std::vector< uint32_t > & text, std::size_t i)
+    {
+        if ((text[i] >> 26) != OP_RTYPE || (text[i] & 0x3F) != FUNCT_SYSCALL)
+            return false;
+        for (std::size_t back = 1; back <= 8 && back <= i; ++back)
+        {
+            uint32_t w = text[i - back];
+            uint32_t op = w >> 26, rs = (w >> 21) & 31, rt = (w >> 16) & 31;
+            if ((op == OP_ADDI || op == OP_ADDIU || op == OP_ORI) && rt == 2 && rs == 0)
+            {
+                uint32_t imm = w & 0xFFFF;
+                return imm == 5 || imm == 8 || imm == 12;
+            }
+        }
+        return false;
+    }
+
+    void find_loops(const Memory & mem, uint32_t text_end)
+    {
+        std::vector< uint32_t > text;
+        for (uint32_t pc = TEXT_BASE; pc < text_end; pc += 4)
+            text.push_back(mem.load32(pc));
+        instructions_ = text.size();
+
+        // loops by head, each ending at its last back edge
+        std::map< uint32_t, uint32_t > tails;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            uint32_t pc = TEXT_BASE + static_cast<uint32_t>(i) * 4, target = 0;
+            if (backward_target(text[i], pc, target))
+                tails[target] = pc; // pcs ascend: the last edge wins
+        }
+
+        // and how many cover each instruction
+        std::vector< int > delta(text.size() + 1, 0);
+        for (const auto & kv : tails)
+        {
+            loops_.push_back({ kv.first, kv.second, 0, false });
+            ++delta[(kv.first - TEXT_BASE) / 4];
+            --delta[(kv.second - TEXT_BASE) / 4 + 1];
+        }
+
+        std::vector< unsigned > depth(text.size());
+        int d = 0;
+        for (std::size_t i = 0; i < text.size(); ++i)
+        {
+            d += delta[i];
+            depth[i] = static_cast<unsigned>(d);
+            static_steps_ += std::pow(double(LOOP_TRIPS), double(std::min(depth[i], MAX_DEPTH)));
+        }
+
+        for (Loop & l : loops_)
+        {
+            std::size_t head = (l.head - TEXT_BASE) / 4, tail = (l.tail - TEXT_BASE) / 4;
+            // its depth: the loops containing it, itself included
+            unsigned outer = 0;
+            for (const Loop & o : loops_)
+                if (o.head <= l.head && o.tail >= l.tail)
+                    ++outer;
+            l.depth = outer;
+            for (std::size_t i = head; i <= tail && !l.reads_input; ++i)
+                l.reads_input = is_input_syscall(text, i);
+            if (l.reads_input)
+                ++input_loops_;
+        }
+        std::sort(loops_.begin(), loops_.end(),
+                  [](const Loop & a, const Loop & b) { return a.head < b.head || (a.head == b.head && a.tail > b.tail); });
+    }
+
+    // the label at 'addr', or "" if none
+    std::string name_of(uint32_t addr) const
+    {
+        auto it = names_.find(addr);
+        return it == names_.end() ? "" : it->second;
+    }
+};
+
+#endif // COST_MODEL_H
@@ -0,0 +1,419 @@
+// File  : Dataflow.h
+// Author: Cole Schwandt
+//
+// Dataflow-limited critical path of an executed instruction stream.
+//
+// Every register (and hi/lo) and every memory word carries a shadow
+// entry: the cycle its last producer finished and that producer's
+// position in the stream. An instruction can start once all of its
+// sources are ready and finishes one cycle later; its destinations
+// take that finish time. With unlimited units, perfect branch
+// prediction and perfect renaming (only true dependencies count), the
+// largest finish time is the critical path, and instructions divided
+// by it is the ideal ILP. The distance from each consumer back to its
+// producer goes into a log2 histogram.
+//
+// Memory is tracked per aligned word, so a byte store and a load of a
+// different byte in the same word still count as dependent. Syscalls
+// read $v0/$a0/$a1 and write $v0; memory they touch is not tracked.
+
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "mybitlib.h"
+#include "Constants.h"
+#include "RegisterFile.h"
+#include "Histogram.h"
+
+//==============================================================
+// DepOperands: registers an instruction reads and writes
+//==============================================================
+// register numbers 0..31, then HI and LO as in RegisterFile's dirty
+// mask, then the vector registers $w0..$w31 from W0. $zero is never
+// listed.
+struct DepOperands
+{
+    static const uint8_t HI = 32;
+    static const uint8_t LO = 33;
+    static const uint8_t W0 = 34;
+    static const uint8_t NUM_REGS = W0 + 32;
+
+    uint8_t src[4];
+    uint8_t dst[2];
+    uint8_t nsrc = 0;
+    uint8_t ndst = 0;
+
+    bool     load  = false;   // reads the word at mem_addr
+    bool     store = false;   // writes (part of) the word at mem_addr
+    uint32_t mem_bytes = 0;
+
+    void read(uint8_t r)  { if (r != 0) src[nsrc++] = r; }
+    void write(uint8_t r) { if (r != 0) dst[ndst++] = r; }
+};
+
+// operands of 'word'; false for words that are not instructions.
+// 'base_reg' and 'offset' are set for loads and stores.
+inline bool decode_deps(uint32_t word, DepOperands & d,
+                        uint8_t & base_reg, int32_t & offset)
+{
+    uint8_t op    = (word >> 26) & mask_bits(6);
+    uint8_t rs    = (word >> 21) & mask_bits(5);
+    uint8_t rt    = (word >> 16) & mask_bits(5);
+    uint8_t rd    = (word >> 11) & mask_bits(5);
+    uint8_t funct =  word        & mask_bits(6);
+
+    switch (op)
+    {
+        case OP_RTYPE:
+            switch (funct)
+            {
+                case FUNCT_SLL: case FUNCT_SRL: case FUNCT_SRA:
+                    d.read(rt); d.write(rd); break;
+                case FUNCT_JR:
+                    d.read(rs); break;
+                case FUNCT_JALR:
+                    d.read(rs); d.write(rd); break;
+                case FUNCT_MOVZ: case FUNCT_MOVN:
+                    // conditional: the old rd survives when not taken
+                    d.read(rs); d.read(rt); d.read(rd); d.write(rd); break;
+                case FUNCT_SYSCALL:
+                    d.read(2); d.read(4); d.read(5); d.write(2); break;
+                case FUNCT_MFHI: d.read(DepOperands::HI); d.write(rd); break;
+                case FUNCT_MFLO: d.read(DepOperands::LO); d.write(rd); break;
+                case FUNCT_MTHI: d.read(rs); d.write(DepOperands::HI); break;
+                case FUNCT_MTLO: d.read(rs); d.write(DepOperands::LO); break;
+                case FUNCT_MULT: case FUNCT_MULTU:
+                case FUNCT_DIV:  case FUNCT_DIVU:
+                    d.read(rs); d.read(rt);
+                    d.write(DepOperands::HI); d.write(DepOperands::LO);
+                    break;
+                default: // three-register ALU, variable shifts
+                    d.read(rs); d.read(rt); d.write(rd); break;
+            }
+            return true;
+
+        case OP_SPECIAL2:
+            switch (funct)
+            {
+                case S2_MUL:
+                    d.read(rs); d.read(rt); d.write(rd); break;
+                case S2_CLZ: case S2_CLO:
+                    d.read(rs); d.write(rd); break;
+                default: // madd, maddu, msub, msubu accumulate into hi/lo
+                    d.read(rs); d.read(rt);
+                    d.read(DepOperands::HI); d.read(DepOperands::LO);
+                    d.write(DepOperands::HI); d.write(DepOperands::LO);
+                    break;
+            }
+            return true;
+
+        case OP_SPECIAL3:
+            if (funct == S3_BSHFL)
+            {
+                d.read(rt); d.write(rd);
+            }
+            else
+            {
+                d.read(rs);
+                if (funct == S3_INS)
+                    d.read(rt); // ins keeps the rest of rt
+                d.write(rt);
+            }
+            return true;
+
+        case OP_REGIMM: case OP_BLEZ: case OP_BGTZ:
+            d.read(rs);
+            return true;
+
+        case OP_BEQ: case OP_BNE:
+            d.read(rs); d.read(rt);
+            return true;
+
+        case OP_J:
+            return true;
+
+        case OP_COP0:
+            if (rs == C0_MF)
+                d.write(rt);
+            else if (rs == C0_MT)
+                d.read(rt);
+            return true;
+
+        case OP_JAL:
+            d.write(31);
+            return true;
+
+        case OP_LUI:
+            d.write(rt);
+            return true;
+
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU:
+        case OP_ANDI: case OP_ORI:   case OP_XORI:
+            d.read(rs); d.write(rt);
+            return true;
+
+        case OP_LB: case OP_LBU: case OP_LH: case OP_LHU: case OP_LW:
+            d.read(rs); d.write(rt);
+            d.load = true;
+            d.mem_bytes = (op == OP_LW) ? 4 : (op == OP_LH || op == OP_LHU) ? 2 : 1;
+            base_reg = rs;
+            offset = static_cast<int16_t>(word & mask_bits(16));
+            return true;
+
+        case OP_SB: case OP_SH: case OP_SW:
+            d.read(rs); d.read(rt);
+            d.store = true;
+            d.mem_bytes = (op == OP_SW) ? 4 : (op == OP_SH) ? 2 : 1;
+            base_reg = rs;
+            offset = static_cast<int16_t>(word & mask_bits(16));
+            return true;
+
+        case OP_MSA:
+        {
+            // wt, ws and wd sit in the rt, rd and shamt fields
+            const uint8_t wt = rt;
+            const uint8_t ws = rd;
+            const uint8_t wd = (word >> 6) & mask_bits(5);
+            const uint8_t W0 = DepOperands::W0;
+            switch (funct)
+            {
+                case MSA_LD_W: case MSA_ST_W: // the base GPR is in ws
+                    d.read(ws);
+                    if (funct == MSA_LD_W)
+                    {
+                        d.write(W0 + wd);
+                        d.load = true;
+                    }
+                    else
+                    {
+                        d.read(W0 + wd);
+                        d.store = true;
+                    }
+                    d.mem_bytes = 16;
+                    base_reg = ws;
+                    offset = (static_cast<int32_t>(word << 6) >> 22) * 4;
+                    return true;
+                case MSA_ELM: // copy_s.w writes a GPR, splati.w a vector
+                    d.read(W0 + ws);
+                    d.write(((word >> 22) & mask_bits(4)) == 2 ? wd : W0 + wd);
+                    return true;
+                case MSA_VEC:
+                    if (((word >> 21) & mask_bits(5)) >= 8) // fill.w
+                    {
+                        d.read(ws);
+                        d.write(W0 + wd);
+                        return true;
+                    }
+                    [[fallthrough]]; // and.v, or.v, nor.v, xor.v
+                default:
+                    d.read(W0 + ws); d.read(W0 + wt); d.write(W0 + wd);
+                    return true;
+            }
+        }
+
+        default:
+            return false;
+    }
+}
+
+//==============================================================
+// DataflowReport
+//==============================================================
+struct DataflowReport
+{
+    uint64_t instructions = 0;
+    uint64_t critical_path = 0;  // cycles at unit latency
+    uint64_t reg_deps = 0;       // source operands fed by an earlier instruction
+    uint64_t mem_deps = 0;       // loads fed by an earlier store
+    uint64_t initial_reads = 0;  // sources still holding their initial value
+    LatencyHistogram distance;   // consumer index - producer index
+
+    double ilp() const
+    {
+        return critical_path ? static_cast<double>(instructions) / critical_path : 0.0;
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << "Dataflow\n"
+            << "  instructions   " << instructions << '\n'
+            << "  critical path  " << critical_path << " cycles\n"
+            << "  ideal ILP      " << std::fixed << std::setprecision(2) << ilp()
+            << std::defaultfloat << '\n'
+            << "  dependencies   " << reg_deps << " register, " << mem_deps
+            << " memory, " << initial_reads << " on initial values\n";
+
+        if (distance.count() == 0)
+            return;
+
+        out << "  distance       mean=" << distance.mean()
+            << "  p50<=" << distance.percentile(50)
+            << "  p90<=" << distance.percentile(90)
+            << "  max=" << distance.max() << '\n';
+
+        uint64_t peak = 0;
+        for (int k = 0; k < LatencyHistogram::NUM_BUCKETS; ++k)
+            if (distance.bucket(k) > peak) peak = distance.bucket(k);
+
+        // distances are at least 1, so bucket k is [2^k, 2^(k+1))
+        for (int k = 0; k < LatencyHistogram::NUM_BUCKETS; ++k)
+        {
+            uint64_t n = distance.bucket(k);
+            if (n == 0)
+                continue;
+
+            uint64_t lo = 1ull << k;
+            uint64_t hi = (2ull << k) - 1;
+            int bar = static_cast<int>((n * 40 + peak - 1) / peak);
+
+            std::ostringstream range;
+            range << lo;
+            if (hi != lo)
+                range << '-' << hi;
+
+            out << "  " << std::setw(13) << range.str() << " |"
+                << std::string(bar, '#') << std::string(40 - bar, ' ')
+                << "| " << n << '\n';
+        }
+    }
+};
+
+//==============================================================
+// DataflowAnalyzer
+//==============================================================
+class DataflowAnalyzer
+{
+public:
+    DataflowAnalyzer()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (Shadow & s : regs_)
+            s = Shadow();
+        pages_.clear();
+        last_page_ = nullptr;
+        last_page_num_ = UINT32_MAX;
+        report_ = DataflowReport();
+    }
+
+    // account for 'word' about to execute with register state 'regs'
+    // (called before the instruction runs, so base registers hold the
+    // values the address is formed from)
+    void observe(uint32_t word, const RegisterFile & regs)
+    {
+        DepOperands d;
+        uint8_t base = 0;
+        int32_t offset = 0;
+        if (!decode_deps(word, d, base, offset))
+            return;
+
+        const uint64_t seq = ++report_.instructions;
+        uint64_t start = 0;
+
+        for (uint8_t k = 0; k < d.nsrc; ++k)
+        {
+            const Shadow & s = regs_[d.src[k]];
+            consume(s, seq, start);
+            if (s.seq != 0)
+                ++report_.reg_deps;
+        }
+
+        Shadow * cell = nullptr;
+        uint32_t addr = 0;
+        if (d.load || d.store)
+        {
+            addr = regs.readU(base) + static_cast<uint32_t>(offset);
+            cell = &mem_cell(addr);
+            if (d.load)
+            {
+                bool fed = false;
+                // a vector load depends on each of its words
+                for (uint32_t w = 0; w < d.mem_bytes; w += 4)
+                {
+                    Shadow & c = (w == 0) ? *cell : mem_cell(addr + w);
+                    consume(c, seq, start);
+                    fed = fed || c.seq != 0;
+                }
+                if (fed)
+                    ++report_.mem_deps;
+            }
+        }
+
+        const uint64_t finish = start + 1;
+        if (finish > report_.critical_path)
+            report_.critical_path = finish;
+
+        for (uint8_t k = 0; k < d.ndst; ++k)
+            regs_[d.dst[k]] = Shadow{finish, seq};
+
+        if (d.store)
+        {
+            // a partial store leaves the rest of the word to its old
+            // producer; the word is ready when both are
+            if (d.mem_bytes < 4 && cell->ready > finish)
+                cell->seq = seq;
+            else
+                *cell = Shadow{finish, seq};
+            for (uint32_t w = 4; w < d.mem_bytes; w += 4)
+                mem_cell(addr + w) = Shadow{finish, seq};
+        }
+    }
+
+    const DataflowReport & report() const { return report_; }
+
+private:
+    struct Shadow
+    {
+        uint64_t ready = 0; // finish cycle of the last producer
+        uint64_t seq   = 0; // its position in the stream, 0 for none
+    };
+
+    static const uint32_t PAGE_WORDS = 1024; // one 4 KiB page of words
+
+    Shadow regs_[DepOperands::NUM_REGS];
+    std::unordered_map< uint32_t, std::unique_ptr< Shadow[] > > pages_;
+    Shadow * last_page_;
+    uint32_t last_page_num_;
+    DataflowReport report_;
+
+    void consume(const Shadow & s, uint64_t seq, uint64_t & start)
+    {
+        if (s.seq == 0)
+        {
+            ++report_.initial_reads;
+            return;
+        }
+        if (s.ready > start)
+            start = s.ready;
+        report_.distance.add(seq - s.seq);
+    }
+
+    // shadow entry of the word holding 'addr'; consecutive accesses
+    // to one page skip the map
+    Shadow & mem_cell(uint32_t addr)
+    {
+        uint32_t page = addr >> 12;
+        if (page != last_page_num_)
+        {
+            std::unique_ptr< Shadow[] > & p = pages_[page];
+            if (!p)
+                p.reset(new Shadow[PAGE_WORDS]);
+            last_page_ = p.get();
+            last_page_num_ = page;
+        }
+        return last_page_[(addr >> 2) & (PAGE_WORDS - 1)];
+    }
+};
+
+#endif // DATAFLOW_H
@@ -0,0 +1,136 @@
+// File  : Histogram.h
+// Author: Cole Schwandt
+//
+// Log2-bucketed latency histogram. Bucket k counts samples in
+// [2^k, 2^(k+1)) nanoseconds (bucket 0 also holds 0 ns), so adding a
+// sample is a count-leading-zeros and an increment.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <sstream>
+
+class LatencyHistogram
+{
+public:
+    static const int NUM_BUCKETS = 64;
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (auto & b : buckets_)
+            b = 0;
+        count_ = 0;
+        sum_   = 0;
+        min_   = UINT64_MAX;
+        max_   = 0;
+    }
+
+    void add(uint64_t ns)
+    {
+        int k = (ns == 0 ? 0 : 63 - __builtin_clzll(ns));
+        ++buckets_[k];
+        ++count_;
+        sum_ += ns;
+        if (ns < min_) min_ = ns;
+        if (ns > max_) max_ = ns;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t sum()   const { return sum_; }
+    uint64_t min()   const { return count_ ? min_ : 0; }
+    uint64_t max()   const { return max_; }
+    uint64_t mean()  const { return count_ ? sum_ / count_ : 0; }
+
+    // upper bound of the bucket holding the p-th percentile (0..100)
+    uint64_t percentile(double p) const
+    {
+        if (count_ == 0)
+            return 0;
+
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * count_);
+        if (rank >= count_)
+            rank = count_ - 1;
+
+        uint64_t seen = 0;
+        for (int k = 0; k < NUM_BUCKETS; ++k)
+        {
+            seen += buckets_[k];
+            if (seen > rank)
+            {
+                uint64_t hi = (k >= 63 ? UINT64_MAX : (2ull << k) - 1);
+                return hi < max_ ? hi : max_;
+            }
+        }
+        return max_;
+    }
+
+    uint64_t bucket(int k) const { return buckets_[k]; }
+
+    // human readable duration: 850ns, 12.3us, 4.56ms, 1.2s
+    static std::string format_ns(uint64_t ns)
+    {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(1);
+        if (ns < 1000)
+            ss << ns << "ns";
+        else if (ns < 1000000)
+            ss << (ns / 1e3) << "us";
+        else if (ns < 1000000000)
+            ss << (ns / 1e6) << "ms";
+        else
+            ss << (ns / 1e9) << "s";
+        return ss.str();
+    }
+
+    // one summary line plus a bar per non-empty bucket
+    void print(std::ostream & out, const std::string & title) const
+    {
+        out << std::left << std::setw(10) << title << std::right
+            << " n=" << count_;
+        if (count_ == 0)
+        {
+            out << '\n';
+            return;
+        }
+        out << "  mean=" << format_ns(mean())
+            << "  p50=" << format_ns(percentile(50))
+            << "  p99=" << format_ns(percentile(99))
+            << "  max=" << format_ns(max_) << '\n';
+
+        uint64_t peak = 0;
+        for (uint64_t b : buckets_)
+            if (b > peak) peak = b;
+
+        for (int k = 0; k < NUM_BUCKETS; ++k)
+        {
+            if (buckets_[k] == 0)
+                continue;
+
+            uint64_t lo = (k == 0 ? 0 : (1ull << k));
+            int bar = static_cast<int>((buckets_[k] * 40 + peak - 1) / peak);
+
+            out << "  >= " << std::setw(8) << format_ns(lo) << " |"
+                << std::string(bar, '#')
+                << std::string(40 - bar, ' ') << "| "
+                << buckets_[k] << '\n';
+        }
+    }
+
+private:
+    uint64_t buckets_[NUM_BUCKETS];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+#endif // HISTOGRAM_H
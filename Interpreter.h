@@ -16,11 +16,28 @@
 #include <fstream>
 #include <iomanip>
 #include <vector>
+#include <map>
+#include <chrono>
 #include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
 
 #include "Machine.h"
 #include "Lexer.h"
 #include "Parser.h"
+#include "CoreDump.h"
+#include "Histogram.h"
+#include "PhaseTimer.h"
+#include "RunStats.h"
+#include "LazyLoader.h"
+#include "ProgramImage.h"
+#include "RunControl.h"
+#include "Condition.h"
 
 /*
   Features to support (Dr. Liow list):
@@ -153,7 +170,7 @@ const char * uint_to_reg(unsigned i)
         "$fp",   // 30 (aka $s8)
         "$ra"    // 31
     };
-    return (0 <= i && i < 32) ? names[i] : "??";
+    return (i < 32) ? names[i] : "??";
 }
 
 // One assembled source line in the interactive program
@@ -175,106 +192,304 @@ public:
         : machine(), lexer(), parser(machine), line_number(1)
     {}
 
+    ~Interpreter()
+    {
+        set_timing(false);
+    }
+
+    // time lex / parse / fixup / execute / display on this thread into
+    // per-phase histograms (see PhaseTimer.h)
+    void set_timing(bool on)
+    {
+        PhaseTimers *& cur = PhaseTimers::current();
+        if (on)
+            cur = &phase_timers_;
+        else if (cur == &phase_timers_)
+            cur = nullptr;
+    }
+
+    bool timing() const { return PhaseTimers::current() == &phase_timers_; }
+
+    const PhaseTimers & phase_timers() const { return phase_timers_; }
+
+    // print token dumps while assembling (on by default for the REPL)
+    void set_verbose(bool v) { verbose_ = v; }
+
+    // write a core file to 'path' whenever run_program faults.
+    // an empty path disables core dumps.
+    void set_core_path(const std::string & path) { core_path_ = path; }
+
+    // rewrite a Prometheus text-format file at 'path' after every run.
+    // an empty path disables it.
+    void set_prometheus_path(const std::string & path) { prom_path_ = path; }
+
+    // statistics of the most recent run
+    const RunStats & last_stats() const { return last_stats_; }
+
+    // track the dataflow critical path of every run (see Dataflow.h)
+    void set_dataflow(bool on) { dataflow_on_ = on; }
+
+    // critical path of the most recent run with dataflow on
+    const DataflowReport & last_dataflow() const { return dataflow_.report(); }
+
+    // serve syscalls 100..105 (strlen, strcmp, memcpy, memset, atoi,
+    // itoa) on the host (see NativeRuntime.h and rt.s)
+    void set_native_runtime(bool on) { machine.cpu.native_runtime = on; }
+
+    // profile reuse distances of every run (see StackDistance.h)
+    void set_reuse(bool on, const ReuseConfig & cfg = ReuseConfig())
+    {
+        reuse_on_ = on;
+        reuse_.configure(cfg);
+    }
+
+    // miss-ratio curves of the most recent run with profiling on
+    const ReuseProfiler & last_reuse() const { return reuse_; }
+
+    // time every run on the out-of-order model (see OoOModel.h)
+    void set_ooo(bool on, const OoOConfig & cfg = OoOConfig())
+    {
+        ooo_on_ = on;
+        ooo_.configure(cfg);
+    }
+
+    // timing of the most recent run with the model on
+    const OoOModel & last_ooo() const { return ooo_; }
+
+    // translate guest data addresses through a TLB (see Mmu.h)
+    void set_mmu(bool on, const MmuConfig & cfg = MmuConfig())
+    {
+        mmu_on_ = on;
+        mmu_.configure(cfg);
+    }
+
+    // TLB statistics of the most recent run with the MMU on
+    const Mmu & last_mmu() const { return mmu_; }
+
+    // while the REPL waits for a line, compress pages idle for
+    // cfg.idle seconds (see PageCompression.h); off brings every page
+    // back
+    void set_compress(bool on, const CompressConfig & cfg = CompressConfig())
+    {
+        compress_on_ = on;
+        compress_cfg_ = cfg;
+        if (!on)
+            machine.mem.thaw_all();
+    }
+
+    // compress every page now, however recently used
+    std::size_t compress_now()
+    {
+        return machine.mem.compress_idle(0, compress_cfg_);
+    }
+
+    PageCompressionStats compression_stats() const
+    {
+        return machine.mem.compression_stats();
+    }
+
     void reset()
     {
         line_number = 1;
     }
 
     // interactive REPL: read lines from 'in', write output to 'out'.
+    // a console thread reads 'in' so that pause, continue, status, stop
+    // and Ctrl-C reach a running program (see RunControl.h). if the
+    // guest ends the session while that thread is blocked reading, it
+    // is left behind, so 'in' and 'out' must outlive the session.
     void repl(std::istream & in, std::ostream & out)
     {
+        std::shared_ptr< LineQueue > queue = std::make_shared< LineQueue >();
+        std::shared_ptr< RunControl > control = std::make_shared< RunControl >();
+        std::shared_ptr< std::atomic< bool > > console_done =
+            std::make_shared< std::atomic< bool > >(false);
+
+        std::thread console([&in, &out, queue, control, console_done]
+        {
+            std::string line;
+            while (std::getline(in, line) && !queue->closed())
+            {
+                bool idle = queue->idle();
+                bool busy = control->running() || !idle;
+                if (!busy || !control->command(line, out, idle))
+                    queue->push(line);
+            }
+            queue->close();
+            *console_done = true;
+        });
+
+        // the user is thinking: pack away what has gone idle. not while
+        // a guest waits for console input, which runs mid-instruction.
+        RunControl * run = control.get();
+        queue->set_idle_hook(IDLE_POLL, [this, run]
+        {
+            if (!compress_on_ || run->running())
+                return;
+            machine.mem.set_clock(session_seconds());
+            machine.mem.compress_idle(compress_cfg_.idle, compress_cfg_);
+        });
+
+        // REPL lines and guest console input come from the same queue
+        std::istream lines(queue.get());
+        std::istream * guest_in = machine.cpu.console_in;
+        machine.cpu.console_in = &lines;
+        control_ = control.get();
+
         bool quit = false;
 
         while (!quit)
         {
+            control->clear_requests();
+
             // prompt depends on current segment mode
             if (machine.in_text_mode)
                 out << "TEXT:0x" << std::hex << machine.text_cursor << " > " << std::dec;
             else
                 out << "DATA:0x" << std::hex << machine.data_cursor << " > " << std::dec;
 
+            out << std::flush;
+
             std::string line;
-            if (!std::getline(in, line))
+            if (!std::getline(lines, line))
                 break; // EOF
 
-            line = trim_copy(line);
-            if (line.empty())
-                continue;
+            machine.mem.set_clock(session_seconds());
+            process_line(line, out, quit);
+        }
 
-            // segment-switching directives first
-            if (is_cmd(line, ".text"))
-            {
-                machine.in_text_mode = true;
-                continue;
-            }
-            if (is_cmd(line, ".data"))
-            {
-                machine.in_text_mode = false;
-                continue;
-            }
+        control_ = nullptr;
+        machine.cpu.console_in = guest_in;
+        queue->close();
+        if (*console_done)
+            console.join();
+        else
+            console.detach();
+        std::cout << "exiting..." << std::endl;
+    }
+
+    // script mode: feed REPL lines and commands from 'in' with no
+    // prompts, timing every line by phase (assemble / execute /
+    // display). a latency summary is written to 'report' at the end.
+    void run_script(std::istream & in, std::ostream & out, std::ostream & report)
+    {
+        ScriptTimings timings;
+        timings_ = &timings;
 
-            // global commands (work in any segment)
-            if (is_command_line(line))
+        bool quit = false;
+        std::string line;
+        while (!quit && std::getline(in, line))
+        {
+            for (auto & ns : phase_ns_)
+                ns = 0;
+
+            auto t0 = std::chrono::steady_clock::now();
+            process_line(line, out, quit);
+            auto t1 = std::chrono::steady_clock::now();
+
+            std::string key = script_line_kind(trim_copy(line));
+            if (key.empty())
+                continue; // blank or comment-only line
+
+            uint64_t total = static_cast<uint64_t>(
+                std::chrono::duration_cast< std::chrono::nanoseconds >(t1 - t0).count());
+            timings.total.add(total);
+            timings.per_kind[key].add(total);
+            for (int p = 0; p < NUM_SCRIPT_PHASES; ++p)
             {
-                handle_command(line, out, quit);
-                continue;
+                if (phase_ns_[p] != 0)
+                    timings.phase[p].add(phase_ns_[p]);
             }
+        }
 
-            // otherwise: treat as assembly in current segment
+        timings_ = nullptr;
+        print_script_timings(timings, report);
+    }
 
-            // remember old cursors so we can roll back on error
-            uint32_t old_text_cursor = machine.text_cursor;
-            uint32_t old_data_cursor = machine.data_cursor;
+    // headless run: assemble the file and run it from TEXT_BASE.
+    // returns false if the guest faulted or livelocked.
+    bool run_file(const std::string & path, std::ostream & out)
+    {
+        load_file(path);
+        return run_program(out);
+    }
 
-            try
-            {
-                if (machine.in_text_mode)
-                {
-                    // assemble instruction(s) into text segment
-                    assemble_text_line(line);
+    // assemble a file and return the machine reset to TEXT_BASE, ready
+    // to be run (or copied) by an external engine
+    const Machine & load_image(const std::string & path)
+    {
+        load_file(path);
+        machine.mem.seal_text(); // copies share the text pages
+        machine.cpu.pc = TEXT_BASE;
+        return machine;
+    }
 
-                    // record successful text line in program history
-                    record_source_line_text(line, old_text_cursor);
+    // assemble a file into an image that any number of machines (and
+    // threads) can run without copying its text
+    std::shared_ptr< const ProgramImage > load_program_image(const std::string & path)
+    {
+        load_file(path);
 
-                    if (!machine.has_unresolved_fixups())
-                    {
-                        // run newly emitted instructions
-                        // from old_text_cursor up to new text_cursor.
-                        while (machine.cpu.pc < machine.text_cursor)
-                        {
-                            machine.cpu.step();
-                        }
-                    }
-                    else
-                    {
-                        out << "Execution paused: unresolved labels remain.\n";
-                    }
-                }
-                else // in data mode
-                {
-                    // data inserts into the data segment only
-                    assemble_data_line(line);
-                    record_source_line_data(line, old_data_cursor);
-                }
-            }
-            catch (const std::exception & e)
-            {
-                // roll back the cursor on error
-                if (machine.in_text_mode)
-                {
-                    machine.text_cursor = old_text_cursor;
-                }
-                else
-                {
-                    machine.data_cursor = old_data_cursor;
-                }
+        std::vector< ProgramImage::SourceSpan > sources;
+        for (const SourceLine & src : program_)
+        {
+            if (src.in_text && src.pc_before < src.pc_after)
+                sources.push_back({src.pc_before, src.pc_after, src.text});
+        }
+        return ProgramImage::capture(machine, std::move(sources));
+    }
 
-                out << "Error: " << e.what() << "\n";
-            }
+    // headless run of a fresh instance of 'image' on this interpreter's
+    // machine. the image must outlive the call.
+    bool run_image(const ProgramImage & image, std::ostream & out)
+    {
+        program_.clear();
+        image.instantiate(machine);
+
+        image_ = &image;
+        collector_.set_predecoded(&image.predecoded());
+        bool ok = execute_program(out);
+        collector_.set_predecoded(nullptr);
+        image_ = nullptr;
+        return ok;
+    }
 
-            quit = machine.cpu.halted;
-        }
-        std::cout << "exiting..." << std::endl;
+    // headless run of a lazily loaded file: labels and sizes come from
+    // a pre-scan and each region is assembled on its first fetch.
+    // prints how much of the text was assembled to 'report'.
+    bool run_file_lazy(const std::string & path, std::ostream & out,
+                       std::ostream & report)
+    {
+        machine.reset();
+        program_.clear();
+
+        LazyLoader lazy(machine, lexer, parser);
+        lazy.load(path);
+
+        lazy_ = &lazy;
+        machine.cpu.lazy_text = &lazy;
+        bool ok = execute_program(out);
+        machine.cpu.lazy_text = nullptr;
+        lazy_ = nullptr;
+
+        report << "lazy load: " << lazy.num_lines() << " text line(s), "
+               << lazy.regions_assembled() << " of " << lazy.num_regions()
+               << " region(s) assembled\n";
+        return ok;
+    }
+
+    // offline core inspection: assemble the program the core came from
+    // and print the core with pcs/addresses symbolized against it.
+    void inspect_core(const std::string & core_path,
+                      const std::string & program_path,
+                      std::ostream & out)
+    {
+        CoreDump core = CoreDump::read(core_path);
+        load_file(program_path);
+
+        core.print(out,
+                   [this](uint32_t a) { return machine.symbolize(a); },
+                   [this](uint32_t a) { return source_at(a); });
     }
 
     // load a file and assemble it (non-interactive loader)
@@ -286,6 +501,11 @@ public:
             throw std::runtime_error("Could not open file: " + path);
         }
 
+        // append the file to the program history and re-assemble the
+        // whole program, so relaxation sees every label
+        std::size_t old_size = program_.size();
+        bool in_text = machine.in_text_mode;
+
         std::string line;
         while (std::getline(in, line))
         {
@@ -296,52 +516,286 @@ public:
             // segment directives
             if (is_cmd(trimmed, ".text"))
             {
-                machine.in_text_mode = true;
+                in_text = true;
                 continue;
             }
             if (is_cmd(trimmed, ".data"))
             {
-                machine.in_text_mode = false;
+                in_text = false;
                 continue;
             }
 
-            // treat as assembly line
-            uint32_t old_text_cursor = machine.text_cursor;
-            uint32_t old_data_cursor = machine.data_cursor;
+            program_.push_back(SourceLine{trimmed, in_text, 0, 0});
+        }
+
+        // keep the REPL's machine state and, if everything entered so
+        // far had run, its position at the end of text
+        SessionState saved = save_session();
+        bool at_end = (saved.pc == machine.text_cursor);
 
-            try
+        try
+        {
+            rebuild_from_program(old_size);
+        }
+        catch (const std::exception &)
+        {
+            program_.resize(old_size);
+            rebuild_from_program(old_size);
+            restore_session(saved);
+            machine.cpu.pc = saved.pc;
+            throw; // let caller report the error
+        }
+
+        restore_session(saved);
+        machine.cpu.pc = at_end ? machine.text_cursor : saved.pc;
+        machine.in_text_mode = in_text;
+    }
+
+private:
+    Machine machine;
+    Lexer   lexer;
+    Parser  parser;
+    int     line_number;
+
+    // all successfully assembled source lines (in order)
+    std::vector< SourceLine > program_;
+
+    bool        verbose_ = true;
+    LazyLoader * lazy_ = nullptr; // set during run_file_lazy
+    const ProgramImage * image_ = nullptr; // set during run_image
+    std::string core_path_;
+
+    // statistics of the last run and the sum over all runs
+    RunStatsCollector collector_;
+    LivelockDetector  livelock_;
+    DataflowAnalyzer  dataflow_;
+    bool        dataflow_on_ = false;
+    OoOModel    ooo_;
+    bool        ooo_on_ = false;
+    Mmu         mmu_;
+    bool        mmu_on_ = false;
+    ReuseProfiler reuse_;
+    bool        reuse_on_ = false;
+    RunControl * control_ = nullptr; // set while repl runs
+
+    // breakpoints by address; 'break_at_' flags their text words while
+    // a run is armed
+    struct Breakpoint
+    {
+        std::string where;   // label or address as typed
+        Condition   cond;    // empty: always stop
+        uint64_t    hits = 0;
+    };
+    std::map< uint32_t, Breakpoint > breakpoints_;
+    std::vector< uint8_t > break_at_;
+    Condition   until_;            // 'run until', for one run
+    const Breakpoint * break_hit_ = nullptr;
+    bool        until_hit_ = false;
+    std::string watch_error_;
+    bool        resumable_ = false; // 'continue' picks the last run up
+    uint64_t    resume_steps_ = 0;
+    CompressConfig compress_cfg_;
+    bool        compress_on_ = false;
+    // how often a REPL waiting for a line looks for idle pages
+    static constexpr std::chrono::seconds IDLE_POLL{ 1 };
+    std::chrono::steady_clock::time_point started_ = std::chrono::steady_clock::now();
+    PhaseTimers phase_timers_;
+    RunStats    last_stats_;
+    RunStats    total_stats_;
+    uint64_t    runs_ = 0;
+    std::string prom_path_;
+
+    // registers at the last checkpoint (start of a line or run)
+    RegisterFile checkpoint_regs_;
+
+    //----------------------------------------------------------
+    // Line processing (shared by repl and run_script)
+    //----------------------------------------------------------
+    void process_line(std::string line, std::ostream & out, bool & quit)
+    {
+        line = trim_copy(line);
+        if (line.empty())
+            return;
+
+        // segment-switching directives first
+        if (is_cmd(line, ".text"))
+        {
+            machine.in_text_mode = true;
+            return;
+        }
+        if (is_cmd(line, ".data"))
+        {
+            machine.in_text_mode = false;
+            return;
+        }
+
+        // global commands (work in any segment)
+        if (is_command_line(line))
+        {
+            handle_command(line, out, quit);
+            return;
+        }
+
+        // otherwise: treat as assembly in current segment
+
+        // 'regs changed' reports what this line changes
+        checkpoint();
+
+        // remember old cursors so we can roll back on error
+        uint32_t old_text_cursor = machine.text_cursor;
+        uint32_t old_data_cursor = machine.data_cursor;
+
+        try
+        {
+            if (machine.in_text_mode)
             {
-                if (machine.in_text_mode)
+                // assemble instruction(s) into text segment
+                {
+                    PhaseScope ps(*this, PHASE_ASSEMBLE);
+                    assemble_text_line(line);
+
+                    // record successful text line in program history
+                    record_source_line_text(line, old_text_cursor);
+                }
+
+                if (!machine.has_unresolved_fixups())
                 {
-                    assemble_text_line(trimmed);
-                    record_source_line_text(trimmed, old_text_cursor);
+                    // run newly emitted instructions
+                    // from old_text_cursor up to new text_cursor.
+                    PhaseScope ps(*this, PHASE_EXECUTE);
+                    uint64_t steps = 0;
+                    if (step_guest(UINT64_MAX, steps, out) == STEP_STOPPED)
+                        out << "stopped at " << machine.symbolize(machine.cpu.pc)
+                            << " after " << steps << " steps\n";
                 }
                 else
                 {
-                    assemble_data_line(trimmed);
-                    record_source_line_data(trimmed, old_data_cursor);
+                    out << "Execution paused: unresolved labels remain.\n";
                 }
             }
-            catch (const std::exception &)
+            else // in data mode
             {
-                if (machine.in_text_mode)
-                    machine.text_cursor = old_text_cursor;
-                else
-                    machine.data_cursor = old_data_cursor;
+                // data inserts into the data segment only
+                PhaseScope ps(*this, PHASE_ASSEMBLE);
+                assemble_data_line(line);
+                record_source_line_data(line, old_data_cursor);
+            }
+        }
+        catch (const std::exception & e)
+        {
+            // roll back the cursor on error
+            if (machine.in_text_mode)
+            {
+                machine.text_cursor = old_text_cursor;
+            }
+            else
+            {
+                machine.data_cursor = old_data_cursor;
+            }
+
+            out << "Error: " << e.what() << "\n";
+        }
+
+        quit = machine.cpu.halted;
+    }
 
-                throw; // let caller report the error
+    //----------------------------------------------------------
+    // Script timing
+    //----------------------------------------------------------
+    enum ScriptPhase
+    {
+        PHASE_ASSEMBLE,   // lex + parse + emit (incl. rebuild_from_program)
+        PHASE_EXECUTE,    // cpu stepping
+        PHASE_DISPLAY,    // regs / data / stack / labels rendering
+        NUM_SCRIPT_PHASES
+    };
+
+    struct ScriptTimings
+    {
+        LatencyHistogram phase[NUM_SCRIPT_PHASES];
+        LatencyHistogram total;
+        std::map< std::string, LatencyHistogram > per_kind;
+    };
+
+    // adds the time spent in its scope to the current line's phase
+    // total; free when no script is being timed. execute and display
+    // scopes also feed the session's phase timers.
+    class PhaseScope
+    {
+    public:
+        PhaseScope(Interpreter & interp, ScriptPhase p)
+            : interp_(interp), phase_(p), active_(interp.timings_ != nullptr),
+              timer_(p == PHASE_EXECUTE ? TP_EXECUTE :
+                     p == PHASE_DISPLAY ? TP_DISPLAY : TP_NONE)
+        {
+            if (active_)
+                start_ = std::chrono::steady_clock::now();
+        }
+
+        ~PhaseScope()
+        {
+            if (active_)
+            {
+                auto d = std::chrono::steady_clock::now() - start_;
+                interp_.phase_ns_[phase_] += static_cast<uint64_t>(
+                    std::chrono::duration_cast< std::chrono::nanoseconds >(d).count());
             }
         }
+
+    private:
+        Interpreter & interp_;
+        ScriptPhase   phase_;
+        bool          active_;
+        std::chrono::steady_clock::time_point start_;
+        PhaseTimer    timer_;
+    };
+
+    ScriptTimings * timings_ = nullptr;
+    uint64_t        phase_ns_[NUM_SCRIPT_PHASES] = {};
+
+    // key used to group a script line in the per-command summary
+    std::string script_line_kind(const std::string & line) const
+    {
+        if (line.empty() || line[0] == '#')
+            return "";
+        if (is_cmd(line, ".text") || is_cmd(line, ".data"))
+            return line;
+        if (is_command_line(line))
+            return line.substr(0, line.find(' '));
+        return machine.in_text_mode ? "<text>" : "<data>";
     }
 
-private:
-    Machine machine;
-    Lexer   lexer;
-    Parser  parser;
-    int     line_number;
+    void print_script_timings(const ScriptTimings & t, std::ostream & out) const
+    {
+        static const char * names[NUM_SCRIPT_PHASES] = {
+            "assemble", "execute", "display"
+        };
 
-    // all successfully assembled source lines (in order)
-    std::vector< SourceLine > program_;
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "SCRIPT TIMING\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        t.total.print(out, "total");
+        for (int p = 0; p < NUM_SCRIPT_PHASES; ++p)
+            t.phase[p].print(out, names[p]);
+
+        out << "\nper command:\n";
+        out << std::left << std::setw(12) << "  command" << std::right
+            << std::setw(8)  << "count"
+            << std::setw(12) << "mean"
+            << std::setw(12) << "max"
+            << std::setw(12) << "total" << '\n';
+        for (const auto & kv : t.per_kind)
+        {
+            const LatencyHistogram & h = kv.second;
+            out << "  " << std::left << std::setw(10) << kv.first << std::right
+                << std::setw(8)  << h.count()
+                << std::setw(12) << LatencyHistogram::format_ns(h.mean())
+                << std::setw(12) << LatencyHistogram::format_ns(h.max())
+                << std::setw(12) << LatencyHistogram::format_ns(h.sum()) << '\n';
+        }
+    }
 
     //----------------------------------------------------------
     // Program history helpers
@@ -368,25 +822,205 @@ private:
         program_.push_back(src);
     }
 
-    void rebuild_from_program()
+    // what re-assembling the program must not throw away: the state
+    // the REPL's lines have built up by running
+    struct SessionState
     {
-        // Start from a clean machine state
-        machine.reset();
+        RegisterFile       regs;
+        VectorRegisterFile vregs;
+        Cp0                cp0;
+        uint32_t           pc;
+        uint32_t           data_cursor;
+        std::vector< std::pair< uint32_t, std::vector< uint8_t > > > spans; // data and stack
+    };
 
-        // Re-assemble every stored source line, without executing
-        for (const SourceLine & src : program_)
+    SessionState save_session() const
+    {
+        SessionState saved;
+        saved.regs        = machine.cpu.regs;
+        saved.vregs       = machine.cpu.vregs;
+        saved.cp0         = machine.cpu.cp0;
+        saved.pc          = machine.cpu.pc;
+        saved.data_cursor = machine.data_cursor;
+
+        for (uint32_t page : machine.mem.mapped_pages(DATA_BASE, STACK_LIMIT))
+        {
+            uint32_t first = 0, last = 0;
+            if (!machine.mem.mapped_span(page, first, last))
+                continue;
+            std::vector< uint8_t > bytes(last - first);
+            machine.mem.read_block(first, bytes.data(), bytes.size());
+            saved.spans.emplace_back(first, std::move(bytes));
+        }
+        return saved;
+    }
+
+    // put 'saved' back over a rebuilt machine. data lines added since
+    // the save sit at [saved.data_cursor, data_cursor) and keep their
+    // freshly assembled bytes; pc is left to the caller.
+    void restore_session(const SessionState & saved)
+    {
+        machine.cpu.regs  = saved.regs;
+        machine.cpu.vregs = saved.vregs;
+        machine.cpu.cp0   = saved.cp0;
+
+        const uint32_t fresh_lo = saved.data_cursor;
+        const uint32_t fresh_hi = std::max(machine.data_cursor, fresh_lo);
+        for (const auto & span : saved.spans)
         {
-            machine.in_text_mode = src.in_text;
+            const uint32_t lo = span.first;
+            const uint32_t hi = lo + static_cast<uint32_t>(span.second.size());
+            const uint8_t * bytes = span.second.data();
 
-            if (src.in_text)
+            if (lo < fresh_lo)
+                machine.mem.write_block(lo, bytes, std::min(hi, fresh_lo) - lo);
+            if (hi > fresh_hi)
             {
-                assemble_text_line(src.text);
+                const uint32_t from = std::max(lo, fresh_hi);
+                machine.mem.write_block(from, bytes + (from - lo), hi - from);
             }
-            else
+        }
+    }
+
+    // re-assemble the whole program history into a clean machine.
+    //
+    // data lines go first: their addresses do not depend on text. text
+    // is then relaxed: every text label is placed from the current size
+    // estimate of each line, all lines are encoded against those final
+    // addresses (shortest li/la/lw-label, long branches as an inverted
+    // branch over a j), and this repeats until no line changes size.
+    // sizes only grow (a line that once took a long form keeps it), so
+    // the loop converges. lines before 'quiet_below' were assembled
+    // (and echoed) before, so only later ones print their tokens.
+    void rebuild_from_program(std::size_t quiet_below = 0)
+    {
+        const int MAX_PASSES = 32;
+
+        // per text line: label, source without the label, tokens
+        struct TextLine
+        {
+            std::size_t src;     // index in program_
+            std::string label;
+            std::string body;
+            std::vector< Token > toks;
+            uint32_t size;       // words in the last pass
+            bool     long_form;  // sticky
+        };
+
+        std::vector< TextLine > text;
+        for (std::size_t k = 0; k < program_.size(); ++k)
+        {
+            if (!program_[k].in_text)
+                continue;
+
+            TextLine t;
+            t.src  = k;
+            t.body = program_[k].text;
+            t.label = LazyLoader::split_label(t.body);
+            if (!t.body.empty())
+                lexer.lex_core(t.toks, t.body, line_number);
+            // a line assembled before starts from its last size, so a
+            // rebuild of an unchanged program settles in one pass
+            const SourceLine & src = program_[k];
+            t.size = src.pc_after > src.pc_before
+                         ? (src.pc_after - src.pc_before) / 4u
+                         : Parser::estimate_text_size(t.toks, t.body);
+            t.long_form = false;
+            text.push_back(std::move(t));
+        }
+
+        parser.set_final_labels(true);
+        try
+        {
+            for (int pass = 0; ; ++pass)
             {
-                assemble_data_line(src.text);
+                if (pass == MAX_PASSES)
+                    throw std::runtime_error("Relaxation did not converge");
+
+                // Start from a clean machine state
+                machine.reset();
+
+                for (std::size_t k = 0; k < program_.size(); ++k)
+                {
+                    SourceLine & src = program_[k];
+                    if (src.in_text)
+                        continue;
+                    machine.in_text_mode = false;
+                    src.pc_before = machine.data_cursor;
+                    if (pass == 0 && k >= quiet_below)
+                        assemble_data_line(src.text);
+                    else
+                        assemble_data_line_quiet(src.text);
+                    src.pc_after = machine.data_cursor;
+                }
+
+                // place text labels from the current size estimates
+                uint32_t addr = TEXT_BASE;
+                for (const TextLine & t : text)
+                {
+                    if (!t.label.empty())
+                        machine.define_label(t.label, addr);
+                    addr += 4u * t.size;
+                }
+
+                machine.in_text_mode = true;
+                bool changed = false;
+                for (TextLine & t : text)
+                {
+                    SourceLine & src = program_[t.src];
+                    src.pc_before = machine.text_cursor;
+
+                    if (!t.toks.empty())
+                    {
+                        if (pass == 0 && verbose_ && t.src >= quiet_below)
+                            println_toks_detail(t.toks, t.body);
+
+                        parser.set_long_form(t.long_form);
+                        std::vector< uint32_t > words =
+                            parser.assemble_text_line(t.toks, t.body, machine.text_cursor);
+                        for (uint32_t word : words)
+                            machine.emit_text_word(word);
+
+                        t.long_form = t.long_form || parser.went_long();
+                    }
+
+                    src.pc_after = machine.text_cursor;
+                    uint32_t size = (src.pc_after - src.pc_before) / 4u;
+                    if (size != t.size)
+                    {
+                        t.size = size;
+                        changed = true;
+                    }
+                }
+
+                if (!changed)
+                    break;
             }
         }
+        catch (const std::exception &)
+        {
+            parser.set_final_labels(false);
+            parser.set_long_form(false);
+            throw;
+        }
+        parser.set_final_labels(false);
+        parser.set_long_form(false);
+    }
+
+    // source text of the line that assembled the word at 'pc'
+    std::string source_at(uint32_t pc) const
+    {
+        if (lazy_ != nullptr)
+            return lazy_->source_at(pc);
+        if (image_ != nullptr)
+            return image_->source_at(pc);
+
+        for (const SourceLine & src : program_)
+        {
+            if (src.in_text && src.pc_before <= pc && pc < src.pc_after)
+                return src.text;
+        }
+        return "";
     }
 
     void save_program(const std::string & path)
@@ -411,11 +1045,49 @@ private:
         return  is_cmd(line, "?")      ||
                 is_cmd(line, "help")   ||
                 is_cmd(line, "regs")   ||
+                is_cmd(line, "regs changed") ||
+                is_cmd(line, "vregs")  ||
                 is_cmd(line, "run")    ||
+                starts_with(line, "run until ") ||
+                is_cmd(line, "break")  ||
+                starts_with(line, "break ") ||
+                is_cmd(line, "unbreak") ||
+                starts_with(line, "unbreak ") ||
                 is_cmd(line, "reset")  ||
                 is_cmd(line, "data")   ||
                 is_cmd(line, "stack")  ||
                 is_cmd(line, "labels") ||
+                is_cmd(line, "stats")  ||
+                is_cmd(line, "dataflow")     ||
+                is_cmd(line, "dataflow on")  ||
+                is_cmd(line, "dataflow off") ||
+                is_cmd(line, "ooo")    ||
+                is_cmd(line, "ooo on") ||
+                starts_with(line, "ooo on ") ||
+                is_cmd(line, "ooo off") ||
+                is_cmd(line, "nativert on")  ||
+                is_cmd(line, "nativert off") ||
+                is_cmd(line, "timing")       ||
+                is_cmd(line, "timing on")    ||
+                is_cmd(line, "timing off")   ||
+                is_cmd(line, "timing reset") ||
+                is_cmd(line, "reuse")    ||
+                is_cmd(line, "reuse on") ||
+                starts_with(line, "reuse on ") ||
+                is_cmd(line, "reuse off") ||
+                is_cmd(line, "mmu")    ||
+                is_cmd(line, "mmu on") ||
+                starts_with(line, "mmu on ") ||
+                is_cmd(line, "mmu off") ||
+                is_cmd(line, "compress")     ||
+                is_cmd(line, "compress on")  ||
+                starts_with(line, "compress on ") ||
+                is_cmd(line, "compress off") ||
+                is_cmd(line, "compress now") ||
+                is_cmd(line, "status")   ||
+                is_cmd(line, "pause")    ||
+                is_cmd(line, "continue") ||
+                is_cmd(line, "stop")     ||
                 is_cmd(line, "save")   ||
                 starts_with(line, "read ") ||
                 starts_with(line, "load ") ||
@@ -463,16 +1135,282 @@ private:
     {
         if (is_cmd(line, "?") || is_cmd(line, "help"))
         {
+            PhaseScope ps(*this, PHASE_DISPLAY);
             print_help(out);
         }
         else if (is_cmd(line, "regs"))
         {
+            PhaseScope ps(*this, PHASE_DISPLAY);
             print_registers(out);
         }
+        else if (is_cmd(line, "regs changed"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            print_registers(out, changed_registers());
+        }
+        else if (is_cmd(line, "vregs"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            out << std::setfill('=') << std::setw(65) << '\n'
+                << "VECTOR REGISTERS (lanes 0..3)\n"
+                << std::setw(65) << '\n' << std::setfill(' ');
+            machine.cpu.vregs.print(out);
+        }
         else if (is_cmd(line, "labels"))
         {
+            PhaseScope ps(*this, PHASE_DISPLAY);
             print_labels(out);
         }
+        else if (is_cmd(line, "stats"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            if (runs_ == 0)
+                out << "No run yet.\n";
+            else
+                last_stats_.print(out);
+        }
+        else if (is_cmd(line, "dataflow on") || is_cmd(line, "dataflow off"))
+        {
+            dataflow_on_ = is_cmd(line, "dataflow on");
+            out << "Dataflow analysis " << (dataflow_on_ ? "on" : "off") << ".\n";
+        }
+        else if (is_cmd(line, "dataflow"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            if (dataflow_.report().instructions == 0)
+                out << "No dataflow run yet (use 'dataflow on', then 'run').\n";
+            else
+                dataflow_.report().print(out);
+        }
+        else if (is_cmd(line, "nativert on") || is_cmd(line, "nativert off"))
+        {
+            set_native_runtime(is_cmd(line, "nativert on"));
+            out << "Native runtime syscalls (100-105) "
+                << (machine.cpu.native_runtime ? "on" : "off") << ".\n";
+        }
+        else if (is_cmd(line, "timing on") || is_cmd(line, "timing off"))
+        {
+            set_timing(is_cmd(line, "timing on"));
+            out << "Phase timing " << (timing() ? "on" : "off") << ".\n";
+        }
+        else if (is_cmd(line, "timing reset"))
+        {
+            phase_timers_.reset();
+            out << "Phase timers cleared.\n";
+        }
+        else if (is_cmd(line, "timing"))
+        {
+            if (!timing())
+                out << "Phase timing is off ('timing on' starts it).\n";
+            phase_timers_.print(out);
+        }
+        else if (is_cmd(line, "reuse on") || starts_with(line, "reuse on ") ||
+                 is_cmd(line, "reuse off"))
+        {
+            if (is_cmd(line, "reuse off"))
+            {
+                reuse_on_ = false;
+            }
+            else
+            {
+                try
+                {
+                    ReuseConfig cfg;
+                    cfg.parse(trim_copy(line.substr(8)));
+                    set_reuse(true, cfg);
+                }
+                catch (const std::exception & e)
+                {
+                    out << e.what() << "\n";
+                    return;
+                }
+            }
+            out << "Reuse-distance profiling " << (reuse_on_ ? "on" : "off");
+            if (reuse_on_)
+            {
+                out << ", lines";
+                for (unsigned size : reuse_.config().line_sizes)
+                    out << ' ' << size;
+            }
+            out << ".\n";
+        }
+        else if (is_cmd(line, "reuse"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            if (reuse_.fetches() == 0)
+                out << "No profiled run yet (use 'reuse on', then 'run').\n";
+            else
+                reuse_.print(out);
+        }
+        else if (is_cmd(line, "ooo on") || starts_with(line, "ooo on ") ||
+                 is_cmd(line, "ooo off"))
+        {
+            if (is_cmd(line, "ooo off"))
+            {
+                ooo_on_ = false;
+            }
+            else
+            {
+                try
+                {
+                    OoOConfig cfg;
+                    cfg.parse(trim_copy(line.substr(6)));
+                    set_ooo(true, cfg);
+                }
+                catch (const std::exception & e)
+                {
+                    out << e.what() << "\n";
+                    return;
+                }
+            }
+            out << "Out-of-order model " << (ooo_on_ ? "on: " : "off.\n");
+            if (ooo_on_)
+                ooo_.config().print(out);
+        }
+        else if (is_cmd(line, "mmu on") || starts_with(line, "mmu on ") ||
+                 is_cmd(line, "mmu off"))
+        {
+            if (is_cmd(line, "mmu off"))
+            {
+                mmu_on_ = false;
+            }
+            else
+            {
+                try
+                {
+                    MmuConfig cfg;
+                    cfg.parse(trim_copy(line.substr(6)));
+                    set_mmu(true, cfg);
+                }
+                catch (const std::exception & e)
+                {
+                    out << e.what() << "\n";
+                    return;
+                }
+            }
+            out << "MMU " << (mmu_on_ ? "on: " : "off.\n");
+            if (mmu_on_)
+                mmu_.config().print(out);
+        }
+        else if (is_cmd(line, "compress on") || starts_with(line, "compress on ") ||
+                 is_cmd(line, "compress off"))
+        {
+            if (is_cmd(line, "compress off"))
+            {
+                set_compress(false);
+            }
+            else
+            {
+                try
+                {
+                    CompressConfig cfg;
+                    cfg.parse(trim_copy(line.substr(11)));
+                    set_compress(true, cfg);
+                }
+                catch (const std::exception & e)
+                {
+                    out << e.what() << "\n";
+                    return;
+                }
+            }
+            out << "Page compression " << (compress_on_ ? "on: " : "off.\n");
+            if (compress_on_)
+                compress_cfg_.print(out);
+        }
+        else if (is_cmd(line, "compress now"))
+        {
+            out << compress_now() << " page(s) compressed.\n";
+        }
+        else if (is_cmd(line, "compress"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            compression_stats().print(out);
+        }
+        else if (is_cmd(line, "continue") && resumable_)
+        {
+            checkpoint();
+            execute_program(out, true);
+        }
+        else if (is_cmd(line, "status") || is_cmd(line, "pause") ||
+                 is_cmd(line, "continue") || is_cmd(line, "stop"))
+        {
+            // a running program gets these from the console thread
+            out << "No program is running.\n";
+        }
+        else if (is_cmd(line, "break"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            print_breakpoints(out);
+        }
+        else if (starts_with(line, "break "))
+        {
+            std::string rest = trim_copy(line.substr(6));
+            std::size_t cut = rest.find(" if ");
+            std::string where = trim_copy(rest.substr(0, cut));
+            try
+            {
+                Breakpoint bp;
+                bp.where = where;
+                uint32_t addr = break_address(where);
+                if (cut != std::string::npos)
+                    bp.cond = compile_condition(rest.substr(cut + 4));
+                breakpoints_[addr] = bp;
+                out << "Breakpoint at " << machine.symbolize(addr);
+                if (!bp.cond.empty())
+                    out << " if " << bp.cond.text() << " (" << bp.cond.size() << " ops)";
+                out << ".\n";
+            }
+            catch (const std::exception & e)
+            {
+                out << e.what() << "\n";
+            }
+        }
+        else if (is_cmd(line, "unbreak"))
+        {
+            out << breakpoints_.size() << " breakpoint(s) deleted.\n";
+            breakpoints_.clear();
+        }
+        else if (starts_with(line, "unbreak "))
+        {
+            try
+            {
+                if (breakpoints_.erase(break_address(trim_copy(line.substr(8)))) == 0)
+                    out << "No breakpoint there.\n";
+            }
+            catch (const std::exception & e)
+            {
+                out << e.what() << "\n";
+            }
+        }
+        else if (starts_with(line, "run until "))
+        {
+            try
+            {
+                until_ = compile_condition(line.substr(10));
+            }
+            catch (const std::exception & e)
+            {
+                out << e.what() << "\n";
+                return;
+            }
+            run_program(out);
+        }
+        else if (is_cmd(line, "mmu"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            if (mmu_.stats().accesses == 0)
+                out << "No translated accesses yet (use 'mmu on', then 'run').\n";
+            else
+                mmu_.stats().print(out, mmu_.config());
+        }
+        else if (is_cmd(line, "ooo"))
+        {
+            PhaseScope ps(*this, PHASE_DISPLAY);
+            if (ooo_.report().instructions == 0)
+                out << "No timed run yet (use 'ooo on', then 'run').\n";
+            else
+                ooo_.report().print(out, ooo_.config());
+        }
         else if (is_cmd(line, "run"))
         {
             run_program(out);
@@ -480,14 +1418,17 @@ private:
         else if (is_cmd(line, "reset"))
         {
             machine.reset();
+            resumable_ = false;
             out << "Machine reset.\n";
         }
         else if (is_cmd(line, "data"))
         {
+            PhaseScope ps(*this, PHASE_DISPLAY);
             print_data_segment(out);
         }
         else if (is_cmd(line, "stack"))
         {
+            PhaseScope ps(*this, PHASE_DISPLAY);
             print_stack(out);
         }
         else if (is_cmd(line, "save"))
@@ -515,6 +1456,7 @@ private:
             {
                 try
                 {
+                    PhaseScope ps(*this, PHASE_ASSEMBLE);
                     load_file(filename);
                     out << "Read \"" << filename << "\".\n";
                 }
@@ -535,6 +1477,7 @@ private:
             {
                 try
                 {
+                    PhaseScope ps(*this, PHASE_ASSEMBLE);
                     load_file(filename);
                     out << "Loaded \"" << filename << "\".\n";
                 }
@@ -563,19 +1506,48 @@ private:
             << "  read \"FILE\" - read assembly file into memory\n"
             << "  load \"FILE\" - same as read\n"
             << "  regs         - show register file\n"
+            << "  regs changed - show registers the last line or run changed\n"
+            << "  vregs        - show the nonzero vector registers $w0..$w31\n"
             << "  data         - show data segment in use\n"
             << "  stack        - show stack segment in use\n"
             << "  labels       - show all currently defined labels\n"
             << "  run          - rebuild from history and run from TEXT_BASE\n"
+            << "  status       - show pc, steps and MIPS of the running program\n"
+            << "  pause/continue - hold the running program / let it go on;\n"
+            << "                 continue also resumes a run that broke or stopped\n"
+            << "  stop         - stop the running program (so does Ctrl-C)\n"
+            << "  run until EXPR - run, stopping at the first block where EXPR holds\n"
+            << "  break LABEL [if EXPR] - stop runs at LABEL (or an address)\n"
+            << "  break        - list breakpoints\n"
+            << "  unbreak [LABEL] - delete one breakpoint, or all of them\n"
+            << "  stats        - show statistics of the last run\n"
+            << "  dataflow on/off - track the critical path of later runs\n"
+            << "  dataflow     - show critical path and ILP of the last run\n"
+            << "  ooo on [K=V,...]/off - time later runs on an out-of-order core\n"
+            << "  ooo          - show IPC and stall causes of the last timed run\n"
+            << "  nativert on/off - strlen..itoa as host syscalls 100-105 (rt.s)\n"
+            << "  timing on/off/reset - time lex, parse, fixup, execute, display\n"
+            << "  timing       - show time per phase (after 'timing on')\n"
+            << "  reuse on [SIZES]/off - profile stack distances at these line sizes\n"
+            << "  reuse        - show LRU miss ratio by cache size of the last run\n"
+            << "  mmu on [K=V,...]/off - translate data addresses through a TLB\n"
+            << "  mmu          - show TLB hit rates and refill costs of the last run\n"
+            << "  compress on [idle=S,codec=lz|dedup|both]/off - pack idle pages\n"
+            << "  compress now - compress every page at once\n"
+            << "  compress     - show compressed pages and the ratio\n"
             << "  save         - save interactive program to program.s\n"
             << "  reset        - reset machine (regs, pc, cursors, memory)\n"
             << "  exit/quit    - quit interpreter\n";
     }
 
-    void print_registers(std::ostream & out) const
+    // all registers, or just those with their bit set in 'mask'
+    // (RegisterFile dirty-mask layout)
+    void print_registers(std::ostream & out,
+                         uint64_t mask = RegisterFile::ALL_DIRTY | 1u) const
     {
         out << std::setfill('=') << std::setw(65) << '\n';
-        out << "REGISTERS\n";
+        out << (mask == (RegisterFile::ALL_DIRTY | 1u) ? "REGISTERS\n"
+                                                       : "REGISTERS (changed)\n");
         out << std::setw(65) << '\n';
         out << std::setfill(' ')
             << std::setw(12) << "reg number"   << '|'
@@ -591,8 +1563,14 @@ private:
             << std::setw(13) << '\n';
         out << std::setfill(' ');
 
+        if (mask == 0)
+            out << "  (no registers changed)\n";
+
         for (unsigned int i = 0; i < 32; ++i)
         {
+            if (!(mask >> i & 1u))
+                continue;
+
             uint32_t u = machine.cpu.regs.readU(i);
             int32_t  s = machine.cpu.regs.readS(i);
 
@@ -607,6 +1585,7 @@ private:
         }
 
         // Hi register
+        if (mask >> RegisterFile::HI_BIT & 1u)
         {
             uint32_t u = machine.cpu.regs.hiU();
             int32_t  s = machine.cpu.regs.hiS();
@@ -620,6 +1599,7 @@ private:
         }
 
         // Lo register
+        if (mask >> RegisterFile::LO_BIT & 1u)
         {
             uint32_t u = machine.cpu.regs.loU();
             int32_t  s = machine.cpu.regs.loS();
@@ -656,30 +1636,320 @@ private:
         machine.print_labels(out);
     }
 
-    void run_program(std::ostream & out)
+    bool run_program(std::ostream & out)
     {
         // Rebuild machine state from stored program history,
         // then run from TEXT_BASE to current text_cursor.
-        rebuild_from_program();
+        {
+            PhaseScope ps(*this, PHASE_ASSEMBLE);
+            rebuild_from_program();
+        }
         machine.cpu.pc = TEXT_BASE;
+        checkpoint();
+        return execute_program(out);
+    }
+
+    // whole seconds since this interpreter was made: the memory clock
+    // idle pages are measured against
+    uint32_t session_seconds() const
+    {
+        return static_cast<uint32_t>(std::chrono::duration_cast< std::chrono::seconds >(
+            std::chrono::steady_clock::now() - started_).count());
+    }
+
+    void checkpoint()
+    {
+        machine.checkpoint();
+        checkpoint_regs_ = machine.cpu.regs;
+    }
+
+    // registers written since the checkpoint whose value differs from
+    // the checkpoint's
+    uint64_t changed_registers() const
+    {
+        const RegisterFile & now = machine.cpu.regs;
+        uint64_t changed = 0;
+        for (uint64_t m = now.dirty_mask(); m != 0; m &= m - 1)
+        {
+            uint8_t bit = static_cast<uint8_t>(__builtin_ctzll(m));
+            if (now.read_bit(bit) != checkpoint_regs_.read_bit(bit))
+                changed |= 1ull << bit;
+        }
+        return changed;
+    }
+
+    // why step_guest returned
+    enum StepEnd
+    {
+        STEP_DONE,     // halted, left the text or reached the step cap
+        STEP_STOPPED,  // 'stop' or Ctrl-C
+        STEP_BREAK     // a breakpoint or the 'run until' condition
+    };
+
+    bool can_step(uint64_t steps, uint64_t limit) const
+    {
+        return !machine.cpu.halted && machine.cpu.pc < machine.text_cursor && steps < limit;
+    }
+
+    // step until the guest halts, leaves the text or 'steps' reaches
+    // 'max_steps'. under the REPL (control_ set) it steps in slices:
+    // after each one the pc and count are published for 'status', and a
+    // pause or stop is honoured at the next block boundary.
+    StepEnd step_guest(uint64_t max_steps, uint64_t & steps, std::ostream & out)
+    {
+        if (!control_)
+            return step_until(max_steps, steps, false) ? STEP_BREAK : STEP_DONE;
+
+        StepEnd end = STEP_DONE;
+        control_->begin(machine.cpu.pc);
+        try
+        {
+            while (end == STEP_DONE && can_step(steps, max_steps))
+            {
+                uint64_t slice_end = std::min< uint64_t >(steps + RunControl::STEP_SLICE, max_steps);
+                if (step_until(slice_end, steps, false))
+                {
+                    end = STEP_BREAK;
+                    break;
+                }
+                control_->publish(machine.cpu.pc, steps);
+                if (!control_->yield_requested())
+                    continue;
+
+                if (step_until(max_steps, steps, true))
+                    end = STEP_BREAK;
+                else if (!control_->hold(machine.cpu.pc, steps, out))
+                    end = STEP_STOPPED;
+            }
+        }
+        catch (...)
+        {
+            control_->end();
+            throw;
+        }
+        control_->end();
+        return end;
+    }
+
+    // step while the guest can and 'steps' is below 'limit'; with
+    // 'block_end', only up to the next control transfer. true if a
+    // breakpoint or the 'run until' condition stopped it.
+    bool step_until(uint64_t limit, uint64_t & steps, bool block_end)
+    {
+        CPU & cpu = machine.cpu;
+        const bool watching = !break_at_.empty() || !until_.empty();
+        while (can_step(steps, limit))
+        {
+            const uint32_t at = cpu.pc;
+            cpu.step();
+            ++steps;
+            const bool jumped = cpu.pc != at + 4;
+            if (watching && watch_hit(jumped || (!until_.empty() && ends_block(at)), steps))
+                return true;
+            if (block_end && jumped)
+                break;
+        }
+        return false;
+    }
 
-        const uint32_t max_steps = 1000000; // safety cap to avoid infinite loops
-        uint32_t steps = 0;
+    // the word at 'at' (already executed, so never a lazy placeholder)
+    // is a branch or jump: whatever follows it starts a basic block
+    bool ends_block(uint32_t at) const
+    {
+        uint32_t bytes = 0;
+        InstrClass c = classify_instr(machine.mem.load32(at), bytes);
+        return c == IC_BRANCH || c == IC_JUMP;
+    }
 
+    // at the pc about to execute: does a breakpoint or, at a block
+    // boundary, the 'run until' condition stop the run? a condition that
+    // cannot be evaluated (a bad mem[] address) stops it too, with
+    // watch_error_ saying why.
+    bool watch_hit(bool block_start, uint64_t steps)
+    {
+        const CPU & cpu = machine.cpu;
         try
         {
-            while (!machine.cpu.halted &&            // <-- new
-                   machine.cpu.pc < machine.text_cursor &&
-                   steps < max_steps)
+            if (block_start && !until_.empty() &&
+                until_.eval(cpu.regs, machine.mem, cpu.pc, steps))
+            {
+                until_hit_ = true;
+                return true;
+            }
+
+            const uint32_t word = (cpu.pc - TEXT_BASE) >> 2;
+            if (cpu.pc < TEXT_BASE || word >= break_at_.size() || !break_at_[word])
+                return false;
+            Breakpoint & bp = breakpoints_.at(cpu.pc);
+            if (bp.cond.empty() || bp.cond.eval(cpu.regs, machine.mem, cpu.pc, steps))
+            {
+                ++bp.hits;
+                break_hit_ = &bp;
+                return true;
+            }
+        }
+        catch (const std::exception & e)
+        {
+            watch_error_ = e.what();
+            return true;
+        }
+        return false;
+    }
+
+    // flag the text words holding breakpoints, for one run
+    void arm_breakpoints()
+    {
+        break_at_.clear();
+        break_hit_ = nullptr;
+        until_hit_ = false;
+        watch_error_.clear();
+        if (breakpoints_.empty() || machine.text_cursor <= TEXT_BASE)
+            return;
+        break_at_.assign((machine.text_cursor - TEXT_BASE) / 4, 0);
+        for (const auto & kv : breakpoints_)
+        {
+            uint32_t word = (kv.first - TEXT_BASE) / 4;
+            if (word < break_at_.size())
+                break_at_[word] = 1;
+        }
+    }
+
+    // the text address a 'break' or 'unbreak' names: a label or a
+    // number. throws if it is not an instruction address.
+    uint32_t break_address(const std::string & where) const
+    {
+        if (where.empty())
+            throw std::runtime_error("break: expected a label or an address");
+
+        uint32_t addr = 0;
+        if (std::isdigit(static_cast<unsigned char>(where[0])))
+        {
+            try
+            {
+                std::size_t used = 0;
+                addr = static_cast<uint32_t>(std::stoul(where, &used, 0));
+                if (used != where.size())
+                    throw std::invalid_argument(where);
+            }
+            catch (const std::logic_error &)
             {
-                machine.cpu.step();
-                ++steps;
+                throw std::runtime_error("break: bad address " + where);
             }
+        }
+        else if (machine.has_label(where))
+        {
+            addr = machine.lookup_label(where);
+        }
+        else
+        {
+            throw std::runtime_error("break: unknown label " + where);
+        }
+
+        if (!Memory::is_text(addr) || (addr & 3))
+            throw std::runtime_error("break: " + where + " is not an instruction address");
+        return addr;
+    }
+
+    Condition compile_condition(const std::string & text) const
+    {
+        return Condition::compile(trim_copy(text),
+            [this](const std::string & name, uint32_t & addr)
+            {
+                if (!machine.has_label(name))
+                    return false;
+                addr = machine.lookup_label(name);
+                return true;
+            });
+    }
+
+    void print_breakpoints(std::ostream & out) const
+    {
+        if (breakpoints_.empty())
+        {
+            out << "No breakpoints.\n";
+            return;
+        }
+        for (const auto & kv : breakpoints_)
+        {
+            out << "  0x" << std::hex << kv.first << std::dec << "  "
+                << std::left << std::setw(16) << machine.symbolize(kv.first) << std::right;
+            if (!kv.second.cond.empty())
+                out << " if " << kv.second.cond.text();
+            out << "  (" << kv.second.hits << " hit" << (kv.second.hits == 1 ? "" : "s") << ")\n";
+        }
+    }
+
+    // run the assembled machine from its current pc to a halt, the end
+    // of text, the step cap, a breakpoint, a livelock or a fault. the
+    // REPL has no step cap, since a runaway program can be stopped
+    // there. 'resume' goes on from where the last run broke or stopped.
+    bool execute_program(std::ostream & out, bool resume = false)
+    {
+        const uint64_t max_steps = control_ ? UINT64_MAX : 1000000; // safety cap to avoid infinite loops
+        uint64_t steps = resume ? resume_steps_ : 0;
+        bool ok = true;
+
+        resumable_ = false;
+        arm_breakpoints();
+
+        collector_.set_lazy_text(machine.cpu.lazy_text);
+        collector_.begin(machine.mem, machine.cpu.pc, machine.text_cursor);
+        machine.cpu.stats = &collector_;
+        livelock_.reset();
+        machine.cpu.livelock = &livelock_;
+        if (dataflow_on_)
+        {
+            dataflow_.reset();
+            machine.cpu.dataflow = &dataflow_;
+        }
+        if (ooo_on_)
+        {
+            ooo_.reset();
+            machine.cpu.ooo = &ooo_;
+        }
+        if (reuse_on_)
+        {
+            reuse_.reset();
+            machine.cpu.reuse = &reuse_;
+        }
+        if (mmu_on_)
+        {
+            mmu_.reset();
+            machine.cpu.mmu = &mmu_;
+        }
+
+        try
+        {
+            PhaseScope ps(*this, PHASE_EXECUTE);
+            // a fresh run starts a block: a breakpoint on the first
+            // instruction, or a 'run until' that already holds, stops it at once
+            StepEnd end = (!resume && can_step(steps, max_steps) && watch_hit(true, steps))
+                ? STEP_BREAK : step_guest(max_steps, steps, out);
+            collector_.finish(machine.cpu.pc, false);
 
             if (machine.cpu.halted)
             {
                 out << "Program halted after " << steps << " steps.\n";
             }
+            else if (end == STEP_STOPPED)
+            {
+                out << "run: stopped at " << machine.symbolize(machine.cpu.pc)
+                    << " after " << steps << " steps\n";
+            }
+            else if (end == STEP_BREAK)
+            {
+                if (!watch_error_.empty())
+                    out << "break: condition failed at " << machine.symbolize(machine.cpu.pc)
+                        << ": " << watch_error_ << "\n";
+                else if (until_hit_)
+                    out << "run: " << until_.text() << " at " << machine.symbolize(machine.cpu.pc)
+                        << " after " << steps << " steps\n";
+                else
+                    out << "Breakpoint at " << machine.symbolize(machine.cpu.pc)
+                        << " after " << steps << " steps"
+                        << (break_hit_->cond.empty() ? "" : " (" + break_hit_->cond.text() + ")")
+                        << ".\n";
+            }
             else if (steps >= max_steps)
             {
                 out << "run: stopped after " << steps
@@ -687,9 +1957,71 @@ private:
             }
             // else: pc ran past text_cursor without halt; that’s effectively “fell off”
         }
+        catch (const LivelockError & e)
+        {
+            // the branch that closed the cycle did retire
+            collector_.finish(machine.cpu.pc, false);
+            out << "run: livelock at " << machine.symbolize(e.pc)
+                << " after " << steps + 1 << " steps\n";
+            ok = false;
+        }
         catch (const std::exception & e)
         {
+            collector_.finish(machine.cpu.recent_pcs().back(), true);
             out << "Runtime error: " << e.what() << "\n";
+            dump_core(e.what(), steps, out);
+            ok = false;
+        }
+
+        resumable_ = ok && !machine.cpu.halted && machine.cpu.pc < machine.text_cursor &&
+                     steps < max_steps;
+        resume_steps_ = steps;
+        break_at_.clear();
+        until_ = Condition();
+
+        machine.cpu.stats = nullptr;
+        machine.cpu.livelock = nullptr;
+        machine.cpu.dataflow = nullptr;
+        machine.cpu.ooo = nullptr;
+        machine.cpu.mmu = nullptr;
+        machine.cpu.reuse = nullptr;
+        last_stats_ = collector_.stats();
+        total_stats_.add(last_stats_);
+        ++runs_;
+        if (!prom_path_.empty())
+            write_prometheus();
+        return ok;
+    }
+
+    // rewrite the Prometheus file with the totals so far. written to a
+    // temporary and renamed so a scraper never sees a partial file.
+    void write_prometheus()
+    {
+        std::string tmp = prom_path_ + ".tmp";
+        {
+            std::ofstream f(tmp);
+            if (!f)
+                return;
+            total_stats_.write_prometheus(f, runs_);
+        }
+        std::rename(tmp.c_str(), prom_path_.c_str());
+    }
+
+    void dump_core(const char * why, uint64_t steps, std::ostream & out)
+    {
+        if (core_path_.empty())
+            return;
+
+        try
+        {
+            // the core format counts steps in 32 bits
+            uint32_t steps32 = static_cast<uint32_t>(std::min< uint64_t >(steps, UINT32_MAX));
+            CoreDump::capture(machine.cpu, why, steps32).write(core_path_);
+            out << "Core written to '" << core_path_ << "'.\n";
+        }
+        catch (const std::exception & e)
+        {
+            out << "Core dump failed: " << e.what() << "\n";
         }
     }
 
@@ -700,7 +2032,8 @@ private:
     {
         std::vector< Token > toks;
         lexer.lex_core(toks, line, line_number);
-        println_toks_detail(toks, line);
+        if (verbose_)
+            println_toks_detail(toks, line);
 
         uint32_t line_pc = machine.text_cursor;
 
@@ -712,11 +2045,19 @@ private:
         }
     }
 
+    void assemble_data_line_quiet(const std::string & line)
+    {
+        std::vector< Token > toks;
+        lexer.lex_core(toks, line, line_number);
+        parser.assemble_data_line(toks, line, machine.data_cursor);
+    }
+
     void assemble_data_line(const std::string & line)
     {
         std::vector< Token > toks;
         lexer.lex_core(toks, line, line_number);
-        println_toks_detail(toks, line);
+        if (verbose_)
+            println_toks_detail(toks, line);
         uint32_t line_pc = machine.data_cursor;
         parser.assemble_data_line(toks, line, line_pc);
     }
@@ -0,0 +1,294 @@
+// File  : LazyLoader.h
+// Author: Cole Schwandt
+//
+// Lazy on-demand assembly for very large (generated) programs.
+//
+// load() makes one fast pass over the file:
+//   - data lines are assembled as usual (they are small and their
+//     labels must have exact addresses)
+//   - text lines are only measured: the label prefix is recorded and
+//     the mnemonic (plus the immediate for li) gives the word count,
+//     so every text label gets its final address without encoding
+// Text is cut into regions at labels. Each region's first word is set
+// to LAZY_TEXT_WORD; the CPU (on fetch or jr/jalr) and the run stats
+// profiler call materialize() when they meet one, which runs the full
+// Lexer/Parser over that region's lines only. Control can only enter a
+// region at its start (fall-through, a branch/jump to its label, or a
+// jr to a label address), so untouched regions are never assembled.
+
+#ifndef LAZY_LOADER_H
+#define LAZY_LOADER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "Constants.h"
+#include "Memory.h"
+#include "Machine.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+class LazyLoader : public LazyText
+{
+public:
+    LazyLoader(Machine & m, Lexer & lx, Parser & p)
+        : machine(m), lexer(lx), parser(p), assembled_(0)
+    {}
+
+    // pre-scan 'path' into the (already reset) machine. text_cursor
+    // ends at the exact end of text; pc is TEXT_BASE.
+    void load(const std::string & path)
+    {
+        std::ifstream in(path);
+        if (!in)
+            throw std::runtime_error("Could not open file: " + path);
+
+        lines_.clear();
+        regions_.clear();
+        assembled_ = 0;
+
+        bool text_mode = true;
+        uint32_t cursor = machine.text_cursor;
+        uint32_t line_number = 0;
+        std::string raw;
+
+        while (std::getline(in, raw))
+        {
+            ++line_number;
+            std::string line = trim(raw);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            if (is_directive(line, ".text")) { text_mode = true;  continue; }
+            if (is_directive(line, ".data")) { text_mode = false; continue; }
+
+            if (!text_mode)
+            {
+                std::vector< Token > toks;
+                lexer.lex_core(toks, line, line_number);
+                parser.assemble_data_line(toks, line, machine.data_cursor);
+                continue;
+            }
+
+            // label prefix: a new region starts here, unless the
+            // current one has no code yet
+            std::string rest = line;
+            std::string label = split_label(rest);
+            if (!label.empty())
+            {
+                if (regions_.empty() || cursor != regions_.back().start)
+                    regions_.push_back(Region{cursor, cursor,
+                                              static_cast<uint32_t>(lines_.size()),
+                                              static_cast<uint32_t>(lines_.size()),
+                                              false});
+                machine.define_label(label, cursor);
+            }
+            else if (regions_.empty())
+            {
+                regions_.push_back(Region{cursor, cursor, 0, 0, false});
+            }
+
+            cursor += 4u * line_size(rest, line_number);
+            if (cursor > TEXT_LIMIT)
+                throw std::runtime_error("emit_text_word: text segment overflow");
+
+            lines_.push_back(Line{line, line_number});
+            regions_.back().end  = cursor;
+            regions_.back().last = static_cast<uint32_t>(lines_.size());
+        }
+
+        for (const Region & r : regions_)
+        {
+            if (r.end > r.start)
+                machine.mem.store32(r.start, LAZY_TEXT_WORD);
+        }
+
+        machine.text_cursor  = cursor;
+        machine.in_text_mode = true;
+        machine.cpu.pc       = TEXT_BASE;
+    }
+
+    bool materialize(uint32_t addr) override
+    {
+        if (regions_.empty() || addr < regions_.front().start ||
+            addr >= machine.text_cursor)
+            return false;
+
+        // last region starting at or before addr
+        auto it = std::upper_bound(regions_.begin(), regions_.end(), addr,
+                                   [](uint32_t a, const Region & r)
+                                   { return a < r.start; });
+        Region & r = *(it - 1);
+        if (r.done || addr >= r.end)
+            return false;
+        r.done = true;
+
+        uint32_t end = machine.text_cursor;
+        machine.text_cursor = r.start;
+
+        for (uint32_t i = r.first; i < r.last; ++i)
+        {
+            const Line & l = lines_[i];
+            try
+            {
+                std::vector< Token > toks;
+                lexer.lex_core(toks, l.text, l.number);
+                for (uint32_t word :
+                     parser.assemble_text_line(toks, l.text, machine.text_cursor))
+                {
+                    machine.emit_text_word(word);
+                }
+            }
+            catch (const std::exception & e)
+            {
+                machine.text_cursor = end;
+                throw std::runtime_error(std::string(e.what()) + " (line " +
+                                         std::to_string(l.number) + ": " +
+                                         l.text + ")");
+            }
+        }
+
+        uint32_t got = machine.text_cursor;
+        machine.text_cursor = end;
+        if (got != r.end)
+            throw std::runtime_error("lazy load: size mismatch in region at " +
+                                     machine.symbolize(r.start));
+
+        ++assembled_;
+        return true;
+    }
+
+    uint32_t num_regions() const { return static_cast<uint32_t>(regions_.size()); }
+    uint32_t regions_assembled() const { return assembled_; }
+    uint32_t num_lines() const { return static_cast<uint32_t>(lines_.size()); }
+
+    // source text of the line that assembled (or will assemble) 'pc'
+    std::string source_at(uint32_t pc) const
+    {
+        auto it = std::upper_bound(regions_.begin(), regions_.end(), pc,
+                                   [](uint32_t a, const Region & r)
+                                   { return a < r.start; });
+        if (it == regions_.begin())
+            return "";
+        const Region & r = *(it - 1);
+        if (pc >= r.end)
+            return "";
+
+        uint32_t a = r.start;
+        for (uint32_t i = r.first; i < r.last; ++i)
+        {
+            std::string rest = lines_[i].text;
+            split_label(rest);
+            uint32_t next = a + 4u * line_size(rest, lines_[i].number);
+            if (a <= pc && pc < next)
+                return lines_[i].text;
+            a = next;
+        }
+        return "";
+    }
+
+    // strip "label:" from the front of 'line'; returns the label or ""
+    static std::string split_label(std::string & line)
+    {
+        std::size_t k = 0;
+        while (k < line.size() && is_ident_char(line[k]))
+            ++k;
+        if (k == 0)
+            return "";
+
+        std::size_t c = k;
+        while (c < line.size() && (line[c] == ' ' || line[c] == '\t'))
+            ++c;
+        if (c >= line.size() || line[c] != ':')
+            return "";
+
+        std::string label = line.substr(0, k);
+        line = trim(line.substr(c + 1));
+        return label;
+    }
+
+private:
+    struct Line
+    {
+        std::string text;
+        uint32_t    number;
+    };
+
+    // text addresses [start, end) assembled from lines [first, last)
+    struct Region
+    {
+        uint32_t start;
+        uint32_t end;
+        uint32_t first;
+        uint32_t last;
+        bool     done;
+    };
+
+    Machine & machine;
+    Lexer   & lexer;
+    Parser  & parser;
+
+    std::vector< Line >   lines_;
+    std::vector< Region > regions_;
+    uint32_t assembled_;
+
+    static std::string trim(const std::string & s)
+    {
+        std::size_t b = s.find_first_not_of(" \t\r\n");
+        if (b == std::string::npos)
+            return "";
+        std::size_t e = s.find_last_not_of(" \t\r\n");
+        return s.substr(b, e - b + 1);
+    }
+
+    static bool is_directive(const std::string & line, const char * dir)
+    {
+        std::string first = line.substr(0, line.find_first_of(" \t#"));
+        return first == dir;
+    }
+
+    static bool is_ident_char(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.';
+    }
+
+    // words a text line (label already stripped) assembles to
+    uint32_t line_size(const std::string & rest, uint32_t line_number) const
+    {
+        if (rest.empty() || rest[0] == '#')
+            return 0;
+
+        std::string mnem = rest.substr(0, rest.find_first_of(" \t#"));
+        if (!Parser::is_pseudo(mnem))
+        {
+            // throws on an unknown mnemonic
+            InstrInfo info = Parser::get_instr_info(mnem);
+
+            // "lw rt, label" is lui + lw: every segment address needs
+            // more than 16 bits
+            if (info.type == I_LS && rest.find('(') == std::string::npos)
+                return 2;
+            return 1;
+        }
+
+        PseudoType type = Parser::get_pseudo(mnem);
+        if (type != LI)
+            return Parser::pseudo_size(type);
+
+        // li: the immediate decides between one and two words
+        std::vector< Token > toks;
+        lexer.lex_core(toks, rest, line_number);
+        for (const Token & t : toks)
+        {
+            if (t.type == INT)
+                return Parser::pseudo_size(LI, Parser::parse_imm32(t, rest));
+        }
+        throw std::runtime_error("li expects an integer operand: " + rest);
+    }
+};
+
+#endif // LAZY_LOADER_H
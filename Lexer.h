@@ -9,6 +9,7 @@
 #include <unordered_map>
 
 #include "Token.h"
+#include "PhaseTimer.h"
 
 //============================c==================================
 // Helpers
@@ -116,6 +117,7 @@ public:
     // lex a single line into tokens
     void lex_core(std::vector< Token > & toks, const std::string & s, uint32_t line_n)
     {
+        PhaseTimer timer(TP_LEX);
         size_t i = 0;
         size_t n = s.size();
 
@@ -152,6 +154,8 @@ public:
                     if (c == ',') { push_tok(COMMA, i, i+1); ++i; break; }
                     if (c == '(') { push_tok(LPAREN, i, i+1); ++i; break; }
                     if (c == ')') { push_tok(RPAREN, i, i+1); ++i; break; }
+                    if (c == '[') { push_tok(LBRACKET, i, i+1); ++i; break; }
+                    if (c == ']') { push_tok(RBRACKET, i, i+1); ++i; break; }
                     if (c == ':') { push_tok(COLON, i, i+1); ++i; break; }
 
                     // string literal
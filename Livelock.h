@@ -0,0 +1,112 @@
+// File  : Livelock.h
+// Author: Cole Schwandt
+//
+// Livelock detection by state fingerprinting.
+// The CPU samples its state whenever control goes backwards (a taken
+// backward branch or jump, including a branch to itself). A sample is
+// the pc, all registers and hi/lo, tagged with an epoch that changes on
+// every memory write, vector register write, syscall and CP0 or TLB
+// write. If the same state shows up twice within one epoch, nothing
+// outside the registers can have changed, so the program will repeat
+// that loop forever.
+//
+// Samples live in a small direct-mapped table indexed by a hash of the
+// state. A hash hit is confirmed against the stored copy, so a
+// collision can only cost a missed detection, never a false stop.
+
+#ifndef LIVELOCK_H
+#define LIVELOCK_H
+
+#include <cstdint>
+#include <stdexcept>
+
+#include "RegisterFile.h"
+
+// thrown out of CPU::step when a livelock is found
+class LivelockError : public std::runtime_error
+{
+public:
+    explicit LivelockError(uint32_t at)
+        : std::runtime_error("livelock"), pc(at)
+    {}
+
+    uint32_t pc; // target of the backward branch that closed the cycle
+};
+
+class LivelockDetector
+{
+public:
+    LivelockDetector()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (Entry & e : table_)
+            e.valid = false;
+    }
+
+    // sample the state at 'pc'; throws LivelockError on a repeat
+    void sample(uint32_t pc, const RegisterFile & regs, uint64_t epoch)
+    {
+        State s;
+        s.pc = pc;
+        for (uint8_t i = 0; i < 32; ++i)
+            s.regs[i] = regs.readU(i);
+        s.regs[32] = regs.hiU();
+        s.regs[33] = regs.loU();
+
+        uint64_t h = hash(s);
+        Entry & e = table_[h & (TABLE_SIZE - 1u)];
+
+        if (e.valid && e.hash == h && e.epoch == epoch && same(e.state, s))
+            throw LivelockError(pc);
+
+        e.valid = true;
+        e.hash  = h;
+        e.epoch = epoch;
+        e.state = s;
+    }
+
+private:
+    static const uint32_t TABLE_SIZE = 256; // power of two
+
+    struct State
+    {
+        uint32_t pc;
+        uint32_t regs[34]; // 32 GPRs, hi, lo
+    };
+
+    struct Entry
+    {
+        bool     valid;
+        uint64_t hash;
+        uint64_t epoch;
+        State    state;
+    };
+
+    Entry table_[TABLE_SIZE];
+
+    // FNV-1a over the words
+    static uint64_t hash(const State & s)
+    {
+        uint64_t h = 1469598103934665603ull;
+        h = (h ^ s.pc) * 1099511628211ull;
+        for (uint32_t r : s.regs)
+            h = (h ^ r) * 1099511628211ull;
+        return h ^ (h >> 29);
+    }
+
+    static bool same(const State & a, const State & b)
+    {
+        if (a.pc != b.pc)
+            return false;
+        for (int i = 0; i < 34; ++i)
+            if (a.regs[i] != b.regs[i])
+                return false;
+        return true;
+    }
+};
+
+#endif // LIVELOCK_H
@@ -0,0 +1,742 @@
+// File  : Lockstep.h
+// Author: Cole Schwandt
+//
+// Lockstep execution of one assembled program over many inputs.
+// K lanes share one pc. Every register is stored as a K-wide row, so
+// the common ALU instructions run for all lanes with a handful of SSE2
+// operations. Loads, stores and syscalls run per lane against the
+// lane's own memory view: a byte overlay on top of the shared program
+// image, so nothing is copied until a lane writes.
+//
+// A lane leaves the group when
+//   - its branch/jump goes somewhere other than the majority's, or
+//   - the instruction would trap for it (overflow, bad address, ...)
+// and is then finished on an ordinary scalar CPU. A lane that would
+// trap is split *before* the instruction, so the scalar CPU replays it
+// and reports exactly the fault a normal run would.
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "Constants.h"
+#include "Simd.h"
+#include "Memory.h"
+#include "CPU.h"
+#include "Machine.h"
+
+//==============================================================
+// LaneMemory: per-lane writes over a shared, read-only image
+//==============================================================
+class LaneMemory
+{
+public:
+    explicit LaneMemory(const Memory & base)
+        : base_(&base)
+    {}
+
+    uint8_t load8(uint32_t addr) const
+    {
+        if (!Memory::is_valid_address(addr))
+            throw std::runtime_error("Memory load8: address out of bounds");
+
+        auto it = writes_.find(addr);
+        if (it != writes_.end())
+            return it->second;
+        return base_->load8(addr);
+    }
+
+    void store8(uint32_t addr, uint8_t val)
+    {
+        if (!Memory::is_valid_address(addr))
+            throw std::runtime_error("Memory store8: address out of bounds");
+        writes_[addr] = val;
+    }
+
+    // big-endian; callers have already checked alignment and bounds
+    uint32_t load32(uint32_t addr) const
+    {
+        return (static_cast<uint32_t>(load8(addr))     << 24) |
+               (static_cast<uint32_t>(load8(addr + 1)) << 16) |
+               (static_cast<uint32_t>(load8(addr + 2)) <<  8) |
+                static_cast<uint32_t>(load8(addr + 3));
+    }
+
+    void store32(uint32_t addr, uint32_t val)
+    {
+        store8(addr,     static_cast<uint8_t>(val >> 24));
+        store8(addr + 1, static_cast<uint8_t>(val >> 16));
+        store8(addr + 2, static_cast<uint8_t>(val >>  8));
+        store8(addr + 3, static_cast<uint8_t>(val));
+    }
+
+    // block operations used by the string syscalls; byte by byte,
+    // since writes are an overlay
+    void read_block(uint32_t addr, uint8_t * dst, std::size_t n) const
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            dst[i] = load8(addr + static_cast<uint32_t>(i));
+    }
+
+    void write_block(uint32_t addr, const uint8_t * src, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            store8(addr + static_cast<uint32_t>(i), src[i]);
+    }
+
+    // nothing to translate
+    void probe(uint32_t, std::size_t, bool) const {}
+
+    std::size_t find_byte(uint32_t addr, uint8_t val, std::size_t max_len) const
+    {
+        for (std::size_t i = 0; i < max_len; ++i)
+        {
+            if (load8(addr + static_cast<uint32_t>(i)) == val)
+                return i;
+        }
+        return max_len;
+    }
+
+    // private full copy, for a lane that continues on a scalar CPU
+    void materialize(Memory & m) const
+    {
+        m = *base_;
+        for (const auto & kv : writes_)
+            m.store8(kv.first, kv.second);
+    }
+
+private:
+    const Memory * base_;
+    std::unordered_map< uint32_t, uint8_t > writes_;
+};
+
+//==============================================================
+// LockstepEngine
+//==============================================================
+struct LaneResult
+{
+    std::string output;
+    std::string status;             // "halted", "end of text", "step limit" or a fault
+    bool        faulted        = false;
+    bool        split          = false; // finished on the scalar path
+    uint64_t    steps          = 0;     // instructions executed by this lane
+    uint64_t    lockstep_steps = 0;     // ... of which in the group
+};
+
+class LockstepEngine
+{
+public:
+    LockstepEngine(const Machine & image,
+                   const std::vector< std::string > & inputs,
+                   uint64_t max_steps = 1000000)
+        : image_(image),
+          scratch_cpu_(scratch_mem_),
+          num_lanes_(static_cast<uint32_t>(inputs.size())),
+          stride_((static_cast<uint32_t>(inputs.size()) + 3u) & ~3u),
+          pc_(image.cpu.pc),
+          text_end_(image.text_cursor),
+          max_steps_(max_steps),
+          group_steps_(0)
+    {
+        rows_.assign(NUM_ROWS * stride_, 0);
+
+        for (uint32_t l = 0; l < num_lanes_; ++l)
+        {
+            lanes_.emplace_back(new Lane(image.mem, inputs[l]));
+            active_.push_back(l);
+        }
+
+        // every lane starts from the image's register state ($sp etc.)
+        RegisterFile init = image.cpu.regs;
+        for (uint32_t l = 0; l < num_lanes_; ++l)
+            scatter(l, init);
+    }
+
+    void run()
+    {
+        while (!active_.empty())
+        {
+            if (pc_ >= text_end_)
+            {
+                finish_group("end of text");
+                break;
+            }
+            if (group_steps_ >= max_steps_)
+            {
+                finish_group("step limit");
+                break;
+            }
+
+            uint32_t word = 0;
+            try
+            {
+                word = image_.mem.load32(pc_);
+            }
+            catch (const std::exception &)
+            {
+                // bad fetch: let each lane's scalar CPU report it
+                split_all_at(pc_);
+                break;
+            }
+
+            execute(word);
+            ++group_steps_;
+        }
+    }
+
+    uint32_t num_lanes() const { return num_lanes_; }
+
+    // instructions the group executed together
+    uint64_t group_steps() const { return group_steps_; }
+
+    LaneResult & result(uint32_t lane) { return lanes_[lane]->result; }
+
+private:
+    static const uint32_t HI_ROW   = 32;
+    static const uint32_t LO_ROW   = 33;
+    static const uint32_t NUM_ROWS = 34;
+
+    struct Lane
+    {
+        Lane(const Memory & base, const std::string & input)
+            : in(input), mem(base)
+        {}
+
+        std::istringstream in;
+        std::ostringstream out;
+        LaneMemory mem;
+        LaneResult result;
+    };
+
+    const Machine & image_;
+    Memory scratch_mem_;   // never touched: the generic path is ALU/control only
+    CPU    scratch_cpu_;
+
+    uint32_t num_lanes_;
+    uint32_t stride_;      // lanes rounded up to a multiple of 4
+    uint32_t pc_;
+    uint32_t text_end_;
+    uint64_t max_steps_;
+    uint64_t group_steps_;
+
+    std::vector< uint32_t > rows_;                 // NUM_ROWS x stride_
+    std::vector< std::unique_ptr< Lane > > lanes_;
+    std::vector< uint32_t > active_;               // lanes still in the group
+    std::vector< uint32_t > next_pc_;              // per-lane scratch
+
+    uint32_t * row(uint32_t r) { return &rows_[r * stride_]; }
+
+    //----------------------------------------------------------
+    // lane <-> RegisterFile
+    //----------------------------------------------------------
+    void gather(uint32_t lane, RegisterFile & rf)
+    {
+        for (uint8_t r = 1; r < 32; ++r)
+            rf.writeU(r, rows_[r * stride_ + lane]);
+        rf.write_hiU(rows_[HI_ROW * stride_ + lane]);
+        rf.write_loU(rows_[LO_ROW * stride_ + lane]);
+    }
+
+    void scatter(uint32_t lane, const RegisterFile & rf)
+    {
+        for (uint8_t r = 1; r < 32; ++r)
+            rows_[r * stride_ + lane] = rf.readU(r);
+        rows_[HI_ROW * stride_ + lane] = rf.hiU();
+        rows_[LO_ROW * stride_ + lane] = rf.loU();
+    }
+
+    //----------------------------------------------------------
+    // leaving the group
+    //----------------------------------------------------------
+    void finish_lane(uint32_t lane, const std::string & status, bool faulted,
+                     uint64_t steps)
+    {
+        Lane & L = *lanes_[lane];
+        L.result.status         = status;
+        L.result.faulted        = faulted;
+        L.result.steps          = steps;
+        L.result.lockstep_steps = steps;
+        L.result.output         = L.out.str();
+    }
+
+    void finish_group(const std::string & status)
+    {
+        for (uint32_t l : active_)
+            finish_lane(l, status, false, group_steps_);
+        active_.clear();
+    }
+
+    // continue 'lane' on a scalar CPU from 'pc'. 'executed' is the
+    // number of instructions the lane has already retired.
+    void split_lane(uint32_t lane, uint32_t pc, uint64_t executed)
+    {
+        Lane & L = *lanes_[lane];
+        L.result.split          = true;
+        L.result.lockstep_steps = executed;
+
+        Memory mem;
+        L.mem.materialize(mem);
+
+        CPU cpu(mem);
+        gather(lane, cpu.regs);
+        cpu.pc          = pc;
+        cpu.console_in  = &L.in;
+        cpu.console_out = &L.out;
+
+        uint64_t steps = executed;
+        try
+        {
+            while (!cpu.halted && cpu.pc < text_end_ && steps < max_steps_)
+            {
+                cpu.step();
+                ++steps;
+            }
+
+            if (cpu.halted)
+                L.result.status = "halted";
+            else if (steps >= max_steps_)
+                L.result.status = "step limit";
+            else
+                L.result.status = "end of text";
+        }
+        catch (const std::exception & e)
+        {
+            L.result.status  = e.what();
+            L.result.faulted = true;
+        }
+
+        L.result.steps  = steps;
+        L.result.output = L.out.str();
+    }
+
+    void split_all_at(uint32_t pc)
+    {
+        for (uint32_t l : active_)
+            split_lane(l, pc, group_steps_);
+        active_.clear();
+    }
+
+    // drop lanes flagged in 'gone' (indexed by lane) from the group
+    void compact(const std::vector< char > & gone)
+    {
+        std::size_t w = 0;
+        for (uint32_t l : active_)
+        {
+            if (!gone[l])
+                active_[w++] = l;
+        }
+        active_.resize(w);
+    }
+
+    // after a control instruction: keep the lanes going to the most
+    // common next pc, split the others at their own next pc
+    void converge(std::vector< char > & gone)
+    {
+        uint32_t best = 0, best_n = 0;
+        for (uint32_t l : active_)
+        {
+            if (gone[l])
+                continue;
+            uint32_t n = 0;
+            for (uint32_t m : active_)
+                if (!gone[m] && next_pc_[m] == next_pc_[l])
+                    ++n;
+            if (n > best_n)
+            {
+                best   = next_pc_[l];
+                best_n = n;
+            }
+            if (best_n * 2 > active_.size())
+                break; // clear majority already
+        }
+
+        for (uint32_t l : active_)
+        {
+            if (!gone[l] && next_pc_[l] != best)
+            {
+                split_lane(l, next_pc_[l], group_steps_ + 1);
+                gone[l] = 1;
+            }
+        }
+
+        compact(gone);
+        pc_ = best;
+    }
+
+    //----------------------------------------------------------
+    // vector ALU helpers
+    //----------------------------------------------------------
+    template < typename F >
+    void vec_rr(uint32_t rd, uint32_t rs, uint32_t rt, F f)
+    {
+        if (rd == 0)
+            return;
+        uint32_t * d = row(rd);
+        const uint32_t * a = row(rs);
+        const uint32_t * b = row(rt);
+        for (uint32_t i = 0; i < stride_; i += 4)
+            store4(d + i, f(load4(a + i), load4(b + i)));
+    }
+
+    template < typename F >
+    void vec_ri(uint32_t rt, uint32_t rs, uint32_t imm, F f)
+    {
+        if (rt == 0)
+            return;
+        uint32_t * d = row(rt);
+        const uint32_t * a = row(rs);
+        u32x4 b = splat4(imm);
+        for (uint32_t i = 0; i < stride_; i += 4)
+            store4(d + i, f(load4(a + i), b));
+    }
+
+    template < typename F >
+    void vec_shift(uint32_t rd, uint32_t rt, F f)
+    {
+        if (rd == 0)
+            return;
+        uint32_t * d = row(rd);
+        const uint32_t * a = row(rt);
+        for (uint32_t i = 0; i < stride_; i += 4)
+            store4(d + i, f(load4(a + i)));
+    }
+
+    // split (for replay) every active lane whose sign bit is set in
+    // the per-lane mask produced by 'f'
+    template < typename F >
+    void split_where(F f)
+    {
+        std::vector< char > gone(num_lanes_, 0);
+        bool any = false;
+        for (uint32_t i = 0; i < stride_; i += 4)
+        {
+            int m = signs4(f(i));
+            for (int k = 0; m != 0; ++k, m >>= 1)
+            {
+                if ((m & 1) && i + k < num_lanes_)
+                {
+                    gone[i + k] = 1;
+                    any = true;
+                }
+            }
+        }
+        if (!any)
+            return;
+
+        for (uint32_t l : active_)
+        {
+            if (gone[l])
+                split_lane(l, pc_, group_steps_);
+        }
+        compact(gone);
+    }
+
+    //----------------------------------------------------------
+    // one instruction for the whole group
+    //----------------------------------------------------------
+    void execute(uint32_t word)
+    {
+        uint32_t op    = (word >> 26) & mask_bits(6);
+        uint32_t rs    = (word >> 21) & mask_bits(5);
+        uint32_t rt    = (word >> 16) & mask_bits(5);
+        uint32_t rd    = (word >> 11) & mask_bits(5);
+        uint32_t shamt = (word >>  6) & mask_bits(5);
+        uint32_t funct =  word        & mask_bits(6);
+        uint32_t simm  = static_cast<uint32_t>(static_cast<int32_t>(
+                             static_cast<int16_t>(word & 0xFFFFu)));
+        uint32_t zimm  = word & 0xFFFFu;
+
+        switch (op)
+        {
+            case OP_RTYPE:
+                switch (funct)
+                {
+                    case FUNCT_ADDU: vec_rr(rd, rs, rt, add4); break;
+                    case FUNCT_AND:  vec_rr(rd, rs, rt, and4); break;
+                    case FUNCT_OR:   vec_rr(rd, rs, rt, or4);  break;
+                    case FUNCT_XOR:  vec_rr(rd, rs, rt, xor4); break;
+                    case FUNCT_NOR:
+                        vec_rr(rd, rs, rt, [](u32x4 a, u32x4 b)
+                               { return xor4(or4(a, b), splat4(~0u)); });
+                        break;
+                    case FUNCT_SLT:
+                        vec_rr(rd, rs, rt, [](u32x4 a, u32x4 b)
+                               { return and4(lt4(a, b), splat4(1)); });
+                        break;
+                    case FUNCT_SLTU:
+                        vec_rr(rd, rs, rt, [](u32x4 a, u32x4 b)
+                               {
+                                   u32x4 bias = splat4(0x80000000u);
+                                   return and4(lt4(xor4(a, bias), xor4(b, bias)), splat4(1));
+                               });
+                        break;
+                    case FUNCT_SEQ:
+                        vec_rr(rd, rs, rt, [](u32x4 a, u32x4 b)
+                               { return and4(eq4(a, b), splat4(1)); });
+                        break;
+
+                    case FUNCT_SLL: vec_shift(rd, rt, [=](u32x4 a) { return sll4(a, shamt); }); break;
+                    case FUNCT_SRA: vec_shift(rd, rt, [=](u32x4 a) { return sra4(a, shamt); }); break;
+                    case FUNCT_SRL:
+                        if (rs != 0) // rotr
+                        {
+                            generic(word);
+                            return;
+                        }
+                        vec_shift(rd, rt, [=](u32x4 a) { return srl4(a, shamt); });
+                        break;
+
+                    case FUNCT_ADD:
+                    {
+                        // lanes whose signed add overflows trap: replay them
+                        const uint32_t * a = row(rs);
+                        const uint32_t * b = row(rt);
+                        split_where([&](uint32_t i)
+                        {
+                            u32x4 x = load4(a + i), y = load4(b + i), r = add4(x, y);
+                            return and4(xor4(x, r), xor4(y, r));
+                        });
+                        vec_rr(rd, rs, rt, add4);
+                        break;
+                    }
+
+                    case FUNCT_SUB:
+                    {
+                        const uint32_t * a = row(rs);
+                        const uint32_t * b = row(rt);
+                        split_where([&](uint32_t i)
+                        {
+                            u32x4 x = load4(a + i), y = load4(b + i), r = sub4(x, y);
+                            return and4(xor4(x, y), xor4(x, r));
+                        });
+                        vec_rr(rd, rs, rt, sub4);
+                        break;
+                    }
+
+                    case FUNCT_SYSCALL:
+                        syscalls();
+                        return;
+
+                    default:
+                        generic(word);
+                        return;
+                }
+                pc_ += 4;
+                return;
+
+            case OP_ADDIU: vec_ri(rt, rs, simm, add4); break;
+            case OP_ANDI:  vec_ri(rt, rs, zimm, and4); break;
+            case OP_ORI:   vec_ri(rt, rs, zimm, or4);  break;
+            case OP_XORI:  vec_ri(rt, rs, zimm, xor4); break;
+            case OP_LUI:
+                vec_ri(rt, 0, zimm << 16, [](u32x4, u32x4 b) { return b; });
+                break;
+            case OP_SLTI:
+                vec_ri(rt, rs, simm, [](u32x4 a, u32x4 b)
+                       { return and4(lt4(a, b), splat4(1)); });
+                break;
+            case OP_SLTIU:
+                vec_ri(rt, rs, simm, [](u32x4 a, u32x4 b)
+                       {
+                           u32x4 bias = splat4(0x80000000u);
+                           return and4(lt4(xor4(a, bias), xor4(b, bias)), splat4(1));
+                       });
+                break;
+
+            case OP_ADDI:
+            {
+                const uint32_t * a = row(rs);
+                u32x4 y = splat4(simm);
+                split_where([&](uint32_t i)
+                {
+                    u32x4 x = load4(a + i), r = add4(x, y);
+                    return and4(xor4(x, r), xor4(y, r));
+                });
+                vec_ri(rt, rs, simm, add4);
+                break;
+            }
+
+            case OP_BEQ:
+            case OP_BNE:
+            {
+                std::vector< char > gone(num_lanes_, 0);
+                next_pc_.resize(num_lanes_);
+                const uint32_t * a = row(rs);
+                const uint32_t * b = row(rt);
+                uint32_t taken_pc = pc_ + 4 + (simm << 2);
+                for (uint32_t i = 0; i < stride_; i += 4)
+                {
+                    int eq = signs4(eq4(load4(a + i), load4(b + i)));
+                    for (uint32_t k = 0; k < 4 && i + k < num_lanes_; ++k)
+                    {
+                        bool taken = ((eq >> k) & 1) ? (op == OP_BEQ) : (op == OP_BNE);
+                        next_pc_[i + k] = taken ? taken_pc : pc_ + 4;
+                    }
+                }
+                converge(gone);
+                return;
+            }
+
+            case OP_LB:  case OP_LBU: case OP_LH: case OP_LHU: case OP_LW:
+            case OP_SB:  case OP_SH:  case OP_SW:
+                loads_stores(op, rs, rt, simm);
+                return;
+
+            // CP0 state and the vector registers are per machine; only
+            // the scalar CPU keeps them
+            case OP_COP0:
+            case OP_MSA:
+                split_all_at(pc_);
+                return;
+
+            default:
+                generic(word);
+                return;
+        }
+        pc_ += 4;
+    }
+
+    //----------------------------------------------------------
+    // per-lane paths
+    //----------------------------------------------------------
+    void loads_stores(uint32_t op, uint32_t rs, uint32_t rt, uint32_t simm)
+    {
+        uint32_t size = (op == OP_LW || op == OP_SW) ? 4u
+                      : (op == OP_LH || op == OP_LHU || op == OP_SH) ? 2u : 1u;
+        bool store = (op == OP_SB || op == OP_SH || op == OP_SW);
+
+        std::vector< char > gone(num_lanes_, 0);
+        bool any_gone = false;
+
+        for (uint32_t l : active_)
+        {
+            uint32_t addr = rows_[rs * stride_ + l] + simm;
+
+            // anything that would fault, and stores into text (which
+            // every lane fetches from the shared image), go scalar
+            bool ok = (addr & (size - 1u)) == 0 &&
+                      Memory::is_valid_address(addr) &&
+                      Memory::is_valid_address(addr + size - 1u) &&
+                      !(store && Memory::is_text(addr));
+            if (!ok)
+            {
+                split_lane(l, pc_, group_steps_);
+                gone[l] = 1;
+                any_gone = true;
+                continue;
+            }
+
+            LaneMemory & m = lanes_[l]->mem;
+            uint32_t & r   = rows_[rt * stride_ + l];
+            uint32_t v     = r;
+
+            switch (op)
+            {
+                case OP_LB:  v = static_cast<uint32_t>(static_cast<int8_t>(m.load8(addr))); break;
+                case OP_LBU: v = m.load8(addr); break;
+                case OP_LH:
+                    v = static_cast<uint32_t>(static_cast<int16_t>(
+                            (m.load8(addr) << 8) | m.load8(addr + 1)));
+                    break;
+                case OP_LHU: v = (m.load8(addr) << 8) | m.load8(addr + 1); break;
+                case OP_LW:  v = m.load32(addr); break;
+                case OP_SB:  m.store8(addr, static_cast<uint8_t>(r)); break;
+                case OP_SH:
+                    m.store8(addr,     static_cast<uint8_t>(r >> 8));
+                    m.store8(addr + 1, static_cast<uint8_t>(r));
+                    break;
+                case OP_SW:  m.store32(addr, r); break;
+            }
+
+            if (!store && rt != 0)
+                r = v;
+        }
+
+        if (any_gone)
+            compact(gone);
+        pc_ += 4;
+    }
+
+    void syscalls()
+    {
+        std::vector< char > gone(num_lanes_, 0);
+        bool any_gone = false;
+
+        for (uint32_t l : active_)
+        {
+            Lane & L = *lanes_[l];
+            RegisterFile & rf = scratch_cpu_.regs;
+            gather(l, rf);
+
+            bool halted = false;
+            try
+            {
+                CPU::do_syscall(rf, L.mem, L.in, L.out, halted);
+            }
+            catch (const std::exception & e)
+            {
+                // the service may already have produced output, so
+                // record the fault here rather than replaying it
+                finish_lane(l, e.what(), true, group_steps_ + 1);
+                gone[l] = 1;
+                any_gone = true;
+                continue;
+            }
+
+            scatter(l, rf);
+            if (halted)
+            {
+                finish_lane(l, "halted", false, group_steps_ + 1);
+                gone[l] = 1;
+                any_gone = true;
+            }
+        }
+
+        if (any_gone)
+            compact(gone);
+        pc_ += 4;
+    }
+
+    // everything else (mult/div, hi/lo, jumps, REGIMM branches, r2
+    // ops): run the real CPU::execute once per lane on a scratch CPU.
+    // none of these touch memory.
+    void generic(uint32_t word)
+    {
+        std::vector< char > gone(num_lanes_, 0);
+        next_pc_.resize(num_lanes_);
+
+        for (uint32_t l : active_)
+        {
+            scratch_cpu_.regs.reset();
+            gather(l, scratch_cpu_.regs);
+            scratch_cpu_.pc = pc_ + 4;
+
+            try
+            {
+                scratch_cpu_.execute(word);
+            }
+            catch (const std::exception &)
+            {
+                split_lane(l, pc_, group_steps_);
+                gone[l] = 1;
+                continue;
+            }
+
+            scatter(l, scratch_cpu_.regs);
+            next_pc_[l] = scratch_cpu_.pc;
+        }
+
+        if (active_.size() == 0)
+            return;
+        converge(gone);
+    }
+};
+
+#endif // LOCKSTEP_H
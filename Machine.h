@@ -9,6 +9,7 @@
 #define MACHINE_H
 
 #include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <unordered_map>
 #include <string>
@@ -16,21 +17,31 @@
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <limits>
+#include <memory_resource>
 
 #include "Constants.h"
 #include "Memory.h"
 #include "CPU.h"
+#include "PhaseTimer.h"
 
 class Machine
 {
 public:
-    Machine()
-        : mem(),
+    typedef std::pmr::unordered_map< std::string, uint32_t > LabelMap;
+
+    // memory, labels and fixups allocate from 'arena'
+    explicit Machine(std::pmr::memory_resource * arena = std::pmr::get_default_resource())
+        : mem(arena),
           cpu(mem),
           text_cursor(TEXT_BASE),
           data_cursor(DATA_BASE),
-          in_text_mode(true)
+          in_text_mode(true),
+          labels(arena),
+          branch_fixups(arena),
+          jump_fixups(arena),
+          la_fixups_(arena)
     {
         reset();
     }
@@ -42,6 +53,7 @@ public:
         
         cpu.regs.reset();
         cpu.pc = TEXT_BASE;
+        cpu.halted = false;
         
         text_cursor = TEXT_BASE;
         data_cursor = DATA_BASE;
@@ -56,6 +68,29 @@ public:
         cpu.regs.writeU(29, STACK_INIT);
     }
 
+    // start tracking changes afresh: registers, vector registers and
+    // memory pages written from here on are dirty
+    void checkpoint()
+    {
+        cpu.regs.clear_dirty();
+        cpu.vregs.clear_dirty();
+        mem.clear_dirty();
+    }
+
+    // reset, then give every container's storage back to the arena.
+    // afterwards the arena may be released; nothing points into it.
+    void drop_storage()
+    {
+        reset();
+        mem.drop_storage();
+
+        std::pmr::memory_resource * arena = labels.get_allocator().resource();
+        labels        = LabelMap(arena);
+        branch_fixups = std::pmr::vector< BranchFixup >(arena);
+        jump_fixups   = std::pmr::vector< JumpFixup >(arena);
+        la_fixups_    = std::pmr::vector< LaFixup >(arena);
+    }
+
     void define_label(const std::string & name, uint32_t addr)
     {
         auto it = labels.find(name);
@@ -65,7 +100,13 @@ public:
         {
             labels[name] = addr;
             resolve_fixups_for(name);
-        } 
+        }
+        // same label at the same address: a lazy load re-assembling a
+        // line whose label the pre-scan already placed
+        else if (it->second == addr)
+        {
+            return;
+        }
         // otherwise, throw error (label redefined)
         else
         {
@@ -88,6 +129,41 @@ public:
         return labels.find(name) != labels.end();
     }
 
+    // nearest label at or below addr in the same segment, formatted as
+    // "label" or "label+0x10". falls back to the raw hex address.
+    std::string symbolize(uint32_t addr) const
+    {
+        const std::string * best = nullptr;
+        uint32_t best_addr = 0;
+
+        for (const auto & kv : labels)
+        {
+            uint32_t a = kv.second;
+            if (a > addr)
+                continue;
+            if (Memory::is_text(a) != Memory::is_text(addr))
+                continue;
+            if (best == nullptr || a > best_addr ||
+                (a == best_addr && kv.first < *best))
+            {
+                best = &kv.first;
+                best_addr = a;
+            }
+        }
+
+        std::ostringstream ss;
+        if (best == nullptr)
+        {
+            ss << "0x" << std::hex << addr;
+            return ss.str();
+        }
+
+        ss << *best;
+        if (addr != best_addr)
+            ss << "+0x" << std::hex << (addr - best_addr);
+        return ss.str();
+    }
+
     struct BranchFixup
     {
         uint32_t instr_addr;   // address of the branch instruction
@@ -166,14 +242,21 @@ public:
             throw std::runtime_error("emit_data_bytes: data segment overflow");
 
         // write n bytes starting at current data_cursor
-        for (std::size_t i = 0; i < n; ++i)
-        {
-            mem.store8(data_cursor + static_cast<uint32_t>(i), bytes[i]);
-        }
+        mem.write_block(data_cursor, bytes, n);
 
         data_cursor += static_cast<uint32_t>(n);
     }
 
+    // append n copies of 'value' (.space, .align padding)
+    void emit_data_fill(uint8_t value, std::size_t n)
+    {
+        if (data_cursor + static_cast<uint32_t>(n) > DATA_LIMIT)
+            throw std::runtime_error("emit_data_fill: data segment overflow");
+
+        mem.fill(data_cursor, value, n);
+        data_cursor += static_cast<uint32_t>(n);
+    }
+
     // .byte (single byte)
     void emit_data_byte(uint8_t value)
     {
@@ -218,13 +301,7 @@ public:
     void emit_data_asciiz(const char * s)
     {
         // write characters including the final '\0'
-        const char * p = s;
-        while (*p)
-        {
-            emit_data_byte(static_cast<uint8_t>(*p));
-            ++p;
-        }
-        emit_data_byte(0); // terminating null
+        emit_data_bytes(reinterpret_cast<const uint8_t *>(s), std::strlen(s) + 1);
     }
 
     void print_labels(std::ostream & out) const
@@ -277,15 +354,16 @@ public:
     uint32_t text_cursor;   // next free address in text segment
     uint32_t data_cursor;   // next free address in data segment
     bool in_text_mode;      // current assembly target (.text / .data)
-    std::unordered_map< std::string, uint32_t > labels; // addresses of labels
+    LabelMap labels;        // addresses of labels
 
 private:
-    std::vector< BranchFixup > branch_fixups;
-    std::vector< JumpFixup > jump_fixups;
-    std::vector< LaFixup >    la_fixups_;
+    std::pmr::vector< BranchFixup > branch_fixups;
+    std::pmr::vector< JumpFixup >   jump_fixups;
+    std::pmr::vector< LaFixup >     la_fixups_;
 
     void resolve_fixups_for(const std::string & label)
     {
+        PhaseTimer timer(TP_FIXUP);
         auto it_label = labels.find(label);
         if (it_label == labels.end())
             return;
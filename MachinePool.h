@@ -0,0 +1,154 @@
+// File  : MachinePool.h
+// Author: Cole Schwandt
+//
+// Recycled Machines with a per-run arena.
+//
+// Every pooled Machine allocates its memory map, page table, labels and
+// fixups from its own RunArena: a monotonic buffer in front of the
+// global heap. A run's allocations are pointer bumps in that buffer and
+// are never freed one by one. When the machine goes back to the pool
+// its containers drop their storage and the arena is released in one
+// step, ready for the next run. Worker threads therefore only touch the
+// global heap when a run outgrows its arena, and the pool's lock is
+// held just long enough to pop or push a pointer.
+//
+// Free machines are kept per NUMA node. An arena's buffer is touched
+// by the thread that creates it, so with first-touch placement its
+// pages live on that thread's node; a worker pinned to a node asks for
+// that node's machines and only ever recycles memory local to it.
+
+#ifndef MACHINE_POOL_H
+#define MACHINE_POOL_H
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <vector>
+
+#include "Machine.h"
+
+//==============================================================
+// RunArena
+//==============================================================
+class RunArena
+{
+public:
+    static const std::size_t DEFAULT_SIZE = 1u << 20;
+
+    explicit RunArena(std::size_t size = DEFAULT_SIZE)
+        : buffer_(new unsigned char[size]),
+          resource_(buffer_.get(), size, std::pmr::new_delete_resource())
+    {
+        // fault the buffer in now, on the creating thread's node
+        for (std::size_t off = 0; off < size; off += 4096)
+            buffer_[off] = 0;
+    }
+
+    std::pmr::memory_resource * resource() { return &resource_; }
+
+    // forget every allocation at once; overflow chunks go back to the
+    // heap, the initial buffer is kept
+    void release() { resource_.release(); }
+
+private:
+    std::unique_ptr< unsigned char[] > buffer_;
+    std::pmr::monotonic_buffer_resource resource_;
+};
+
+//==============================================================
+// MachinePool
+//==============================================================
+class MachinePool
+{
+    struct Slot;
+
+public:
+    // a machine on loan; returned to the pool when the lease ends
+    class Lease
+    {
+    public:
+        Lease(MachinePool & pool, std::unique_ptr< Slot > slot)
+            : pool_(&pool), slot_(std::move(slot))
+        {}
+
+        Lease(Lease && o) = default;
+        Lease & operator=(Lease &&) = delete;
+
+        ~Lease()
+        {
+            if (slot_)
+                pool_->give_back(std::move(slot_));
+        }
+
+        Machine & machine() { return slot_->machine; }
+
+        // the arena the machine allocates from, for other per-run state
+        std::pmr::memory_resource * arena() { return slot_->arena.resource(); }
+
+    private:
+        MachinePool * pool_;
+        std::unique_ptr< Slot > slot_;
+    };
+
+    explicit MachinePool(std::size_t arena_size = RunArena::DEFAULT_SIZE)
+        : arena_size_(arena_size), created_(0)
+    {}
+
+    // a clean machine: recycled from 'node' if one is free there, new
+    // (and first-touched by the calling thread) otherwise
+    Lease acquire(std::size_t node = 0)
+    {
+        {
+            std::lock_guard< std::mutex > lock(mutex_);
+            if (node < free_.size() && !free_[node].empty())
+            {
+                std::unique_ptr< Slot > slot = std::move(free_[node].back());
+                free_[node].pop_back();
+                return Lease(*this, std::move(slot));
+            }
+            ++created_;
+        }
+        return Lease(*this, std::unique_ptr< Slot >(new Slot(arena_size_, node)));
+    }
+
+    // machines constructed so far (free or on loan)
+    std::size_t created() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return created_;
+    }
+
+private:
+    struct Slot
+    {
+        Slot(std::size_t arena_size, std::size_t node)
+            : arena(arena_size), machine(arena.resource()), node(node)
+        {}
+
+        RunArena    arena;     // declared first: outlives the machine
+        Machine     machine;
+        std::size_t node;      // NUMA node its memory was touched on
+    };
+
+    void give_back(std::unique_ptr< Slot > slot)
+    {
+        // outside the lock: this is the O(1) arena release plus the
+        // machine's container resets
+        slot->machine.drop_storage();
+        slot->arena.release();
+
+        std::lock_guard< std::mutex > lock(mutex_);
+        if (slot->node >= free_.size())
+            free_.resize(slot->node + 1);
+        free_[slot->node].push_back(std::move(slot));
+    }
+
+    std::size_t arena_size_;
+    mutable std::mutex mutex_;
+    std::vector< std::vector< std::unique_ptr< Slot > > > free_; // by node
+    std::size_t created_;
+};
+
+#endif // MACHINE_POOL_H
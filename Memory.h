@@ -4,23 +4,161 @@
 // Sparse memory model for MIPS simulator.
 // Uses a single 32-bit address space with text, data, and stack
 // regions defined in Constants.h.
+//
+// Memory is kept in MEM_PAGE_SIZE pages, created on the first store
+// into them. Each page records which of its bytes have been written
+// (the "mapped" bytes shown by dumps); unwritten bytes read as 0. Bulk
+// operations (read_block, write_block, fill, find_byte) walk a range one
+// page span at a time with memcpy/memset/memchr.
+//
+// Pages stored to since the last clear_dirty() are listed, so a diff
+// against a checkpoint only has to look at those.
+//
+// Text can be sealed into immutable, reference-counted pages. Copies
+// of a Memory then share those pages and only hold their own data and
+// stack; a store into a shared text page copies that page first.
+//
+// Pages not stored to for a while can be compressed into cold blobs
+// (compress_idle, see PageCompression.h). Any access to a cold page,
+// even a read through a const Memory, brings it back first. Reads of
+// a resident page do not restart its idle clock: that would cost a
+// store per load, and a page read after compression is just thawed.
+// Since such a read writes the page maps, a Memory read by several
+// threads at once must hold no cold pages (ProgramImage thaws its own).
 
 #ifndef MEMORY_H
 #define MEMORY_H
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <stdexcept>
+#include <vector>
 
 #include "Constants.h"
+#include "PageCompression.h"
+
+// segments start and end on page boundaries, so one address check per
+// page span covers every byte of it
+static_assert(TEXT_BASE  % MEM_PAGE_SIZE == 0 && DATA_BASE   % MEM_PAGE_SIZE == 0 &&
+              DATA_LIMIT % MEM_PAGE_SIZE == 0 && STACK_LIMIT % MEM_PAGE_SIZE == 0,
+              "segment bounds must be page aligned");
+
+// source of text that is assembled on demand. the region holding a
+// lazily loaded address starts with LAZY_TEXT_WORD until then.
+class LazyText
+{
+public:
+    virtual ~LazyText() {}
+
+    // assemble the region holding 'addr' if it is still pending.
+    // returns true if anything was assembled.
+    virtual bool materialize(uint32_t addr) = 0;
+};
+
+// one page of memory and a bitmap of its written bytes
+struct MemPage
+{
+    uint8_t  bytes[MEM_PAGE_SIZE] = {};
+    uint64_t mapped[MEM_PAGE_SIZE / 64] = {};
+    bool     dirty = false;   // listed in Memory's dirty pages
+    uint32_t last_use = 0;    // Memory's clock at the last store or thaw
+
+    // page image for compression: bytes, then the mapped bitmap
+    void save(uint8_t * image) const
+    {
+        std::memcpy(image, bytes, MEM_PAGE_SIZE);
+        std::memcpy(image + MEM_PAGE_SIZE, mapped, sizeof mapped);
+    }
+
+    void load(const uint8_t * image)
+    {
+        std::memcpy(bytes, image, MEM_PAGE_SIZE);
+        std::memcpy(mapped, image + MEM_PAGE_SIZE, sizeof mapped);
+    }
+
+    // set the mapped bits of [off, off + n)
+    void mark(uint32_t off, uint32_t n)
+    {
+        for (uint32_t end = off + n; off < end; )
+        {
+            uint32_t bit  = off & 63u;
+            uint32_t take = std::min(64u - bit, end - off);
+            mapped[off >> 6] |= (take == 64 ? ~0ull : ((1ull << take) - 1) << bit);
+            off += take;
+        }
+    }
+
+    bool any_mapped(uint32_t off, uint32_t n) const
+    {
+        for (uint32_t end = off + n; off < end; )
+        {
+            uint32_t bit  = off & 63u;
+            uint32_t take = std::min(64u - bit, end - off);
+            if (mapped[off >> 6] & (take == 64 ? ~0ull : ((1ull << take) - 1) << bit))
+                return true;
+            off += take;
+        }
+        return false;
+    }
+
+    // offsets of the first and one-past-last mapped byte
+    bool span(uint32_t & first, uint32_t & last) const
+    {
+        const uint32_t WORDS = MEM_PAGE_SIZE / 64;
+        uint32_t lo = 0, hi = WORDS;
+        while (lo < WORDS && mapped[lo] == 0)
+            ++lo;
+        if (lo == WORDS)
+            return false;
+        while (mapped[hi - 1] == 0)
+            --hi;
+
+        first = lo * 64 + static_cast<uint32_t>(__builtin_ctzll(mapped[lo]));
+        last  = (hi - 1) * 64 + 64 - static_cast<uint32_t>(__builtin_clzll(mapped[hi - 1]));
+        return true;
+    }
+
+    std::size_t count_mapped() const
+    {
+        std::size_t n = 0;
+        for (uint64_t w : mapped)
+            n += static_cast<std::size_t>(__builtin_popcountll(w));
+        return n;
+    }
+};
 
 class Memory
 {
 public:
+    // pages and page table allocate from 'arena' (a copy made with the
+    // copy constructor uses the default resource)
+    explicit Memory(std::pmr::memory_resource * arena = std::pmr::get_default_resource())
+        : pages_(arena), cold_(arena), text_pages_(arena), dirty_pages_(arena)
+    {}
+
     // clear all memory contents
     void reset()
     {
-        mem_.clear();
+        pages_.clear();
+        cold_.clear();
+        text_pages_.clear();
+        dirty_pages_.clear();
+        has_fault_ = false;
+        fault_addr_ = 0;
+    }
+
+    // reset and hand every allocation back to the arena, so the arena
+    // can be released wholesale
+    void drop_storage()
+    {
+        reset();
+        cold_        = decltype(cold_)(cold_.get_allocator());
+        text_pages_  = decltype(text_pages_)(text_pages_.get_allocator());
+        dirty_pages_ = decltype(dirty_pages_)(dirty_pages_.get_allocator());
     }
 
     //==============================================================
@@ -31,22 +169,231 @@ public:
     uint8_t load8(uint32_t addr) const
     {
         if (!is_valid_address(addr))
-            throw std::runtime_error("Memory load8: address out of bounds");
-
-        auto it = mem_.find(addr);
-        if (it == mem_.end())
-            return 0; // default value for unmapped memory
+            raise_fault(addr, "Memory load8: address out of bounds");
 
-        return it->second;
+        const MemPage * page = find_page(addr);
+        return page ? page->bytes[addr & (MEM_PAGE_SIZE - 1u)] : 0;
     }
 
     // store a single byte into memory
     void store8(uint32_t addr, uint8_t val)
     {
         if (!is_valid_address(addr))
-            throw std::runtime_error("Memory store8: address out of bounds");
+            raise_fault(addr, "Memory store8: address out of bounds");
+
+        uint32_t off = addr & (MEM_PAGE_SIZE - 1u);
+        MemPage & page = write_page(addr);
+        page.bytes[off] = val;
+        page.mark(off, 1);
+        ++write_gen_;
+    }
+
+    // bumped by every store; equal generations mean no memory write
+    // happened in between
+    uint64_t write_generation() const { return write_gen_; }
+
+    // bases of pages stored to since the last clear_dirty(), in the
+    // order they were first stored to
+    const std::pmr::vector< uint32_t > & dirty_pages() const { return dirty_pages_; }
+
+    void clear_dirty()
+    {
+        for (uint32_t base : dirty_pages_)
+        {
+            auto it = pages_.find(base);
+            if (it != pages_.end())
+                it->second.dirty = false;
+            else if (!cold_.empty())
+            {
+                auto ct = cold_.find(base);
+                if (ct != cold_.end())
+                    ct->second.dirty = false;
+            }
+        }
+        dirty_pages_.clear();
+    }
+
+    //==============================================================
+    // Block access
+    //==============================================================
+    // copy [addr, addr + n) into 'dst'
+    void read_block(uint32_t addr, uint8_t * dst, std::size_t n) const
+    {
+        while (n != 0)
+        {
+            uint32_t len = span_len(addr, n, "Memory read_block: address out of bounds");
+            const MemPage * page = find_page(addr);
+            if (page)
+                std::memcpy(dst, page->bytes + (addr & (MEM_PAGE_SIZE - 1u)), len);
+            else
+                std::memset(dst, 0, len);
+            addr += len; dst += len; n -= len;
+        }
+    }
+
+    // copy 'src' into [addr, addr + n)
+    void write_block(uint32_t addr, const uint8_t * src, std::size_t n)
+    {
+        while (n != 0)
+        {
+            uint32_t len = span_len(addr, n, "Memory write_block: address out of bounds");
+            uint32_t off = addr & (MEM_PAGE_SIZE - 1u);
+            MemPage & page = write_page(addr);
+            std::memcpy(page.bytes + off, src, len);
+            page.mark(off, len);
+            ++write_gen_;
+            addr += len; src += len; n -= len;
+        }
+    }
+
+    // set [addr, addr + n) to 'val'
+    void fill(uint32_t addr, uint8_t val, std::size_t n)
+    {
+        while (n != 0)
+        {
+            uint32_t len = span_len(addr, n, "Memory fill: address out of bounds");
+            uint32_t off = addr & (MEM_PAGE_SIZE - 1u);
+            MemPage & page = write_page(addr);
+            std::memset(page.bytes + off, val, len);
+            page.mark(off, len);
+            ++write_gen_;
+            addr += len; n -= len;
+        }
+    }
+
+    // MappedMemory translates a range up front with this; physical
+    // addresses have nothing to translate
+    void probe(uint32_t, std::size_t, bool) const {}
+
+    // offset from 'addr' of the first byte equal to 'val' within the
+    // next 'max_len' bytes, or max_len if there is none. running into
+    // an invalid address before a match faults, like load8 would.
+    std::size_t find_byte(uint32_t addr, uint8_t val, std::size_t max_len) const
+    {
+        std::size_t done = 0;
+        while (done < max_len)
+        {
+            uint32_t len = span_len(addr, max_len - done, "Memory find_byte: address out of bounds");
+            const MemPage * page = find_page(addr);
+            if (page)
+            {
+                const void * p = std::memchr(page->bytes + (addr & (MEM_PAGE_SIZE - 1u)), val, len);
+                if (p)
+                    return done + static_cast<std::size_t>(
+                        static_cast<const uint8_t *>(p) - (page->bytes + (addr & (MEM_PAGE_SIZE - 1u))));
+            }
+            else if (val == 0)
+            {
+                return done; // an untouched page reads as zeros
+            }
+            addr += len; done += len;
+        }
+        return max_len;
+    }
+
+    //==============================================================
+    // Shared text
+    //==============================================================
+    // move every text page into sealed pages. copies made from here
+    // on share them instead of copying the text.
+    void seal_text()
+    {
+        thaw_range(TEXT_BASE, TEXT_LIMIT);
+        auto it  = pages_.lower_bound(TEXT_BASE);
+        auto end = pages_.lower_bound(TEXT_LIMIT);
+        for (; it != end; ++it)
+        {
+            uint32_t k = (it->first - TEXT_BASE) / MEM_PAGE_SIZE;
+            if (k >= text_pages_.size())
+                text_pages_.resize(k + 1);
+            text_pages_[k] = std::make_shared< const MemPage >(it->second);
+        }
+        pages_.erase(pages_.lower_bound(TEXT_BASE), end);
+    }
+
+    // true while 'addr' reads from a sealed page this memory has not
+    // written to
+    bool is_shared_text(uint32_t addr) const
+    {
+        return shared_page(addr) != nullptr;
+    }
 
-        mem_[addr] = val;
+    // bytes held by this memory alone (data, stack, copied text pages)
+    std::size_t private_bytes() const
+    {
+        std::size_t n = 0;
+        for (const auto & kv : pages_)
+            n += kv.second.count_mapped();
+        for (const auto & kv : cold_)
+            n += kv.second.mapped_bytes;
+        return n;
+    }
+
+    //==============================================================
+    // Idle page compression
+    //==============================================================
+    // the time stamped into a page by each store and thaw. any unit
+    // that only goes up will do; the Interpreter uses seconds.
+    void set_clock(uint32_t now) { clock_ = now; }
+
+    // compress every private page not stored to or thawed for at least
+    // 'idle' clock units (sealed text is already shared). returns the
+    // number of pages compressed.
+    std::size_t compress_idle(uint32_t idle, const CompressConfig & cfg)
+    {
+        uint8_t image[PAGE_IMAGE_BYTES];
+        std::size_t n = 0;
+        for (auto it = pages_.begin(); it != pages_.end(); )
+        {
+            const MemPage & p = it->second;
+            if (clock_ - p.last_use < idle)
+            {
+                ++it;
+                continue;
+            }
+
+            p.save(image);
+            ColdPage c;
+            c.blob = cfg.dedup ? ColdPageStore::shared().intern(image, cfg.lz)
+                               : ColdBlob::make(image, cfg.lz, 0);
+            c.mapped_bytes = static_cast<uint32_t>(p.count_mapped());
+            c.dirty = p.dirty;
+            cold_.emplace(it->first, std::move(c));
+            it = pages_.erase(it);
+            ++n;
+        }
+        compressed_ += n;
+        return n;
+    }
+
+    // bring every compressed page back
+    void thaw_all()
+    {
+        thaw_range(0, UINT32_MAX);
+    }
+
+    PageCompressionStats compression_stats() const
+    {
+        PageCompressionStats s;
+        s.resident_pages = pages_.size();
+        s.cold_pages = cold_.size();
+        s.compressed = compressed_;
+        s.thawed = thawed_;
+
+        std::vector< const ColdBlob * > seen;
+        for (const auto & kv : cold_)
+        {
+            const ColdBlob * b = kv.second.blob.get();
+            s.raw_bytes += PAGE_IMAGE_BYTES;
+            if (kv.second.blob.use_count() > 1)
+                ++s.shared_pages;
+            seen.push_back(b);
+        }
+        std::sort(seen.begin(), seen.end());
+        seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+        for (const ColdBlob * b : seen)
+            s.stored_bytes += b->footprint();
+        return s;
     }
 
     //==============================================================
@@ -56,46 +403,99 @@ public:
     uint32_t load32(uint32_t addr) const
     {
         if (addr & 0x3)
-            throw std::runtime_error("Memory load32: unaligned address");
+            raise_fault(addr, "Memory load32: unaligned address");
 
-        // check all 4 bytes are in a valid region
-        if (!is_valid_address(addr) ||
-            !is_valid_address(addr + 1) ||
-            !is_valid_address(addr + 2) ||
-            !is_valid_address(addr + 3))
-        {
-            throw std::runtime_error("Memory load32: address out of bounds");
-        }
+        // an aligned word never crosses a page, so never a segment
+        if (!is_valid_address(addr))
+            raise_fault(addr, "Memory load32: address out of bounds");
 
-        uint32_t b0 = load8(addr + 0);
-        uint32_t b1 = load8(addr + 1);
-        uint32_t b2 = load8(addr + 2);
-        uint32_t b3 = load8(addr + 3);
+        const MemPage * page = find_page(addr);
+        if (!page)
+            return 0;
 
-        return (b0 << 24) | (b1 << 16) | (b2 << 8) | b3;
+        const uint8_t * b = page->bytes + (addr & (MEM_PAGE_SIZE - 1u));
+        return (static_cast<uint32_t>(b[0]) << 24) | (static_cast<uint32_t>(b[1]) << 16) |
+               (static_cast<uint32_t>(b[2]) <<  8) |  static_cast<uint32_t>(b[3]);
     }
 
     // store a 32-bit word to memory
     void store32(uint32_t addr, uint32_t val)
     {
         if (addr & 0x3)
-            throw std::runtime_error("Memory store32: unaligned address");
+            raise_fault(addr, "Memory store32: unaligned address");
 
-        // check all 4 bytes are in a valid region
-        if (!is_valid_address(addr + 3))
+        if (!is_valid_address(addr))
+            raise_fault(addr, "Memory store32: address out of bounds");
+
+        uint32_t off = addr & (MEM_PAGE_SIZE - 1u);
+        MemPage & page = write_page(addr);
+        page.bytes[off + 0] = static_cast<uint8_t>((val >> 24) & 0xFF);
+        page.bytes[off + 1] = static_cast<uint8_t>((val >> 16) & 0xFF);
+        page.bytes[off + 2] = static_cast<uint8_t>((val >> 8)  & 0xFF);
+        page.bytes[off + 3] = static_cast<uint8_t>( val        & 0xFF);
+        page.mark(off, 4);
+        ++write_gen_;
+    }
+
+    //==============================================================
+    // Fault reporting
+    //==============================================================
+    // record the faulting address and throw. the address is kept
+    // so a post-mortem dump can report it after the exception has
+    // unwound; nothing is recorded on the non-faulting path.
+    [[noreturn]] void raise_fault(uint32_t addr, const char * msg) const
+    {
+        fault_addr_ = addr;
+        has_fault_  = true;
+        throw std::runtime_error(msg);
+    }
+
+    bool has_fault() const { return has_fault_; }
+    uint32_t fault_addr() const { return fault_addr_; }
+
+    // aligned base addresses of all pages holding at least one mapped
+    // byte in [start, limit), in ascending order
+    std::vector< uint32_t > mapped_pages(uint32_t start, uint32_t limit) const
+    {
+        std::vector< uint32_t > pages;
+        for (std::size_t k = 0; k < text_pages_.size(); ++k)
         {
-            throw std::runtime_error("Memory store32: address out of bounds");
+            uint32_t page = TEXT_BASE + static_cast<uint32_t>(k) * MEM_PAGE_SIZE;
+            if (text_pages_[k] && page >= start && page < limit)
+                pages.push_back(page);
         }
+        std::size_t num_shared = pages.size();
+
+        auto it  = pages_.lower_bound(start & ~(MEM_PAGE_SIZE - 1u));
+        auto end = pages_.lower_bound(limit);
+        for (; it != end; ++it)
+            pages.push_back(it->first);
+        std::size_t num_resident = pages.size();
+
+        // compressed pages are listed without bringing them back
+        auto ct   = cold_.lower_bound(start & ~(MEM_PAGE_SIZE - 1u));
+        auto cend = cold_.lower_bound(limit);
+        for (; ct != cend; ++ct)
+            pages.push_back(ct->first);
+
+        if (num_resident != pages.size())
+            std::inplace_merge(pages.begin() + num_shared, pages.begin() + num_resident, pages.end());
+        if (num_shared != 0)
+            std::inplace_merge(pages.begin(), pages.begin() + num_shared, pages.end());
+        return pages;
+    }
 
-        uint8_t b0 = static_cast<uint8_t>((val >> 24) & 0xFF);
-        uint8_t b1 = static_cast<uint8_t>((val >> 16) & 0xFF);
-        uint8_t b2 = static_cast<uint8_t>((val >> 8)  & 0xFF);
-        uint8_t b3 = static_cast<uint8_t>( val        & 0xFF);
+    // first and one-past-last mapped byte addresses inside the page at
+    // 'page'. returns false if the page has no mapped bytes.
+    bool mapped_span(uint32_t page, uint32_t & first, uint32_t & last) const
+    {
+        const MemPage * p = is_valid_address(page) ? find_page(page) : nullptr;
+        if (!p || !p->span(first, last))
+            return false;
 
-        store8(addr + 0, b0);
-        store8(addr + 1, b1);
-        store8(addr + 2, b2);
-        store8(addr + 3, b3);
+        first += page;
+        last  += page;
+        return true;
     }
 
     //==============================================================
@@ -116,6 +516,11 @@ public:
         return addr >= STACK_BASE && addr < STACK_LIMIT;
     }
 
+    static bool is_valid_address(uint32_t addr)
+    {
+        return is_text(addr) || is_data(addr) || is_stack(addr);
+    }
+
     // print all mapped 32-bit words in [start, limit) in a table
     void print_region(std::ostream & out,
                       uint32_t start,
@@ -174,29 +579,27 @@ public:
             return s + std::string(2 - s.size(), ' ');
         };
 
-        // collect unique aligned word addresses in [start, limit)
-        // that have at least one mapped byte.
+        // collect aligned word addresses in [start, limit) that have
+        // at least one mapped byte.
         std::vector<uint32_t> word_addrs;
-        uint32_t last_word = std::numeric_limits<uint32_t>::max();
+        thaw_range(start, limit);
 
-        auto it  = mem_.lower_bound(start);
-        auto end = mem_.lower_bound(limit);
+        auto it  = pages_.lower_bound(start & ~(MEM_PAGE_SIZE - 1u));
+        auto end = pages_.lower_bound(limit);
 
         for (; it != end; ++it)
         {
-            uint32_t addr = it->first;
-            if (addr < start || addr >= limit)
-                continue;
-
-            uint32_t word_addr = addr & ~0x3u; // align down to 4-byte boundary
-            if (word_addr == last_word)
-                continue; // already recorded this word
-            last_word = word_addr;
-
-            if (word_addr + 3 >= limit)
-                continue; // avoid crossing region limit
-
-            word_addrs.push_back(word_addr);
+            for (uint32_t off = 0; off < MEM_PAGE_SIZE; off += 4)
+            {
+                uint32_t word_addr = it->first + off;
+                if (word_addr < (start & ~0x3u))
+                    continue;
+                if (word_addr + 3 >= limit)
+                    break; // avoid crossing region limit
+
+                if (it->second.any_mapped(off, 4))
+                    word_addrs.push_back(word_addr);
+            }
         }
 
         if (word_addrs.empty())
@@ -258,12 +661,127 @@ public:
     }
 
 private:
-    bool is_valid_address(uint32_t addr) const
+
+    // a compressed page; mapped_bytes is kept for private_bytes(), and
+    // dirty so the page is not listed twice in dirty_pages_
+    struct ColdPage
     {
-        return is_text(addr) || is_data(addr) || is_stack(addr);
+        std::shared_ptr< const ColdBlob > blob;
+        uint32_t mapped_bytes = 0;
+        bool     dirty = false;
+    };
+
+    // private pages by base address, resident and compressed. a page
+    // is in at most one of them; reads move a page from cold_ to
+    // pages_, hence mutable.
+    mutable std::pmr::map< uint32_t, MemPage >  pages_;
+    mutable std::pmr::map< uint32_t, ColdPage > cold_;
+    uint64_t write_gen_ = 0;
+
+    uint32_t clock_ = 0;
+    uint64_t compressed_ = 0;
+    mutable uint64_t thawed_ = 0;
+
+    // sealed text, indexed by page number from TEXT_BASE; null for a
+    // page that was never sealed or has been copied into pages_
+    std::pmr::vector< std::shared_ptr< const MemPage > > text_pages_;
+
+    std::pmr::vector< uint32_t > dirty_pages_;
+
+    mutable uint32_t fault_addr_ = 0;
+    mutable bool     has_fault_  = false;
+
+    const MemPage * shared_page(uint32_t addr) const
+    {
+        if (!is_text(addr))
+            return nullptr;
+        uint32_t k = (addr - TEXT_BASE) / MEM_PAGE_SIZE;
+        return k < text_pages_.size() ? text_pages_[k].get() : nullptr;
+    }
+
+    // page holding 'addr' for reading; null if never written
+    const MemPage * find_page(uint32_t addr) const
+    {
+        if (const MemPage * page = shared_page(addr))
+            return page;
+
+        uint32_t base = addr & ~(MEM_PAGE_SIZE - 1u);
+        auto it = pages_.find(base);
+        if (it != pages_.end())
+            return &it->second;
+        return cold_.empty() ? nullptr : thaw(base);
+    }
+
+    // move the compressed page at 'base' back into pages_; null if it
+    // is not compressed
+    MemPage * thaw(uint32_t base) const
+    {
+        auto it = cold_.find(base);
+        if (it == cold_.end())
+            return nullptr;
+
+        uint8_t image[PAGE_IMAGE_BYTES];
+        it->second.blob->restore(image);
+        MemPage & page = pages_[base];
+        page.load(image);
+        page.dirty = it->second.dirty;
+        page.last_use = clock_;
+        cold_.erase(it);
+        ++thawed_;
+        return &page;
     }
 
-    std::map< uint32_t, uint8_t > mem_;
+    void thaw_range(uint32_t start, uint32_t limit) const
+    {
+        auto it = cold_.lower_bound(start & ~(MEM_PAGE_SIZE - 1u));
+        while (it != cold_.end() && it->first < limit)
+        {
+            uint32_t base = it->first;
+            ++it; // thaw erases the entry
+            thaw(base);
+        }
+    }
+
+    // page holding 'addr' for writing: created on first use, and a
+    // sealed text page is copied first (copy-on-write)
+    MemPage & write_page(uint32_t addr)
+    {
+        uint32_t base = addr & ~(MEM_PAGE_SIZE - 1u);
+        MemPage * page = nullptr;
+        if (is_text(addr))
+        {
+            uint32_t k = (addr - TEXT_BASE) / MEM_PAGE_SIZE;
+            if (k < text_pages_.size() && text_pages_[k])
+            {
+                std::shared_ptr< const MemPage > shared = std::move(text_pages_[k]);
+                page = &pages_.emplace(base, *shared).first->second;
+                page->dirty = false;
+            }
+        }
+        if (page == nullptr && !cold_.empty())
+            page = thaw(base);
+        if (page == nullptr)
+            page = &pages_[base];
+        page->last_use = clock_;
+
+        if (!page->dirty)
+        {
+            page->dirty = true;
+            dirty_pages_.push_back(base);
+        }
+        return *page;
+    }
+
+    // length of the part of [addr, addr + n) inside addr's page, after
+    // checking that page is in a segment
+    uint32_t span_len(uint32_t addr, std::size_t n, const char * msg) const
+    {
+        if (!is_valid_address(addr))
+            raise_fault(addr, msg);
+
+        std::size_t room = MEM_PAGE_SIZE - (addr & (MEM_PAGE_SIZE - 1u));
+        return static_cast<uint32_t>(n < room ? n : room);
+    }
 };
 
 #endif // MEMORY_H
@@ -0,0 +1,549 @@
+// File  : Mmu.h
+// Author: Cole Schwandt
+//
+// Optional guest virtual memory: a set-associative TLB in front of the
+// flat Memory, refilled by a hardware page walk or by a guest handler
+// through CP0-style registers.
+//
+// Only data accesses (loads, stores and syscall buffers) are
+// translated, and only while Status.EXL is clear; instruction fetches
+// and exception handlers see physical addresses, like code in an
+// unmapped kernel segment.
+//
+// The guest page table is linear: the entry for virtual page VPN is the
+// word at PTEBase + 4 * VPN, in the layout of MIPS EntryLo (PFN in
+// 4 KiB frames from bit 6, D = bit 2, V = bit 1). PTEBase is written
+// through CP0 Context; after a miss Context reads back as the address
+// of the missing entry, so a refill handler is
+//
+//     refill: mfc0 $k0, $4      # Context: &PTE
+//             lw   $k0, 0($k0)
+//             mtc0 $k0, $2      # EntryLo
+//             tlbwr             # EntryHi was set by the miss
+//             eret
+//
+// With walk=hw the MMU does the same itself. Until the guest sets a
+// PTEBase the hardware walker reads an identity table, so an ordinary
+// program runs unchanged and only the TLB behaviour is measured.
+//
+// Every translation first checks a small direct-mapped micro-TLB on
+// the host (virtual page -> physical page, writable). It only caches
+// what the TLB holds and is invalidated whenever a TLB entry changes,
+// so it never changes what the guest sees; it just keeps the common
+// case to a compare and an add.
+
+#ifndef MMU_H
+#define MMU_H
+
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Memory.h"
+
+//==============================================================
+// Cp0: the system-control registers the MMU and eret use
+//==============================================================
+struct Cp0
+{
+    enum Reg : uint8_t
+    {
+        INDEX    = 0,
+        ENTRYLO  = 2,
+        CONTEXT  = 4,
+        BADVADDR = 8,
+        ENTRYHI  = 10,
+        STATUS   = 12,
+        CAUSE    = 13,
+        EPC      = 14,
+        EBASE    = 15,
+    };
+
+    static const uint32_t STATUS_EXL  = 1u << 1;   // in an exception
+    static const uint32_t INDEX_PROBE = 1u << 31;  // tlbp found nothing
+    static const uint32_t EXC_TLBL    = 2;         // Cause codes
+    static const uint32_t EXC_TLBS    = 3;
+
+    uint32_t index    = 0;
+    uint32_t entrylo  = 0;
+    uint32_t pte_base = 0;   // the written part of Context
+    uint32_t context  = 0;   // PTEBase + 4 * VPN of the last miss
+    uint32_t badvaddr = 0;
+    uint32_t entryhi  = 0;
+    uint32_t status   = 0;
+    uint32_t cause    = 0;
+    uint32_t epc      = 0;
+    uint32_t ebase    = 0;
+
+    void reset() { *this = Cp0(); }
+
+    uint32_t read(uint8_t reg) const
+    {
+        switch (reg)
+        {
+            case INDEX:    return index;
+            case ENTRYLO:  return entrylo;
+            case CONTEXT:  return context;
+            case BADVADDR: return badvaddr;
+            case ENTRYHI:  return entryhi;
+            case STATUS:   return status;
+            case CAUSE:    return cause;
+            case EPC:      return epc;
+            case EBASE:    return ebase;
+            default:       return 0;
+        }
+    }
+
+    void write(uint8_t reg, uint32_t v)
+    {
+        switch (reg)
+        {
+            case INDEX:    index = v;                 break;
+            case ENTRYLO:  entrylo = v;               break;
+            case CONTEXT:  pte_base = context = v;    break;
+            case ENTRYHI:  entryhi = v;               break;
+            case STATUS:   status = v;                break;
+            case CAUSE:    cause = v;                 break;
+            case EPC:      epc = v;                   break;
+            case EBASE:    ebase = v;                 break;
+            default:                                  break; // read-only
+        }
+    }
+};
+
+// thrown out of a translation to enter the guest's refill handler; the
+// CPU catches it, abandons the instruction and continues at 'vector'
+struct TlbRefill
+{
+    uint32_t vector;
+};
+
+//==============================================================
+// MmuConfig
+//==============================================================
+struct MmuConfig
+{
+    unsigned entries   = 64;
+    unsigned ways      = 4;
+    unsigned page      = 4096;  // bytes, a power of two from 4 KiB
+    bool     hw_walk   = true;  // false: refill exception to EBase
+    unsigned walk_cost = 20;    // cycles charged per hardware walk
+
+    // apply "key=value,..." (walk=hw|sw); throws on bad input
+    void parse(const std::string & spec)
+    {
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty())
+                continue;
+            std::size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                throw std::runtime_error("mmu: expected key=value, got '" + item + "'");
+
+            std::string key = item.substr(0, eq);
+            std::string val = item.substr(eq + 1);
+            if (key == "walk")
+            {
+                if (val != "hw" && val != "sw")
+                    throw std::runtime_error("mmu: walk must be hw or sw");
+                hw_walk = (val == "hw");
+                continue;
+            }
+
+            unsigned long v = 0;
+            try
+            {
+                v = std::stoul(val);
+            }
+            catch (const std::exception &)
+            {
+                throw std::runtime_error("mmu: bad value for " + key);
+            }
+
+            if (key == "entries")        entries = static_cast<unsigned>(v);
+            else if (key == "ways")      ways = static_cast<unsigned>(v);
+            else if (key == "page")      page = static_cast<unsigned>(v);
+            else if (key == "walk_cost") walk_cost = static_cast<unsigned>(v);
+            else
+                throw std::runtime_error("mmu: unknown setting " + key);
+        }
+
+        if (ways == 0 || entries == 0 || entries % ways != 0)
+            throw std::runtime_error("mmu: entries must be a positive multiple of ways");
+        if (page < MEM_PAGE_SIZE || (page & (page - 1)) != 0)
+            throw std::runtime_error("mmu: page must be a power of two, at least 4096");
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << "entries=" << entries << " ways=" << ways << " page=" << page
+            << " walk=" << (hw_walk ? "hw" : "sw") << '\n';
+    }
+};
+
+//==============================================================
+// MmuStats
+//==============================================================
+struct MmuStats
+{
+    uint64_t accesses       = 0;  // translated accesses
+    uint64_t micro_hits     = 0;  // served by the host micro-TLB
+    uint64_t tlb_hits       = 0;  // found in the TLB proper
+    uint64_t misses         = 0;
+    uint64_t walks          = 0;  // hardware page walks
+    uint64_t refills        = 0;  // refill exceptions taken
+    uint64_t handler_instrs = 0;  // instructions run with EXL set
+    uint64_t tlb_writes     = 0;
+
+    void print(std::ostream & out, const MmuConfig & cfg) const
+    {
+        auto pct = [](uint64_t n, uint64_t d)
+        {
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(2) << (d ? 100.0 * n / d : 0.0) << '%';
+            return ss.str();
+        };
+
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "MMU\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        out << "config       : ";
+        cfg.print(out);
+        out << "accesses     : " << accesses << '\n'
+            << "TLB hits     : " << micro_hits + tlb_hits << " ("
+            << pct(micro_hits + tlb_hits, accesses) << ", " << micro_hits
+            << " in the micro-TLB)\n"
+            << "TLB misses   : " << misses << " (" << pct(misses, accesses) << ")\n";
+        if (cfg.hw_walk)
+        {
+            out << "page walks   : " << walks << " (" << walks * cfg.walk_cost
+                << " cycles at " << cfg.walk_cost << " per walk)\n";
+        }
+        else
+        {
+            out << "refills      : " << refills << " (" << handler_instrs
+                << " handler instructions";
+            if (refills != 0)
+                out << ", " << std::fixed << std::setprecision(1)
+                    << static_cast<double>(handler_instrs) / refills << std::defaultfloat
+                    << " per refill";
+            out << ")\n";
+        }
+        out << "TLB writes   : " << tlb_writes << '\n';
+    }
+};
+
+//==============================================================
+// Mmu
+//==============================================================
+class Mmu
+{
+public:
+    explicit Mmu(const MmuConfig & cfg = MmuConfig())
+    {
+        configure(cfg);
+    }
+
+    void configure(const MmuConfig & cfg)
+    {
+        cfg_   = cfg;
+        shift_ = 0;
+        while ((1u << shift_) < cfg_.page)
+            ++shift_;
+        sets_  = cfg_.entries / cfg_.ways;
+        reset();
+    }
+
+    const MmuConfig & config() const { return cfg_; }
+    const MmuStats & stats() const { return stats_; }
+
+    void reset()
+    {
+        tlb_.assign(cfg_.entries, Entry());
+        victim_.assign(sets_, 0);
+        for (Micro & m : micro_)
+            m = Micro();
+        stats_ = MmuStats();
+        in_refill_ = false;
+    }
+
+    // physical address of data access 'vaddr'. 'epc' is the pc of the
+    // instruction making it, for a refill exception.
+    uint32_t translate(uint32_t vaddr, bool write, Cp0 & cp0, uint32_t epc,
+                       const Memory & mem)
+    {
+        if (cp0.status & Cp0::STATUS_EXL)
+            return vaddr;
+
+        ++stats_.accesses;
+        const uint32_t vpn = vaddr >> shift_;
+        const uint32_t off = vaddr & (cfg_.page - 1u);
+
+        const Micro & m = micro_[vpn & (MICRO_SIZE - 1u)];
+        if (m.vpn == vpn && (m.writable || !write))
+        {
+            ++stats_.micro_hits;
+            return m.pbase | off;
+        }
+
+        int slot = find(vpn);
+        if (slot >= 0)
+        {
+            ++stats_.tlb_hits;
+        }
+        else
+        {
+            ++stats_.misses;
+            if (!cfg_.hw_walk)
+                raise_refill(vaddr, vpn, write, cp0, epc);
+
+            ++stats_.walks;
+            slot = fill(vpn, read_pte(vpn, cp0, mem));
+        }
+
+        const Entry & e = tlb_[slot];
+        if (!(e.lo & PTE_V))
+            mem.raise_fault(vaddr, write ? "TLB invalid (store)" : "TLB invalid (load)");
+        if (write && !(e.lo & PTE_D))
+            mem.raise_fault(vaddr, "TLB modified: store to a read-only page");
+
+        Micro & fresh = micro_[vpn & (MICRO_SIZE - 1u)];
+        fresh.vpn      = vpn;
+        fresh.pbase    = pbase(e.lo);
+        fresh.writable = (e.lo & PTE_D) != 0;
+        return fresh.pbase | off;
+    }
+
+    // the CPU reports each instruction run with EXL set; only those
+    // between a refill and its eret are handler cost (kernel setup
+    // code also runs with EXL set)
+    void count_handler_instr()
+    {
+        if (in_refill_)
+            ++stats_.handler_instrs;
+    }
+
+    void eret() { in_refill_ = false; }
+
+    //----------------------------------------------------------
+    // TLB instructions
+    //----------------------------------------------------------
+    // tlbwr: EntryHi/EntryLo into the next way of EntryHi's set
+    void write_random(const Cp0 & cp0)
+    {
+        uint32_t vpn = cp0.entryhi >> shift_;
+        int slot = find(vpn);
+        if (slot < 0)
+        {
+            uint32_t set = vpn % sets_;
+            slot = static_cast<int>(set * cfg_.ways + victim_[set]);
+            victim_[set] = (victim_[set] + 1) % cfg_.ways;
+        }
+        write_slot(static_cast<uint32_t>(slot), vpn, cp0.entrylo);
+    }
+
+    // tlbwi: EntryHi/EntryLo into entry Index (set * ways + way)
+    void write_indexed(const Cp0 & cp0)
+    {
+        uint32_t slot = cp0.index % cfg_.entries;
+        write_slot(slot, cp0.entryhi >> shift_, cp0.entrylo);
+    }
+
+    // tlbp: Index of EntryHi's page, or INDEX_PROBE if not present
+    void probe(Cp0 & cp0) const
+    {
+        int slot = find(cp0.entryhi >> shift_);
+        cp0.index = slot < 0 ? Cp0::INDEX_PROBE : static_cast<uint32_t>(slot);
+    }
+
+private:
+    static const uint32_t PTE_D = 1u << 2;
+    static const uint32_t PTE_V = 1u << 1;
+    static const uint32_t MICRO_SIZE = 64;
+
+    struct Entry
+    {
+        bool     valid = false;
+        uint32_t vpn   = 0;
+        uint32_t lo    = 0;  // EntryLo layout
+    };
+
+    struct Micro
+    {
+        uint32_t vpn      = UINT32_MAX;
+        uint32_t pbase    = 0;
+        bool     writable = false;
+    };
+
+    MmuConfig cfg_;
+    unsigned  shift_;
+    bool      in_refill_ = false;
+    unsigned  sets_;
+    std::vector< Entry > tlb_;
+    std::vector< uint32_t > victim_;   // round-robin way per set
+    Micro     micro_[MICRO_SIZE];
+    MmuStats  stats_;
+
+    uint32_t pbase(uint32_t lo) const
+    {
+        return ((lo >> 6) << 12) & ~(cfg_.page - 1u);
+    }
+
+    int find(uint32_t vpn) const
+    {
+        uint32_t base = (vpn % sets_) * cfg_.ways;
+        for (uint32_t w = 0; w < cfg_.ways; ++w)
+        {
+            const Entry & e = tlb_[base + w];
+            if (e.valid && e.vpn == vpn)
+                return static_cast<int>(base + w);
+        }
+        return -1;
+    }
+
+    int fill(uint32_t vpn, uint32_t lo)
+    {
+        uint32_t set = vpn % sets_;
+        uint32_t slot = set * cfg_.ways + victim_[set];
+        victim_[set] = (victim_[set] + 1) % cfg_.ways;
+        write_slot(slot, vpn, lo);
+        return static_cast<int>(slot);
+    }
+
+    void write_slot(uint32_t slot, uint32_t vpn, uint32_t lo)
+    {
+        Entry & e = tlb_[slot];
+        if (e.valid)
+            micro_[e.vpn & (MICRO_SIZE - 1u)] = Micro();
+        micro_[vpn & (MICRO_SIZE - 1u)] = Micro();
+
+        e.valid = true;
+        e.vpn   = vpn;
+        e.lo    = lo;
+        ++stats_.tlb_writes;
+    }
+
+    // the guest's entry for 'vpn', or an identity entry before the
+    // guest has installed a table
+    uint32_t read_pte(uint32_t vpn, const Cp0 & cp0, const Memory & mem) const
+    {
+        if (cp0.pte_base == 0)
+            return ((vpn << shift_) >> 12 << 6) | PTE_D | PTE_V;
+        return mem.load32(cp0.pte_base + (vpn << 2));
+    }
+
+    [[noreturn]] void raise_refill(uint32_t vaddr, uint32_t vpn, bool write,
+                                   Cp0 & cp0, uint32_t epc)
+    {
+        if (cp0.ebase == 0)
+            throw std::runtime_error("TLB miss with no refill handler (set EBase)");
+
+        ++stats_.refills;
+        in_refill_ = true;
+        cp0.badvaddr = vaddr;
+        cp0.entryhi  = vpn << shift_;
+        cp0.context  = cp0.pte_base + (vpn << 2);
+        cp0.epc      = epc;
+        cp0.cause    = (write ? Cp0::EXC_TLBS : Cp0::EXC_TLBL) << 2;
+        cp0.status  |= Cp0::STATUS_EXL;
+        throw TlbRefill{cp0.ebase};
+    }
+};
+
+//==============================================================
+// MappedMemory: the block operations of Memory on virtual addresses
+//==============================================================
+// what CPU::do_syscall sees with the MMU on; each run within one
+// virtual page is translated once
+class MappedMemory
+{
+public:
+    MappedMemory(Memory & mem, Mmu & mmu, Cp0 & cp0, uint32_t epc)
+        : mem_(mem), mmu_(mmu), cp0_(cp0), epc_(epc)
+    {}
+
+    void read_block(uint32_t addr, uint8_t * dst, std::size_t n)
+    {
+        while (n != 0)
+        {
+            std::size_t len = chunk(addr, n);
+            mem_.read_block(phys(addr, false), dst, len);
+            addr += static_cast<uint32_t>(len); dst += len; n -= len;
+        }
+    }
+
+    void write_block(uint32_t addr, const uint8_t * src, std::size_t n)
+    {
+        while (n != 0)
+        {
+            std::size_t len = chunk(addr, n);
+            mem_.write_block(phys(addr, true), src, len);
+            addr += static_cast<uint32_t>(len); src += len; n -= len;
+        }
+    }
+
+    void fill(uint32_t addr, uint8_t val, std::size_t n)
+    {
+        while (n != 0)
+        {
+            std::size_t len = chunk(addr, n);
+            mem_.fill(phys(addr, true), val, len);
+            addr += static_cast<uint32_t>(len); n -= len;
+        }
+    }
+
+    // translate every page of [addr, addr+n) now, so a refill is raised
+    // before the caller does anything it cannot repeat (like consuming
+    // a line of input) when eret re-executes the syscall
+    void probe(uint32_t addr, std::size_t n, bool write)
+    {
+        while (n != 0)
+        {
+            std::size_t len = chunk(addr, n);
+            phys(addr, write);
+            addr += static_cast<uint32_t>(len); n -= len;
+        }
+    }
+
+    std::size_t find_byte(uint32_t addr, uint8_t val, std::size_t max_len)
+    {
+        std::size_t done = 0;
+        while (done < max_len)
+        {
+            std::size_t len = chunk(addr, max_len - done);
+            std::size_t at = mem_.find_byte(phys(addr, false), val, len);
+            if (at < len)
+                return done + at;
+            addr += static_cast<uint32_t>(len); done += len;
+        }
+        return max_len;
+    }
+
+private:
+    Memory & mem_;
+    Mmu &    mmu_;
+    Cp0 &    cp0_;
+    uint32_t epc_;
+
+    uint32_t phys(uint32_t vaddr, bool write)
+    {
+        return mmu_.translate(vaddr, write, cp0_, epc_, mem_);
+    }
+
+    // bytes from 'addr' to the end of its virtual page, at most n
+    std::size_t chunk(uint32_t addr, std::size_t n) const
+    {
+        std::size_t left = mmu_.config().page - (addr & (mmu_.config().page - 1u));
+        return left < n ? left : n;
+    }
+};
+
+#endif // MMU_H
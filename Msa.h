@@ -0,0 +1,221 @@
+// File  : Msa.h
+// Author: Cole Schwandt
+//
+// Guest SIMD unit: a subset of the MIPS SIMD Architecture (MSA).
+//
+// There are 32 vector registers $w0..$w31 of 128 bits. Only the word
+// data format is implemented, so each register is four 32-bit lanes,
+// and every lane operation is one host vector instruction on a u32x4
+// (Simd.h). Encodings are the real MSA ones, so a listing disassembled
+// elsewhere reads the same.
+//
+//   addv.w subv.w mulv.w       wd, ws, wt   lane add, subtract, multiply
+//   sll.w  srl.w  sra.w        wd, ws, wt   shift each lane by wt mod 32
+//   ceq.w clt_s.w clt_u.w
+//   cle_s.w cle_u.w            wd, ws, wt   lane = all ones if true, else 0
+//   and.v or.v nor.v xor.v     wd, ws, wt   bitwise over all 128 bits
+//   ld.w  st.w                 wd, off(rs)  16 bytes; off a multiple of 4
+//   fill.w                     wd, rs       every lane = rs
+//   splati.w                   wd, ws[n]    every lane = ws lane n
+//   copy_s.w                   rd, ws[n]    rd = ws lane n
+//
+// Lane 0 is the word at the lowest address. Guest memory is big-endian,
+// so ld.w and st.w move the 16 bytes as one block and swap the bytes of
+// each lane. They need a 4-byte aligned address.
+
+#ifndef MSA_H
+#define MSA_H
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "mybitlib.h"
+#include "Constants.h"
+#include "RegisterFile.h"
+#include "Simd.h"
+
+//==============================================================
+// VectorRegisterFile: $w0..$w31
+//==============================================================
+class VectorRegisterFile
+{
+public:
+    VectorRegisterFile()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        std::memset(w_, 0, sizeof w_);
+        dirty_ = ALL_DIRTY;
+    }
+
+    u32x4 read(uint8_t i) const { return load4(w_[i]); }
+
+    void write(uint8_t i, u32x4 v)
+    {
+        store4(w_[i], v);
+        dirty_ |= 1u << i;
+        ++write_gen_;
+    }
+
+    uint32_t lane(uint8_t i, unsigned n) const { return w_[i][n & 3]; }
+
+    // bumped by every write; equal generations mean no vector register
+    // was written in between (see Memory::write_generation)
+    uint64_t write_generation() const { return write_gen_; }
+
+    // registers written since the last clear_dirty(), bit i for $wi
+    uint32_t dirty_mask() const { return dirty_; }
+    void clear_dirty() { dirty_ = 0; }
+
+    // registers with any lane set, one per line, lane 0 first
+    void print(std::ostream & out) const
+    {
+        bool any = false;
+        for (int i = 0; i < 32; ++i)
+        {
+            if ((w_[i][0] | w_[i][1] | w_[i][2] | w_[i][3]) == 0)
+                continue;
+            any = true;
+            out << "$w" << std::left << std::setw(3) << i << std::right
+                << std::hex << std::setfill('0');
+            for (int n = 0; n < 4; ++n)
+                out << " 0x" << std::setw(8) << w_[i][n];
+            out << std::dec << std::setfill(' ') << '\n';
+        }
+        if (!any)
+            out << "all vector registers are zero\n";
+    }
+
+private:
+    static const uint32_t ALL_DIRTY = 0xFFFFFFFFu;
+
+    alignas(16) uint32_t w_[32][4];
+    uint32_t dirty_;
+    uint64_t write_gen_ = 0;
+};
+
+//==============================================================
+// execution
+//==============================================================
+// run one OP_MSA instruction. a template over the memory type, so
+// ld.w/st.w go through MappedMemory when the MMU is on.
+template < typename Mem >
+void msa_execute(uint32_t word, RegisterFile & regs, VectorRegisterFile & vregs, Mem & mem)
+{
+    const uint8_t wt    = (word >> 16) & mask_bits(5);
+    const uint8_t ws    = (word >> 11) & mask_bits(5);
+    const uint8_t wd    = (word >>  6) & mask_bits(5);
+    const uint8_t minor =  word        & mask_bits(6);
+
+    switch (minor)
+    {
+        case MSA_ADD:
+        case MSA_MUL:
+        case MSA_SHIFT:
+        case MSA_CMP:
+        {
+            if (((word >> 21) & 3) != MSA_DF_W)
+                throw std::runtime_error("MSA: only the .w data format is supported");
+
+            const uint32_t operation = (word >> 23) & mask_bits(3);
+            const u32x4 a = vregs.read(ws);
+            const u32x4 b = vregs.read(wt);
+            u32x4 r;
+
+            if (minor == MSA_ADD && operation == 0)        r = add4(a, b);
+            else if (minor == MSA_ADD && operation == 1)   r = sub4(a, b);
+            else if (minor == MSA_MUL && operation == 0)   r = mul4(a, b);
+            else if (minor == MSA_SHIFT && operation == 0) r = sllv4(a, b);
+            else if (minor == MSA_SHIFT && operation == 1) r = srav4(a, b);
+            else if (minor == MSA_SHIFT && operation == 2) r = srlv4(a, b);
+            else if (minor == MSA_CMP && operation == 0)   r = eq4(a, b);
+            else if (minor == MSA_CMP && operation == 2)   r = lt4(a, b);
+            else if (minor == MSA_CMP && operation == 3)   r = ltu4(a, b);
+            else if (minor == MSA_CMP && operation == 4)   r = not4(lt4(b, a));
+            else if (minor == MSA_CMP && operation == 5)   r = not4(ltu4(b, a));
+            else
+                throw std::runtime_error("Unknown MSA instruction");
+
+            vregs.write(wd, r);
+            break;
+        }
+
+        case MSA_VEC:
+        {
+            const uint32_t op5 = (word >> 21) & mask_bits(5);
+            if (op5 < 8)
+            {
+                const u32x4 a = vregs.read(ws);
+                const u32x4 b = vregs.read(wt);
+                switch (op5)
+                {
+                    case 0: vregs.write(wd, and4(a, b));       break;
+                    case 1: vregs.write(wd, or4(a, b));        break;
+                    case 2: vregs.write(wd, not4(or4(a, b)));  break;
+                    case 3: vregs.write(wd, xor4(a, b));       break;
+                    default:
+                        throw std::runtime_error("Unknown MSA instruction");
+                }
+                break;
+            }
+
+            // 2R format: fill.w is the only one
+            if (((word >> 18) & mask_bits(8)) != 0xC0 || ((word >> 16) & 3) != MSA_DF_W)
+                throw std::runtime_error("Unknown MSA instruction");
+            vregs.write(wd, splat4(regs.readU(ws)));
+            break;
+        }
+
+        case MSA_ELM:
+        {
+            const uint32_t op4 = (word >> 22) & mask_bits(4);
+            const uint32_t dfn = (word >> 16) & mask_bits(6);
+            if ((dfn & 0x3C) != 0x30)
+                throw std::runtime_error("MSA: only the .w data format is supported");
+            const unsigned n = dfn & 3;
+
+            if (op4 == 1)      // splati.w
+                vregs.write(wd, splat4(vregs.lane(ws, n)));
+            else if (op4 == 2) // copy_s.w: wd is a GPR here
+                regs.writeU(wd, vregs.lane(ws, n));
+            else
+                throw std::runtime_error("Unknown MSA instruction");
+            break;
+        }
+
+        case MSA_LD_W:
+        case MSA_ST_W:
+        {
+            // s10 (bits 25..16) counts words; rs sits where ws does
+            int32_t s10 = static_cast<int32_t>(word << 6) >> 22;
+            uint32_t addr = regs.readU(ws) + static_cast<uint32_t>(s10 * 4);
+            if (addr & 0x3)
+                throw std::runtime_error(minor == MSA_LD_W ? "MIPS ld.w: unaligned address"
+                                                           : "MIPS st.w: unaligned address");
+
+            alignas(16) uint32_t buf[4];
+            if (minor == MSA_LD_W)
+            {
+                mem.read_block(addr, reinterpret_cast<uint8_t *>(buf), sizeof buf);
+                vregs.write(wd, bswap4(load4(buf)));
+            }
+            else
+            {
+                store4(buf, bswap4(vregs.read(wd)));
+                mem.write_block(addr, reinterpret_cast<const uint8_t *>(buf), sizeof buf);
+            }
+            break;
+        }
+
+        default:
+            throw std::runtime_error("Unknown MSA instruction");
+    }
+}
+
+#endif // MSA_H
@@ -0,0 +1,216 @@
+// File  : NativeRuntime.h
+// Author: Cole Schwandt
+//
+// Opt-in syscalls that run common C library routines on the host.
+//
+// Guest programs often spend most of their instructions in byte loops
+// such as strlen, strcmp and memcpy. With the native runtime on
+// (`nativert on` in the REPL, --native-rt headless), syscall codes 100
+// to 105 do that work directly over the memory model. rt.s in the repo
+// wraps each one in a MIPS routine with the usual calling convention.
+//
+//   100 strlen   $a0 = s                  -> $v0 = length
+//   101 strcmp   $a0 = a, $a1 = b         -> $v0 = -1, 0 or 1
+//   102 memcpy   $a0 = dst, $a1 = src,
+//                $a2 = n                  -> $v0 = dst (overlap is safe)
+//   103 memset   $a0 = dst, $a1 = byte,
+//                $a2 = n                  -> $v0 = dst
+//   104 atoi     $a0 = s                  -> $v0 = value
+//   105 itoa     $a0 = value, $a1 = buf,
+//                $a2 = base (2..36)       -> $v0 = length (without NUL)
+//
+// Every access goes through the block operations of the memory type
+// (Memory, or MappedMemory with the MMU on). Those check each page
+// span against the segments, so a bad pointer faults at the first
+// out-of-bounds byte, like the guest loop would have. Strings are
+// scanned in bounded chunks, so a string that ends just before the end
+// of a segment never reads past it.
+//
+// With the MMU on, a TLB refill re-executes the whole syscall after
+// eret. The calls that write probe every page they touch first, so a
+// refill is taken before anything is written: a half-done overlapping
+// memcpy would otherwise re-run over its own output.
+
+#ifndef NATIVE_RUNTIME_H
+#define NATIVE_RUNTIME_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "Constants.h"
+#include "RegisterFile.h"
+
+enum NativeRuntimeCode : uint32_t
+{
+    RT_STRLEN = 100,
+    RT_STRCMP = 101,
+    RT_MEMCPY = 102,
+    RT_MEMSET = 103,
+    RT_ATOI   = 104,
+    RT_ITOA   = 105,
+};
+
+inline bool is_native_runtime_code(uint32_t code)
+{
+    return code >= RT_STRLEN && code <= RT_ITOA;
+}
+
+// run runtime service $v0 over 'mem'; the code must satisfy
+// is_native_runtime_code
+template < typename Mem >
+void native_runtime_call(RegisterFile & regs, Mem & mem)
+{
+    const std::size_t CHUNK = 256;
+    const uint32_t a0 = regs.readU(4);
+    const uint32_t a1 = regs.readU(5);
+    const uint32_t a2 = regs.readU(6);
+
+    switch (regs.readU(2))
+    {
+        case RT_STRLEN:
+        {
+            std::size_t len = mem.find_byte(a0, 0, SIZE_MAX);
+            regs.writeU(2, static_cast<uint32_t>(len));
+            break;
+        }
+
+        case RT_STRCMP:
+        {
+            uint8_t ba[CHUNK], bb[CHUNK];
+            uint32_t pa = a0, pb = a1;
+            int result = 0;
+            for (;;)
+            {
+                // never read past the terminator of the shorter string
+                std::size_t la = mem.find_byte(pa, 0, CHUNK);
+                std::size_t lb = mem.find_byte(pb, 0, CHUNK);
+                std::size_t n = (la < lb ? la : lb);
+                n = (n < CHUNK ? n + 1 : CHUNK);
+
+                mem.read_block(pa, ba, n);
+                mem.read_block(pb, bb, n);
+                int c = std::memcmp(ba, bb, n);
+                if (c != 0)
+                {
+                    result = (c < 0 ? -1 : 1);
+                    break;
+                }
+                if (ba[n - 1] == 0)
+                    break; // equal through both terminators
+                pa += static_cast<uint32_t>(n);
+                pb += static_cast<uint32_t>(n);
+            }
+            regs.writeS(2, result);
+            break;
+        }
+
+        case RT_MEMCPY:
+        {
+            uint8_t buf[MEM_PAGE_SIZE];
+            std::size_t n = a2;
+            // copy backwards when dst overlaps the tail of src
+            bool backward = a0 > a1 && a0 - a1 < n;
+            mem.probe(a1, n, false);
+            mem.probe(a0, n, true);
+            std::size_t done = 0;
+            while (done < n)
+            {
+                std::size_t len = n - done < sizeof buf ? n - done : sizeof buf;
+                uint32_t off = static_cast<uint32_t>(backward ? n - done - len : done);
+                mem.read_block(a1 + off, buf, len);
+                mem.write_block(a0 + off, buf, len);
+                done += len;
+            }
+            regs.writeU(2, a0);
+            break;
+        }
+
+        case RT_MEMSET:
+        {
+            mem.probe(a0, a2, true);
+            mem.fill(a0, static_cast<uint8_t>(a1), a2);
+            regs.writeU(2, a0);
+            break;
+        }
+
+        case RT_ATOI:
+        {
+            // leading blanks, an optional sign, then decimal digits;
+            // wraps at 32 bits
+            uint8_t buf[CHUNK];
+            uint32_t p = a0;
+            uint32_t value = 0;
+            bool neg = false;
+            int state = 0; // 0: blanks, 1: after sign, 2: digits
+            bool done = false;
+            while (!done)
+            {
+                std::size_t len = mem.find_byte(p, 0, CHUNK);
+                std::size_t n = (len < CHUNK ? len + 1 : CHUNK);
+                mem.read_block(p, buf, n);
+                for (std::size_t i = 0; i < n && !done; ++i)
+                {
+                    uint8_t c = buf[i];
+                    if (state == 0 && (c == ' ' || c == '\t' || c == '\n' ||
+                                       c == '\r' || c == '\v' || c == '\f'))
+                        continue;
+                    if (state == 0 && (c == '-' || c == '+'))
+                    {
+                        neg = (c == '-');
+                        state = 1;
+                        continue;
+                    }
+                    if (c >= '0' && c <= '9')
+                    {
+                        value = value * 10u + (c - '0');
+                        state = 2;
+                        continue;
+                    }
+                    done = true;
+                }
+                p += static_cast<uint32_t>(n);
+            }
+            regs.writeU(2, neg ? 0u - value : value);
+            break;
+        }
+
+        case RT_ITOA:
+        {
+            if (a2 < 2 || a2 > 36)
+                throw std::runtime_error("itoa: base must be 2..36");
+
+            // negative values are signed only in base 10, as in most
+            // C library itoa implementations
+            bool neg = (a2 == 10 && static_cast<int32_t>(a0) < 0);
+            uint32_t v = neg ? 0u - a0 : a0;
+
+            char digits[40];
+            int n = 0;
+            do
+            {
+                uint32_t d = v % a2;
+                digits[n++] = static_cast<char>(d < 10 ? '0' + d : 'a' + d - 10);
+                v /= a2;
+            } while (v != 0);
+
+            std::string text;
+            if (neg)
+                text += '-';
+            while (n > 0)
+                text += digits[--n];
+
+            mem.probe(a1, text.size() + 1, true);
+            mem.write_block(a1, reinterpret_cast<const uint8_t *>(text.c_str()),
+                            text.size() + 1);
+            regs.writeU(2, static_cast<uint32_t>(text.size()));
+            break;
+        }
+
+        default:
+            throw std::runtime_error("Unknown native runtime syscall");
+    }
+}
+
+#endif // NATIVE_RUNTIME_H
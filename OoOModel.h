@@ -0,0 +1,544 @@
+// File  : OoOModel.h
+// Author: Cole Schwandt
+//
+// Timing model of a Tomasulo-style out-of-order superscalar core.
+//
+// The functional CPU stays the oracle: it hands every instruction to
+// the model just before executing it, so the model sees the real
+// instruction stream with real load/store addresses and never has to
+// undo anything (branch prediction is perfect). Each instruction is
+// timed once, in program order, through four stages:
+//
+//   dispatch  in order, 'width' per cycle, needs a free ROB entry and
+//             a free reservation station of its class
+//   issue     once its operands are ready and a functional unit and
+//             an issue slot are free in that cycle
+//   complete  issue + unit latency (loads: + cache hit or miss time)
+//   commit    in order, 'width' per cycle, not before completion
+//
+// Reservation stations free up at issue, ROB entries at commit. Issue
+// slots and units are booked in per-cycle calendars, so a younger
+// instruction may take a cycle before an older one's. A load waits for
+// the last store to its word (store-to-load forwarding). Syscalls
+// serialize: they dispatch into an empty ROB and nothing dispatches
+// until they commit.
+//
+// Whenever a constraint pushes an instruction later than it could
+// otherwise go, the delay is charged to that structure; the report
+// lists these stall cycles next to the IPC.
+
+#ifndef OOO_MODEL_H
+#define OOO_MODEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "RegisterFile.h"
+#include "RunStats.h"
+#include "Dataflow.h"
+
+//==============================================================
+// OoOConfig
+//==============================================================
+struct OoOConfig
+{
+    unsigned width     = 4;    // dispatch, issue and commit per cycle
+    unsigned rob       = 64;   // reorder buffer entries
+
+    unsigned rs_alu    = 16;   // reservation stations per class
+    unsigned rs_muldiv = 8;
+    unsigned rs_mem    = 16;
+
+    unsigned alu_units = 3;    // functional units
+    unsigned mul_units = 1;    // pipelined
+    unsigned div_units = 1;    // busy for the whole division
+    unsigned mem_ports = 2;
+
+    unsigned alu_lat   = 1;    // latencies in cycles
+    unsigned mul_lat   = 3;
+    unsigned div_lat   = 20;
+    unsigned load_hit  = 3;    // address generation included
+    unsigned load_miss = 30;
+    unsigned store_lat = 1;
+
+    unsigned cache_lines = 512; // direct-mapped data cache
+    unsigned line_bytes  = 64;
+
+    // apply "key=value,key=value"; throws on an unknown key or a bad
+    // value
+    void parse(const std::string & spec)
+    {
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty())
+                continue;
+            std::size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                throw std::runtime_error("ooo: expected key=value, got '" + item + "'");
+
+            std::string key = item.substr(0, eq);
+            unsigned long v = 0;
+            try
+            {
+                v = std::stoul(item.substr(eq + 1));
+            }
+            catch (const std::exception &)
+            {
+                throw std::runtime_error("ooo: bad value for " + key);
+            }
+
+            unsigned * field = find(key);
+            if (field == nullptr)
+                throw std::runtime_error("ooo: unknown setting " + key);
+            if (v == 0)
+                throw std::runtime_error("ooo: " + key + " must be positive");
+            *field = static_cast<unsigned>(v);
+        }
+
+        if ((cache_lines & (cache_lines - 1)) != 0 || (line_bytes & (line_bytes - 1)) != 0)
+            throw std::runtime_error("ooo: cache_lines and line_bytes must be powers of two");
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << "width=" << width << " rob=" << rob
+            << " rs=" << rs_alu << '/' << rs_muldiv << '/' << rs_mem
+            << " units=" << alu_units << '/' << mul_units << '/' << div_units
+            << '/' << mem_ports
+            << " lat=" << alu_lat << '/' << mul_lat << '/' << div_lat
+            << '/' << load_hit << '/' << load_miss
+            << " cache=" << cache_lines << 'x' << line_bytes << "B\n";
+    }
+
+private:
+    unsigned * find(const std::string & key)
+    {
+        struct Field { const char * name; unsigned OoOConfig::* member; };
+        static const Field FIELDS[] = {
+            { "width", &OoOConfig::width },         { "rob", &OoOConfig::rob },
+            { "rs_alu", &OoOConfig::rs_alu },       { "rs_muldiv", &OoOConfig::rs_muldiv },
+            { "rs_mem", &OoOConfig::rs_mem },       { "alu_units", &OoOConfig::alu_units },
+            { "mul_units", &OoOConfig::mul_units }, { "div_units", &OoOConfig::div_units },
+            { "mem_ports", &OoOConfig::mem_ports }, { "alu_lat", &OoOConfig::alu_lat },
+            { "mul_lat", &OoOConfig::mul_lat },     { "div_lat", &OoOConfig::div_lat },
+            { "load_hit", &OoOConfig::load_hit },   { "load_miss", &OoOConfig::load_miss },
+            { "store_lat", &OoOConfig::store_lat }, { "cache_lines", &OoOConfig::cache_lines },
+            { "line_bytes", &OoOConfig::line_bytes },
+        };
+        for (const Field & f : FIELDS)
+        {
+            if (key == f.name)
+                return &(this->*f.member);
+        }
+        return nullptr;
+    }
+};
+
+//==============================================================
+// OoOReport
+//==============================================================
+enum OoOStall
+{
+    STALL_WIDTH,       // dispatch bandwidth
+    STALL_ROB,         // reorder buffer full
+    STALL_RS_ALU,      // reservation stations full
+    STALL_RS_MULDIV,
+    STALL_RS_MEM,
+    STALL_SERIALIZE,   // waiting around a syscall
+    STALL_OPERANDS,    // issue waiting for source operands
+    STALL_FU_ALU,      // issue waiting for a free unit
+    STALL_FU_MUL,
+    STALL_FU_DIV,
+    STALL_FU_MEM,
+    STALL_ISSUE,       // issue slots of the cycle used up
+    STALL_COMMIT,      // commit bandwidth
+    NUM_OOO_STALLS
+};
+
+static const char * const OOO_STALL_NAMES[NUM_OOO_STALLS] = {
+    "dispatch width", "rob full", "rs full (alu)", "rs full (mul/div)",
+    "rs full (mem)", "serialize", "operands", "fu busy (alu)",
+    "fu busy (mul)", "fu busy (div)", "fu busy (mem)", "issue width",
+    "commit width"
+};
+
+struct OoOReport
+{
+    uint64_t instructions = 0;
+    uint64_t cycles       = 0;
+    uint64_t loads        = 0;
+    uint64_t load_misses  = 0;
+    uint64_t forwarded    = 0;  // loads that waited on an in-flight store
+    uint64_t stalls[NUM_OOO_STALLS] = {};
+
+    double ipc() const
+    {
+        return cycles ? static_cast<double>(instructions) / cycles : 0.0;
+    }
+
+    void print(std::ostream & out, const OoOConfig & cfg) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "OUT-OF-ORDER MODEL\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        out << "config       : ";
+        cfg.print(out);
+        out << "instructions : " << instructions << '\n'
+            << "cycles       : " << cycles << '\n'
+            << "IPC          : " << std::fixed << std::setprecision(3) << ipc()
+            << std::defaultfloat << '\n'
+            << "loads        : " << loads << " (" << load_misses << " missed, "
+            << forwarded << " after an in-flight store)\n";
+        out << "stall cycles : (summed over instructions)\n";
+        for (int s = 0; s < NUM_OOO_STALLS; ++s)
+        {
+            if (stalls[s] == 0)
+                continue;
+            out << "  " << std::left << std::setw(18) << OOO_STALL_NAMES[s]
+                << std::right << std::setw(12) << stalls[s] << '\n';
+        }
+    }
+};
+
+//==============================================================
+// OoOModel
+//==============================================================
+class OoOModel
+{
+public:
+    explicit OoOModel(const OoOConfig & cfg = OoOConfig())
+    {
+        configure(cfg);
+    }
+
+    void configure(const OoOConfig & cfg)
+    {
+        cfg_ = cfg;
+
+        // a calendar must span every cycle the instructions in flight
+        // can still book: about rob entries times the longest latency
+        unsigned longest = std::max(std::max(cfg_.div_lat, cfg_.load_miss),
+                                    std::max(cfg_.mul_lat, cfg_.alu_lat)) + 2;
+        std::size_t span = 1024;
+        while (span < static_cast<std::size_t>(cfg_.rob) * longest * 2)
+            span <<= 1;
+
+        issue_.init(span);
+        for (Calendar & c : units_)
+            c.init(span);
+        unit_count_[FU_ALU] = cfg_.alu_units;
+        unit_count_[FU_MUL] = cfg_.mul_units;
+        unit_count_[FU_DIV] = cfg_.div_units;
+        unit_count_[FU_MEM] = cfg_.mem_ports;
+        rs_size_[RS_ALU]    = cfg_.rs_alu;
+        rs_size_[RS_MULDIV] = cfg_.rs_muldiv;
+        rs_size_[RS_MEM]    = cfg_.rs_mem;
+
+        reset();
+    }
+
+    const OoOConfig & config() const { return cfg_; }
+
+    void reset()
+    {
+        for (uint64_t & r : reg_ready_)
+            r = 0;
+        rob_commit_.assign(cfg_.rob, 0);
+        for (auto & rs : rs_)
+            rs = RsQueue();
+        cache_tags_.assign(cfg_.cache_lines, UINT32_MAX);
+        for (StoreEntry & s : stores_)
+            s = StoreEntry();
+
+        issue_.clear();
+        for (Calendar & c : units_)
+            c.clear();
+
+        disp_cycle_  = 0;
+        disp_count_  = 0;
+        commit_cycle_ = 0;
+        commit_count_ = 0;
+        serial_until_ = 0;
+        report_ = OoOReport();
+    }
+
+    // time 'word', about to execute with register state 'regs'
+    void observe(uint32_t word, const RegisterFile & regs)
+    {
+        DepOperands d;
+        uint8_t base = 0;
+        int32_t offset = 0;
+        if (!decode_deps(word, d, base, offset))
+            return;
+
+        uint32_t bytes = 0;
+        InstrClass ic = classify_instr(word, bytes);
+        Unit unit = unit_of(word, ic);
+        Rs   rs   = (unit == FU_ALU) ? RS_ALU : (unit == FU_MEM) ? RS_MEM : RS_MULDIV;
+        const uint64_t seq = report_.instructions++;
+        uint64_t * stalls = report_.stalls;
+
+        //------------------------------------------------------
+        // dispatch
+        //------------------------------------------------------
+        uint64_t t = disp_cycle_;
+        if (disp_count_ == cfg_.width)
+        {
+            ++t;
+            ++stalls[STALL_WIDTH];
+        }
+
+        // the ROB entry this instruction reuses frees when its last
+        // occupant commits
+        uint64_t & rob_slot = rob_commit_[seq % cfg_.rob];
+        if (seq >= cfg_.rob && rob_slot + 1 > t)
+        {
+            stalls[STALL_ROB] += rob_slot + 1 - t;
+            t = rob_slot + 1;
+        }
+
+        RsQueue & q = rs_[rs];
+        while (!q.empty() && q.top() < t)
+            q.pop();
+        if (q.size() >= rs_size_[rs])
+        {
+            uint64_t free_at = q.top() + 1;
+            stalls[STALL_RS_ALU + rs] += free_at - t;
+            t = free_at;
+            while (!q.empty() && q.top() < t)
+                q.pop();
+        }
+
+        const bool serial = (ic == IC_SYSCALL);
+        uint64_t fence = serial ? std::max(serial_until_, commit_cycle_ + 1) : serial_until_;
+        if (fence > t)
+        {
+            stalls[STALL_SERIALIZE] += fence - t;
+            t = fence;
+        }
+
+        if (t != disp_cycle_)
+        {
+            disp_cycle_ = t;
+            disp_count_ = 0;
+        }
+        ++disp_count_;
+        const uint64_t dispatch = t;
+
+        //------------------------------------------------------
+        // issue
+        //------------------------------------------------------
+        uint64_t ready = dispatch + 1;
+        for (uint8_t k = 0; k < d.nsrc; ++k)
+            ready = std::max(ready, reg_ready_[d.src[k]]);
+
+        uint32_t addr = 0;
+        StoreEntry * st = nullptr;
+        if (d.load || d.store)
+        {
+            addr = regs.readU(base) + static_cast<uint32_t>(offset);
+            st = &stores_[(addr >> 2) & (STORE_TABLE - 1)];
+            if (d.load && st->word == (addr >> 2) && st->ready > ready)
+            {
+                ready = st->ready;
+                ++report_.forwarded;
+            }
+        }
+        stalls[STALL_OPERANDS] += ready - (dispatch + 1);
+
+        const unsigned busy = (unit == FU_DIV) ? cfg_.div_lat : 1;
+        uint64_t issue = ready;
+        for (;;)
+        {
+            if (!units_[unit].has_room(issue, busy, unit_count_[unit]))
+            {
+                ++stalls[STALL_FU_ALU + unit];
+                ++issue;
+            }
+            else if (!issue_.has_room(issue, 1, cfg_.width))
+            {
+                ++stalls[STALL_ISSUE];
+                ++issue;
+            }
+            else
+                break;
+        }
+        units_[unit].book(issue, busy);
+        issue_.book(issue, 1);
+        q.push(issue);
+
+        //------------------------------------------------------
+        // complete
+        //------------------------------------------------------
+        uint64_t lat = latency(unit, d, addr);
+        const uint64_t complete = issue + lat;
+        for (uint8_t k = 0; k < d.ndst; ++k)
+            reg_ready_[d.dst[k]] = complete;
+        if (d.store)
+        {
+            st->word  = addr >> 2;
+            st->ready = complete;
+        }
+
+        //------------------------------------------------------
+        // commit
+        //------------------------------------------------------
+        uint64_t c = std::max(complete, commit_cycle_);
+        if (c == commit_cycle_ && commit_count_ == cfg_.width)
+        {
+            ++c;
+            ++stalls[STALL_COMMIT];
+        }
+        if (c != commit_cycle_)
+        {
+            commit_cycle_ = c;
+            commit_count_ = 0;
+        }
+        ++commit_count_;
+        rob_slot = c;
+        if (serial)
+            serial_until_ = c + 1;
+
+        report_.cycles = commit_cycle_ + 1;
+    }
+
+    const OoOReport & report() const { return report_; }
+
+private:
+    enum Unit { FU_ALU, FU_MUL, FU_DIV, FU_MEM, NUM_UNITS };
+    enum Rs   { RS_ALU, RS_MULDIV, RS_MEM, NUM_RS };
+
+    // per-cycle booking counts in a ring; a slot whose tag is not the
+    // cycle asked about holds an older cycle and counts as empty
+    class Calendar
+    {
+    public:
+        void init(std::size_t span)
+        {
+            tag_.assign(span, UINT64_MAX);
+            used_.assign(span, 0);
+            mask_ = span - 1;
+        }
+
+        void clear()
+        {
+            std::fill(tag_.begin(), tag_.end(), UINT64_MAX);
+        }
+
+        // room for one more booking in each of cycles [c, c + n)
+        bool has_room(uint64_t c, unsigned n, unsigned limit) const
+        {
+            for (uint64_t k = c; k < c + n; ++k)
+            {
+                std::size_t i = k & mask_;
+                if (tag_[i] == k && used_[i] >= limit)
+                    return false;
+            }
+            return true;
+        }
+
+        void book(uint64_t c, unsigned n)
+        {
+            for (uint64_t k = c; k < c + n; ++k)
+            {
+                std::size_t i = k & mask_;
+                if (tag_[i] != k)
+                {
+                    tag_[i] = k;
+                    used_[i] = 0;
+                }
+                ++used_[i];
+            }
+        }
+
+    private:
+        std::vector< uint64_t > tag_;
+        std::vector< uint32_t > used_;
+        std::size_t mask_ = 0;
+    };
+
+    // issue cycles of a class's reservation station occupants, earliest
+    // on top
+    typedef std::priority_queue< uint64_t, std::vector< uint64_t >,
+                                 std::greater< uint64_t > > RsQueue;
+
+    // last store per word, direct mapped; an evicted store is long done
+    struct StoreEntry
+    {
+        uint32_t word  = UINT32_MAX;
+        uint64_t ready = 0;
+    };
+    static const std::size_t STORE_TABLE = 1024;
+
+    OoOConfig cfg_;
+    uint64_t  reg_ready_[DepOperands::NUM_REGS];
+    std::vector< uint64_t > rob_commit_;      // commit cycle per ROB slot
+    RsQueue   rs_[NUM_RS];
+    unsigned  rs_size_[NUM_RS];
+    Calendar  issue_;
+    Calendar  units_[NUM_UNITS];
+    unsigned  unit_count_[NUM_UNITS];
+    std::vector< uint32_t > cache_tags_;
+    StoreEntry stores_[STORE_TABLE];
+
+    uint64_t disp_cycle_;
+    unsigned disp_count_;
+    uint64_t commit_cycle_;
+    unsigned commit_count_;
+    uint64_t serial_until_;
+    OoOReport report_;
+
+    static Unit unit_of(uint32_t word, InstrClass ic)
+    {
+        if (ic == IC_LOAD || ic == IC_STORE)
+            return FU_MEM;
+        if (ic != IC_MULDIV)
+            return FU_ALU;
+
+        uint32_t op    = (word >> 26) & 0x3Fu;
+        uint32_t funct =  word        & 0x3Fu;
+        if (op == OP_RTYPE && (funct == FUNCT_DIV || funct == FUNCT_DIVU))
+            return FU_DIV;
+        return FU_MUL;
+    }
+
+    uint64_t latency(Unit unit, const DepOperands & d, uint32_t addr)
+    {
+        switch (unit)
+        {
+            case FU_MUL: return cfg_.mul_lat;
+            case FU_DIV: return cfg_.div_lat;
+            case FU_MEM:
+            {
+                uint32_t line = addr / cfg_.line_bytes;
+                uint32_t & tag = cache_tags_[line & (cfg_.cache_lines - 1)];
+                bool hit = (tag == line);
+                tag = line; // write-allocate
+                if (d.store)
+                    return cfg_.store_lat;
+                ++report_.loads;
+                if (hit)
+                    return cfg_.load_hit;
+                ++report_.load_misses;
+                return cfg_.load_miss;
+            }
+            default:
+                return cfg_.alu_lat;
+        }
+    }
+};
+
+#endif // OOO_MODEL_H
@@ -0,0 +1,380 @@
+// File  : PageCompression.h
+// Author: Cole Schwandt
+//
+// Compressed storage for memory pages nobody is using.
+//
+// An interactive session spends most of its life waiting for the next
+// line, and its pages sit untouched meanwhile. Memory::compress_idle
+// turns such pages into cold blobs and brings them back on the next
+// access (see Memory.h). A page's image is its bytes followed by its
+// mapped-byte bitmap.
+//
+// Two methods, used alone or together:
+//   lz     a small LZ77 codec (LZ4-style sequences: a token with the
+//          literal and match lengths, the literals, a 16-bit offset).
+//          Sparse and zero-filled pages shrink to a few dozen bytes.
+//   dedup  blobs are interned by content hash in one store for the
+//          whole process, so identical pages of any number of machines
+//          (the same program's data, an untouched stack page) share one
+//          blob. The store holds weak references, so a blob goes away
+//          with the last page using it.
+
+#ifndef PAGE_COMPRESSION_H
+#define PAGE_COMPRESSION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Constants.h"
+
+// bytes, then one mapped bit per byte
+static const std::size_t PAGE_IMAGE_BYTES = MEM_PAGE_SIZE + MEM_PAGE_SIZE / 8;
+
+//==============================================================
+// LZ codec
+//==============================================================
+// append 'len' in the LZ4 length encoding: the first 15 are in the
+// token, then bytes of 255 and a final byte below 255
+inline void lz_put_length(std::vector< uint8_t > & out, std::size_t len)
+{
+    for (; len >= 255; len -= 255)
+        out.push_back(255);
+    out.push_back(static_cast<uint8_t>(len));
+}
+
+// compress src[0, n) into 'out' (replacing its contents)
+inline void lz_compress(const uint8_t * src, std::size_t n, std::vector< uint8_t > & out)
+{
+    const std::size_t MIN_MATCH = 4;
+    const unsigned HASH_BITS = 12;
+    uint32_t table[1u << HASH_BITS] = {}; // position + 1, 0 for none
+
+    out.clear();
+    std::size_t anchor = 0, i = 0;
+
+    auto emit = [&](std::size_t match_len, std::size_t offset)
+    {
+        std::size_t lit = i - anchor;
+        std::size_t ml  = match_len ? match_len - MIN_MATCH : 0;
+        out.push_back(static_cast<uint8_t>(((lit < 15 ? lit : 15) << 4) | (ml < 15 ? ml : 15)));
+        if (lit >= 15)
+            lz_put_length(out, lit - 15);
+        out.insert(out.end(), src + anchor, src + i);
+        if (match_len == 0)
+            return; // last sequence: literals only
+        out.push_back(static_cast<uint8_t>(offset & 0xFF));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if (ml >= 15)
+            lz_put_length(out, ml - 15);
+    };
+
+    while (i + MIN_MATCH <= n)
+    {
+        uint32_t seq;
+        std::memcpy(&seq, src + i, 4);
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        uint32_t cand = table[h];
+        table[h] = static_cast<uint32_t>(i + 1);
+
+        if (cand != 0)
+        {
+            std::size_t c = cand - 1;
+            if (i - c <= 0xFFFF && std::memcmp(src + c, src + i, MIN_MATCH) == 0)
+            {
+                // overlapping matches are fine: runs become offset 1
+                std::size_t len = MIN_MATCH;
+                while (i + len < n && src[c + len] == src[i + len])
+                    ++len;
+                emit(len, i - c);
+                i += len;
+                anchor = i;
+                continue;
+            }
+        }
+        ++i;
+    }
+    i = n;
+    emit(0, 0);
+}
+
+// expand 'src' into exactly 'cap' bytes at 'dst'; throws on a corrupt
+// block
+inline void lz_decompress(const uint8_t * src, std::size_t n, uint8_t * dst, std::size_t cap)
+{
+    const uint8_t * end = src + n;
+    std::size_t o = 0;
+
+    auto get_length = [&](std::size_t len)
+    {
+        if (len != 15)
+            return len;
+        uint8_t b;
+        do
+        {
+            if (src == end)
+                throw std::runtime_error("page codec: truncated block");
+            b = *src++;
+            len += b;
+        } while (b == 255);
+        return len;
+    };
+
+    while (src != end)
+    {
+        uint8_t token = *src++;
+        std::size_t lit = get_length(token >> 4);
+        if (lit > static_cast<std::size_t>(end - src) || lit > cap - o)
+            throw std::runtime_error("page codec: corrupt block");
+        std::memcpy(dst + o, src, lit);
+        src += lit;
+        o += lit;
+        if (src == end)
+            break; // last sequence
+
+        if (end - src < 2)
+            throw std::runtime_error("page codec: truncated block");
+        std::size_t offset = src[0] | (static_cast<std::size_t>(src[1]) << 8);
+        src += 2;
+        std::size_t len = get_length(token & 15) + 4;
+        if (offset == 0 || offset > o || len > cap - o)
+            throw std::runtime_error("page codec: corrupt block");
+        // byte by byte: the source may overlap what is being written
+        for (std::size_t k = 0; k < len; ++k, ++o)
+            dst[o] = dst[o - offset];
+    }
+    if (o != cap)
+        throw std::runtime_error("page codec: block has the wrong size");
+}
+
+//==============================================================
+// ColdBlob: one stored page image
+//==============================================================
+struct ColdBlob
+{
+    std::vector< uint8_t > data; // LZ block, or the image itself
+    bool     lz   = false;
+    uint64_t hash = 0;
+
+    void restore(uint8_t * image) const
+    {
+        if (lz)
+            lz_decompress(data.data(), data.size(), image, PAGE_IMAGE_BYTES);
+        else
+            std::memcpy(image, data.data(), PAGE_IMAGE_BYTES);
+    }
+
+    bool equals(const uint8_t * image) const
+    {
+        if (!lz)
+            return std::memcmp(data.data(), image, PAGE_IMAGE_BYTES) == 0;
+        uint8_t mine[PAGE_IMAGE_BYTES];
+        restore(mine);
+        return std::memcmp(mine, image, PAGE_IMAGE_BYTES) == 0;
+    }
+
+    // heap bytes this blob costs
+    std::size_t footprint() const { return data.size() + sizeof(ColdBlob); }
+
+    static std::shared_ptr< const ColdBlob > make(const uint8_t * image, bool lz, uint64_t hash)
+    {
+        std::shared_ptr< ColdBlob > b = std::make_shared< ColdBlob >();
+        b->hash = hash;
+        if (lz)
+        {
+            lz_compress(image, PAGE_IMAGE_BYTES, b->data);
+            b->lz = b->data.size() < PAGE_IMAGE_BYTES;
+        }
+        if (!b->lz)
+            b->data.assign(image, image + PAGE_IMAGE_BYTES);
+        b->data.shrink_to_fit();
+        return b;
+    }
+};
+
+inline uint64_t page_image_hash(const uint8_t * image)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (std::size_t i = 0; i < PAGE_IMAGE_BYTES; i += 8)
+    {
+        uint64_t w;
+        std::memcpy(&w, image + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+//==============================================================
+// ColdPageStore: blobs shared by content, process-wide
+//==============================================================
+class ColdPageStore
+{
+public:
+    static ColdPageStore & shared()
+    {
+        static ColdPageStore store;
+        return store;
+    }
+
+    // a blob holding 'image': an existing one with the same content,
+    // or a new one
+    std::shared_ptr< const ColdBlob > intern(const uint8_t * image, bool lz)
+    {
+        uint64_t h = page_image_hash(image);
+        std::lock_guard< std::mutex > lock(mutex_);
+
+        auto it = by_hash_.find(h);
+        if (it != by_hash_.end())
+        {
+            std::shared_ptr< const ColdBlob > b = it->second.lock();
+            if (b && b->equals(image))
+            {
+                ++hits_;
+                return b;
+            }
+        }
+
+        // on a (rare) hash collision the newer blob takes the slot
+        std::shared_ptr< const ColdBlob > b = ColdBlob::make(image, lz, h);
+        by_hash_[h] = b;
+        if (by_hash_.size() >= prune_at_)
+            prune();
+        return b;
+    }
+
+    // interns answered with an existing blob
+    uint64_t hits() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return hits_;
+    }
+
+    // blobs still in use by some page
+    std::size_t live_blobs() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        std::size_t n = 0;
+        for (const auto & kv : by_hash_)
+            n += kv.second.expired() ? 0 : 1;
+        return n;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map< uint64_t, std::weak_ptr< const ColdBlob > > by_hash_;
+    std::size_t prune_at_ = 1024;
+    uint64_t hits_ = 0;
+
+    // drop the entries of freed blobs; the next prune waits until the
+    // table has doubled
+    void prune()
+    {
+        for (auto it = by_hash_.begin(); it != by_hash_.end(); )
+            it = it->second.expired() ? by_hash_.erase(it) : std::next(it);
+        prune_at_ = std::max< std::size_t >(1024, 2 * by_hash_.size());
+    }
+};
+
+//==============================================================
+// CompressConfig
+//==============================================================
+struct CompressConfig
+{
+    unsigned idle  = 30;   // seconds since a page's last store or thaw
+    bool     lz    = true;
+    bool     dedup = true;
+
+    // apply "key=value,..." (idle=SECONDS, codec=lz|dedup|both);
+    // throws on bad input
+    void parse(const std::string & spec)
+    {
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty())
+                continue;
+            std::size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                throw std::runtime_error("compress: expected key=value, got '" + item + "'");
+
+            std::string key = item.substr(0, eq);
+            std::string val = item.substr(eq + 1);
+            if (key == "codec")
+            {
+                if (val != "lz" && val != "dedup" && val != "both")
+                    throw std::runtime_error("compress: codec must be lz, dedup or both");
+                lz    = (val != "dedup");
+                dedup = (val != "lz");
+            }
+            else if (key == "idle")
+            {
+                try
+                {
+                    idle = static_cast<unsigned>(std::stoul(val));
+                }
+                catch (const std::exception &)
+                {
+                    throw std::runtime_error("compress: bad value for idle");
+                }
+            }
+            else
+            {
+                throw std::runtime_error("compress: unknown setting " + key);
+            }
+        }
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << "idle=" << idle << "s codec="
+            << (lz && dedup ? "both" : lz ? "lz" : "dedup") << '\n';
+    }
+};
+
+//==============================================================
+// PageCompressionStats: one Memory's compressed pages
+//==============================================================
+struct PageCompressionStats
+{
+    std::size_t resident_pages = 0;
+    std::size_t cold_pages     = 0;
+    std::size_t shared_pages   = 0;  // cold pages whose blob is also used elsewhere
+    uint64_t    raw_bytes      = 0;  // page images of the cold pages
+    uint64_t    stored_bytes   = 0;  // their distinct blobs
+    uint64_t    compressed     = 0;  // pages compressed so far
+    uint64_t    thawed         = 0;  // pages brought back by an access
+
+    double ratio() const
+    {
+        return stored_bytes ? static_cast<double>(raw_bytes) / stored_bytes : 0.0;
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n'
+            << "PAGE COMPRESSION\n"
+            << std::setw(65) << '\n' << std::setfill(' ');
+        out << "resident pages : " << resident_pages << '\n'
+            << "cold pages     : " << cold_pages << " (" << shared_pages << " sharing a blob)\n"
+            << "cold size      : " << raw_bytes << " -> " << stored_bytes << " bytes";
+        if (stored_bytes)
+            out << " (" << std::fixed << std::setprecision(1) << ratio() << "x)"
+                << std::defaultfloat;
+        out << '\n'
+            << "compressed     : " << compressed << " page(s), " << thawed << " thawed on access\n";
+    }
+};
+
+#endif // PAGE_COMPRESSION_H
@@ -16,6 +16,7 @@
 #include "Token.h"
 #include "Lexer.h"
 #include "Machine.h"
+#include "PhaseTimer.h"
 
 //==============================================================
 // Parser
@@ -76,28 +77,86 @@ public:
         return it->second;
     }
 
-    static int parse_register(const Token & tok, const std::string & line)
+    // register number without throwing: false with 'err' set on a
+    // token that is not a register name (see try_parse_int_token)
+    static bool try_parse_register(const Token & tok, const std::string & line,
+                                   int & reg_out, std::string & err)
     {
         if (tok.type != REGISTER)
-            throw std::runtime_error("Expected register token");
+        {
+            err = "Expected register token";
+            return false;
+        }
 
         std::string name = tok.get_string(line);
         auto it = REG_TABLE.find(name);
         if (it == REG_TABLE.end())
-            throw std::runtime_error("Invalid register name: " + name);
+        {
+            err = "Invalid register name: " + name;
+            return false;
+        }
 
-        return it->second;
+        reg_out = it->second;
+        return true;
     }
 
-    static int64_t parse_int_token(const Token & tok, const std::string & line)
+    static int parse_register(const Token & tok, const std::string & line)
+    {
+        int reg = 0;
+        std::string err;
+        if (!try_parse_register(tok, line, reg, err))
+            throw std::runtime_error(err);
+        return reg;
+    }
+
+    // $w0..$w31 (MSA vector registers)
+    static bool try_parse_vector_register(const Token & tok, const std::string & line,
+                                          int & reg_out, std::string & err)
+    {
+        if (tok.type != REGISTER)
+        {
+            err = "Expected register token";
+            return false;
+        }
+
+        std::string name = tok.get_string(line);
+        reg_out = vector_register_index(name);
+        if (reg_out < 0)
+        {
+            err = "Invalid vector register name: " + name;
+            return false;
+        }
+        return true;
+    }
+
+    static int parse_vector_register(const Token & tok, const std::string & line)
+    {
+        int w = 0;
+        std::string err;
+        if (!try_parse_vector_register(tok, line, w, err))
+            throw std::runtime_error(err);
+        return w;
+    }
+
+    // integer literal value without throwing: false with 'err' set on
+    // a malformed literal (used by the Checker; the assembler calls
+    // parse_int_token)
+    static bool try_parse_int_token(const Token & tok, const std::string & line,
+                                    int64_t & value_out, std::string & err)
     {
         if (tok.type != INT)
-            throw std::runtime_error("Expected integer token");
+        {
+            err = "Expected integer token";
+            return false;
+        }
 
         std::string text = tok.get_string(line);
         const std::size_t n = text.size();
         if (n == 0)
-            throw std::runtime_error("Empty integer token");
+        {
+            err = "Empty integer token";
+            return false;
+        }
 
         //==========================================================
         // Char literal case: 'x' or '\n' etc., tokenized as INT
@@ -110,20 +169,27 @@ public:
 
             if (body.empty())
             {
-                throw std::runtime_error("Empty char literal: " + text);
+                err = "Empty char literal: " + text;
+                return false;
             }
             else if (body[0] != '\\')
             {
                 // simple char like '+', 'A'
                 if (body.size() != 1)
-                    throw std::runtime_error("Invalid char literal: " + text);
+                {
+                    err = "Invalid char literal: " + text;
+                    return false;
+                }
                 c = body[0];
             }
             else
             {
                 // escape sequence: '\n', '\t', '\\', '\'', '\r', '\0'
                 if (body.size() != 2)
-                    throw std::runtime_error("Invalid escape in char literal: " + text);
+                {
+                    err = "Invalid escape in char literal: " + text;
+                    return false;
+                }
 
                 char e = body[1];
                 switch (e)
@@ -135,12 +201,14 @@ public:
                     case '\'': c = '\''; break;
                     case '0':  c = '\0'; break;
                     default:
-                        throw std::runtime_error(std::string("Unknown char escape: \\") + e);
+                        err = std::string("Unknown char escape: \\") + e;
+                        return false;
                 }
             }
 
             // Return ASCII value as integer (0..255)
-            return static_cast<uint8_t>(c);
+            value_out = static_cast<uint8_t>(c);
+            return true;
         }
 
         //==========================================================
@@ -155,7 +223,10 @@ public:
             negative = true;
             ++i;
             if (i >= n)
-                throw std::runtime_error("Invalid integer literal: " + text);
+            {
+                err = "Invalid integer literal: " + text;
+                return false;
+            }
         }
 
         int base = 10;
@@ -167,7 +238,10 @@ public:
             base = 16;
             i += 2;
             if (i >= n)
-                throw std::runtime_error("Invalid hex literal: " + text);
+            {
+                err = "Invalid hex literal: " + text;
+                return false;
+            }
         }
         else if (i < n && text[i] == '0')
         {
@@ -177,7 +251,10 @@ public:
 
             // if no more digits, it's just 0
             if (i == n)
-                return 0;
+            {
+                value_out = 0;
+                return true;
+            }
         }
         else
         {
@@ -194,7 +271,10 @@ public:
             if (base == 16)
             {
                 if (!is_hex_digit(c))
-                    throw std::runtime_error("Invalid hex digit in: " + text);
+                {
+                    err = "Invalid hex digit in: " + text;
+                    return false;
+                }
 
                 if ('0' <= c && c <= '9')
                     digit = c - '0';
@@ -204,14 +284,20 @@ public:
             else if (base == 8)
             {
                 if (!is_oct_digit(c))
-                    throw std::runtime_error("Invalid octal digit in: " + text);
+                {
+                    err = "Invalid octal digit in: " + text;
+                    return false;
+                }
 
                 digit = c - '0'; // '0'..'7'
             }
             else // base 10
             {
                 if (!is_num(c))
-                    throw std::runtime_error("Invalid decimal digit in: " + text + " in " + line);
+                {
+                    err = "Invalid decimal digit in: " + text + " in " + line;
+                    return false;
+                }
 
                 digit = c - '0'; // '0'..'9'
             }
@@ -219,47 +305,43 @@ public:
             value = value * base + static_cast<uint64_t>(digit);
         }
 
-        int64_t signed_val = negative ? -static_cast<int64_t>(value)
+        value_out = negative ? -static_cast<int64_t>(value)
             : static_cast<int64_t>(value);
-        return signed_val;
+        return true;
+    }
+
+    static int64_t parse_int_token(const Token & tok, const std::string & line)
+    {
+        int64_t v = 0;
+        std::string err;
+        if (!try_parse_int_token(tok, line, v, err))
+            throw std::runtime_error(err);
+        return v;
     }
 
     static int16_t parse_imm16_signed(const Token & tok, const std::string & line)
     {
-        int64_t v = parse_int_token(tok, line);
-        if (v < -32768 || v > 32767)
-            throw std::runtime_error("Immediate out of 16-bit signed range");
-        return static_cast<int16_t>(v);
+        return static_cast<int16_t>(parse_int_in(tok, line, IMM16_RANGE));
     }
 
     static uint16_t parse_imm16_unsigned(const Token & tok, const std::string & line)
     {
-        int64_t v = parse_int_token(tok, line);
-        if (v < 0 || v > 0xFFFF)
-            throw std::runtime_error("Immediate out of 16-bit unsigned range");
-        return static_cast<uint16_t>(v);
+        return static_cast<uint16_t>(parse_int_in(tok, line, UIMM16_RANGE));
     }
 
     static int32_t parse_imm32(const Token & tok, const std::string & line)
     {
-        int64_t v = parse_int_token(tok, line);
-        if (v < std::numeric_limits<int32_t>::min() ||
-            v > std::numeric_limits<int32_t>::max())
-        {
-            throw std::runtime_error("Immediate out of 32-bit range");
-        }
-        return static_cast<int32_t>(v);
+        return static_cast<int32_t>(parse_int_in(tok, line, IMM32_RANGE));
     }
 
     static uint8_t parse_shamt(const Token & tok, const std::string & line)
     {
-        int64_t v = parse_int_token(tok, line);
-        if (v < 0 || v > 31)
-            throw std::runtime_error("Shift amount out of range 0..31");
-        return static_cast<uint8_t>(v);
+        return static_cast<uint8_t>(parse_int_in(tok, line, SHIFT_RANGE));
     }
 
-    static std::string parse_string_literal(const Token & tok, const std::string & line)
+    // string literal contents without throwing (see try_parse_int_token)
+    static bool try_parse_string_literal(const Token & tok, const std::string & line,
+                                         std::string & result, std::string & err)
     {
         std::string raw = tok.get_string(line); // currently something like: "Hello\n"
 
@@ -267,7 +349,7 @@ public:
         if (raw.size() >= 2 && raw.front() == '"' && raw.back() == '"')
             raw = raw.substr(1, raw.size() - 2);
 
-        std::string result;
+        result.clear();
         result.reserve(raw.size());
 
         for (std::size_t i = 0; i < raw.size(); ++i)
@@ -281,7 +363,10 @@ public:
 
             // escape sequence
             if (i + 1 >= raw.size())
-                throw std::runtime_error("Invalid escape at end of string literal");
+            {
+                err = "Invalid escape at end of string literal";
+                return false;
+            }
 
             char e = raw[++i];
             switch (e)
@@ -294,13 +379,385 @@ public:
                 case '0': result.push_back('\0'); break;
                 default:
                     // could allow unknown escapes as literal
-                    throw std::runtime_error(std::string("Unknown escape: \\") + e);
+                    err = std::string("Unknown escape: \\") + e;
+                    return false;
             }
         }
 
+        return true;
+    }
+
+    static std::string parse_string_literal(const Token & tok, const std::string & line)
+    {
+        std::string result, err;
+        if (!try_parse_string_literal(tok, line, result, err))
+            throw std::runtime_error(err);
         return result;
     }
 
+    //==========================================================
+    // Operand checks
+    //==========================================================
+    // every rule on the operands of a line, in one place. the
+    // assembler throws the first issue found (throw_issue); the
+    // Checker (Checker.h) reports them all. nothing here throws.
+
+    enum OperandProblem
+    {
+        OPERAND_SHAPE,      // tokens do not fit the instruction
+        OPERAND_REGISTER,   // unknown register, or the wrong kind
+        OPERAND_LITERAL,    // malformed integer or string literal
+        OPERAND_RANGE,      // value out of range
+        OPERAND_DIRECTIVE,  // unknown or malformed data directive
+    };
+
+    struct OperandIssue
+    {
+        std::size_t    tok;       // index of the offending token
+        OperandProblem problem;
+        std::string    message;
+    };
+
+    // the values an integer operand may take
+    struct IntRange
+    {
+        int64_t      lo;
+        int64_t      hi;
+        int64_t      step;   // the value is a multiple of this
+        const char * what;   // names the operand in messages
+    };
+
+    static constexpr IntRange SHIFT_RANGE      = { 0, 31, 1, "shift amount" };
+    static constexpr IntRange IMM16_RANGE      = { -32768, 32767, 1, "immediate" };
+    static constexpr IntRange UIMM16_RANGE     = { 0, 65535, 1, "immediate" };
+    static constexpr IntRange IMM32_RANGE      = { INT32_MIN, INT32_MAX, 1, "immediate" };
+    static constexpr IntRange OFFSET_RANGE     = { -32768, 32767, 1, "offset" };
+    static constexpr IntRange VEC_OFFSET_RANGE = { -2048, 2044, 4, "vector offset" };
+    static constexpr IntRange LANE_RANGE       = { 0, 3, 1, "lane index" };
+    static constexpr IntRange BIT_POS_RANGE    = { 0, 31, 1, "bit-field position" };
+    static constexpr IntRange WORD_RANGE       = { INT32_MIN, INT32_MAX, 1, "value" };
+    static constexpr IntRange HALF_RANGE       = { -32768, 65535, 1, "value" };
+    static constexpr IntRange BYTE_RANGE       = { INT64_MIN, INT64_MAX, 1, "value" }; // low 8 bits kept
+    static constexpr IntRange SPACE_RANGE      = { 0, UINT32_MAX, 1, "size" };
+    static constexpr IntRange ALIGN_RANGE      = { 0, 31, 1, "alignment" };
+
+    // the size of an ext/ins bit-field at 'pos'
+    static IntRange bit_size_range(int64_t pos)
+    {
+        return IntRange{ 1, 32 - pos, 1, "bit-field size" };
+    }
+
+    // integer operand within 'r' without throwing: false with 'why'
+    // and 'err' set otherwise
+    static bool try_parse_int_in(const Token & tok, const std::string & line, const IntRange & r,
+                                 int64_t & value_out, OperandProblem & why, std::string & err)
+    {
+        if (!try_parse_int_token(tok, line, value_out, err))
+        {
+            why = OPERAND_LITERAL;
+            return false;
+        }
+        if (value_out < r.lo || value_out > r.hi)
+        {
+            why = OPERAND_RANGE;
+            err = std::string(r.what) + " " + tok.get_string(line) + " out of range " +
+                  std::to_string(r.lo) + ".." + std::to_string(r.hi);
+            return false;
+        }
+        if (value_out % r.step != 0)
+        {
+            why = OPERAND_RANGE;
+            err = std::string(r.what) + " " + tok.get_string(line) + " is not a multiple of " +
+                  std::to_string(r.step);
+            return false;
+        }
+        return true;
+    }
+
+    static int64_t parse_int_in(const Token & tok, const std::string & line, const IntRange & r)
+    {
+        int64_t v = 0;
+        OperandProblem why = OPERAND_LITERAL;
+        std::string err;
+        if (!try_parse_int_in(tok, line, r, v, why, err))
+            throw std::runtime_error(err);
+        return v;
+    }
+
+    // the assembler's way to report an issue
+    [[noreturn]] static void throw_issue(const OperandIssue & issue, const std::string & line)
+    {
+        if (issue.problem == OPERAND_SHAPE)
+            throw std::runtime_error("Unknown assembly pattern: " + line);
+        throw std::runtime_error(issue.message);
+    }
+
+    // true if toks[j..] has exactly the token types of 'shape' (which
+    // ends in EOL)
+    static bool matches_shape(const std::vector<Token> & toks, std::size_t j,
+                              const std::vector<TokenType> & shape)
+    {
+        if (j > toks.size() || toks.size() - j != shape.size())
+            return false;
+        for (std::size_t k = 0; k < shape.size(); ++k)
+        {
+            if (toks[j + k].type != shape[k])
+                return false;
+        }
+        return true;
+    }
+
+    // toks[k] within 'r'; adds an issue otherwise. 'value' gets the
+    // value when it is in range.
+    static bool check_int(const std::vector<Token> & toks, std::size_t k,
+                          const std::string & line, const IntRange & r,
+                          std::vector<OperandIssue> & issues, int64_t * value = nullptr)
+    {
+        int64_t v = 0;
+        OperandProblem why = OPERAND_LITERAL;
+        std::string err;
+        if (!try_parse_int_in(toks[k], line, r, v, why, err))
+        {
+            issues.push_back(OperandIssue{ k, why, err });
+            return false;
+        }
+        if (value != nullptr)
+            *value = v;
+        return true;
+    }
+
+    // every REGISTER token from toks[j] on names a register. 'kinds'
+    // (see msa_register_kinds) says which of them are vector registers
+    // ('w'); the rest are general ones.
+    static void check_registers(const std::vector<Token> & toks, std::size_t j,
+                                const std::string & line, const char * kinds,
+                                std::vector<OperandIssue> & issues)
+    {
+        for (std::size_t k = j; k < toks.size(); ++k)
+        {
+            if (toks[k].type != REGISTER)
+                continue;
+            bool vector = (*kinds != '\0') && (*kinds++ == 'w');
+            int reg = 0;
+            std::string err;
+            if (vector ? !try_parse_vector_register(toks[k], line, reg, err)
+                       : !try_parse_register(toks[k], line, reg, err))
+                issues.push_back(OperandIssue{ k, OPERAND_REGISTER, err });
+        }
+    }
+
+    // the shape of a pseudo-instruction's operands; null if it has none
+    // the assembler expands
+    static const std::vector<TokenType> * pseudo_pattern(PseudoType type)
+    {
+        static const std::vector<TokenType> RR  = { REGISTER, COMMA, REGISTER, EOL };
+        static const std::vector<TokenType> RRR =
+            { REGISTER, COMMA, REGISTER, COMMA, REGISTER, EOL };
+        static const std::vector<TokenType> RRL =
+            { REGISTER, COMMA, REGISTER, COMMA, IDENTIFIER, EOL };
+        static const std::vector<TokenType> RI  = { REGISTER, COMMA, INT, EOL };
+        static const std::vector<TokenType> RL  = { REGISTER, COMMA, IDENTIFIER, EOL };
+        static const std::vector<TokenType> L   = { IDENTIFIER, EOL };
+
+        switch (type)
+        {
+            case MOVE: case ABS: case NEG: case NEGU: case NOT:
+                return &RR;
+            case SGT: case SGE:
+                return &RRR;
+            case BLT: case BLE: case BGT: case BGE:
+                return &RRL;
+            case B:
+                return &L;
+            case LI:
+                return &RI;
+            case LA:
+                return &RL;
+            default:
+                return nullptr;
+        }
+    }
+
+    // every issue with the operands of 'info' in toks[j..] (j is the
+    // token after the mnemonic)
+    static void check_operands(const InstrInfo & info, const std::vector<Token> & toks,
+                               std::size_t j, const std::string & line,
+                               std::vector<OperandIssue> & issues)
+    {
+        // load/store with a label operand:  lw rt, label
+        if (info.type == I_LS && matches_shape(toks, j, { REGISTER, COMMA, IDENTIFIER, EOL }))
+        {
+            check_registers(toks, j, line, "", issues);
+            return;
+        }
+
+        if (!matches_shape(toks, j, PATTERNS[int(info.type)]))
+        {
+            issues.push_back(OperandIssue{ j - 1, OPERAND_SHAPE,
+                                           "bad operands for " + toks[j - 1].get_string(line) });
+            return;
+        }
+        check_registers(toks, j, line, info.opcode == OP_MSA ? msa_register_kinds(info) : "",
+                        issues);
+
+        int64_t pos = 0;
+        switch (info.type)
+        {
+            case RSHIFT:
+            case RROTATE:
+                check_int(toks, j + 4, line, SHIFT_RANGE, issues);
+                break;
+            case I_ARITH:
+                check_int(toks, j + 4, line,
+                          (info.opcode == OP_ANDI || info.opcode == OP_ORI) ? UIMM16_RANGE
+                                                                            : IMM16_RANGE,
+                          issues);
+                break;
+            case I_LS:
+                check_int(toks, j + 2, line, OFFSET_RANGE, issues);
+                break;
+            case MSA_LS:
+                check_int(toks, j + 2, line, VEC_OFFSET_RANGE, issues);
+                break;
+            case MSA_ELEM:
+                check_int(toks, j + 4, line, LANE_RANGE, issues);
+                break;
+            case EXT_INS:
+                if (check_int(toks, j + 4, line, BIT_POS_RANGE, issues, &pos))
+                    check_int(toks, j + 6, line, bit_size_range(pos), issues);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // ... of pseudo-instruction 'type'
+    static void check_pseudo_operands(PseudoType type, const std::vector<Token> & toks,
+                                      std::size_t j, const std::string & line,
+                                      std::vector<OperandIssue> & issues)
+    {
+        const std::vector<TokenType> * shape = pseudo_pattern(type);
+        if (shape == nullptr || !matches_shape(toks, j, *shape))
+        {
+            issues.push_back(OperandIssue{ j - 1, OPERAND_SHAPE,
+                                           "bad operands for " + toks[j - 1].get_string(line) });
+            return;
+        }
+        check_registers(toks, j, line, "", issues);
+        if (type == LI)
+            check_int(toks, j + 2, line, IMM32_RANGE, issues);
+    }
+
+    // ... of data directive 'dir' (toks[j - 1]) in toks[j..]
+    static void check_data_operands(const std::string & dir, const std::vector<Token> & toks,
+                                    std::size_t j, const std::string & line,
+                                    std::vector<OperandIssue> & issues)
+    {
+        const std::size_t dir_tok = j - 1;
+        const std::size_t end = toks.size() - 1; // the EOL
+
+        if (dir == ".word" || dir == ".byte" || dir == ".half")
+        {
+            const IntRange & r = (dir == ".word") ? WORD_RANGE
+                               : (dir == ".half") ? HALF_RANGE : BYTE_RANGE;
+            std::size_t count = 0;
+            for (; j < end; ++j)
+            {
+                // only .byte takes commas between operands
+                if (toks[j].type == COMMA && dir == ".byte")
+                    continue;
+                if (toks[j].type != INT)
+                {
+                    issues.push_back(OperandIssue{ j, OPERAND_DIRECTIVE,
+                                                   dir + " expects integer operands" });
+                    return;
+                }
+                check_int(toks, j, line, r, issues);
+                ++count;
+            }
+            if (count == 0)
+                issues.push_back(OperandIssue{ dir_tok, OPERAND_DIRECTIVE,
+                                               dir + " requires at least one integer" });
+        }
+        else if (dir == ".ascii" || dir == ".asciiz")
+        {
+            if (j + 1 != end || toks[j].type != STRING)
+            {
+                issues.push_back(OperandIssue{ dir_tok, OPERAND_DIRECTIVE,
+                                               dir + " expects one string literal" });
+                return;
+            }
+            std::string text, err;
+            if (!try_parse_string_literal(toks[j], line, text, err))
+                issues.push_back(OperandIssue{ j, OPERAND_LITERAL, err });
+        }
+        else if (dir == ".space" || dir == ".align")
+        {
+            if (j + 1 != end || toks[j].type != INT)
+            {
+                issues.push_back(OperandIssue{ dir_tok, OPERAND_DIRECTIVE,
+                                               dir + " expects a single integer operand" });
+                return;
+            }
+            check_int(toks, j, line, dir == ".space" ? SPACE_RANGE : ALIGN_RANGE, issues);
+        }
+        else
+        {
+            issues.push_back(OperandIssue{ dir_tok, OPERAND_DIRECTIVE,
+                                           "unknown directive: " + dir });
+        }
+    }
+
+    // number of words expand_pseudo emits for 'type' outside of
+    // relaxation (see set_final_labels). only li depends on its operand
+    // ('li_imm'); keep in step with expand_pseudo.
+    static uint32_t pseudo_size(PseudoType type, int32_t li_imm = 0)
+    {
+        switch (type)
+        {
+            case MOVE: case B:   case NEG: case NEGU:
+            case NOT:  case SGT:
+                return 1;
+            case LA:  case SGE:
+            case BLT: case BLE: case BGT: case BGE:
+                return 2;
+            case ABS:
+                return 3;
+            case LI:
+            {
+                uint32_t u = static_cast<uint32_t>(li_imm);
+                bool one = (li_imm >= -32768 && li_imm <= 32767) ||
+                           (u >> 16) == 0 || (u & 0xFFFFu) == 0;
+                return one ? 1 : 2;
+            }
+            default:
+                throw std::runtime_error("Unknown pseudo-instruction size");
+        }
+    }
+
+    // words a (label-free) text line assembles to outside of relaxation;
+    // the starting estimate for relaxation
+    static uint32_t estimate_text_size(const std::vector<Token> & toks,
+                                       const std::string & line)
+    {
+        if (toks.empty() || toks[0].type != IDENTIFIER)
+            return 0;
+
+        std::string mnem = toks[0].get_string(line);
+        if (is_pseudo(mnem))
+        {
+            PseudoType type = get_pseudo(mnem);
+            if (type == LI && toks.size() > 3 && toks[3].type == INT)
+                return pseudo_size(LI, parse_imm32(toks[3], line));
+            return pseudo_size(type);
+        }
+
+        if (get_instr_type(mnem) == I_LS && toks.size() > 3 &&
+            toks[3].type == IDENTIFIER)
+            return 2;
+        return 1;
+    }
+
     void
     expand_pseudo(const std::vector<Token> & toks,
                           int mnem_index,
@@ -346,8 +803,10 @@ public:
             //--------------------------------------------------
             // li rt, imm32
             //
-            // if 16-bit signed:  addi rt, $zero, imm
-            // else:              lui  $at, hi(imm)
+            // if 16-bit signed:   addi rt, $zero, imm
+            // if 16-bit unsigned: ori  rt, $zero, imm
+            // if low half zero:   lui  rt, hi(imm)
+            // else:               lui  $at, hi(imm)
             //                     ori  rt,  $at, lo(imm)
             //--------------------------------------------------
             case LI:
@@ -358,7 +817,11 @@ public:
                 int32_t imm = parse_imm32(toks[j++], line);
 
                 // li does different things depending
-                // on size of immediate
+                // on size of immediate; always the shortest form
+                uint32_t uimm = static_cast<uint32_t>(imm);
+                uint16_t hi = static_cast<uint16_t>((uimm >> 16) & 0xFFFFu);
+                uint16_t lo = static_cast<uint16_t>(uimm & 0xFFFFu);
+
                 if (imm >= -32768 && imm <= 32767)
                 {
                     uint16_t imm16 = static_cast<uint16_t>(imm);
@@ -372,12 +835,30 @@ public:
 
                     words.push_back(word);
                 }
+                else if (hi == 0)
+                {
+                    // ori rt, $zero, lo   (32768..65535)
+                    uint32_t op = static_cast<uint32_t>(OP_ORI);
+                    uint32_t word =
+                        (op    << 26) |
+                        (ZERO  << 21) |
+                        (rt    << 16) |
+                        lo;
+                    words.push_back(word);
+                }
+                else if (lo == 0)
+                {
+                    // lui rt, hi
+                    uint32_t op = static_cast<uint32_t>(OP_LUI);
+                    uint32_t word =
+                        (op    << 26) |
+                        (ZERO  << 21) |
+                        (rt    << 16) |
+                        hi;
+                    words.push_back(word);
+                }
                 else
                 {
-                    uint32_t uimm = static_cast<uint32_t>(imm);
-                    uint16_t hi = static_cast<uint16_t>((uimm >> 16) & 0xFFFFu);
-                    uint16_t lo = static_cast<uint16_t>(uimm & 0xFFFFu);
-
                     // lui $at, hi
                     {
                         uint32_t op = static_cast<uint32_t>(OP_LUI);
@@ -447,6 +928,21 @@ public:
                 uint16_t hi = static_cast<uint16_t>((addr >> 16) & 0xFFFFu);
                 uint16_t lo = static_cast<uint16_t>(addr & 0xFFFFu);
 
+                // with final label addresses (relaxation), an address
+                // with a zero low half is a single lui rt, hi
+                if (final_labels_ && have_addr && lo == 0 && !long_form_)
+                {
+                    uint32_t op = static_cast<uint32_t>(OP_LUI);
+                    uint32_t word =
+                        (op   << 26) |
+                        (ZERO << 21) |
+                        (rt   << 16) |
+                        hi;
+                    words.push_back(word);
+                    break;
+                }
+                went_long_ = true;
+
                 // Emit placeholder (or final) instructions. If addr isn't known
                 // yet, hi/lo = 0 for now; Machine will overwrite them at fixup time.
 
@@ -539,54 +1035,12 @@ public:
                 }
 
                 // 2) branch instruction using existing fixup logic
-                uint32_t opcode_branch =
+                Opcode opcode_branch =
                     (type == BLT || type == BGT)
-                    ? static_cast<uint32_t>(OP_BNE)   // blt/bgt
-                    : static_cast<uint32_t>(OP_BEQ);  // ble/bge
-
-                uint32_t instr_pc =
-                    current_pc + 4u * static_cast<uint32_t>(words.size());
-
-                uint16_t imm = 0;
-
-                if (machine.has_label(label))
-                {
-                    uint32_t target_addr = machine.lookup_label(label);
-
-                    int32_t diff = static_cast<int32_t>(target_addr)
-                        - static_cast<int32_t>(instr_pc + 4);
-
-                    if (diff & 0x3)
-                        throw std::runtime_error("Branch target not word-aligned");
-
-                    int32_t offset = diff >> 2;
-
-                    if (offset < std::numeric_limits<int16_t>::min() ||
-                        offset > std::numeric_limits<int16_t>::max())
-                    {
-                        throw std::runtime_error("Branch offset out of 16-bit range");
-                    }
-
-                    imm = static_cast<uint16_t>(offset & 0xFFFF);
-                }
-
-                uint32_t word_branch =
-                    (opcode_branch << 26) |
-                    (AT            << 21) |   // rs = $at
-                    (ZERO          << 16) |   // rt = $zero
-                    imm;
-
-                words.push_back(word_branch);
-
-                if (!machine.has_label(label))
-                {
-                    machine.add_branch_fixup(instr_pc,
-                                             static_cast<Opcode>(opcode_branch),
-                                             AT,
-                                             ZERO,
-                                             label);
-                }
+                    ? OP_BNE   // blt/bgt
+                    : OP_BEQ;  // ble/bge
 
+                emit_branch(opcode_branch, AT, ZERO, label, current_pc, words);
                 break;
             }
 
@@ -605,54 +1059,7 @@ public:
 
                 std::string label = toks[j++].get_string(line);
 
-                uint32_t op = static_cast<uint32_t>(OP_BEQ);
-
-                // PC where this beq will be stored (first word of this line’s expansion)
-                uint32_t instr_pc =
-                    current_pc + 4u * static_cast<uint32_t>(words.size());
-
-                uint16_t imm = 0; // placeholder
-
-                // If label is already known, fully encode now
-                if (machine.has_label(label))
-                {
-                    uint32_t target_addr = machine.lookup_label(label);
-
-                    int32_t diff = static_cast<int32_t>(target_addr)
-                        - static_cast<int32_t>(instr_pc + 4);
-
-                    if (diff & 0x3)
-                        throw std::runtime_error("Branch target not word-aligned");
-
-                    int32_t offset = diff >> 2;
-
-                    if (offset < std::numeric_limits<int16_t>::min() ||
-                        offset > std::numeric_limits<int16_t>::max())
-                    {
-                        throw std::runtime_error("Branch offset out of 16-bit range");
-                    }
-
-                    imm = static_cast<uint16_t>(offset & 0xFFFF);
-                }
-
-                uint32_t word =
-                    (op            << 26) |
-                    (ZERO          << 21) |  // rs = $zero
-                    (ZERO          << 16) |  // rt = $zero
-                    imm;
-
-                words.push_back(word);
-
-                // If label not yet known, record fixup
-                if (!machine.has_label(label))
-                {
-                    machine.add_branch_fixup(instr_pc,
-                                             OP_BEQ,
-                                             ZERO,
-                                             ZERO,
-                                             label);
-                }
-
+                emit_branch(OP_BEQ, ZERO, ZERO, label, current_pc, words);
                 break;
             }
 
@@ -799,60 +1206,9 @@ public:
             }
 
             //--------------------------------------------------
-            // mul rd, rs, rt
-            //
-            // SPIM-style pseudo:
-            //   mult rs, rt
-            //   mflo rd
+            // sgt rd, rs, rt   == slt rd, rt, rs
             //--------------------------------------------------
-            case MUL:
-            {
-                int j = mnem_index + 1;
-                uint32_t rd = parse_register(toks[j++], line);
-                ++j; // COMMA
-                uint32_t rs = parse_register(toks[j++], line);
-                ++j; // COMMA
-                uint32_t rt = parse_register(toks[j++], line);
-
-                // 1) mult rs, rt
-                {
-                    uint32_t op    = static_cast<uint32_t>(OP_RTYPE);
-                    uint32_t funct = static_cast<uint32_t>(FUNCT_MULT);
-
-                    uint32_t word =
-                        (op    << 26) |
-                        (rs    << 21) |   // rs
-                        (rt    << 16) |   // rt
-                        (0u    << 11) |   // rd unused for mult
-                        (0u    <<  6) |
-                        (funct <<  0);
-
-                    words.push_back(word);
-                }
-
-                // 2) mflo rd
-                {
-                    uint32_t op    = static_cast<uint32_t>(OP_RTYPE);
-                    uint32_t funct = static_cast<uint32_t>(FUNCT_MFLO);
-
-                    uint32_t word =
-                        (op    << 26) |
-                        (0u    << 21) |   // rs = 0
-                        (0u    << 16) |   // rt = 0
-                        (rd    << 11) |   // rd gets LO
-                        (0u    <<  6) |
-                        (funct <<  0);
-
-                    words.push_back(word);
-                }
-
-                break;
-            }
-
-            //--------------------------------------------------
-            // sgt rd, rs, rt   == slt rd, rt, rs
-            //--------------------------------------------------
-            case SGT:
+            case SGT:
             {
                 int j = mnem_index + 1;
                 uint32_t rd = parse_register(toks[j++], line);
@@ -1000,7 +1356,9 @@ public:
                        const std::string & line,
                        uint32_t current_pc)
     {
+        PhaseTimer timer(TP_PARSE);
         std::vector<uint32_t> words;
+        went_long_ = false;
 
         if (toks.empty())
         {
@@ -1052,8 +1410,13 @@ public:
         //==========================================================
         // PSEUDOINSTRUCTIONS
         //==========================================================
+        std::vector<OperandIssue> issues;
         if (is_pseudo(mnemonic))
         {
+            check_pseudo_operands(get_pseudo(mnemonic), toks, i + 1, line, issues);
+            if (!issues.empty())
+                throw_issue(issues.front(), line);
+
             // expand into 1 or more real instructions and return
             // If expand_pseudo throws, we never define the label.
             expand_pseudo(toks, i, line, current_pc, words);
@@ -1072,23 +1435,22 @@ public:
         //==========================================================
         // get instruction info
         InstrInfo info = get_instr_info(mnemonic);
-        const std::vector<TokenType> & pattern = get_pattern(info.type);
-
-        int j = i + 1; // first token after mnemonic
+        check_operands(info, toks, i + 1, line, issues);
+        if (!issues.empty())
+            throw_issue(issues.front(), line);
 
-        // check if pattern matches
-        // the -1 is because checking the EOL is pointless
-        for (std::size_t k = 0; k < pattern.size() - 1; ++k, ++j)
+        // load/store with a label operand:  lw rt, label
+        if (info.type == I_LS && toks[i+3].type == IDENTIFIER)
         {
-            if (j >= static_cast<int>(toks.size()) || toks[j].type != pattern[k])
-            {
-                throw std::runtime_error("Unknown assembly pattern: " + line);
-            }
+            emit_ls_label(info.opcode, parse_register(toks[i+1], line),
+                          toks[i+3].get_string(line), words);
+            if (has_label)
+                machine.define_label(label_name, current_pc);
+            return words;
         }
 
         // encode to 32-bit machine word and store to memory.
-        // reset j to first token after mnemonic
-        j = i + 1;
+        int j = i + 1; // first token after mnemonic
 
         uint32_t word = 0;
 
@@ -1192,53 +1554,7 @@ public:
 
                 std::string label = toks[j++].get_string(line);
 
-                uint32_t op = static_cast<uint32_t>(info.opcode);
-
-                // pc where this instruction will be stored
-                uint32_t instr_pc = current_pc + 4u * static_cast<uint32_t>(words.size());
-
-                uint16_t imm = 0; // placeholder
-
-                // if label is already known, can fully encode
-                if (machine.has_label(label))
-                {
-                    uint32_t target_addr = machine.lookup_label(label);
-
-                    int32_t diff = static_cast<int32_t>(target_addr)
-                        - static_cast<int32_t>(instr_pc + 4);
-
-                    if (diff & 0x3)
-                        throw std::runtime_error("Branch target not word-aligned");
-
-                    int32_t offset = diff >> 2;
-
-                    if (offset < std::numeric_limits<int16_t>::min() ||
-                        offset > std::numeric_limits<int16_t>::max())
-                    {
-                        throw std::runtime_error("Branch offset out of 16-bit range");
-                    }
-
-                    imm = static_cast<uint16_t>(offset & 0xFFFF);
-                }
-
-                word = (op << 26) |
-                    (rs << 21) |
-                    (rt << 16) |
-                    imm;
-
-                words.push_back(word);
-
-                // if label was not yet known,
-                // record a fixup so Machine can patch later
-                if (!machine.has_label(label))
-                {
-                    machine.add_branch_fixup(instr_pc,
-                                             info.opcode,
-                                             rs,
-                                             rt,
-                                             label);
-                }
-
+                emit_branch(info.opcode, rs, rt, label, current_pc, words);
                 break;
             }
 
@@ -1252,7 +1568,6 @@ public:
 
                 std::string label = toks[j++].get_string(line);
 
-                uint32_t op = static_cast<uint32_t>(info.opcode);
                 uint32_t rt = 0;
 
                 if (info.opcode == OP_REGIMM)
@@ -1266,49 +1581,7 @@ public:
                     rt = 0;
                 }
 
-                uint32_t instr_pc =
-                    current_pc + 4u * static_cast<uint32_t>(words.size());
-
-                uint16_t imm = 0;
-
-                if (machine.has_label(label))
-                {
-                    uint32_t target_addr = machine.lookup_label(label);
-
-                    int32_t diff = static_cast<int32_t>(target_addr)
-                        - static_cast<int32_t>(instr_pc + 4);
-
-                    if (diff & 0x3)
-                        throw std::runtime_error("Branch target not word-aligned");
-
-                    int32_t offset = diff >> 2;
-
-                    if (offset < std::numeric_limits<int16_t>::min() ||
-                        offset > std::numeric_limits<int16_t>::max())
-                    {
-                        throw std::runtime_error("Branch offset out of 16-bit range");
-                    }
-
-                    imm = static_cast<uint16_t>(offset & 0xFFFF);
-                }
-
-                uint32_t word =
-                    (op << 26) |
-                    (rs << 21) |
-                    (rt << 16) |
-                    imm;
-
-                words.push_back(word);
-
-                if (!machine.has_label(label))
-                {
-                    machine.add_branch_fixup(instr_pc,
-                                             info.opcode,
-                                             rs,
-                                             rt,
-                                             label);
-                }
-
+                emit_branch(info.opcode, rs, rt, label, current_pc, words);
                 break;
             }
 
@@ -1455,6 +1728,216 @@ public:
                 break;
             }
 
+            case R2: // rd, rs   (clz, clo; rt must equal rd)
+            {
+                uint32_t rd = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rs = parse_register(toks[j++], line);
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_SPECIAL2
+                uint32_t funct = static_cast<uint32_t>(info.funct);
+
+                word = (op    << 26) |
+                    (rs    << 21) |
+                    (rd    << 16) |
+                    (rd    << 11) |
+                    (0u    <<  6) |
+                    (funct <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case R2_BSHFL: // rd, rt   (seb, seh, wsbh)
+            {
+                uint32_t rd = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rt = parse_register(toks[j++], line);
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_SPECIAL3
+                uint32_t subop = static_cast<uint32_t>(info.funct);  // BSHFL_*
+                uint32_t funct = static_cast<uint32_t>(S3_BSHFL);
+
+                word = (op    << 26) |
+                    (0u    << 21) |
+                    (rt    << 16) |
+                    (rd    << 11) |
+                    (subop <<  6) |
+                    (funct <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case RROTATE: // rd, rt, sa   (rotr = srl with rs = 1)
+            {
+                uint32_t rd = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rt = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint8_t sa = parse_shamt(toks[j++], line);
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode);
+                uint32_t funct = static_cast<uint32_t>(info.funct);
+
+                word = (op    << 26) |
+                    (1u    << 21) |  // R bit selects rotate
+                    (rt    << 16) |
+                    (rd    << 11) |
+                    (static_cast<uint32_t>(sa) << 6) |
+                    (funct <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case EXT_INS: // rt, rs, pos, size
+            {
+                uint32_t rt = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rs = parse_register(toks[j++], line);
+                ++j; // COMMA
+                int64_t pos  = parse_int_in(toks[j++], line, BIT_POS_RANGE);
+                ++j; // COMMA
+                int64_t size = parse_int_in(toks[j++], line, bit_size_range(pos));
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_SPECIAL3
+                uint32_t funct = static_cast<uint32_t>(info.funct);
+
+                // ext stores size-1 (msbd), ins stores pos+size-1 (msb)
+                uint32_t msb = (funct == static_cast<uint32_t>(S3_EXT))
+                    ? static_cast<uint32_t>(size - 1)
+                    : static_cast<uint32_t>(pos + size - 1);
+                uint32_t lsb = static_cast<uint32_t>(pos);
+
+                word = (op    << 26) |
+                    (rs    << 21) |
+                    (rt    << 16) |
+                    (msb   << 11) |
+                    (lsb   <<  6) |
+                    (funct <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case COP0_MOVE: // rt, rd: the funct slot holds the rs code
+            {
+                uint32_t rt = parse_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rd = parse_register(toks[j++], line);
+
+                uint32_t op   = static_cast<uint32_t>(info.opcode); // OP_COP0
+                uint32_t code = static_cast<uint32_t>(info.funct);  // C0_MF / C0_MT
+
+                word = (op   << 26) |
+                    (code << 21) |
+                    (rt   << 16) |
+                    (rd   << 11);
+
+                words.push_back(word);
+                break;
+            }
+
+            case COP0_OP: // tlbwr, tlbwi, tlbp, eret
+            {
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_COP0
+                uint32_t funct = static_cast<uint32_t>(info.funct);
+
+                word = (op << 26) |
+                    (static_cast<uint32_t>(C0_CO) << 21) |
+                    funct;
+
+                words.push_back(word);
+                break;
+            }
+
+            case MSA_3R: // wd, ws, wt
+            {
+                uint32_t wd = parse_vector_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t ws = parse_vector_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t wt = parse_vector_register(toks[j++], line);
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_MSA
+                uint32_t minor = static_cast<uint32_t>(info.funct);
+
+                word = (op << 26) | info.bits |
+                    (wt    << 16) |
+                    (ws    << 11) |
+                    (wd    <<  6) |
+                    (minor <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case MSA_LS: // wd, offset(rs); offset is bytes, stored in words
+            {
+                uint32_t wd = parse_vector_register(toks[j++], line);
+                ++j; // COMMA
+                int64_t offset = parse_int_in(toks[j++], line, VEC_OFFSET_RANGE);
+                ++j; // LPAREN
+                uint32_t rs = parse_register(toks[j++], line);
+                ++j; // RPAREN
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_MSA
+                uint32_t minor = static_cast<uint32_t>(info.funct);
+                uint32_t s10   = static_cast<uint32_t>(offset / 4) & 0x3FFu;
+
+                word = (op << 26) |
+                    (s10   << 16) |
+                    (rs    << 11) |
+                    (wd    <<  6) |
+                    (minor <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case MSA_FILL: // wd, rs
+            {
+                uint32_t wd = parse_vector_register(toks[j++], line);
+                ++j; // COMMA
+                uint32_t rs = parse_register(toks[j++], line);
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_MSA
+                uint32_t minor = static_cast<uint32_t>(info.funct);
+
+                word = (op << 26) | info.bits |
+                    (rs    << 11) |
+                    (wd    <<  6) |
+                    (minor <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
+            case MSA_ELEM: // wd, ws[n] (splati.w) or rd, ws[n] (copy_s.w)
+            {
+                uint32_t wd = (msa_register_kinds(info)[0] == 'g')
+                    ? static_cast<uint32_t>(parse_register(toks[j++], line))
+                    : static_cast<uint32_t>(parse_vector_register(toks[j++], line));
+                ++j; // COMMA
+                uint32_t ws = parse_vector_register(toks[j++], line);
+                ++j; // LBRACKET
+                int64_t n = parse_int_in(toks[j++], line, LANE_RANGE);
+                ++j; // RBRACKET
+
+                uint32_t op    = static_cast<uint32_t>(info.opcode); // OP_MSA
+                uint32_t minor = static_cast<uint32_t>(info.funct);
+
+                word = (op << 26) | info.bits |
+                    (static_cast<uint32_t>(n) << 16) |
+                    (ws    << 11) |
+                    (wd    <<  6) |
+                    (minor <<  0);
+
+                words.push_back(word);
+                break;
+            }
+
             default:
                 throw std::runtime_error("Unknown instruction pattern");
         }
@@ -1475,6 +1958,7 @@ public:
                        const std::string & line,
                        uint32_t current_pc)
     {
+        PhaseTimer timer(TP_PARSE);
         if (toks.empty())
             return;
 
@@ -1514,146 +1998,54 @@ public:
         std::string dir = toks[i].get_string(line);
         ++i;
 
-        auto error_here = [&](const std::string & msg)
-        {
-            throw std::runtime_error(msg + " in data line");
-        };
+        // every directive's operands are checked up front; the code
+        // below only encodes them
+        std::vector<OperandIssue> issues;
+        check_data_operands(dir, toks, i, line, issues);
+        if (!issues.empty())
+            throw std::runtime_error(issues.front().message + " in data line");
 
         // --------------------------------------------------------
         // .word v1 v2 v3 ...
         // --------------------------------------------------------
         if (dir == ".word")
         {
-            std::vector<uint32_t> values;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                if (toks[i].type != INT)
-                    error_here(".word expects integer operands");
-
-                int32_t sval = parse_imm32(toks[i], line);
-                uint32_t uval = static_cast<uint32_t>(sval);
-                values.push_back(uval);
-                ++i;
-            }
-
-            if (values.empty())
-                error_here(".word requires at least one integer");
-
-            // emit only after parsed successfully
-            for (uint32_t v : values)
-                machine.emit_data_word(v);
+            for (; toks[i].type != EOL; ++i)
+                machine.emit_data_word(static_cast<uint32_t>(parse_int_token(toks[i], line)));
         }
         // --------------------------------------------------------
-        // .byte b1 b2 b3 ...
+        // .byte b1 b2 b3 ...  (optional commas between operands)
         // --------------------------------------------------------
         else if (dir == ".byte")
         {
-            std::vector<uint8_t> bytes;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
+            for (; toks[i].type != EOL; ++i)
             {
-                // allow optional commas between operands
-                if (toks[i].type == COMMA)
-                {
-                    ++i;
-                    continue;
-                }
-
-                if (toks[i].type != INT)
-                    error_here(".byte expects integer operands");
-
-                int64_t v = parse_int_token(toks[i], line);
-                uint8_t b = static_cast<uint8_t>(v & 0xFF);
-                bytes.push_back(b);
-                ++i;
+                if (toks[i].type != COMMA)
+                    machine.emit_data_byte(static_cast<uint8_t>(parse_int_token(toks[i], line) & 0xFF));
             }
-
-            if (bytes.empty())
-                error_here(".byte requires at least one integer");
-
-            for (uint8_t b : bytes)
-                machine.emit_data_byte(b);
         }
-
         // --------------------------------------------------------
-        // .half h1 h2 h3 ...
+        // .half h1 h2 h3 ...  (unsigned 16 bits, SPIM style)
         // --------------------------------------------------------
         else if (dir == ".half")
         {
-            std::vector<uint16_t> halves;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                if (toks[i].type != INT)
-                    error_here(".half expects integer operands");
-
-                int64_t v = parse_int_token(toks[i], line);
-                if (v < -32768 || v > 65535)
-                    error_here(".half operand out of 16-bit range");
-
-                // treat as unsigned 16 bits (SPIM style)
-                uint16_t h = static_cast<uint16_t>(v & 0xFFFF);
-                halves.push_back(h);
-                ++i;
-            }
-
-            if (halves.empty())
-                error_here(".half requires at least one integer");
-
-            for (uint16_t h : halves)
-                machine.emit_data_half(h);
+            for (; toks[i].type != EOL; ++i)
+                machine.emit_data_half(static_cast<uint16_t>(parse_int_token(toks[i], line) & 0xFFFF));
         }
         // --------------------------------------------------------
-        // .ascii "string"
-        //  (no terminating '\0')
+        // .ascii "string"  (no terminating '\0')
         // --------------------------------------------------------
         else if (dir == ".ascii")
         {
-            if (i >= static_cast<int>(toks.size()) ||
-                toks[i].type != STRING)
-            {
-                error_here(".ascii expects a string literal");
-            }
-
             std::string s = parse_string_literal(toks[i], line);
-            ++i;
-
-            // any extra non-EOL tokens = error
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                error_here("extra tokens after .ascii directive");
-            }
-
-            // emit bytes (no null terminator)
-            for (char c : s)
-                machine.emit_data_byte(static_cast<uint8_t>(c));
+            machine.emit_data_bytes(reinterpret_cast<const uint8_t *>(s.data()), s.size());
         }
         // --------------------------------------------------------
-        // .asciiz "string"
-        //  (null-terminated)
+        // .asciiz "string"  (null-terminated)
         // --------------------------------------------------------
         else if (dir == ".asciiz")
         {
-            if (i >= static_cast<int>(toks.size()) ||
-                toks[i].type != STRING)
-            {
-                error_here(".asciiz expects a string literal");
-            }
-
             std::string s = parse_string_literal(toks[i], line);
-            ++i;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                error_here("extra tokens after .asciiz directive");
-            }
-
             machine.emit_data_asciiz(s.c_str());
         }
         // --------------------------------------------------------
@@ -1661,71 +2053,24 @@ public:
         // --------------------------------------------------------
         else if (dir == ".space")
         {
-            if (i >= static_cast<int>(toks.size()) ||
-                toks[i].type != INT)
-            {
-                error_here(".space expects a single integer operand");
-            }
-
-            int64_t v = parse_int_token(toks[i], line);
-            if (v < 0)
-                error_here(".space size must be non-negative");
-
-            uint32_t n = static_cast<uint32_t>(v);
-            ++i;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                error_here("extra tokens after .space directive");
-            }
-
-            for (uint32_t k = 0; k < n; ++k)
-                machine.emit_data_byte(0);
+            uint32_t n = static_cast<uint32_t>(parse_int_token(toks[i], line));
+            machine.emit_data_fill(0, n);
         }
         // --------------------------------------------------------
         // .align n  (align data_cursor to 2^n boundary)
         // --------------------------------------------------------
         else if (dir == ".align")
         {
-            if (i >= static_cast<int>(toks.size()) ||
-                toks[i].type != INT)
-            {
-                error_here(".align expects a single integer operand");
-            }
-
-            int64_t v = parse_int_token(toks[i], line);
-            if (v < 0)
-                error_here(".align value must be non-negative");
-
             // SPIM-style: argument is log2(alignment)
             // e.g., .align 2 => align to 4-byte boundary
-            if (v > 31)
-                error_here(".align value too large");
-
-            uint32_t pow2 = 1u << static_cast<uint32_t>(v);
-            ++i;
-
-            while (i < static_cast<int>(toks.size()) &&
-                   toks[i].type != EOL)
-            {
-                error_here("extra tokens after .align directive");
-            }
+            uint32_t pow2 = 1u << static_cast<uint32_t>(parse_int_token(toks[i], line));
 
             // align current data_cursor to next multiple of pow2
             uint32_t addr = machine.data_cursor;
             uint32_t next = (addr + (pow2 - 1u)) & ~(pow2 - 1u);
 
             // fill with zeros up to 'next'
-            while (machine.data_cursor < next)
-                machine.emit_data_byte(0);
-        }
-        // --------------------------------------------------------
-        // Unknown directive
-        // --------------------------------------------------------
-        else
-        {
-            error_here("Unknown data directive: " + dir);
+            machine.emit_data_fill(0, next - machine.data_cursor);
         }
 
         // --------------------------------------------------------
@@ -1737,8 +2082,138 @@ public:
         }
     }
    
+    // relaxation mode: every label already holds its final address,
+    // so expansions may depend on label values. in this mode an
+    // out-of-range conditional branch becomes an inverted branch over a
+    // j instead of an error, and la of an address with a zero low half
+    // is a single lui. long_form forces the long variants.
+    void set_final_labels(bool on) { final_labels_ = on; }
+    void set_long_form(bool on)    { long_form_ = on; }
+
+    // true if the last assemble_text_line chose a long variant
+    bool went_long() const { return went_long_; }
+
 private:
     Machine & machine;
+    bool final_labels_ = false;
+    bool long_form_    = false;
+    bool went_long_    = false;
+
+    // conditional branch 'op rs, rt, label' (b is beq $zero, $zero).
+    // long form:  <inverse op> rs, rt, 1   then   j label
+    // (for b just j label)
+    void emit_branch(Opcode opcode, uint32_t rs, uint32_t rt,
+                     const std::string & label, uint32_t current_pc,
+                     std::vector<uint32_t> & words)
+    {
+        uint32_t op = static_cast<uint32_t>(opcode);
+
+        // pc where this instruction will be stored
+        uint32_t instr_pc = current_pc + 4u * static_cast<uint32_t>(words.size());
+
+        uint16_t imm = 0; // placeholder
+
+        // if label is already known, can fully encode
+        if (machine.has_label(label))
+        {
+            uint32_t target_addr = machine.lookup_label(label);
+
+            int32_t diff = static_cast<int32_t>(target_addr)
+                - static_cast<int32_t>(instr_pc + 4);
+
+            if (diff & 0x3)
+                throw std::runtime_error("Branch target not word-aligned");
+
+            int32_t offset = diff >> 2;
+            bool in_range = offset >= std::numeric_limits<int16_t>::min() &&
+                            offset <= std::numeric_limits<int16_t>::max();
+
+            if (final_labels_ && (long_form_ || !in_range))
+            {
+                went_long_ = true;
+                uint32_t j_word = (static_cast<uint32_t>(OP_J) << 26) |
+                                  ((target_addr >> 2) & 0x03FFFFFFu);
+
+                if (!(opcode == OP_BEQ && rs == 0 && rt == 0))
+                {
+                    uint32_t inv_op = op, inv_rt = rt;
+                    switch (opcode)
+                    {
+                        case OP_BEQ:  inv_op = OP_BNE;  break;
+                        case OP_BNE:  inv_op = OP_BEQ;  break;
+                        case OP_BLEZ: inv_op = OP_BGTZ; break;
+                        case OP_BGTZ: inv_op = OP_BLEZ; break;
+                        case OP_REGIMM:
+                            inv_rt = (rt == RT_BLTZ) ? RT_BGEZ : RT_BLTZ;
+                            break;
+                        default:
+                            throw std::runtime_error("Cannot invert branch");
+                    }
+
+                    // skip the j when the original condition is false
+                    words.push_back((inv_op << 26) | (rs << 21) | (inv_rt << 16) | 1u);
+                }
+                words.push_back(j_word);
+                return;
+            }
+
+            if (!in_range)
+            {
+                throw std::runtime_error("Branch offset out of 16-bit range");
+            }
+
+            imm = static_cast<uint16_t>(offset & 0xFFFF);
+        }
+
+        uint32_t word = (op << 26) |
+            (rs << 21) |
+            (rt << 16) |
+            imm;
+
+        words.push_back(word);
+
+        // if label was not yet known,
+        // record a fixup so Machine can patch later
+        if (!machine.has_label(label))
+        {
+            machine.add_branch_fixup(instr_pc,
+                                     opcode,
+                                     rs,
+                                     rt,
+                                     label);
+        }
+    }
+
+    // load/store 'op rt, label':
+    //   op  rt, addr($zero)          if addr fits in 16 signed bits
+    //   lui $at, hi(addr + 0x8000)
+    //   op  rt, lo(addr)($at)        otherwise
+    void emit_ls_label(Opcode opcode, uint32_t rt, const std::string & label,
+                       std::vector<uint32_t> & words)
+    {
+        const uint32_t AT = REG_TABLE.at("$at");
+
+        if (!machine.has_label(label))
+            throw std::runtime_error("Label not defined yet for load/store: " + label);
+
+        uint32_t addr = machine.lookup_label(label);
+        uint32_t op   = static_cast<uint32_t>(opcode);
+        uint16_t lo   = static_cast<uint16_t>(addr & 0xFFFFu);
+
+        int32_t saddr = static_cast<int32_t>(addr);
+        if (saddr >= -32768 && saddr <= 32767)
+        {
+            words.push_back((op << 26) | (0u << 21) | (rt << 16) | lo);
+            return;
+        }
+
+        // lo is sign-extended by the load, so round hi up when lo < 0
+        uint16_t hi = static_cast<uint16_t>(((addr + 0x8000u) >> 16) & 0xFFFFu);
+
+        uint32_t lui = static_cast<uint32_t>(OP_LUI);
+        words.push_back((lui << 26) | (0u << 21) | (AT << 16) | hi);
+        words.push_back((op << 26) | (AT << 21) | (rt << 16) | lo);
+    }
 };
 
 #endif // PARSER_H
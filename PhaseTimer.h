@@ -0,0 +1,176 @@
+// File  : PhaseTimer.h
+// Author: Cole Schwandt
+//
+// Where an interactive session or a load spends its time: lexing,
+// parsing, label fixups, execution and display.
+//
+// A PhaseTimer is a scoped timer. It is placed in Lexer::lex_core, in
+// the Parser entry points, in Machine's fixup resolution and around the
+// Interpreter's execute and display work. Each scope adds one sample,
+// in nanoseconds, to that phase's histogram in the PhaseTimers set for
+// the current thread. Timers nest, and a scope counts only its own
+// time: a label fixup run from inside the parser is charged to fixup,
+// not to parse. With no PhaseTimers installed, a timer costs one
+// thread-local load.
+//
+// Building with -DMIPS_NO_PHASE_TIMING makes PhaseTimer an empty class,
+// so every timer compiles away.
+
+#ifndef PHASE_TIMER_H
+#define PHASE_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+
+#include "Histogram.h"
+
+#ifdef MIPS_NO_PHASE_TIMING
+#define MIPS_PHASE_TIMING 0
+#else
+#define MIPS_PHASE_TIMING 1
+#endif
+
+enum TimedPhase
+{
+    TP_LEX,
+    TP_PARSE,
+    TP_FIXUP,
+    TP_EXECUTE,
+    TP_DISPLAY,
+    NUM_TIMED_PHASES,
+    TP_NONE = NUM_TIMED_PHASES  // a scope that times nothing
+};
+
+inline const char * timed_phase_name(TimedPhase p)
+{
+    static const char * names[NUM_TIMED_PHASES] = {
+        "lex", "parse", "fixup", "execute", "display"
+    };
+    return p < NUM_TIMED_PHASES ? names[p] : "none";
+}
+
+template < bool Enabled > class BasicPhaseTimer;
+
+//==============================================================
+// PhaseTimers: per-phase histograms for one thread
+//==============================================================
+class PhaseTimers
+{
+public:
+    // the set timers on this thread add to; null when not timing
+    static PhaseTimers *& current()
+    {
+        static thread_local PhaseTimers * timers = nullptr;
+        return timers;
+    }
+
+    void reset()
+    {
+        for (LatencyHistogram & h : phase_)
+            h.reset();
+    }
+
+    const LatencyHistogram & phase(TimedPhase p) const { return phase_[p]; }
+
+    void print(std::ostream & out) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "PHASE TIMING\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        if (!MIPS_PHASE_TIMING)
+        {
+            out << "phase timers were compiled out (MIPS_NO_PHASE_TIMING)\n";
+            return;
+        }
+
+        uint64_t total = 0;
+        for (const LatencyHistogram & h : phase_)
+            total += h.sum();
+
+        for (int p = 0; p < NUM_TIMED_PHASES; ++p)
+        {
+            const LatencyHistogram & h = phase_[p];
+            out << std::left << std::setw(10) << timed_phase_name(TimedPhase(p))
+                << std::right << std::setw(10) << LatencyHistogram::format_ns(h.sum())
+                << std::setw(7) << std::fixed << std::setprecision(1)
+                << (total ? 100.0 * h.sum() / total : 0.0) << '%'
+                << std::defaultfloat << '\n';
+        }
+        out << '\n';
+        for (int p = 0; p < NUM_TIMED_PHASES; ++p)
+            phase_[p].print(out, timed_phase_name(TimedPhase(p)));
+    }
+
+private:
+    friend class BasicPhaseTimer< true >;
+
+    LatencyHistogram phase_[NUM_TIMED_PHASES];
+    BasicPhaseTimer< true > * top_ = nullptr;  // innermost open timer
+};
+
+//==============================================================
+// PhaseTimer: time the enclosing scope as one phase
+//==============================================================
+template <>
+class BasicPhaseTimer< true >
+{
+public:
+    explicit BasicPhaseTimer(TimedPhase p)
+        : timers_(p == TP_NONE ? nullptr : PhaseTimers::current()), phase_(p)
+    {
+        if (timers_ == nullptr)
+            return;
+
+        start_ = std::chrono::steady_clock::now();
+        parent_ = timers_->top_;
+        if (parent_ != nullptr)
+            parent_->pause(start_);
+        timers_->top_ = this;
+    }
+
+    ~BasicPhaseTimer()
+    {
+        if (timers_ == nullptr)
+            return;
+
+        auto now = std::chrono::steady_clock::now();
+        pause(now);
+        timers_->phase_[phase_].add(self_ns_);
+        timers_->top_ = parent_;
+        if (parent_ != nullptr)
+            parent_->start_ = now;
+    }
+
+    BasicPhaseTimer(const BasicPhaseTimer &) = delete;
+    BasicPhaseTimer & operator=(const BasicPhaseTimer &) = delete;
+
+private:
+    PhaseTimers * timers_;
+    TimedPhase    phase_;
+    BasicPhaseTimer * parent_ = nullptr;
+    uint64_t      self_ns_ = 0;
+    std::chrono::steady_clock::time_point start_;
+
+    // bank the time since start_ (a nested timer is starting, or this
+    // one is ending)
+    void pause(std::chrono::steady_clock::time_point now)
+    {
+        self_ns_ += static_cast<uint64_t>(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(now - start_).count());
+    }
+};
+
+template <>
+class BasicPhaseTimer< false >
+{
+public:
+    explicit BasicPhaseTimer(TimedPhase) {}
+};
+
+typedef BasicPhaseTimer< MIPS_PHASE_TIMING != 0 > PhaseTimer;
+
+#endif // PHASE_TIMER_H
@@ -0,0 +1,96 @@
+// File  : ProgramImage.h
+// Author: Cole Schwandt
+//
+// An assembled program frozen so many Machines can run it at once.
+//
+// The image owns a Memory whose text has been sealed into shared,
+// immutable pages, plus a PredecodedText table built from them. Each
+// instance gets a copy of that Memory: the text pages are shared by
+// reference count and only the data and stack bytes are copied. A
+// guest store into text copies just the page it hits. Nothing in the
+// image is written after capture, so instances may run on any thread.
+// For the same reason its Memory holds no compressed pages: capture
+// thaws them, since even a read of a cold page writes the page maps.
+
+#ifndef PROGRAM_IMAGE_H
+#define PROGRAM_IMAGE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "Memory.h"
+#include "Machine.h"
+#include "RunStats.h"
+
+class ProgramImage
+{
+public:
+    // address range and source of one assembled text line
+    struct SourceSpan
+    {
+        uint32_t    pc_before;
+        uint32_t    pc_after;
+        std::string text;
+    };
+
+    // freeze the assembled state of 'm'. 'sources' maps text addresses
+    // back to lines for fault reports and may be empty.
+    static std::shared_ptr< const ProgramImage >
+    capture(const Machine & m, std::vector< SourceSpan > sources)
+    {
+        std::shared_ptr< ProgramImage > image(new ProgramImage());
+        image->mem_ = m.mem;
+        image->mem_.thaw_all();
+        image->mem_.seal_text();
+        image->predecoded_.build(image->mem_, m.text_cursor);
+        image->labels_   = m.labels;
+        image->text_end_ = m.text_cursor;
+        image->data_end_ = m.data_cursor;
+        image->sources_  = std::move(sources);
+        return image;
+    }
+
+    // reset 'm' to a fresh run of the program at TEXT_BASE
+    void instantiate(Machine & m) const
+    {
+        m.reset();
+        m.mem          = mem_;
+        m.labels       = labels_;
+        m.text_cursor  = text_end_;
+        m.data_cursor  = data_end_;
+        m.cpu.pc       = TEXT_BASE;
+        m.cpu.halted   = false;
+        m.checkpoint(); // instances start equal: diffs see only the run
+    }
+
+    const Memory & memory() const { return mem_; }
+    const PredecodedText & predecoded() const { return predecoded_; }
+    uint32_t text_end() const { return text_end_; }
+    uint32_t data_end() const { return data_end_; }
+    const Machine::LabelMap & labels() const { return labels_; }
+
+    std::string source_at(uint32_t pc) const
+    {
+        for (const SourceSpan & s : sources_)
+        {
+            if (s.pc_before <= pc && pc < s.pc_after)
+                return s.text;
+        }
+        return "";
+    }
+
+private:
+    ProgramImage() : text_end_(TEXT_BASE), data_end_(DATA_BASE) {}
+
+    Memory mem_;
+    PredecodedText predecoded_;
+    Machine::LabelMap labels_;
+    uint32_t text_end_;
+    uint32_t data_end_;
+    std::vector< SourceSpan > sources_;
+};
+
+#endif // PROGRAM_IMAGE_H
@@ -1,5 +1,9 @@
 // File  : RegisterFile.h
 // Author: Cole Schwandt
+//
+// General purpose registers plus HI/LO. Every write also sets the
+// register's bit in a dirty mask (bit 32 is HI, bit 33 is LO), cleared
+// at checkpoints, so displays and diffs can skip untouched registers.
 
 #ifndef REGISTER_FILE_H
 #define REGISTER_FILE_H
@@ -10,6 +14,10 @@
 class RegisterFile
 {
   public:
+    static const uint8_t HI_BIT = 32;
+    static const uint8_t LO_BIT = 33;
+    static const uint64_t ALL_DIRTY = (1ull << 34) - 2; // never $0
+
     // structors
     RegisterFile()
     {
@@ -34,7 +42,10 @@ class RegisterFile
         assert(i < 32);
         
         if (i != 0) // silently prevent overwrite of $0
+        {
             x_[i] = v;
+            dirty_ |= 1ull << i;
+        }
     }
 
     void writeS(uint8_t i, int32_t v)
@@ -49,10 +60,20 @@ class RegisterFile
     int32_t  loS() const { return static_cast< int32_t >(lo_); }
 
     // hi/lo setters
-    void write_hiU(uint32_t v) { hi_ = v; }
-    void write_hiS(int32_t v)  { hi_ = static_cast< uint32_t >(v); }
-    void write_loU(uint32_t v) { lo_ = v; }
-    void write_loS(int32_t v)  { lo_ = static_cast< uint32_t >(v); }
+    void write_hiU(uint32_t v) { hi_ = v; dirty_ |= 1ull << HI_BIT; }
+    void write_hiS(int32_t v)  { write_hiU(static_cast< uint32_t >(v)); }
+    void write_loU(uint32_t v) { lo_ = v; dirty_ |= 1ull << LO_BIT; }
+    void write_loS(int32_t v)  { write_loU(static_cast< uint32_t >(v)); }
+
+    // registers written since the last clear_dirty()
+    uint64_t dirty_mask() const { return dirty_; }
+    void clear_dirty() { dirty_ = 0; }
+
+    // value by dirty-mask bit: 0..31, HI_BIT or LO_BIT
+    uint32_t read_bit(uint8_t bit) const
+    {
+        return bit == HI_BIT ? hi_ : bit == LO_BIT ? lo_ : readU(bit);
+    }
     
     // init
     void reset()
@@ -62,12 +83,14 @@ class RegisterFile
             r = 0;
         }
         hi_ = lo_ = 0;
+        dirty_ = ALL_DIRTY;
     }
     
   private:
     uint32_t x_[32];
     uint32_t hi_;
     uint32_t lo_;
+    uint64_t dirty_;
 };
 
 #endif
@@ -0,0 +1,338 @@
+// File  : RunControl.h
+// Author: Cole Schwandt
+//
+// What the REPL needs to keep answering while the guest runs.
+//
+// A console thread reads the user's lines. While a program runs it
+// answers the control commands itself (pause, continue, status, stop)
+// and queues every other line. The interpreter reads its REPL lines and
+// the guest's console input from that queue (LineQueue), in order, so a
+// session behaves exactly as it did reading std::cin directly. While
+// the reader waits for a line, an idle hook can run on its thread now
+// and then (the REPL packs away idle memory there).
+//
+// RunControl is shared by the two threads. The interpreter publishes
+// the pc and step count every STEP_SLICE steps and looks for pause and
+// stop requests there; a request takes effect at the next basic-block
+// boundary. Ctrl-C (SIGINT) during a run is a stop request; with no
+// program running it ends the process as before.
+
+#ifndef RUN_CONTROL_H
+#define RUN_CONTROL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <streambuf>
+#include <string>
+
+//==============================================================
+// LineQueue: lines from the console thread, read as a stream
+//==============================================================
+class LineQueue : public std::streambuf
+{
+public:
+    void push(const std::string & line)
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        lines_.push_back(line + '\n');
+        cv_.notify_one();
+    }
+
+    // no more lines: the reader gets end-of-file once the queue drains
+    void close()
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        closed_ = true;
+        cv_.notify_one();
+    }
+
+    // call 'hook' every 'period' while the reader waits for a line, on
+    // the reader's thread and without the queue locked
+    void set_idle_hook(std::chrono::milliseconds period, std::function< void() > hook)
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        idle_period_ = period;
+        idle_hook_ = std::move(hook);
+    }
+
+    bool closed() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return closed_;
+    }
+
+    // the reader is blocked for want of a line and none is queued
+    bool idle() const
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        return waiting_ && lines_.empty();
+    }
+
+protected:
+    int_type underflow() override
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+
+        std::unique_lock< std::mutex > lock(mutex_);
+        waiting_ = true;
+        auto ready = [this] { return !lines_.empty() || closed_; };
+        while (!ready())
+        {
+            if (!idle_hook_)
+            {
+                cv_.wait(lock, ready);
+                break;
+            }
+            if (cv_.wait_for(lock, idle_period_, ready))
+                break;
+
+            std::function< void() > hook = idle_hook_;
+            lock.unlock();
+            hook();
+            lock.lock();
+        }
+        waiting_ = false;
+        if (lines_.empty())
+            return traits_type::eof();
+
+        current_ = std::move(lines_.front());
+        lines_.pop_front();
+        setg(&current_[0], &current_[0], &current_[0] + current_.size());
+        return traits_type::to_int_type(current_[0]);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque< std::string > lines_;
+    std::string current_;
+    bool closed_  = false;
+    bool waiting_ = false;
+    std::chrono::milliseconds idle_period_{ 0 };
+    std::function< void() > idle_hook_;
+};
+
+//==============================================================
+// RunControl: pause, continue, stop and status of a running guest
+//==============================================================
+class RunControl
+{
+public:
+    // steps between two looks at the control state
+    static const uint32_t STEP_SLICE = 4096;
+
+    // install on_sigint for SIGINT for the life of this object
+    RunControl()
+    {
+        previous_ = std::signal(SIGINT, on_sigint);
+    }
+
+    ~RunControl()
+    {
+        std::signal(SIGINT, previous_ == SIG_ERR ? SIG_DFL : previous_);
+    }
+
+    RunControl(const RunControl &) = delete;
+    RunControl & operator=(const RunControl &) = delete;
+
+    //----------------------------------------------------------
+    // interpreter side
+    //----------------------------------------------------------
+    // a run starts. a stop or pause asked for since the last
+    // clear_requests (say 'stop' typed right behind 'run') applies to it.
+    void begin(uint32_t pc)
+    {
+        interrupt_flag().store(false); // a Ctrl-C while idle is forgotten
+        paused_ = false;
+        pc_ = pc;
+        steps_ = 0;
+        active_ns_ = 0;
+        resumed_ = std::chrono::steady_clock::now();
+        running_ = true;
+        active_flag().store(true);
+    }
+
+    void end()
+    {
+        active_flag().store(false);
+        if (!paused_)
+            bank_active_time();
+        paused_ = false;
+        running_ = false;
+    }
+
+    // drop requests left over from a line that ran nothing
+    void clear_requests()
+    {
+        std::lock_guard< std::mutex > lock(mutex_);
+        stop_ = false;
+        pause_ = false;
+    }
+
+    void publish(uint32_t pc, uint64_t steps)
+    {
+        pc_ = pc;
+        steps_ = steps;
+    }
+
+    // a pause or stop is pending: finish the current block, then hold
+    bool yield_requested() const
+    {
+        return pause_.load() || stop_.load() || interrupt_flag().load();
+    }
+
+    // at a block boundary: wait out a pause. false if the run is to stop.
+    bool hold(uint32_t pc, uint64_t steps, std::ostream & out)
+    {
+        publish(pc, steps);
+        if (interrupt_flag().exchange(false))
+            stop_ = true;
+        if (stop_)
+            return false;
+        if (!pause_)
+            return true;
+
+        bank_active_time();
+        paused_ = true;
+        out << "paused at 0x" << std::hex << pc << std::dec << " after " << steps
+            << " steps ('continue' to resume)\n" << std::flush;
+        {
+            std::unique_lock< std::mutex > lock(mutex_);
+            // Ctrl-C has no way to notify, so look again now and then
+            while (pause_ && !stop_ && !interrupt_flag().load())
+                cv_.wait_for(lock, std::chrono::milliseconds(100));
+        }
+        resumed_ = std::chrono::steady_clock::now();
+        paused_ = false;
+        if (interrupt_flag().exchange(false))
+            stop_ = true;
+        return !stop_;
+    }
+
+    //----------------------------------------------------------
+    // console side
+    //----------------------------------------------------------
+    bool running() const { return running_.load(); }
+
+    // answer a control command: 'pause', 'continue', 'status' or 'stop'.
+    // false (and nothing printed) for any other line, and for 'status'
+    // and 'continue' when no run is active, which the interpreter
+    // answers in turn. 'input_wait': the guest is blocked reading
+    // console input.
+    bool command(std::string line, std::ostream & out, bool input_wait)
+    {
+        const char * blanks = " \t\r";
+        std::size_t b = line.find_first_not_of(blanks);
+        line = (b == std::string::npos) ? "" : line.substr(b, line.find_last_not_of(blanks) + 1 - b);
+
+        if ((line == "status" || line == "continue") && !running())
+            return false;
+
+        if (line == "status")
+        {
+            print_status(out, input_wait);
+        }
+        else if (line == "pause")
+        {
+            if (paused_)
+                out << "Program is already paused.\n";
+            pause_ = true;
+        }
+        else if (line == "continue")
+        {
+            std::lock_guard< std::mutex > lock(mutex_);
+            if (!pause_)
+                out << "Program is not paused.\n";
+            pause_ = false;
+            cv_.notify_all();
+        }
+        else if (line == "stop")
+        {
+            std::lock_guard< std::mutex > lock(mutex_);
+            stop_ = true;
+            cv_.notify_all();
+        }
+        else
+        {
+            return false;
+        }
+        out << std::flush;
+        return true;
+    }
+
+    void print_status(std::ostream & out, bool input_wait) const
+    {
+        const uint64_t steps = steps_.load();
+        uint64_t ns = active_ns_.load();
+        if (!paused_.load())
+            ns += elapsed_ns();
+
+        out << (paused_ ? "paused" : input_wait ? "waiting for console input" : "running")
+            << ": pc 0x" << std::hex << pc_.load() << std::dec
+            << ", " << steps << " steps";
+        if (ns != 0)
+            out << ", " << std::fixed << std::setprecision(2)
+                << (steps * 1e3 / ns) << " MIPS" << std::defaultfloat;
+        out << '\n';
+    }
+
+private:
+    std::atomic< bool >     running_{ false };
+    std::atomic< bool >     pause_{ false };
+    std::atomic< bool >     paused_{ false };
+    std::atomic< bool >     stop_{ false };
+    std::atomic< uint32_t > pc_{ 0 };
+    std::atomic< uint64_t > steps_{ 0 };
+    std::atomic< uint64_t > active_ns_{ 0 };  // running time before the last pause
+    std::atomic< std::chrono::steady_clock::time_point > resumed_{};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    void (*previous_)(int) = SIG_DFL;
+
+    // set from the SIGINT handler; lock-free, so safe there
+    static std::atomic< bool > & interrupt_flag()
+    {
+        static std::atomic< bool > flag{ false };
+        return flag;
+    }
+
+    // a run is in progress, so SIGINT must not end the process
+    static std::atomic< bool > & active_flag()
+    {
+        static std::atomic< bool > flag{ false };
+        return flag;
+    }
+
+    static void on_sigint(int sig)
+    {
+        if (active_flag().load())
+        {
+            interrupt_flag().store(true);
+            return;
+        }
+        std::signal(sig, SIG_DFL);
+        std::raise(sig);
+    }
+
+    uint64_t elapsed_ns() const
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast< std::chrono::nanoseconds >(
+            std::chrono::steady_clock::now() - resumed_.load()).count());
+    }
+
+    void bank_active_time()
+    {
+        active_ns_ += elapsed_ns();
+    }
+};
+
+#endif // RUN_CONTROL_H
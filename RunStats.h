@@ -0,0 +1,522 @@
+// File  : RunStats.h
+// Author: Cole Schwandt
+//
+// Run statistics: instructions by class, memory traffic, branch
+// outcomes, syscalls by code, traps, pages touched and wall time.
+//
+// Counting is per basic block, not per instruction. The first time a
+// block (a straight run from some pc up to and including the next
+// branch/jump/syscall) is entered, its instructions are decoded once
+// into a BlockProfile. From then on the CPU only compares its pc
+// against the current block's last pc; on a match the whole profile is
+// added to the counters in one go.
+
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <cstdint>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+
+#include "Constants.h"
+#include "Memory.h"
+#include "RegisterFile.h"
+
+enum InstrClass
+{
+    IC_ALU,
+    IC_MULDIV,
+    IC_LOAD,
+    IC_STORE,
+    IC_BRANCH,
+    IC_JUMP,
+    IC_SYSCALL,
+    IC_OTHER,
+    NUM_INSTR_CLASSES
+};
+
+static const char * const INSTR_CLASS_NAMES[NUM_INSTR_CLASSES] = {
+    "alu", "muldiv", "load", "store", "branch", "jump", "syscall", "other"
+};
+
+// class of an encoded instruction; 'bytes' gets the access size of
+// loads and stores (0 otherwise)
+inline InstrClass classify_instr(uint32_t word, uint32_t & bytes)
+{
+    uint32_t op    = (word >> 26) & 0x3Fu;
+    uint32_t funct =  word        & 0x3Fu;
+    bytes = 0;
+
+    switch (op)
+    {
+        case OP_RTYPE:
+            switch (funct)
+            {
+                case FUNCT_JR:
+                case FUNCT_JALR:    return IC_JUMP;
+                case FUNCT_SYSCALL: return IC_SYSCALL;
+                case FUNCT_MULT:
+                case FUNCT_MULTU:
+                case FUNCT_DIV:
+                case FUNCT_DIVU:    return IC_MULDIV;
+                default:            return IC_ALU;
+            }
+
+        case OP_SPECIAL2:
+            return (funct == S2_CLZ || funct == S2_CLO) ? IC_ALU : IC_MULDIV;
+
+        case OP_REGIMM:
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLEZ:
+        case OP_BGTZ:
+            return IC_BRANCH;
+
+        case OP_J:
+        case OP_JAL:
+            return IC_JUMP;
+
+        case OP_LB: case OP_LBU: bytes = 1; return IC_LOAD;
+        case OP_LH: case OP_LHU: bytes = 2; return IC_LOAD;
+        case OP_LW:              bytes = 4; return IC_LOAD;
+        case OP_SB:              bytes = 1; return IC_STORE;
+        case OP_SH:              bytes = 2; return IC_STORE;
+        case OP_SW:              bytes = 4; return IC_STORE;
+
+        case OP_ADDI: case OP_ADDIU: case OP_SLTI: case OP_SLTIU:
+        case OP_ANDI: case OP_ORI:   case OP_XORI: case OP_LUI:
+        case OP_SPECIAL3:
+            return IC_ALU;
+
+        // guest SIMD: vector loads and stores move 16 bytes
+        case OP_MSA:
+            if (funct == MSA_LD_W) { bytes = 16; return IC_LOAD; }
+            if (funct == MSA_ST_W) { bytes = 16; return IC_STORE; }
+            return (funct == MSA_MUL) ? IC_MULDIV : IC_ALU;
+
+        // eret ends a basic block like a jump
+        case OP_COP0:
+            return (((word >> 21) & 0x1Fu) == C0_CO && funct == C0_ERET) ? IC_JUMP
+                                                                          : IC_OTHER;
+
+        default:
+            return IC_OTHER;
+    }
+}
+
+//==============================================================
+// PredecodedText: class and access size of every text word
+//==============================================================
+// decoded once when a program image is captured and only read after
+// that, so every run of the image (on any thread) shares one table
+class PredecodedText
+{
+public:
+    void build(const Memory & mem, uint32_t text_end)
+    {
+        entries_.clear();
+        for (uint32_t a = TEXT_BASE; a < text_end; a += 4)
+        {
+            uint32_t bytes = 0;
+            InstrClass c = classify_instr(mem.load32(a), bytes);
+            entries_.push_back(static_cast<uint8_t>(c << 3 | bytes));
+        }
+    }
+
+    bool covers(uint32_t addr) const
+    {
+        return addr >= TEXT_BASE && (addr - TEXT_BASE) / 4 < entries_.size();
+    }
+
+    InstrClass at(uint32_t addr, uint32_t & bytes) const
+    {
+        uint8_t e = entries_[(addr - TEXT_BASE) / 4];
+        bytes = e & 7u;
+        return static_cast<InstrClass>(e >> 3);
+    }
+
+private:
+    std::vector< uint8_t > entries_;   // class << 3 | bytes
+};
+
+//==============================================================
+// RunStats: the counters of one run (or a sum of runs)
+//==============================================================
+struct RunStats
+{
+    static const uint32_t NUM_SYSCALL_CODES = 64; // higher codes share the last slot
+
+    uint64_t instructions = 0;
+    uint64_t by_class[NUM_INSTR_CLASSES] = {};
+    uint64_t load_bytes   = 0;
+    uint64_t store_bytes  = 0;
+    uint64_t branches_taken     = 0;
+    uint64_t branches_not_taken = 0;
+    uint64_t syscalls[NUM_SYSCALL_CODES] = {};
+    uint64_t traps        = 0;
+    uint64_t blocks       = 0; // basic blocks executed
+    uint64_t pages_touched = 0;
+    uint64_t wall_ns      = 0;
+
+    uint64_t loads()  const { return by_class[IC_LOAD]; }
+    uint64_t stores() const { return by_class[IC_STORE]; }
+
+    // guest millions of instructions per second
+    double mips() const
+    {
+        return wall_ns ? instructions * 1e3 / static_cast<double>(wall_ns) : 0.0;
+    }
+
+    void add(const RunStats & o)
+    {
+        instructions += o.instructions;
+        for (int c = 0; c < NUM_INSTR_CLASSES; ++c)
+            by_class[c] += o.by_class[c];
+        load_bytes  += o.load_bytes;
+        store_bytes += o.store_bytes;
+        branches_taken     += o.branches_taken;
+        branches_not_taken += o.branches_not_taken;
+        for (uint32_t s = 0; s < NUM_SYSCALL_CODES; ++s)
+            syscalls[s] += o.syscalls[s];
+        traps   += o.traps;
+        blocks  += o.blocks;
+        pages_touched += o.pages_touched;
+        wall_ns += o.wall_ns;
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n';
+        out << "RUN STATS\n";
+        out << std::setw(65) << '\n';
+        out << std::setfill(' ');
+
+        out << "instructions : " << instructions << '\n';
+        for (int c = 0; c < NUM_INSTR_CLASSES; ++c)
+        {
+            if (by_class[c] == 0)
+                continue;
+            out << "  " << std::left << std::setw(10) << INSTR_CLASS_NAMES[c]
+                << std::right << std::setw(12) << by_class[c] << '\n';
+        }
+        out << "loads        : " << loads()  << " (" << load_bytes  << " bytes)\n"
+            << "stores       : " << stores() << " (" << store_bytes << " bytes)\n"
+            << "branches     : " << branches_taken << " taken, "
+            << branches_not_taken << " not taken\n"
+            << "blocks       : " << blocks << '\n';
+        out << "syscalls     :";
+        bool any = false;
+        for (uint32_t s = 0; s < NUM_SYSCALL_CODES; ++s)
+        {
+            if (syscalls[s] == 0)
+                continue;
+            out << ' ' << s << (s + 1 == NUM_SYSCALL_CODES ? "+" : "")
+                << ':' << syscalls[s];
+            any = true;
+        }
+        out << (any ? "\n" : " none\n");
+        out << "traps        : " << traps << '\n'
+            << "pages touched: " << pages_touched << '\n'
+            << "wall time    : " << std::fixed << std::setprecision(3)
+            << wall_ns / 1e6 << " ms\n"
+            << "guest MIPS   : " << std::setprecision(2) << mips() << '\n';
+        out.unsetf(std::ios::floatfield);
+    }
+
+    void write_json(std::ostream & out) const
+    {
+        out << "{\"instructions\":" << instructions << ",\"by_class\":{";
+        for (int c = 0; c < NUM_INSTR_CLASSES; ++c)
+            out << (c ? "," : "") << '"' << INSTR_CLASS_NAMES[c] << "\":" << by_class[c];
+        out << "},\"loads\":" << loads()
+            << ",\"stores\":" << stores()
+            << ",\"load_bytes\":" << load_bytes
+            << ",\"store_bytes\":" << store_bytes
+            << ",\"branches_taken\":" << branches_taken
+            << ",\"branches_not_taken\":" << branches_not_taken
+            << ",\"blocks\":" << blocks
+            << ",\"syscalls\":{";
+        bool first = true;
+        for (uint32_t s = 0; s < NUM_SYSCALL_CODES; ++s)
+        {
+            if (syscalls[s] == 0)
+                continue;
+            out << (first ? "" : ",") << '"' << s << "\":" << syscalls[s];
+            first = false;
+        }
+        out << "},\"traps\":" << traps
+            << ",\"pages_touched\":" << pages_touched
+            << ",\"wall_ns\":" << wall_ns
+            << ",\"mips\":" << std::fixed << std::setprecision(3) << mips()
+            << "}\n";
+        out.unsetf(std::ios::floatfield);
+    }
+
+    // Prometheus text exposition format; 'runs' is the number of runs
+    // summed into these counters
+    void write_prometheus(std::ostream & out, uint64_t runs) const
+    {
+        auto counter = [&](const char * name, const char * help)
+        {
+            out << "# HELP " << name << ' ' << help << '\n'
+                << "# TYPE " << name << " counter\n";
+        };
+
+        counter("mips_runs_total", "Programs run.");
+        out << "mips_runs_total " << runs << '\n';
+
+        counter("mips_instructions_total", "Instructions retired, by class.");
+        for (int c = 0; c < NUM_INSTR_CLASSES; ++c)
+            out << "mips_instructions_total{class=\"" << INSTR_CLASS_NAMES[c]
+                << "\"} " << by_class[c] << '\n';
+
+        counter("mips_memory_bytes_total", "Bytes moved by loads and stores.");
+        out << "mips_memory_bytes_total{dir=\"load\"} "  << load_bytes  << '\n'
+            << "mips_memory_bytes_total{dir=\"store\"} " << store_bytes << '\n';
+
+        counter("mips_branches_total", "Conditional branches by outcome.");
+        out << "mips_branches_total{outcome=\"taken\"} "     << branches_taken     << '\n'
+            << "mips_branches_total{outcome=\"not_taken\"} " << branches_not_taken << '\n';
+
+        counter("mips_syscalls_total", "Syscalls by service code.");
+        for (uint32_t s = 0; s < NUM_SYSCALL_CODES; ++s)
+        {
+            if (syscalls[s] != 0)
+                out << "mips_syscalls_total{code=\"" << s << "\"} " << syscalls[s] << '\n';
+        }
+
+        counter("mips_traps_total", "Runs ended by a guest fault.");
+        out << "mips_traps_total " << traps << '\n';
+
+        counter("mips_pages_touched_total", "Mapped pages at the end of each run.");
+        out << "mips_pages_touched_total " << pages_touched << '\n';
+
+        counter("mips_run_seconds_total", "Wall time spent executing.");
+        out << "mips_run_seconds_total " << std::fixed << std::setprecision(6)
+            << wall_ns / 1e9 << '\n';
+        out.unsetf(std::ios::floatfield);
+    }
+};
+
+//==============================================================
+// RunStatsCollector: block-batched counting for one run
+//==============================================================
+class RunStatsCollector
+{
+public:
+    // sentinel for "not inside a known block"; never a fetchable pc
+    static const uint32_t NO_BLOCK = 0xFFFFFFFFu;
+
+    RunStatsCollector()
+        : mem_(nullptr), lazy_(nullptr), predecoded_(nullptr), text_end_(0),
+          cur_(nullptr),
+          last_(NO_BLOCK), closed_(false), syscall_(0)
+    {}
+
+    // text assembled on demand: blocks are profiled from the real
+    // instructions, not the placeholders
+    void set_lazy_text(LazyText * lazy) { lazy_ = lazy; }
+
+    // shared decode of the text; used for every word still read from a
+    // sealed page (a page the run stored to is decoded from memory)
+    void set_predecoded(const PredecodedText * p) { predecoded_ = p; }
+
+    // start counting a run that begins at 'pc'. the block cache is
+    // dropped: the program may have been re-assembled since last time.
+    void begin(const Memory & mem, uint32_t pc, uint32_t text_end)
+    {
+        mem_      = &mem;
+        text_end_ = text_end;
+        blocks_.clear();
+        stats_    = RunStats();
+        start_    = std::chrono::steady_clock::now();
+        enter(pc);
+    }
+
+    // pc of the last instruction of the current block
+    uint32_t block_last() const { return last_; }
+
+    // the CPU is about to execute the current block's last instruction
+    void close_block(const RegisterFile & regs)
+    {
+        const BlockProfile & b = *cur_;
+        stats_.instructions += b.length;
+        for (int c = 0; c < NUM_INSTR_CLASSES; ++c)
+            stats_.by_class[c] += b.count[c];
+        stats_.load_bytes  += b.load_bytes;
+        stats_.store_bytes += b.store_bytes;
+        ++stats_.blocks;
+        closed_ = true;
+
+        if (b.ends_in == IC_SYSCALL)
+        {
+            uint32_t code = regs.readU(2);
+            if (code >= RunStats::NUM_SYSCALL_CODES)
+                code = RunStats::NUM_SYSCALL_CODES - 1;
+            ++stats_.syscalls[code];
+            syscall_ = code;
+        }
+    }
+
+    // ... and has executed it; 'pc' is where control went
+    void next_block(uint32_t pc)
+    {
+        if (cur_->ends_in == IC_BRANCH)
+        {
+            if (pc == cur_->last + 4)
+                ++stats_.branches_not_taken;
+            else
+                ++stats_.branches_taken;
+        }
+        enter(pc);
+    }
+
+    // the instruction at 'at' raised an exception the guest handles
+    // (a TLB refill): the block ends there, without a branch outcome,
+    // and the next one starts at the handler 'vector'
+    void trap(uint32_t at, uint32_t vector)
+    {
+        retire_partial(at);
+        enter(vector);
+    }
+
+    // the run stopped with 'pc' as the next instruction to execute
+    // (for a fault: the faulting instruction). the part of the current
+    // block before 'pc' is counted.
+    void finish(uint32_t pc, bool trapped)
+    {
+        retire_partial(pc);
+        cur_  = nullptr;
+        last_ = NO_BLOCK;
+
+        if (trapped)
+            ++stats_.traps;
+        stats_.pages_touched = mem_->mapped_pages(TEXT_BASE, STACK_LIMIT).size();
+        stats_.wall_ns = static_cast<uint64_t>(
+            std::chrono::duration_cast< std::chrono::nanoseconds >(
+                std::chrono::steady_clock::now() - start_).count());
+    }
+
+    const RunStats & stats() const { return stats_; }
+
+private:
+    struct BlockProfile
+    {
+        uint32_t start;
+        uint32_t last;
+        uint32_t length;
+        uint32_t count[NUM_INSTR_CLASSES];
+        uint32_t load_bytes;
+        uint32_t store_bytes;
+        InstrClass ends_in;  // IC_BRANCH / IC_JUMP / IC_SYSCALL, or IC_ALU
+                             // for a block that runs off the end of text
+    };
+
+    const Memory * mem_;
+    LazyText * lazy_;
+    const PredecodedText * predecoded_;
+    uint32_t text_end_;
+    std::unordered_map< uint32_t, BlockProfile > blocks_;
+    const BlockProfile * cur_;
+    uint32_t last_;
+    bool closed_;   // close_block ran, next_block has not yet
+    uint32_t syscall_;  // code counted by that close_block, if a syscall
+    RunStats stats_;
+    std::chrono::steady_clock::time_point start_;
+
+    // the current block ran only up to 'pc', which did not retire:
+    // count what ran before it, or, when close_block already counted
+    // the whole block, take back its last instruction
+    void retire_partial(uint32_t pc)
+    {
+        if (cur_ != nullptr && closed_)
+        {
+            uint32_t bytes = 0;
+            InstrClass c = classify_at(cur_->last, bytes);
+            --stats_.instructions;
+            --stats_.by_class[c];
+            if (c == IC_LOAD)  stats_.load_bytes  -= bytes;
+            if (c == IC_STORE) stats_.store_bytes -= bytes;
+            if (c == IC_SYSCALL)
+                --stats_.syscalls[syscall_];
+        }
+        else if (cur_ != nullptr && cur_->start <= pc && pc <= cur_->last)
+        {
+            for (uint32_t a = cur_->start; a < pc; a += 4)
+            {
+                uint32_t bytes = 0;
+                InstrClass c = classify_at(a, bytes);
+                ++stats_.instructions;
+                ++stats_.by_class[c];
+                if (c == IC_LOAD)  stats_.load_bytes  += bytes;
+                if (c == IC_STORE) stats_.store_bytes += bytes;
+            }
+        }
+        closed_ = false;
+    }
+
+    void enter(uint32_t pc)
+    {
+        closed_ = false;
+        if (pc < TEXT_BASE || pc >= text_end_ || (pc & 3u) != 0)
+        {
+            // the run loop is about to stop (or fault); nothing to count
+            cur_  = nullptr;
+            last_ = NO_BLOCK;
+            return;
+        }
+
+        auto it = blocks_.find(pc);
+        if (it == blocks_.end())
+            it = blocks_.emplace(pc, profile(pc)).first;
+
+        cur_  = &it->second;
+        last_ = cur_->last;
+    }
+
+    // decode the straight-line run starting at 'pc'. stores into text
+    // are not tracked, so self-modifying code is counted as assembled.
+    BlockProfile profile(uint32_t pc)
+    {
+        BlockProfile b = {};
+        b.start   = pc;
+        b.ends_in = IC_ALU;
+
+        for (uint32_t a = pc; a < text_end_; a += 4)
+        {
+            uint32_t bytes = 0;
+            InstrClass c = classify_at(a, bytes);
+            ++b.count[c];
+            ++b.length;
+            if (c == IC_LOAD)  b.load_bytes  += bytes;
+            if (c == IC_STORE) b.store_bytes += bytes;
+            b.last = a;
+
+            if (c == IC_BRANCH || c == IC_JUMP || c == IC_SYSCALL)
+            {
+                b.ends_in = c;
+                break;
+            }
+        }
+        return b;
+    }
+
+    // class of the text word at 'a', as profile counts it
+    InstrClass classify_at(uint32_t a, uint32_t & bytes)
+    {
+        if (predecoded_ != nullptr && predecoded_->covers(a) && mem_->is_shared_text(a))
+            return predecoded_->at(a, bytes);
+
+        uint32_t word = mem_->load32(a);
+        if (word == LAZY_TEXT_WORD && lazy_ != nullptr && lazy_->materialize(a))
+            word = mem_->load32(a);
+        return classify_instr(word, bytes);
+    }
+};
+
+#endif // RUN_STATS_H
@@ -0,0 +1,164 @@
+// File  : Simd.h
+// Author: Cole Schwandt
+//
+// u32x4: four 32-bit lanes held in one SSE2 register, with a plain
+// array in its place on hosts without SSE2. Lockstep execution keeps a
+// register's value for four inputs in one u32x4; the guest SIMD unit
+// (Msa.h) keeps one 128-bit vector register in one.
+//
+// Where the build allows it, SSE4.1 supplies the lane multiply and
+// AVX2 the per-lane shifts; otherwise they are emulated.
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+//==============================================================
+// u32x4: four 32-bit lanes (SSE2, or a plain array elsewhere)
+//==============================================================
+#if defined(__SSE2__)
+
+struct u32x4 { __m128i v; };
+
+inline u32x4 load4(const uint32_t * p)
+{ return { _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)) }; }
+inline void store4(uint32_t * p, u32x4 a)
+{ _mm_storeu_si128(reinterpret_cast<__m128i *>(p), a.v); }
+inline u32x4 splat4(uint32_t x) { return { _mm_set1_epi32(static_cast<int>(x)) }; }
+inline u32x4 add4(u32x4 a, u32x4 b) { return { _mm_add_epi32(a.v, b.v) }; }
+inline u32x4 sub4(u32x4 a, u32x4 b) { return { _mm_sub_epi32(a.v, b.v) }; }
+inline u32x4 and4(u32x4 a, u32x4 b) { return { _mm_and_si128(a.v, b.v) }; }
+inline u32x4 or4 (u32x4 a, u32x4 b) { return { _mm_or_si128(a.v, b.v) }; }
+inline u32x4 xor4(u32x4 a, u32x4 b) { return { _mm_xor_si128(a.v, b.v) }; }
+inline u32x4 eq4 (u32x4 a, u32x4 b) { return { _mm_cmpeq_epi32(a.v, b.v) }; }
+inline u32x4 lt4 (u32x4 a, u32x4 b) { return { _mm_cmplt_epi32(a.v, b.v) }; }
+inline u32x4 sll4(u32x4 a, unsigned n) { return { _mm_sll_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+inline u32x4 srl4(u32x4 a, unsigned n) { return { _mm_srl_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+inline u32x4 sra4(u32x4 a, unsigned n) { return { _mm_sra_epi32(a.v, _mm_cvtsi32_si128(n)) }; }
+// bit i set if lane i has its sign bit set
+inline int signs4(u32x4 a) { return _mm_movemask_ps(_mm_castsi128_ps(a.v)); }
+
+// ops used by the guest SIMD unit (Msa.h)
+inline u32x4 not4(u32x4 a) { return { _mm_xor_si128(a.v, _mm_set1_epi32(-1)) }; }
+inline u32x4 ltu4(u32x4 a, u32x4 b)
+{
+    const __m128i bias = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    return { _mm_cmplt_epi32(_mm_xor_si128(a.v, bias), _mm_xor_si128(b.v, bias)) };
+}
+inline u32x4 mul4(u32x4 a, u32x4 b)
+{
+#if defined(__SSE4_1__)
+    return { _mm_mullo_epi32(a.v, b.v) };
+#else
+    // even and odd lanes through the 32x32->64 multiply, low halves kept
+    __m128i even = _mm_mul_epu32(a.v, b.v);
+    __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a.v, 32), _mm_srli_epi64(b.v, 32));
+    return { _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                _mm_shuffle_epi32(odd,  _MM_SHUFFLE(0, 0, 2, 0))) };
+#endif
+}
+// reverse the bytes of every lane (big-endian guest memory)
+inline u32x4 bswap4(u32x4 a)
+{
+    __m128i t = _mm_or_si128(_mm_slli_epi16(a.v, 8), _mm_srli_epi16(a.v, 8));
+    t = _mm_shufflelo_epi16(t, _MM_SHUFFLE(2, 3, 0, 1));
+    return { _mm_shufflehi_epi16(t, _MM_SHUFFLE(2, 3, 0, 1)) };
+}
+// per-lane shift counts, taken mod 32 as MSA does
+#if defined(__AVX2__)
+inline u32x4 sllv4(u32x4 a, u32x4 n)
+{ return { _mm_sllv_epi32(a.v, _mm_and_si128(n.v, _mm_set1_epi32(31))) }; }
+inline u32x4 srlv4(u32x4 a, u32x4 n)
+{ return { _mm_srlv_epi32(a.v, _mm_and_si128(n.v, _mm_set1_epi32(31))) }; }
+inline u32x4 srav4(u32x4 a, u32x4 n)
+{ return { _mm_srav_epi32(a.v, _mm_and_si128(n.v, _mm_set1_epi32(31))) }; }
+#else
+template < typename F >
+inline u32x4 lanes4(u32x4 a, u32x4 b, F f)
+{
+    alignas(16) uint32_t x[4], y[4];
+    store4(x, a);
+    store4(y, b);
+    for (int i = 0; i < 4; ++i)
+        x[i] = f(x[i], y[i]);
+    return load4(x);
+}
+inline u32x4 sllv4(u32x4 a, u32x4 n)
+{ return lanes4(a, n, [](uint32_t x, uint32_t s) { return x << (s & 31); }); }
+inline u32x4 srlv4(u32x4 a, u32x4 n)
+{ return lanes4(a, n, [](uint32_t x, uint32_t s) { return x >> (s & 31); }); }
+inline u32x4 srav4(u32x4 a, u32x4 n)
+{
+    return lanes4(a, n, [](uint32_t x, uint32_t s)
+                  { return static_cast<uint32_t>(static_cast<int32_t>(x) >> (s & 31)); });
+}
+#endif
+
+#else
+
+struct u32x4 { uint32_t v[4]; };
+
+template < typename F >
+inline u32x4 map4(u32x4 a, u32x4 b, F f)
+{
+    u32x4 r;
+    for (int i = 0; i < 4; ++i)
+        r.v[i] = f(a.v[i], b.v[i]);
+    return r;
+}
+
+inline u32x4 load4(const uint32_t * p) { u32x4 r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+inline void store4(uint32_t * p, u32x4 a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+inline u32x4 splat4(uint32_t x) { return { { x, x, x, x } }; }
+inline u32x4 add4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x + y; }); }
+inline u32x4 sub4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x - y; }); }
+inline u32x4 and4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x & y; }); }
+inline u32x4 or4 (u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x | y; }); }
+inline u32x4 xor4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x ^ y; }); }
+inline u32x4 eq4 (u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x == y ? ~0u : 0u; }); }
+inline u32x4 lt4 (u32x4 a, u32x4 b)
+{
+    return map4(a, b, [](uint32_t x, uint32_t y)
+                { return static_cast<int32_t>(x) < static_cast<int32_t>(y) ? ~0u : 0u; });
+}
+inline u32x4 sll4(u32x4 a, unsigned n) { for (auto & x : a.v) x <<= n; return a; }
+inline u32x4 srl4(u32x4 a, unsigned n) { for (auto & x : a.v) x >>= n; return a; }
+inline u32x4 sra4(u32x4 a, unsigned n)
+{
+    for (auto & x : a.v) x = static_cast<uint32_t>(static_cast<int32_t>(x) >> n);
+    return a;
+}
+inline int signs4(u32x4 a)
+{
+    int m = 0;
+    for (int i = 0; i < 4; ++i) m |= static_cast<int>(a.v[i] >> 31) << i;
+    return m;
+}
+
+// ops used by the guest SIMD unit (Msa.h)
+inline u32x4 not4(u32x4 a) { for (auto & x : a.v) x = ~x; return a; }
+inline u32x4 ltu4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x < y ? ~0u : 0u; }); }
+inline u32x4 mul4(u32x4 a, u32x4 b) { return map4(a, b, [](uint32_t x, uint32_t y) { return x * y; }); }
+inline u32x4 bswap4(u32x4 a) { for (auto & x : a.v) x = __builtin_bswap32(x); return a; }
+inline u32x4 sllv4(u32x4 a, u32x4 n) { return map4(a, n, [](uint32_t x, uint32_t s) { return x << (s & 31); }); }
+inline u32x4 srlv4(u32x4 a, u32x4 n) { return map4(a, n, [](uint32_t x, uint32_t s) { return x >> (s & 31); }); }
+inline u32x4 srav4(u32x4 a, u32x4 n)
+{
+    return map4(a, n, [](uint32_t x, uint32_t s)
+                { return static_cast<uint32_t>(static_cast<int32_t>(x) >> (s & 31)); });
+}
+
+#endif
+
+#endif // SIMD_H
@@ -0,0 +1,344 @@
+// File  : StackDistance.h
+// Author: Cole Schwandt
+//
+// LRU stack-distance (reuse distance) profile of the instruction-fetch
+// and data address streams, for every cache size in one run.
+//
+// The stack distance of an access is the number of distinct lines
+// touched since the previous access to the same line. A fully
+// associative LRU cache of C lines hits exactly the accesses with
+// distance < C, so a histogram of distances gives the miss ratio of
+// every cache size at once (Mattson et al.).
+//
+// Distances are counted with a Fenwick tree over access times
+// (Bennett and Kruskal): time t is marked while t is the latest access
+// of some line, so the distance of an access is the number of marks
+// after that line's previous time. Each access is one hash lookup and
+// two O(log n) tree operations per line size. When the clock reaches
+// the end of the tree the live marks are renumbered 1..k, so memory
+// follows the footprint rather than the run length. A repeat access to
+// the most recent line is distance 0 and leaves the stack unchanged,
+// so it skips the tree entirely.
+//
+// Data addresses are decoded before the instruction runs, like the
+// dataflow analyzer; they are guest (virtual) addresses, and buffers
+// touched by syscalls are not included.
+
+#ifndef STACK_DISTANCE_H
+#define STACK_DISTANCE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Constants.h"
+#include "RegisterFile.h"
+#include "Dataflow.h"
+
+//==============================================================
+// ReuseConfig: the line sizes to profile
+//==============================================================
+struct ReuseConfig
+{
+    std::vector< unsigned > line_sizes = { 16, 32, 64, 128 };
+
+    // "16,64,256": line sizes in bytes, powers of two from 4 to 4096
+    void parse(const std::string & spec)
+    {
+        if (spec.empty())
+            return;
+
+        std::vector< unsigned > sizes;
+        std::stringstream ss(spec);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (item.empty())
+                continue;
+            unsigned long v = 0;
+            try
+            {
+                v = std::stoul(item);
+            }
+            catch (const std::exception &)
+            {
+                throw std::runtime_error("reuse: bad line size '" + item + "'");
+            }
+            if (v < 4 || v > 4096 || (v & (v - 1)) != 0)
+                throw std::runtime_error("reuse: line size must be a power of two from 4 to 4096");
+            sizes.push_back(static_cast<unsigned>(v));
+        }
+        if (sizes.empty())
+            throw std::runtime_error("reuse: no line sizes given");
+
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+        line_sizes = sizes;
+    }
+};
+
+//==============================================================
+// StackDistance: one address stream at one line size
+//==============================================================
+class StackDistance
+{
+public:
+    explicit StackDistance(unsigned line_bytes)
+        : shift_(__builtin_ctz(line_bytes))
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        last_.clear();
+        tree_.assign(INITIAL_CAPACITY + 1, 0);
+        now_ = 0;
+        mru_ = UINT32_MAX;
+        hist_.clear();
+        cold_ = 0;
+        accesses_ = 0;
+    }
+
+    void access(uint32_t addr)
+    {
+        ++accesses_;
+        uint32_t line = addr >> shift_;
+        if (line == mru_)
+        {
+            count(0);
+            return;
+        }
+        mru_ = line;
+
+        if (now_ + 1 >= tree_.size())
+            compact();
+        uint32_t t = ++now_;
+
+        std::pair< std::unordered_map< uint32_t, uint32_t >::iterator, bool > ins =
+            last_.emplace(line, t);
+        if (ins.second)
+        {
+            ++cold_;
+        }
+        else
+        {
+            uint32_t prev = ins.first->second;
+            // marks in (prev, t): lines touched since, each once
+            count(prefix(t - 1) - prefix(prev));
+            add(prev, -1);
+            ins.first->second = t;
+        }
+        add(t, 1);
+    }
+
+    unsigned line_bytes() const { return 1u << shift_; }
+    uint64_t accesses() const { return accesses_; }
+    uint64_t cold() const { return cold_; }
+    uint64_t footprint() const { return last_.size(); }
+
+    // misses of a fully associative LRU cache of 'lines' lines
+    uint64_t misses(uint64_t lines) const
+    {
+        uint64_t m = cold_;
+        for (uint64_t d = lines; d < hist_.size(); ++d)
+            m += hist_[d];
+        return m;
+    }
+
+    // largest distance seen; caches beyond this many lines only take
+    // cold misses
+    uint64_t max_distance() const { return hist_.empty() ? 0 : hist_.size() - 1; }
+
+private:
+    static const uint32_t INITIAL_CAPACITY = 1u << 16;
+
+    unsigned shift_;
+    std::unordered_map< uint32_t, uint32_t > last_; // line -> last access time
+    std::vector< int32_t > tree_;                   // Fenwick tree, 1-based
+    uint32_t now_;
+    uint32_t mru_;
+    std::vector< uint64_t > hist_;                  // distance -> accesses
+    uint64_t cold_;
+    uint64_t accesses_;
+
+    void count(uint64_t d)
+    {
+        if (d >= hist_.size())
+            hist_.resize(d + 1, 0);
+        ++hist_[d];
+    }
+
+    void add(uint32_t i, int32_t v)
+    {
+        for (; i < tree_.size(); i += i & (0u - i))
+            tree_[i] += v;
+    }
+
+    uint64_t prefix(uint32_t i) const
+    {
+        int64_t s = 0;
+        for (; i > 0; i -= i & (0u - i))
+            s += tree_[i];
+        return static_cast<uint64_t>(s);
+    }
+
+    // renumber the live marks 1..k in time order and rebuild the tree
+    // with room for as many again
+    void compact()
+    {
+        std::vector< std::pair< uint32_t, uint32_t > > order; // time, line
+        order.reserve(last_.size());
+        for (const auto & kv : last_)
+            order.push_back(std::make_pair(kv.second, kv.first));
+        std::sort(order.begin(), order.end());
+
+        uint32_t k = static_cast<uint32_t>(order.size());
+        std::size_t capacity = std::max< std::size_t >(INITIAL_CAPACITY, 2 * std::size_t(k));
+        tree_.assign(capacity + 1, 0);
+        for (uint32_t i = 0; i < k; ++i)
+        {
+            last_[order[i].second] = i + 1;
+            tree_[i + 1] = 1;
+        }
+        // linear-time build: push each node into its parent
+        for (std::size_t i = 1; i < tree_.size(); ++i)
+        {
+            std::size_t parent = i + (i & (0 - i));
+            if (parent < tree_.size())
+                tree_[parent] += tree_[i];
+        }
+        now_ = k;
+    }
+};
+
+//==============================================================
+// ReuseProfiler: instruction and data streams at every line size
+//==============================================================
+class ReuseProfiler
+{
+public:
+    ReuseProfiler()
+    {
+        configure(ReuseConfig());
+    }
+
+    void configure(const ReuseConfig & cfg)
+    {
+        cfg_ = cfg;
+        inst_.clear();
+        data_.clear();
+        for (unsigned size : cfg_.line_sizes)
+        {
+            inst_.push_back(StackDistance(size));
+            data_.push_back(StackDistance(size));
+        }
+    }
+
+    void reset()
+    {
+        for (StackDistance & s : inst_) s.reset();
+        for (StackDistance & s : data_) s.reset();
+    }
+
+    const ReuseConfig & config() const { return cfg_; }
+    uint64_t fetches() const { return inst_.empty() ? 0 : inst_[0].accesses(); }
+
+    void fetch(uint32_t pc)
+    {
+        for (StackDistance & s : inst_)
+            s.access(pc);
+    }
+
+    // data access of 'word', about to execute with register state 'regs'
+    void observe(uint32_t word, const RegisterFile & regs)
+    {
+        DepOperands d;
+        uint8_t base = 0;
+        int32_t offset = 0;
+        if (!decode_deps(word, d, base, offset) || !(d.load || d.store))
+            return;
+
+        uint32_t addr = regs.readU(base) + static_cast<uint32_t>(offset);
+        for (StackDistance & s : data_)
+            s.access(addr);
+    }
+
+    void print(std::ostream & out) const
+    {
+        out << std::setfill('=') << std::setw(65) << '\n'
+            << "REUSE DISTANCE (fully associative LRU miss ratio)\n"
+            << std::setw(65) << '\n' << std::setfill(' ');
+        print_stream(out, "instruction fetches", inst_);
+        print_stream(out, "data accesses", data_);
+    }
+
+private:
+    ReuseConfig cfg_;
+    std::vector< StackDistance > inst_;
+    std::vector< StackDistance > data_;
+
+    static std::string size_name(uint64_t bytes)
+    {
+        std::ostringstream s;
+        if (bytes >= (1u << 20) && bytes % (1u << 20) == 0)
+            s << (bytes >> 20) << 'M';
+        else if (bytes >= 1024 && bytes % 1024 == 0)
+            s << (bytes >> 10) << 'K';
+        else
+            s << bytes << 'B';
+        return s.str();
+    }
+
+    // one row per power-of-two capacity, from the smallest that holds
+    // one line of every size until every column is down to cold misses
+    static void print_stream(std::ostream & out, const char * title,
+                             const std::vector< StackDistance > & streams)
+    {
+        if (streams.empty() || streams[0].accesses() == 0)
+        {
+            out << title << " : none\n";
+            return;
+        }
+
+        out << title << " : " << streams[0].accesses() << '\n'
+            << "  footprint (lines) ";
+        for (const StackDistance & s : streams)
+            out << "  " << std::setw(8) << s.footprint();
+        out << '\n'
+            << "  capacity \\ line   ";
+        for (const StackDistance & s : streams)
+            out << "  " << std::setw(8) << size_name(s.line_bytes());
+        out << '\n';
+
+        uint64_t bytes = streams.back().line_bytes();
+        for (;;)
+        {
+            bool all_cold = true;
+            out << "  " << std::setw(17) << size_name(bytes) << ' ';
+            for (const StackDistance & s : streams)
+            {
+                uint64_t lines = bytes / s.line_bytes();
+                double ratio = 100.0 * s.misses(lines) / s.accesses();
+                out << "  " << std::setw(7) << std::fixed << std::setprecision(2)
+                    << ratio << '%';
+                if (lines <= s.max_distance())
+                    all_cold = false;
+            }
+            out << std::defaultfloat << '\n';
+
+            if (all_cold || bytes >= (1ull << 31))
+                break;
+            bytes <<= 1;
+        }
+    }
+};
+
+#endif // STACK_DISTANCE_H
@@ -0,0 +1,164 @@
+// File  : StateDiff.h
+// Author: Cole Schwandt
+//
+// Difference between two machine states that were equal at their last
+// checkpoint (two runs of one image from the same input, say, or a run
+// against a copy taken at the checkpoint). Only registers and vector
+// registers in either dirty mask and pages in either dirty list can
+// differ, so nothing else is looked at.
+
+#ifndef STATE_DIFF_H
+#define STATE_DIFF_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Constants.h"
+#include "Machine.h"
+#include "RegisterFile.h"
+
+struct StateDiff
+{
+    struct Reg
+    {
+        uint8_t  bit;     // 0..31, RegisterFile::HI_BIT or LO_BIT
+        uint32_t a;
+        uint32_t b;
+    };
+
+    struct Lane
+    {
+        uint8_t  reg;     // $w0..$w31
+        uint8_t  lane;    // 0..3
+        uint32_t a;
+        uint32_t b;
+    };
+
+    struct Word
+    {
+        uint32_t addr;
+        uint32_t a;
+        uint32_t b;
+    };
+
+    bool     pc_differs = false;
+    uint32_t pc_a = 0;
+    uint32_t pc_b = 0;
+    std::vector< Reg >  regs;
+    std::vector< Lane > lanes;
+    std::vector< Word > words;
+
+    bool empty() const
+    {
+        return !pc_differs && regs.empty() && lanes.empty() && words.empty();
+    }
+
+    static StateDiff between(const Machine & a, const Machine & b)
+    {
+        StateDiff d;
+        d.pc_a = a.cpu.pc;
+        d.pc_b = b.cpu.pc;
+        d.pc_differs = (d.pc_a != d.pc_b);
+
+        uint64_t mask = a.cpu.regs.dirty_mask() | b.cpu.regs.dirty_mask();
+        while (mask != 0)
+        {
+            uint8_t bit = static_cast<uint8_t>(__builtin_ctzll(mask));
+            mask &= mask - 1;
+
+            uint32_t va = a.cpu.regs.read_bit(bit);
+            uint32_t vb = b.cpu.regs.read_bit(bit);
+            if (va != vb)
+                d.regs.push_back(Reg{bit, va, vb});
+        }
+
+        uint32_t vmask = a.cpu.vregs.dirty_mask() | b.cpu.vregs.dirty_mask();
+        while (vmask != 0)
+        {
+            uint8_t w = static_cast<uint8_t>(__builtin_ctz(vmask));
+            vmask &= vmask - 1;
+
+            for (uint8_t n = 0; n < 4; ++n)
+            {
+                uint32_t va = a.cpu.vregs.lane(w, n);
+                uint32_t vb = b.cpu.vregs.lane(w, n);
+                if (va != vb)
+                    d.lanes.push_back(Lane{w, n, va, vb});
+            }
+        }
+
+        std::vector< uint32_t > pages(a.mem.dirty_pages().begin(), a.mem.dirty_pages().end());
+        pages.insert(pages.end(), b.mem.dirty_pages().begin(), b.mem.dirty_pages().end());
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+        uint8_t pa[MEM_PAGE_SIZE], pb[MEM_PAGE_SIZE];
+        for (uint32_t base : pages)
+        {
+            a.mem.read_block(base, pa, MEM_PAGE_SIZE);
+            b.mem.read_block(base, pb, MEM_PAGE_SIZE);
+            if (std::memcmp(pa, pb, MEM_PAGE_SIZE) == 0)
+                continue;
+
+            for (uint32_t off = 0; off < MEM_PAGE_SIZE; off += 4)
+            {
+                if (std::memcmp(pa + off, pb + off, 4) != 0)
+                    d.words.push_back(Word{base + off, word_at(pa + off), word_at(pb + off)});
+            }
+        }
+        return d;
+    }
+
+    void print(std::ostream & out) const
+    {
+        if (empty())
+        {
+            out << "(no differences)\n";
+            return;
+        }
+
+        if (pc_differs)
+            row(out, "pc", pc_a, pc_b);
+        for (const Reg & r : regs)
+        {
+            std::string name = r.bit == RegisterFile::HI_BIT ? "$hi" :
+                               r.bit == RegisterFile::LO_BIT ? "$lo" :
+                               "$" + std::to_string(r.bit);
+            row(out, name, r.a, r.b);
+        }
+        for (const Lane & l : lanes)
+        {
+            row(out, "$w" + std::to_string(l.reg) + "[" + std::to_string(l.lane) + "]",
+                l.a, l.b);
+        }
+        for (const Word & w : words)
+        {
+            std::ostringstream addr;
+            addr << "0x" << std::hex << std::setw(8) << std::setfill('0') << w.addr;
+            row(out, addr.str(), w.a, w.b);
+        }
+    }
+
+private:
+    static void row(std::ostream & out, const std::string & what, uint32_t a, uint32_t b)
+    {
+        out << std::left << std::setw(12) << what << std::right
+            << std::hex << std::setfill('0')
+            << "0x" << std::setw(8) << a << "  0x" << std::setw(8) << b
+            << std::dec << std::setfill(' ') << '\n';
+    }
+
+    static uint32_t word_at(const uint8_t * p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) <<  8) |  static_cast<uint32_t>(p[3]);
+    }
+};
+
+#endif // STATE_DIFF_H
@@ -19,6 +19,8 @@ enum TokenType
     COMMA,       // ,
     LPAREN,      // (
     RPAREN,      // )
+    LBRACKET,    // [  (vector element: $w1[2])
+    RBRACKET,    // ]
     COLON,       // :
     ERROR,       // invalid char (&&&&, **^*)
     EOL          // end of line marker
@@ -57,6 +59,8 @@ const char * token_type_cstr(TokenType t)
         case COMMA:      return "COMMA";
         case LPAREN:     return "LPAREN";
         case RPAREN:     return "RPAREN";
+        case LBRACKET:   return "LBRACKET";
+        case RBRACKET:   return "RBRACKET";
         case COLON:      return "COLON";
         case ERROR:      return "ERROR";
         case EOL:        return "EOL";
@@ -4,7 +4,11 @@
 #include <iostream>
 #include <iomanip>
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
 
 #include "mybitlib.h"
 #include "Token.h"
@@ -14,20 +18,430 @@
 #include "CPU.h"
 //#include "Executor.h"
 #include "Interpreter.h"
+#include "Lockstep.h"
+#include "BatchRunner.h"
+#include "CostModel.h"
+#include "Checker.h"
 
-int main()
+void usage(std::ostream & out)
+{
+    out << "usage:\n"
+        << "  a.out                              interactive REPL\n"
+        << "  a.out --run FILE [OPTION...]       assemble and run FILE headless;\n"
+        << "                                     the reports below go to stderr\n"
+        << "      --core PATH                    core file on a fault (default mips.core)\n"
+        << "      --stats-json PATH              run stats as JSON ('-' for stdout)\n"
+        << "      --prom PATH                    run stats as a Prometheus text file\n"
+        << "      --lazy                         assemble each text line on first use\n"
+        << "      --dataflow                     critical path and ideal ILP\n"
+        << "      --ooo[=K=V,...]                IPC and stalls of an out-of-order core\n"
+        << "      --mmu[=K=V,...]                data addresses through a TLB, hit rates\n"
+        << "      --reuse[=SIZE,...]             LRU miss ratio at every cache size\n"
+        << "      --timing                       time per phase\n"
+        << "      --native-rt                    syscalls 100-105 (strlen..itoa) on the host\n"
+        << "      --compress[=K=V,...]           compress idle memory, report the ratio\n"
+        << "  a.out --inspect-core CORE FILE     print a core symbolized against FILE\n"
+        << "  a.out --script FILE [--prom PATH]  REPL lines from FILE without prompts;\n"
+        << "                                     a timing summary on stderr\n"
+        << "      --prom PATH                    Prometheus file rewritten after every run\n"
+        << "  a.out --lockstep FILE INPUT...     run FILE once per INPUT, in SIMD lockstep\n"
+        << "  a.out --batch FILE [OPTION...] INPUT...\n"
+        << "                                     run FILE once per INPUT on pooled machines\n"
+        << "      --jobs N                       worker threads (default: one per core)\n"
+        << "      --pin                          one pinned worker per CPU, per-node queues\n"
+        << "      --cpus LIST                    CPUs to pin to, e.g. 0-7,16-23\n"
+        << "      --ljf                          start the longest predicted jobs first\n"
+        << "      --history PATH                 as --ljf, learning step counts from PATH\n"
+        << "      --verify                       diff each job against a fresh machine\n"
+        << "  a.out --estimate FILE [--history PATH] INPUT...\n"
+        << "                                     print FILE's loops and predicted steps\n"
+        << "  a.out --check [--jobs N] FILE...   syntax-check each FILE without running it\n";
+}
+
+int main(int argc, char * argv[])
 {
-    Interpreter interpreter;
     try
     {
-        Interpreter interpreter;
-        interpreter.repl(std::cin, std::cout);
+        if (argc == 1)
+        {
+            Interpreter interpreter;
+            interpreter.repl(std::cin, std::cout);
+            return 0;
+        }
+
+        std::string mode = argv[1];
+
+        if (mode == "--run" && argc >= 3)
+        {
+            std::string core_path = "mips.core";
+            std::string json_path, prom_path;
+            bool lazy = false, dataflow = false, ooo = false;
+            OoOConfig ooo_cfg;
+            bool mmu = false;
+            MmuConfig mmu_cfg;
+            bool reuse = false, timing = false, native_rt = false;
+            ReuseConfig reuse_cfg;
+            bool compress = false;
+            CompressConfig compress_cfg;
+            for (int i = 3; i < argc; ++i)
+            {
+                if (std::strcmp(argv[i], "--core") == 0 && i + 1 < argc)
+                {
+                    core_path = argv[++i];
+                }
+                else if (std::strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+                {
+                    json_path = argv[++i];
+                }
+                else if (std::strcmp(argv[i], "--prom") == 0 && i + 1 < argc)
+                {
+                    prom_path = argv[++i];
+                }
+                else if (std::strcmp(argv[i], "--lazy") == 0)
+                {
+                    lazy = true;
+                }
+                else if (std::strcmp(argv[i], "--dataflow") == 0)
+                {
+                    dataflow = true;
+                }
+                else if (std::strcmp(argv[i], "--ooo") == 0)
+                {
+                    ooo = true;
+                }
+                else if (std::strncmp(argv[i], "--ooo=", 6) == 0)
+                {
+                    ooo = true;
+                    ooo_cfg.parse(argv[i] + 6);
+                }
+                else if (std::strcmp(argv[i], "--mmu") == 0)
+                {
+                    mmu = true;
+                }
+                else if (std::strncmp(argv[i], "--mmu=", 6) == 0)
+                {
+                    mmu = true;
+                    mmu_cfg.parse(argv[i] + 6);
+                }
+                else if (std::strcmp(argv[i], "--native-rt") == 0)
+                {
+                    native_rt = true;
+                }
+                else if (std::strcmp(argv[i], "--timing") == 0)
+                {
+                    timing = true;
+                }
+                else if (std::strcmp(argv[i], "--reuse") == 0)
+                {
+                    reuse = true;
+                }
+                else if (std::strncmp(argv[i], "--reuse=", 8) == 0)
+                {
+                    reuse = true;
+                    reuse_cfg.parse(argv[i] + 8);
+                }
+                else if (std::strcmp(argv[i], "--compress") == 0)
+                {
+                    compress = true;
+                }
+                else if (std::strncmp(argv[i], "--compress=", 11) == 0)
+                {
+                    compress = true;
+                    compress_cfg.parse(argv[i] + 11);
+                }
+                else
+                {
+                    usage(std::cerr);
+                    return 2;
+                }
+            }
+
+            Interpreter interpreter;
+            interpreter.set_verbose(false);
+            interpreter.set_core_path(core_path);
+            interpreter.set_prometheus_path(prom_path);
+            interpreter.set_dataflow(dataflow);
+            interpreter.set_ooo(ooo, ooo_cfg);
+            interpreter.set_mmu(mmu, mmu_cfg);
+            interpreter.set_reuse(reuse, reuse_cfg);
+            interpreter.set_timing(timing);
+            interpreter.set_native_runtime(native_rt);
+            interpreter.set_compress(compress, compress_cfg);
+            bool ok = lazy ? interpreter.run_file_lazy(argv[2], std::cout, std::cerr)
+                           : interpreter.run_file(argv[2], std::cout);
+            if (dataflow)
+                interpreter.last_dataflow().print(std::cerr);
+            if (ooo)
+                interpreter.last_ooo().report().print(std::cerr, interpreter.last_ooo().config());
+            if (mmu)
+                interpreter.last_mmu().stats().print(std::cerr, interpreter.last_mmu().config());
+            if (reuse)
+                interpreter.last_reuse().print(std::cerr);
+            if (timing)
+                interpreter.phase_timers().print(std::cerr);
+            if (compress)
+            {
+                interpreter.compress_now();
+                interpreter.compression_stats().print(std::cerr);
+            }
+
+            if (json_path == "-")
+            {
+                interpreter.last_stats().write_json(std::cout);
+            }
+            else if (!json_path.empty())
+            {
+                std::ofstream f(json_path);
+                if (!f)
+                {
+                    std::cerr << "Could not open stats file: " << json_path << "\n";
+                    return 1;
+                }
+                interpreter.last_stats().write_json(f);
+            }
+            return ok ? 0 : 1;
+        }
+
+        if (mode == "--inspect-core" && argc == 4)
+        {
+            Interpreter interpreter;
+            interpreter.set_verbose(false);
+            interpreter.inspect_core(argv[2], argv[3], std::cout);
+            return 0;
+        }
+
+        if (mode == "--script" && (argc == 3 ||
+                                   (argc == 5 && std::strcmp(argv[3], "--prom") == 0)))
+        {
+            std::ifstream script(argv[2]);
+            if (!script)
+            {
+                std::cerr << "Could not open script: " << argv[2] << "\n";
+                return 1;
+            }
+
+            Interpreter interpreter;
+            interpreter.set_verbose(false);
+            if (argc == 5)
+                interpreter.set_prometheus_path(argv[4]);
+            interpreter.run_script(script, std::cout, std::cerr);
+            return 0;
+        }
+
+        if (mode == "--lockstep" && argc >= 4)
+        {
+            std::vector< std::string > inputs;
+            for (int i = 3; i < argc; ++i)
+            {
+                std::ifstream f(argv[i]);
+                if (!f)
+                {
+                    std::cerr << "Could not open input: " << argv[i] << "\n";
+                    return 1;
+                }
+                std::ostringstream ss;
+                ss << f.rdbuf();
+                inputs.push_back(ss.str());
+            }
+
+            Interpreter interpreter;
+            interpreter.set_verbose(false);
+            LockstepEngine engine(interpreter.load_image(argv[2]), inputs);
+            engine.run();
+
+            int rc = 0;
+            uint32_t split = 0;
+            for (uint32_t l = 0; l < engine.num_lanes(); ++l)
+            {
+                const LaneResult & r = engine.result(l);
+                std::cout << "=== lane " << l << " (" << argv[3 + l] << "): "
+                          << r.status << ", " << r.steps << " steps";
+                if (r.split)
+                    std::cout << ", split after " << r.lockstep_steps;
+                std::cout << " ===\n" << r.output;
+                if (!r.output.empty() && r.output.back() != '\n')
+                    std::cout << '\n';
+
+                split += r.split ? 1 : 0;
+                if (r.faulted)
+                    rc = 1;
+            }
+            std::cout << engine.num_lanes() << " lane(s), "
+                      << engine.group_steps() << " lockstep step(s), "
+                      << split << " lane(s) split\n";
+            return rc;
+        }
+
+        if ((mode == "--batch" && argc >= 4) || (mode == "--estimate" && argc >= 3))
+        {
+            unsigned jobs = 0;
+            BatchPlacement place;
+            bool ljf = false;
+            bool verify = false;
+            std::string history_path;
+            std::vector< std::string > names, inputs;
+            for (int i = 3; i < argc; ++i)
+            {
+                if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+                {
+                    jobs = static_cast<unsigned>(std::stoul(argv[++i]));
+                    continue;
+                }
+                if (std::strcmp(argv[i], "--ljf") == 0)
+                {
+                    ljf = true;
+                    continue;
+                }
+                if (std::strcmp(argv[i], "--history") == 0 && i + 1 < argc)
+                {
+                    ljf = true;
+                    history_path = argv[++i];
+                    continue;
+                }
+                if (std::strcmp(argv[i], "--pin") == 0)
+                {
+                    place.pin = true;
+                    continue;
+                }
+                if (std::strcmp(argv[i], "--verify") == 0)
+                {
+                    verify = true;
+                    continue;
+                }
+                if (std::strcmp(argv[i], "--cpus") == 0 && i + 1 < argc)
+                {
+                    place.pin = true;
+                    place.cpus = parse_cpulist(argv[++i]);
+                    continue;
+                }
+
+                std::ifstream f(argv[i]);
+                if (!f)
+                {
+                    std::cerr << "Could not open input: " << argv[i] << "\n";
+                    return 1;
+                }
+                std::ostringstream ss;
+                ss << f.rdbuf();
+                names.push_back(argv[i]);
+                inputs.push_back(ss.str());
+            }
+
+            Interpreter interpreter;
+            interpreter.set_verbose(false);
+            std::shared_ptr< const ProgramImage > image = interpreter.load_program_image(argv[2]);
+
+            // predicted steps per job, for longest-first scheduling
+            RunHistory history;
+            if (!history_path.empty())
+                history.load(history_path);
+            CostModel model(*image);
+            double mean_bytes = 0;
+            for (const std::string & in : inputs)
+                mean_bytes += static_cast<double>(in.size()) / inputs.size();
+            std::vector< double > costs;
+            std::size_t from_history = 0;
+            for (const std::string & in : inputs)
+            {
+                CostModel::Estimate e = model.predict(in, history, mean_bytes);
+                costs.push_back(e.steps);
+                from_history += (e.source == CostModel::FROM_HISTORY);
+            }
+
+            if (mode == "--estimate")
+            {
+                model.print(std::cout, history);
+                for (std::size_t j = 0; j < inputs.size(); ++j)
+                {
+                    CostModel::Estimate e = model.predict(inputs[j], history, mean_bytes);
+                    std::cout << "  " << names[j] << ": " << std::fixed << std::setprecision(0)
+                              << e.steps << " steps (" << CostModel::source_name(e.source) << ")\n"
+                              << std::defaultfloat;
+                }
+                return 0;
+            }
+
+            MachinePool pool;
+            BatchRunner runner(image, pool);
+            runner.set_verify(verify);
+            std::vector< BatchResult > results =
+                runner.run(inputs, jobs, place, ljf ? costs : std::vector< double >());
+
+            if (!history_path.empty())
+            {
+                for (std::size_t j = 0; j < results.size(); ++j)
+                    history.record(model.program_hash(), inputs[j], results[j].steps);
+                history.save(history_path);
+            }
+
+            int rc = 0;
+            for (std::size_t j = 0; j < results.size(); ++j)
+            {
+                const BatchResult & r = results[j];
+                std::cout << "=== job " << j << " (" << names[j] << "): "
+                          << r.status;
+                if (r.faulted)
+                    std::cout << " at " << r.where;
+                std::cout << ", " << r.steps << " steps ===\n" << r.output;
+                if (!r.output.empty() && r.output.back() != '\n')
+                    std::cout << '\n';
+                if (!r.mismatch.empty())
+                    std::cout << "--- differs on a fresh machine:\n" << r.mismatch;
+                if (r.faulted || !r.mismatch.empty())
+                    rc = 1;
+            }
+            std::cout << results.size() << " job(s), "
+                      << pool.created() << " machine(s)";
+            if (ljf)
+                std::cout << ", longest first (" << from_history << " predicted from history)";
+            if (place.pin)
+            {
+                std::cout << ", " << runner.last_stolen() << " stolen across nodes";
+                if (runner.last_unpinned() != 0)
+                    std::cout << ", " << runner.last_unpinned() << " worker(s) not pinned";
+            }
+            std::cout << '\n';
+            return rc;
+        }
+
+        if (mode == "--check" && argc >= 3)
+        {
+            unsigned jobs = 0;
+            std::vector< std::string > paths;
+            for (int i = 2; i < argc; ++i)
+            {
+                if (std::strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+                    jobs = static_cast<unsigned>(std::stoul(argv[++i]));
+                else
+                    paths.push_back(argv[i]);
+            }
+
+            std::vector< std::vector< Diagnostic > > results = check_files(paths, jobs);
+
+            std::size_t bad = 0, total = 0;
+            for (std::size_t f = 0; f < results.size(); ++f)
+            {
+                for (const Diagnostic & d : results[f])
+                {
+                    std::cout << paths[f] << ':' << d.line << ':' << d.col << ": "
+                              << diag_code_name(d.code) << ": " << d.message << '\n';
+                }
+                bad += results[f].empty() ? 0 : 1;
+                total += results[f].size();
+            }
+            std::cout << results.size() << " file(s), " << bad << " with errors, "
+                      << total << " diagnostic(s)\n";
+            return bad ? 1 : 0;
+        }
+
+        usage(std::cerr);
+        return 2;
     }
     catch (const std::exception & e)
     {
         std::cerr << "Fatal error: " << e.what() << "\n";
         return 1;
     }
-    
+
     return 0;
 }
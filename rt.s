@@ -0,0 +1,80 @@
+#========================================================
+# Filename: rt.s
+#========================================================
+# Wrappers for the native runtime syscalls (see NativeRuntime.h).
+# They need the native runtime turned on: 'nativert on' in the REPL,
+# or --native-rt with --run. Otherwise codes 100..105 are unknown
+# syscalls.
+#
+# Put this file in front of the program (cat rt.s prog.s > all.s, or
+# 'read "rt.s"' first in the REPL). The first instruction jumps over the
+# routines, so execution starts at the program that follows.
+#
+# Each routine takes its arguments in $a0..$a2, returns in $v0 and
+# clobbers only $v0.
+
+        .text
+        j       rt_end
+
+#########################################################
+# rt_strlen
+#   Inputs:  a0 = string
+#   Outputs: v0 = length, not counting the NUL
+#########################################################
+rt_strlen:
+        li      $v0, 100
+        syscall
+        jr      $ra
+
+#########################################################
+# rt_strcmp
+#   Inputs:  a0 = string a, a1 = string b
+#   Outputs: v0 = -1, 0 or 1 as a < b, a == b, a > b (bytes unsigned)
+#########################################################
+rt_strcmp:
+        li      $v0, 101
+        syscall
+        jr      $ra
+
+#########################################################
+# rt_memcpy
+#   Inputs:  a0 = dst, a1 = src, a2 = byte count (may overlap)
+#   Outputs: v0 = dst
+#########################################################
+rt_memcpy:
+        li      $v0, 102
+        syscall
+        jr      $ra
+
+#########################################################
+# rt_memset
+#   Inputs:  a0 = dst, a1 = byte value, a2 = byte count
+#   Outputs: v0 = dst
+#########################################################
+rt_memset:
+        li      $v0, 103
+        syscall
+        jr      $ra
+
+#########################################################
+# rt_atoi
+#   Inputs:  a0 = string: blanks, optional sign, decimal digits
+#   Outputs: v0 = value (wraps at 32 bits)
+#########################################################
+rt_atoi:
+        li      $v0, 104
+        syscall
+        jr      $ra
+
+#########################################################
+# rt_itoa
+#   Inputs:  a0 = value, a1 = buffer (33 bytes is always enough),
+#            a2 = base 2..36 (negative values signed in base 10 only)
+#   Outputs: v0 = length written, not counting the NUL
+#########################################################
+rt_itoa:
+        li      $v0, 105
+        syscall
+        jr      $ra
+
+rt_end: